@@ -15,6 +15,8 @@
 #include <linux/cpufeature.h>
 #include <linux/crypto.h>
 #include <linux/module.h>
+#include <linux/sizes.h>
+#include <linux/string.h>
 
 MODULE_DESCRIPTION("SHA-224/SHA-256 secure hash using ARMv8 Crypto Extensions");
 MODULE_AUTHOR("Ard Biesheuvel <ard.biesheuvel@linaro.org>");
@@ -54,6 +56,10 @@ const u32 sha256_ce_offsetof_count = offsetof(struct sha256_ce_state,
 const u32 sha256_ce_offsetof_finalize = offsetof(struct sha256_ce_state,
 						 finalize);
 
+asmlinkage void __sha256_ce_transform2x(u32 *state_a, u32 *state_b,
+					u8 const *src_a, u8 const *src_b,
+					int blocks);
+
 asmlinkage void sha256_block_data_order(u32 *digest, u8 const *src, int blocks);
 
 static void sha256_arm64_transform(struct sha256_state *sst, u8 const *src,
@@ -124,6 +130,71 @@ static int sha256_ce_digest(struct shash_desc *desc, const u8 *data,
 	return sha256_ce_finup(desc, data, len, out);
 }
 
+/* Blocks per lane between kernel_neon_begin()/end() in sha256_ce_finup2x() */
+#define SHA256_CE_MB_BLOCKS	(SZ_4K / SHA256_BLOCK_SIZE)
+
+/*
+ * Finish two equal length messages that continue from the state in @desc,
+ * interleaving them two lanes wide. This is what dm-verity and fs-verity
+ * do for every pair of data blocks they verify.
+ */
+static int sha256_ce_finup2x(struct shash_desc *desc, const u8 * const data[],
+			     unsigned int len, u8 * const outs[],
+			     unsigned int num_msgs)
+{
+	struct sha256_ce_state *sctx = shash_desc_ctx(desc);
+	unsigned int digestsize = crypto_shash_digestsize(desc->tfm);
+	unsigned int blocks = len / SHA256_BLOCK_SIZE;
+	unsigned int partial = len % SHA256_BLOCK_SIZE;
+	u8 pad[2][2 * SHA256_BLOCK_SIZE];
+	u32 state[2][SHA256_DIGEST_SIZE / 4];
+	const u8 *src[2] = { data[0], data[1] };
+	unsigned int i, j, npad;
+	u64 bits;
+
+	/* The lanes can't take over partial data buffered in the prefix */
+	if (num_msgs != 2 || !crypto_simd_usable() ||
+	    sctx->sst.count % SHA256_BLOCK_SIZE)
+		return -EOPNOTSUPP;
+
+	npad = partial < SHA256_BLOCK_SIZE - sizeof(__be64) ? 1 : 2;
+	bits = (sctx->sst.count + len) << 3;
+	for (i = 0; i < 2; i++) {
+		memcpy(state[i], sctx->sst.state, sizeof(state[i]));
+		memset(pad[i], 0, sizeof(pad[i]));
+		memcpy(pad[i], src[i] + blocks * SHA256_BLOCK_SIZE, partial);
+		pad[i][partial] = 0x80;
+		put_unaligned_be64(bits,
+				   &pad[i][npad * SHA256_BLOCK_SIZE - sizeof(__be64)]);
+	}
+
+	do {
+		unsigned int n = min_t(unsigned int, blocks, SHA256_CE_MB_BLOCKS);
+
+		kernel_neon_begin();
+		if (n)
+			__sha256_ce_transform2x(state[0], state[1],
+						src[0], src[1], n);
+		blocks -= n;
+		if (!blocks)
+			__sha256_ce_transform2x(state[0], state[1],
+						pad[0], pad[1], npad);
+		kernel_neon_end();
+
+		src[0] += n * SHA256_BLOCK_SIZE;
+		src[1] += n * SHA256_BLOCK_SIZE;
+	} while (blocks);
+
+	for (i = 0; i < 2; i++)
+		for (j = 0; j < digestsize / sizeof(u32); j++)
+			put_unaligned_be32(state[i][j], outs[i] + j * sizeof(u32));
+
+	memzero_explicit(pad, sizeof(pad));
+	memzero_explicit(state, sizeof(state));
+	memzero_explicit(sctx, sizeof(*sctx));
+	return 0;
+}
+
 static int sha256_ce_export(struct shash_desc *desc, void *out)
 {
 	struct sha256_ce_state *sctx = shash_desc_ctx(desc);
@@ -148,7 +219,9 @@ static struct shash_alg algs[] = { {
 	.finup			= sha256_ce_finup,
 	.export			= sha256_ce_export,
 	.import			= sha256_ce_import,
+	.finup_mb		= sha256_ce_finup2x,
 	.descsize		= sizeof(struct sha256_ce_state),
+	.mb_max_msgs		= 2,
 	.statesize		= sizeof(struct sha256_state),
 	.digestsize		= SHA224_DIGEST_SIZE,
 	.base			= {
@@ -166,7 +239,9 @@ static struct shash_alg algs[] = { {
 	.digest			= sha256_ce_digest,
 	.export			= sha256_ce_export,
 	.import			= sha256_ce_import,
+	.finup_mb		= sha256_ce_finup2x,
 	.descsize		= sizeof(struct sha256_ce_state),
+	.mb_max_msgs		= 2,
 	.statesize		= sizeof(struct sha256_state),
 	.digestsize		= SHA256_DIGEST_SIZE,
 	.base			= {
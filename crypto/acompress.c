@@ -8,6 +8,7 @@
  */
 
 #include <crypto/internal/acompress.h>
+#include <linux/completion.h>
 #include <linux/cryptouser.h>
 #include <linux/errno.h>
 #include <linux/kernel.h>
@@ -23,6 +24,22 @@ struct crypto_scomp;
 
 static const struct crypto_type crypto_acomp_type;
 
+struct acomp_batch {
+	struct completion done;
+	atomic_t pending;
+	int *errors;
+};
+
+/* The caller's callback of a request, given back when it completes */
+struct acomp_batch_slot {
+	struct acomp_batch *batch;
+	struct acomp_req *req;
+	crypto_completion_t complete;
+	void *data;
+	u32 flags;
+	unsigned int idx;
+};
+
 static inline struct acomp_alg *__crypto_acomp_alg(struct crypto_alg *alg)
 {
 	return container_of(alg, struct acomp_alg, calg.base);
@@ -153,6 +170,136 @@ void acomp_request_free(struct acomp_req *req)
 }
 EXPORT_SYMBOL_GPL(acomp_request_free);
 
+int acomp_batch_status(const int errors[], unsigned int nr)
+{
+	unsigned int i;
+
+	for (i = 0; i < nr; i++)
+		if (errors[i])
+			return errors[i];
+
+	return 0;
+}
+
+static void acomp_batch_restore(struct acomp_batch_slot *slot)
+{
+	struct acomp_req *req = slot->req;
+
+	req->base.complete = slot->complete;
+	req->base.data = slot->data;
+	req->base.flags = slot->flags;
+}
+
+static void acomp_batch_done(void *data, int err)
+{
+	struct acomp_batch_slot *slot = data;
+	struct acomp_batch *batch = slot->batch;
+
+	if (err == -EINPROGRESS)
+		return;
+
+	acomp_batch_restore(slot);
+	batch->errors[slot->idx] = err;
+	if (atomic_dec_and_test(&batch->pending))
+		complete(&batch->done);
+}
+
+/*
+ * Generic batch for asynchronous algorithms without a batch hook: submit
+ * every request, then wait once for all of them to complete.
+ */
+static int acomp_batch_submit(struct acomp_req *reqs[], int errors[],
+			      unsigned int nr,
+			      int (*op)(struct acomp_req *req))
+{
+	struct acomp_batch_slot *slots;
+	struct acomp_batch batch;
+	unsigned int i;
+	int err;
+
+	slots = kmalloc_array(nr, sizeof(*slots), GFP_KERNEL);
+	if (!slots)
+		return -ENOMEM;
+
+	init_completion(&batch.done);
+	/* Biased by one so that completions can't finish the batch early */
+	atomic_set(&batch.pending, nr + 1);
+	batch.errors = errors;
+
+	for (i = 0; i < nr; i++) {
+		slots[i].batch = &batch;
+		slots[i].req = reqs[i];
+		slots[i].complete = reqs[i]->base.complete;
+		slots[i].data = reqs[i]->base.data;
+		slots[i].flags = reqs[i]->base.flags;
+		slots[i].idx = i;
+		acomp_request_set_callback(reqs[i],
+					   reqs[i]->base.flags |
+					   CRYPTO_TFM_REQ_MAY_BACKLOG,
+					   acomp_batch_done, &slots[i]);
+
+		err = op(reqs[i]);
+		if (err == -EINPROGRESS || err == -EBUSY)
+			continue;
+
+		acomp_batch_restore(&slots[i]);
+		errors[i] = err;
+		atomic_dec(&batch.pending);
+	}
+
+	if (!atomic_dec_and_test(&batch.pending))
+		wait_for_completion(&batch.done);
+	kfree(slots);
+
+	return acomp_batch_status(errors, nr);
+}
+
+static int acomp_batch(struct acomp_req *reqs[], int errors[],
+		       unsigned int nr, bool comp)
+{
+	int (*batch)(struct acomp_req *reqs[], int errors[], unsigned int nr);
+	int (*op)(struct acomp_req *req);
+	struct crypto_acomp *tfm;
+	unsigned int i;
+
+	might_sleep();
+
+	if (!nr)
+		return 0;
+
+	tfm = crypto_acomp_reqtfm(reqs[0]);
+	for (i = 1; i < nr; i++)
+		if (crypto_acomp_reqtfm(reqs[i]) != tfm)
+			return -EINVAL;
+
+	batch = comp ? tfm->batch_compress : tfm->batch_decompress;
+	if (batch)
+		return batch(reqs, errors, nr);
+
+	op = comp ? tfm->compress : tfm->decompress;
+	if (acomp_is_async(tfm))
+		return acomp_batch_submit(reqs, errors, nr, op);
+
+	for (i = 0; i < nr; i++)
+		errors[i] = op(reqs[i]);
+
+	return acomp_batch_status(errors, nr);
+}
+
+int crypto_acomp_batch_compress(struct acomp_req *reqs[], int errors[],
+				unsigned int nr_reqs)
+{
+	return acomp_batch(reqs, errors, nr_reqs, true);
+}
+EXPORT_SYMBOL_GPL(crypto_acomp_batch_compress);
+
+int crypto_acomp_batch_decompress(struct acomp_req *reqs[], int errors[],
+				  unsigned int nr_reqs)
+{
+	return acomp_batch(reqs, errors, nr_reqs, false);
+}
+EXPORT_SYMBOL_GPL(crypto_acomp_batch_decompress);
+
 void comp_prepare_alg(struct comp_alg_common *alg)
 {
 	struct crypto_alg *base = &alg->base;
@@ -17,6 +17,7 @@ struct comp_alg_common;
 int crypto_init_scomp_ops_async(struct crypto_tfm *tfm);
 struct acomp_req *crypto_acomp_scomp_alloc_ctx(struct acomp_req *req);
 void crypto_acomp_scomp_free_ctx(struct acomp_req *req);
+int acomp_batch_status(const int errors[], unsigned int nr);
 
 void comp_prepare_alg(struct comp_alg_common *alg);
 
@@ -13,11 +13,16 @@
 #include <crypto/internal/hash.h>
 #include <crypto/internal/kpp.h>
 #include <crypto/internal/skcipher.h>
+#include <linux/debugfs.h>
 #include <linux/err.h>
 #include <linux/delay.h>
 #include <linux/device.h>
+#include <linux/idr.h>
 #include <linux/kernel.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/seq_file.h>
+#include <linux/timekeeping.h>
 #include <uapi/linux/sched/types.h>
 #include "internal.h"
 
@@ -31,6 +36,100 @@ struct crypto_engine_alg {
 	struct crypto_engine_op op;
 };
 
+/*
+ * A request's list head is unused between its dequeue and its completion.
+ * While it is in flight, it is linked with a slot of its own as a list of two,
+ * so the slot is found from the request without a lookup.
+ */
+struct crypto_engine_inflight {
+	struct list_head list;
+	u64 start_ns;
+};
+
+struct crypto_engine_stats {
+	u64 requests;
+	u64 requeued;
+	u64 qlen_sum;
+	unsigned int max_qlen;
+	u64 batches;
+	unsigned int max_batch;
+	unsigned int max_inflight;
+	u64 completed;
+	u64 latency_ns;
+	u64 max_latency_ns;
+};
+
+/*
+ * Engine state private to this file, all engines are allocated by
+ * crypto_engine_alloc_init_and_set().
+ *
+ * @max_inflight: batch mode limit of requests handed to the driver and not
+ *                yet finalized, 0 if batch mode is off
+ * @nr_inflight: number of requests in flight
+ * @inflight: per request in flight in batch mode, when it was handed out
+ * @free_slots: entries of @inflight not linked to a request
+ * @stats: protected by queue_lock
+ * @id: makes the debugfs directory name unique, drivers like virtio-crypto
+ *      allocate several engines for the same device
+ * @debugfs: per engine debugfs directory
+ */
+struct crypto_engine_priv {
+	struct crypto_engine base;
+	unsigned int max_inflight;
+	unsigned int nr_inflight;
+	struct crypto_engine_inflight *inflight;
+	struct list_head free_slots;
+	struct crypto_engine_stats stats;
+	int id;
+	struct dentry *debugfs;
+};
+
+static struct dentry *crypto_engine_debugfs_root;
+static DEFINE_IDA(crypto_engine_ida);
+
+static inline struct crypto_engine_priv *
+crypto_engine_priv(struct crypto_engine *engine)
+{
+	return container_of(engine, struct crypto_engine_priv, base);
+}
+
+/* Called with queue_lock held */
+static void crypto_engine_track(struct crypto_engine_priv *ep,
+				struct crypto_async_request *req)
+{
+	struct crypto_engine_inflight *slot;
+
+	slot = list_first_entry(&ep->free_slots, struct crypto_engine_inflight,
+				list);
+	list_del_init(&slot->list);
+	list_add(&req->list, &slot->list);
+	slot->start_ns = ktime_get_ns();
+	ep->nr_inflight++;
+	ep->stats.max_inflight = max(ep->stats.max_inflight, ep->nr_inflight);
+}
+
+/* Called with queue_lock held */
+static void crypto_engine_untrack(struct crypto_engine_priv *ep,
+				  struct crypto_async_request *req,
+				  bool completed)
+{
+	struct crypto_engine_stats *stats = &ep->stats;
+	struct crypto_engine_inflight *slot;
+	u64 ns;
+
+	slot = list_first_entry(&req->list, struct crypto_engine_inflight,
+				list);
+	if (completed) {
+		ns = ktime_get_ns() - slot->start_ns;
+		stats->completed++;
+		stats->latency_ns += ns;
+		stats->max_latency_ns = max(stats->max_latency_ns, ns);
+	}
+	list_del(&req->list);
+	list_add(&slot->list, &ep->free_slots);
+	ep->nr_inflight--;
+}
+
 /**
  * crypto_finalize_request - finalize one request if the request is done
  * @engine: the hardware engine
@@ -40,14 +139,19 @@ struct crypto_engine_alg {
 static void crypto_finalize_request(struct crypto_engine *engine,
 				    struct crypto_async_request *req, int err)
 {
+	struct crypto_engine_priv *ep = crypto_engine_priv(engine);
 	unsigned long flags;
 
-	/*
-	 * If hardware cannot enqueue more requests
-	 * and retry mechanism is not supported
-	 * make sure we are completing the current request
-	 */
-	if (!engine->retry_support) {
+	if (ep->max_inflight) {
+		spin_lock_irqsave(&engine->queue_lock, flags);
+		crypto_engine_untrack(ep, req, true);
+		spin_unlock_irqrestore(&engine->queue_lock, flags);
+	} else if (!engine->retry_support) {
+		/*
+		 * If hardware cannot enqueue more requests
+		 * and retry mechanism is not supported
+		 * make sure we are completing the current request
+		 */
 		spin_lock_irqsave(&engine->queue_lock, flags);
 		if (engine->cur_req == req) {
 			engine->cur_req = NULL;
@@ -68,14 +172,18 @@ static void crypto_finalize_request(struct crypto_engine *engine,
  *
  * This function checks if there is any request in the engine queue that
  * needs processing and if so call out to the driver to initialize hardware
- * and handle each request.
+ * and handle each request. In batch mode it hands the driver as many
+ * requests as it has room for in flight.
  */
 static void crypto_pump_requests(struct crypto_engine *engine,
 				 bool in_kthread)
 {
+	struct crypto_engine_priv *ep = crypto_engine_priv(engine);
 	struct crypto_async_request *async_req, *backlog;
 	struct crypto_engine_alg *alg;
 	struct crypto_engine_op *op;
+	unsigned int dispatched = 0;
+	unsigned int qlen;
 	unsigned long flags;
 	bool was_busy = false;
 	int ret;
@@ -83,7 +191,7 @@ static void crypto_pump_requests(struct crypto_engine *engine,
 	spin_lock_irqsave(&engine->queue_lock, flags);
 
 	/* Make sure we are not already running a request */
-	if (!engine->retry_support && engine->cur_req)
+	if (!engine->retry_support && !ep->max_inflight && engine->cur_req)
 		goto out;
 
 	/* If another context is idling then defer */
@@ -97,6 +205,10 @@ static void crypto_pump_requests(struct crypto_engine *engine,
 		if (!engine->busy)
 			goto out;
 
+		/* The last completion pumps again */
+		if (ep->nr_inflight)
+			goto out;
+
 		/* Only do teardown in the thread */
 		if (!in_kthread) {
 			kthread_queue_work(engine->kworker,
@@ -118,18 +230,29 @@ static void crypto_pump_requests(struct crypto_engine *engine,
 	}
 
 start_request:
+	/* The driver has no room for more, completions will pump again */
+	if (ep->max_inflight && ep->nr_inflight >= ep->max_inflight)
+		goto out;
+
 	/* Get the fist request from the engine queue to handle */
+	qlen = crypto_queue_len(&engine->queue);
 	backlog = crypto_get_backlog(&engine->queue);
 	async_req = crypto_dequeue_request(&engine->queue);
 	if (!async_req)
 		goto out;
 
+	ep->stats.requests++;
+	ep->stats.qlen_sum += qlen;
+	ep->stats.max_qlen = max(ep->stats.max_qlen, qlen);
+
 	/*
 	 * If hardware doesn't support the retry mechanism,
 	 * keep track of the request we are processing now.
 	 * We'll need it on completion (crypto_finalize_request).
 	 */
-	if (!engine->retry_support)
+	if (ep->max_inflight)
+		crypto_engine_track(ep, async_req);
+	else if (!engine->retry_support)
 		engine->cur_req = async_req;
 
 	if (engine->busy)
@@ -175,20 +298,36 @@ static void crypto_pump_requests(struct crypto_engine *engine,
 			goto req_err_1;
 		}
 		spin_lock_irqsave(&engine->queue_lock, flags);
+		/* Before the queue takes the request's list head back */
+		if (ep->max_inflight)
+			crypto_engine_untrack(ep, async_req, false);
 		/*
 		 * If hardware was unable to execute request, enqueue it
 		 * back in front of crypto-engine queue, to keep the order
 		 * of requests.
 		 */
 		crypto_enqueue_request_head(&engine->queue, async_req);
+		ep->stats.requeued++;
 
-		kthread_queue_work(engine->kworker, &engine->pump_requests);
+		/*
+		 * In batch mode, wait for one of our requests in flight to
+		 * complete rather than spinning on the full hardware queue.
+		 */
+		if (!ep->nr_inflight)
+			kthread_queue_work(engine->kworker,
+					   &engine->pump_requests);
 		goto out;
 	}
 
+	dispatched++;
 	goto retry;
 
 req_err_1:
+	if (ep->max_inflight) {
+		spin_lock_irqsave(&engine->queue_lock, flags);
+		crypto_engine_untrack(ep, async_req, false);
+		spin_unlock_irqrestore(&engine->queue_lock, flags);
+	}
 	crypto_request_complete(async_req, ret);
 
 retry:
@@ -196,20 +335,24 @@ static void crypto_pump_requests(struct crypto_engine *engine,
 		crypto_request_complete(backlog, -EINPROGRESS);
 
 	/* If retry mechanism is supported, send new requests to engine */
-	if (engine->retry_support) {
+	if (engine->retry_support || ep->max_inflight) {
 		spin_lock_irqsave(&engine->queue_lock, flags);
 		goto start_request;
 	}
 	return;
 
 out:
+	if (dispatched) {
+		ep->stats.batches++;
+		ep->stats.max_batch = max(ep->stats.max_batch, dispatched);
+	}
 	spin_unlock_irqrestore(&engine->queue_lock, flags);
 
 	/*
 	 * Batch requests is possible only if
 	 * hardware can enqueue multiple requests
 	 */
-	if (engine->do_batch_requests) {
+	if (engine->do_batch_requests && (dispatched || !ep->max_inflight)) {
 		ret = engine->do_batch_requests(engine);
 		if (ret)
 			dev_err(engine->dev, "failed to do batch requests: %d\n",
@@ -466,6 +609,135 @@ int crypto_engine_stop(struct crypto_engine *engine)
 }
 EXPORT_SYMBOL_GPL(crypto_engine_stop);
 
+/**
+ * crypto_engine_set_batch - let the engine keep several requests in flight
+ * @engine: the hardware engine, must not be running yet
+ * @max_inflight: maximum number of requests handed to the driver and not
+ *                yet finalized, at most CRYPTO_ENGINE_MAX_INFLIGHT
+ * @cbk_do_batch: optional callback run once after each pump that handed
+ *                requests to the driver, e.g. to ring the doorbell for all
+ *                of them
+ *
+ * Each pump hands the driver as many queued requests as there is room for
+ * through ->do_one_request(), and they may be finalized in any order. With
+ * retry support, -ENOSPC from ->do_one_request() requeues the request until
+ * one of the requests in flight completes.
+ *
+ * This must be called from context that can sleep.
+ * Return: 0 on success, else a negative error code.
+ */
+int crypto_engine_set_batch(struct crypto_engine *engine,
+			    unsigned int max_inflight,
+			    int (*cbk_do_batch)(struct crypto_engine *engine))
+{
+	struct crypto_engine_priv *ep = crypto_engine_priv(engine);
+	struct crypto_engine_inflight *inflight;
+	unsigned long flags;
+	unsigned int i;
+
+	if (!max_inflight || max_inflight > CRYPTO_ENGINE_MAX_INFLIGHT)
+		return -EINVAL;
+
+	inflight = devm_kcalloc(engine->dev, max_inflight, sizeof(*inflight),
+				GFP_KERNEL);
+	if (!inflight)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&engine->queue_lock, flags);
+	if (engine->running || engine->busy) {
+		spin_unlock_irqrestore(&engine->queue_lock, flags);
+		devm_kfree(engine->dev, inflight);
+		return -EBUSY;
+	}
+
+	if (ep->inflight)
+		devm_kfree(engine->dev, ep->inflight);
+	ep->inflight = inflight;
+	INIT_LIST_HEAD(&ep->free_slots);
+	for (i = 0; i < max_inflight; i++)
+		list_add_tail(&inflight[i].list, &ep->free_slots);
+	ep->max_inflight = max_inflight;
+	engine->do_batch_requests = cbk_do_batch;
+	spin_unlock_irqrestore(&engine->queue_lock, flags);
+
+	return 0;
+}
+EXPORT_SYMBOL_GPL(crypto_engine_set_batch);
+
+/**
+ * crypto_engine_get_dev - get the device an engine was allocated for
+ * @engine: the hardware engine
+ *
+ * Lets a ->do_batch_requests() callback find its driver state.
+ */
+struct device *crypto_engine_get_dev(struct crypto_engine *engine)
+{
+	return engine->dev;
+}
+EXPORT_SYMBOL_GPL(crypto_engine_get_dev);
+
+static int crypto_engine_stats_show(struct seq_file *m, void *v)
+{
+	struct crypto_engine_priv *ep = m->private;
+	struct crypto_engine_stats st;
+	unsigned int qlen, inflight;
+	unsigned long flags;
+
+	spin_lock_irqsave(&ep->base.queue_lock, flags);
+	st = ep->stats;
+	qlen = crypto_queue_len(&ep->base.queue);
+	inflight = ep->nr_inflight;
+	spin_unlock_irqrestore(&ep->base.queue_lock, flags);
+
+	seq_printf(m, "queue_len      : %u\n", qlen);
+	seq_printf(m, "avg_queue_len  : %llu\n",
+		   st.requests ? div64_u64(st.qlen_sum, st.requests) : 0);
+	seq_printf(m, "max_queue_len  : %u\n", st.max_qlen);
+	seq_printf(m, "requests       : %llu\n", st.requests);
+	seq_printf(m, "requeued       : %llu\n", st.requeued);
+	seq_printf(m, "batches        : %llu\n", st.batches);
+	seq_printf(m, "max_batch      : %u\n", st.max_batch);
+	seq_printf(m, "inflight       : %u\n", inflight);
+	seq_printf(m, "inflight_limit : %u\n", ep->max_inflight);
+	seq_printf(m, "max_inflight   : %u\n", st.max_inflight);
+	seq_printf(m, "completed      : %llu\n", st.completed);
+	seq_printf(m, "avg_latency_ns : %llu\n",
+		   st.completed ? div64_u64(st.latency_ns, st.completed) : 0);
+	seq_printf(m, "max_latency_ns : %llu\n", st.max_latency_ns);
+
+	return 0;
+}
+DEFINE_SHOW_ATTRIBUTE(crypto_engine_stats);
+
+/* The stats file must go before the devm allocated engine does. */
+static void crypto_engine_debugfs_remove(void *data)
+{
+	struct crypto_engine_priv *ep = data;
+
+	debugfs_remove_recursive(ep->debugfs);
+	ep->debugfs = NULL;
+	if (ep->id >= 0) {
+		ida_free(&crypto_engine_ida, ep->id);
+		ep->id = -1;
+	}
+}
+
+static void crypto_engine_debugfs_add(struct crypto_engine_priv *ep)
+{
+	char name[sizeof(ep->base.name) + 12];
+
+	ep->id = ida_alloc(&crypto_engine_ida, GFP_KERNEL);
+	if (ep->id < 0)
+		return;
+
+	snprintf(name, sizeof(name), "%s.%d", ep->base.name, ep->id);
+	ep->debugfs = debugfs_create_dir(name, crypto_engine_debugfs_root);
+	debugfs_create_file("stats", 0400, ep->debugfs, ep,
+			    &crypto_engine_stats_fops);
+	if (devm_add_action(ep->base.dev, crypto_engine_debugfs_remove, ep))
+		crypto_engine_debugfs_remove(ep);
+}
+
 /**
  * crypto_engine_alloc_init_and_set - allocate crypto hardware engine structure
  * and initialize it by setting the maximum number of entries in the software
@@ -489,15 +761,18 @@ struct crypto_engine *crypto_engine_alloc_init_and_set(struct device *dev,
 						       int (*cbk_do_batch)(struct crypto_engine *engine),
 						       bool rt, int qlen)
 {
+	struct crypto_engine_priv *ep;
 	struct crypto_engine *engine;
 
 	if (!dev)
 		return NULL;
 
-	engine = devm_kzalloc(dev, sizeof(*engine), GFP_KERNEL);
-	if (!engine)
+	ep = devm_kzalloc(dev, sizeof(*ep), GFP_KERNEL);
+	if (!ep)
 		return NULL;
 
+	engine = &ep->base;
+
 	engine->dev = dev;
 	engine->rt = rt;
 	engine->running = false;
@@ -529,6 +804,8 @@ struct crypto_engine *crypto_engine_alloc_init_and_set(struct device *dev,
 		sched_set_fifo(engine->kworker->task);
 	}
 
+	crypto_engine_debugfs_add(ep);
+
 	return engine;
 }
 EXPORT_SYMBOL_GPL(crypto_engine_alloc_init_and_set);
@@ -557,6 +834,8 @@ void crypto_engine_exit(struct crypto_engine *engine)
 {
 	int ret;
 
+	crypto_engine_debugfs_remove(crypto_engine_priv(engine));
+
 	ret = crypto_engine_stop(engine);
 	if (ret)
 		return;
@@ -737,5 +1016,19 @@ void crypto_engine_unregister_skciphers(struct skcipher_engine_alg *algs,
 }
 EXPORT_SYMBOL_GPL(crypto_engine_unregister_skciphers);
 
+static int __init crypto_engine_init(void)
+{
+	crypto_engine_debugfs_root = debugfs_create_dir("crypto_engine", NULL);
+	return 0;
+}
+
+static void __exit crypto_engine_fini(void)
+{
+	debugfs_remove_recursive(crypto_engine_debugfs_root);
+}
+
+subsys_initcall(crypto_engine_init);
+module_exit(crypto_engine_fini);
+
 MODULE_LICENSE("GPL");
 MODULE_DESCRIPTION("Crypto hardware engine framework");
@@ -114,6 +114,7 @@ static int pcrypt_aead_encrypt(struct aead_request *req)
 			       req->cryptlen, req->iv);
 	aead_request_set_ad(creq, req->assoclen);
 
+	/* The SA's callback CPU keeps all of its packets on one node. */
 	err = padata_do_parallel(ictx->psenc, padata, &ctx->cb_cpu);
 	if (!err)
 		return -EINPROGRESS;
@@ -174,18 +175,42 @@ static int pcrypt_aead_decrypt(struct aead_request *req)
 
 static int pcrypt_aead_init_tfm(struct crypto_aead *tfm)
 {
-	int cpu, cpu_index;
+	unsigned int cpu_index, node_index, nr_nodes, weight;
+	int cpu, nid;
 	struct aead_instance *inst = aead_alg_instance(tfm);
 	struct pcrypt_instance_ctx *ictx = aead_instance_ctx(inst);
 	struct pcrypt_aead_ctx *ctx = crypto_aead_ctx(tfm);
 	struct crypto_aead *cipher;
 
-	cpu_index = (unsigned int)atomic_inc_return(&ictx->tfm_count) %
-		    cpumask_weight(cpu_online_mask);
-
-	ctx->cb_cpu = cpumask_first(cpu_online_mask);
-	for (cpu = 0; cpu < cpu_index; cpu++)
-		ctx->cb_cpu = cpumask_next(ctx->cb_cpu, cpu_online_mask);
+	/*
+	 * Each tfm is one SA. padata parallelizes and reorders an object on
+	 * the NUMA node of its callback CPU, so spread the SAs over the nodes
+	 * first and over the CPUs of a node second, keeping every SA on one
+	 * node.
+	 */
+	cpu_index = (unsigned int)atomic_inc_return(&ictx->tfm_count);
+	nr_nodes = max(num_node_state(N_CPU), 1);
+	node_index = cpu_index % nr_nodes;
+	cpu_index /= nr_nodes;
+
+	for_each_node_state(nid, N_CPU)
+		if (!node_index--)
+			break;
+
+	weight = 0;
+	if (nid < MAX_NUMNODES)
+		weight = cpumask_weight_and(cpumask_of_node(nid),
+					    cpu_online_mask);
+	if (weight) {
+		ctx->cb_cpu = cpumask_nth_and(cpu_index % weight,
+					      cpumask_of_node(nid),
+					      cpu_online_mask);
+	} else {
+		cpu_index %= cpumask_weight(cpu_online_mask);
+		ctx->cb_cpu = cpumask_first(cpu_online_mask);
+		for (cpu = 0; cpu < cpu_index; cpu++)
+			ctx->cb_cpu = cpumask_next(ctx->cb_cpu, cpu_online_mask);
+	}
 
 	cipher = crypto_spawn_aead(&ictx->spawn);
 
@@ -19,6 +19,7 @@
 #include <linux/slab.h>
 #include <linux/string.h>
 #include <linux/vmalloc.h>
+#include <linux/workqueue.h>
 #include <net/netlink.h>
 
 #include "compress.h"
@@ -33,6 +34,24 @@ static DEFINE_PER_CPU(struct scomp_scratch, scomp_scratch) = {
 	.lock = __SPIN_LOCK_UNLOCKED(scomp_scratch.lock),
 };
 
+/*
+ * Batches take the scratch lock once per SCOMP_BATCH_CHUNK requests, which
+ * also bounds the time spent with preemption disabled. Batches of more than
+ * one chunk are split across workers, each using the scratch of the CPU it
+ * runs on.
+ */
+#define SCOMP_BATCH_CHUNK	8
+
+struct scomp_batch_work {
+	struct work_struct work;
+	struct acomp_req **reqs;
+	int *errors;
+	unsigned int nr;
+	int dir;
+	atomic_t *pending;
+	struct completion *done;
+};
+
 static const struct crypto_type crypto_scomp_type;
 static int scomp_scratch_users;
 static DEFINE_MUTEX(scomp_lock);
@@ -110,13 +129,14 @@ static int crypto_scomp_init_tfm(struct crypto_tfm *tfm)
 	return ret;
 }
 
-static int scomp_acomp_comp_decomp(struct acomp_req *req, int dir)
+/* Called with scratch->lock held */
+static int __scomp_acomp_comp_decomp(struct acomp_req *req, int dir,
+				     struct scomp_scratch *scratch)
 {
 	struct crypto_acomp *tfm = crypto_acomp_reqtfm(req);
 	void **tfm_ctx = acomp_tfm_ctx(tfm);
 	struct crypto_scomp *scomp = *tfm_ctx;
 	void **ctx = acomp_request_ctx(req);
-	struct scomp_scratch *scratch;
 	void *src, *dst;
 	unsigned int dlen;
 	int ret;
@@ -132,9 +152,6 @@ static int scomp_acomp_comp_decomp(struct acomp_req *req, int dir)
 
 	dlen = req->dlen;
 
-	scratch = raw_cpu_ptr(&scomp_scratch);
-	spin_lock(&scratch->lock);
-
 	if (sg_nents(req->src) == 1 && !PageHighMem(sg_page(req->src))) {
 		src = page_to_virt(sg_page(req->src)) + req->src->offset;
 	} else {
@@ -157,13 +174,10 @@ static int scomp_acomp_comp_decomp(struct acomp_req *req, int dir)
 	if (!ret) {
 		if (!req->dst) {
 			req->dst = sgl_alloc(req->dlen, GFP_ATOMIC, NULL);
-			if (!req->dst) {
-				ret = -ENOMEM;
-				goto out;
-			}
+			if (!req->dst)
+				return -ENOMEM;
 		} else if (req->dlen > dlen) {
-			ret = -ENOSPC;
-			goto out;
+			return -ENOSPC;
 		}
 		if (dst == scratch->dst) {
 			scatterwalk_map_and_copy(scratch->dst, req->dst, 0,
@@ -177,11 +191,95 @@ static int scomp_acomp_comp_decomp(struct acomp_req *req, int dir)
 				flush_dcache_page(dst_page + i);
 		}
 	}
-out:
+	return ret;
+}
+
+static int scomp_acomp_comp_decomp(struct acomp_req *req, int dir)
+{
+	struct scomp_scratch *scratch;
+	int ret;
+
+	scratch = raw_cpu_ptr(&scomp_scratch);
+	spin_lock(&scratch->lock);
+	ret = __scomp_acomp_comp_decomp(req, dir, scratch);
 	spin_unlock(&scratch->lock);
+
 	return ret;
 }
 
+static void scomp_acomp_batch_run(struct acomp_req **reqs, int *errors,
+				  unsigned int nr, int dir)
+{
+	struct scomp_scratch *scratch;
+	unsigned int i, end;
+
+	for (i = 0; i < nr; ) {
+		end = min(nr, i + SCOMP_BATCH_CHUNK);
+
+		scratch = raw_cpu_ptr(&scomp_scratch);
+		spin_lock(&scratch->lock);
+		for (; i < end; i++)
+			errors[i] = __scomp_acomp_comp_decomp(reqs[i], dir,
+							      scratch);
+		spin_unlock(&scratch->lock);
+		cond_resched();
+	}
+}
+
+static void scomp_acomp_batch_workfn(struct work_struct *work)
+{
+	struct scomp_batch_work *bw =
+		container_of(work, struct scomp_batch_work, work);
+
+	scomp_acomp_batch_run(bw->reqs, bw->errors, bw->nr, bw->dir);
+	if (atomic_dec_and_test(bw->pending))
+		complete(bw->done);
+}
+
+/*
+ * Splits the batch between the caller and unbound workers, then waits for
+ * them, so this sleeps. acomp_batch() checked that it may.
+ */
+static int scomp_acomp_batch(struct acomp_req *reqs[], int errors[],
+			     unsigned int nr, int dir)
+{
+	DECLARE_COMPLETION_ONSTACK(done);
+	struct scomp_batch_work *works = NULL;
+	unsigned int nr_works, i, start, end;
+	atomic_t pending;
+
+	nr_works = min(DIV_ROUND_UP(nr, SCOMP_BATCH_CHUNK), num_online_cpus());
+	if (nr_works > 1)
+		works = kmalloc_array(nr_works - 1, sizeof(*works), GFP_KERNEL);
+	if (!works)
+		nr_works = 1;
+
+	/* The caller runs the first share, the workers the rest */
+	atomic_set(&pending, nr_works);
+	for (i = 1; i < nr_works; i++) {
+		struct scomp_batch_work *bw = &works[i - 1];
+
+		start = i * nr / nr_works;
+		end = (i + 1) * nr / nr_works;
+
+		INIT_WORK(&bw->work, scomp_acomp_batch_workfn);
+		bw->reqs = reqs + start;
+		bw->errors = errors + start;
+		bw->nr = end - start;
+		bw->dir = dir;
+		bw->pending = &pending;
+		bw->done = &done;
+		queue_work(system_unbound_wq, &bw->work);
+	}
+
+	scomp_acomp_batch_run(reqs, errors, nr / nr_works, dir);
+	if (!atomic_dec_and_test(&pending))
+		wait_for_completion(&done);
+	kfree(works);
+
+	return acomp_batch_status(errors, nr);
+}
+
 static int scomp_acomp_compress(struct acomp_req *req)
 {
 	return scomp_acomp_comp_decomp(req, 1);
@@ -192,6 +290,18 @@ static int scomp_acomp_decompress(struct acomp_req *req)
 	return scomp_acomp_comp_decomp(req, 0);
 }
 
+static int scomp_acomp_batch_compress(struct acomp_req *reqs[], int errors[],
+				      unsigned int nr)
+{
+	return scomp_acomp_batch(reqs, errors, nr, 1);
+}
+
+static int scomp_acomp_batch_decompress(struct acomp_req *reqs[],
+					int errors[], unsigned int nr)
+{
+	return scomp_acomp_batch(reqs, errors, nr, 0);
+}
+
 static void crypto_exit_scomp_ops_async(struct crypto_tfm *tfm)
 {
 	struct crypto_scomp **ctx = crypto_tfm_ctx(tfm);
@@ -225,6 +335,8 @@ int crypto_init_scomp_ops_async(struct crypto_tfm *tfm)
 
 	crt->compress = scomp_acomp_compress;
 	crt->decompress = scomp_acomp_decompress;
+	crt->batch_compress = scomp_acomp_batch_compress;
+	crt->batch_decompress = scomp_acomp_batch_decompress;
 	crt->dst_free = sgl_free;
 	crt->reqsize = sizeof(void *);
 
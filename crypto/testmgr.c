@@ -1439,6 +1439,84 @@ static int test_shash_vec_cfg(const struct hash_testvec *vec,
 				 driver, cfg);
 }
 
+#define TEST_SHASH_MB_MAX_MSGS	8
+
+/*
+ * Test crypto_shash_finup_mb() on one test vector. Message 0 is the test
+ * vector itself, the others share its first half and differ from it in the
+ * last byte; they are checked against crypto_shash_digest(). Up to one more
+ * message than the algorithm interleaves is used, to cover the fallback.
+ */
+static int test_shash_finup_mb(const struct hash_testvec *vec,
+			       const char *vec_name, struct shash_desc *desc)
+{
+	struct crypto_shash *tfm = desc->tfm;
+	const unsigned int digestsize = crypto_shash_digestsize(tfm);
+	const char *driver = crypto_shash_driver_name(tfm);
+	const unsigned int psize = vec->psize;
+	const unsigned int prefix = psize / 2;
+	unsigned int max_msgs, num_msgs, i;
+	const u8 *data[TEST_SHASH_MB_MAX_MSGS];
+	u8 *outs[TEST_SHASH_MB_MAX_MSGS];
+	u8 *msgs, *digests;
+	int err = 0;
+
+	if (!psize || vec->setkey_error || vec->digest_error)
+		return 0;
+
+	max_msgs = min_t(unsigned int, crypto_shash_mb_max_msgs(tfm) + 1,
+			 TEST_SHASH_MB_MAX_MSGS);
+	msgs = kmalloc_array(max_msgs, psize, GFP_KERNEL);
+	digests = kmalloc_array(max_msgs, 2 * digestsize, GFP_KERNEL);
+	if (!msgs || !digests) {
+		err = -ENOMEM;
+		goto out;
+	}
+
+	for (i = 0; i < max_msgs; i++) {
+		u8 *msg = &msgs[i * psize];
+
+		memcpy(msg, vec->plaintext, psize);
+		msg[psize - 1] ^= i;
+		data[i] = msg + prefix;
+		outs[i] = &digests[2 * i * digestsize];
+		err = crypto_shash_digest(desc, msg, psize,
+					  outs[i] + digestsize);
+		if (err) {
+			pr_err("alg: shash: %s digest() failed with err %d on test vector %s\n",
+			       driver, err, vec_name);
+			goto out;
+		}
+	}
+
+	for (num_msgs = 2; num_msgs <= max_msgs; num_msgs++) {
+		err = crypto_shash_init(desc) ?:
+		      crypto_shash_update(desc, vec->plaintext, prefix) ?:
+		      crypto_shash_finup_mb(desc, data, psize - prefix, outs,
+					    num_msgs);
+		if (err) {
+			pr_err("alg: shash: %s finup_mb() failed with err %d on test vector %s, num_msgs=%u\n",
+			       driver, err, vec_name, num_msgs);
+			goto out;
+		}
+		for (i = 0; i < num_msgs; i++) {
+			const u8 *expected = i ? outs[i] + digestsize :
+						 (const u8 *)vec->digest;
+
+			if (memcmp(outs[i], expected, digestsize)) {
+				pr_err("alg: shash: %s finup_mb() gave a wrong digest for message %u of %u on test vector %s\n",
+				       driver, i, num_msgs, vec_name);
+				err = -EINVAL;
+				goto out;
+			}
+		}
+	}
+out:
+	kfree(digests);
+	kfree(msgs);
+	return err;
+}
+
 static int do_ahash_op(int (*op)(struct ahash_request *req),
 		       struct ahash_request *req,
 		       struct crypto_wait *wait, bool nosimd)
@@ -1684,6 +1762,12 @@ static int test_hash_vec(const struct hash_testvec *vec, unsigned int vec_num,
 			return err;
 	}
 
+	if (desc) {
+		err = test_shash_finup_mb(vec, vec_name, desc);
+		if (err)
+			return err;
+	}
+
 #ifdef CONFIG_CRYPTO_MANAGER_EXTRA_TESTS
 	if (!noextratests) {
 		struct rnd_state rng;
@@ -3628,6 +3712,143 @@ static int test_acomp(struct crypto_acomp *tfm,
 	return ret;
 }
 
+#define TEST_ACOMP_BATCH_SIZE	17
+
+/*
+ * Compress copies of the compression test vectors with one
+ * crypto_acomp_batch_compress() call, and decompress the results with one
+ * crypto_acomp_batch_decompress() call. The batch is big enough for the
+ * software path to split it across workers. Every request must get its own
+ * callback back, and a batch mixing two tfms must be refused.
+ */
+static int test_acomp_batch(struct crypto_acomp *tfm,
+			    const struct comp_testvec *ctemplate, int ctcount)
+{
+	const char *algo = crypto_tfm_alg_driver_name(crypto_acomp_tfm(tfm));
+	struct acomp_req *reqs[TEST_ACOMP_BATCH_SIZE] = {};
+	int errors[TEST_ACOMP_BATCH_SIZE];
+	struct crypto_acomp *other_tfm;
+	struct scatterlist *sgs;
+	struct crypto_wait wait;
+	unsigned int i;
+	u8 *bufs;
+	int ret;
+
+	if (!ctcount)
+		return 0;
+
+	/* per request: input, compressed and decompressed buffers */
+	bufs = kmalloc_array(3 * TEST_ACOMP_BATCH_SIZE, COMP_BUF_SIZE,
+			     GFP_KERNEL);
+	sgs = kmalloc_array(2 * TEST_ACOMP_BATCH_SIZE, sizeof(*sgs),
+			    GFP_KERNEL);
+	if (!bufs || !sgs) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	crypto_init_wait(&wait);
+	for (i = 0; i < TEST_ACOMP_BATCH_SIZE; i++) {
+		const struct comp_testvec *vec = &ctemplate[i % ctcount];
+		u8 *input = &bufs[3 * i * COMP_BUF_SIZE];
+
+		reqs[i] = acomp_request_alloc(tfm);
+		if (!reqs[i]) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		memcpy(input, vec->input, vec->inlen);
+		sg_init_one(&sgs[2 * i], input, vec->inlen);
+		sg_init_one(&sgs[2 * i + 1], input + COMP_BUF_SIZE,
+			    COMP_BUF_SIZE);
+		acomp_request_set_params(reqs[i], &sgs[2 * i], &sgs[2 * i + 1],
+					 vec->inlen, COMP_BUF_SIZE);
+		acomp_request_set_callback(reqs[i], CRYPTO_TFM_REQ_MAY_BACKLOG,
+					   crypto_req_done, &wait);
+	}
+
+	ret = crypto_acomp_batch_compress(reqs, errors, TEST_ACOMP_BATCH_SIZE);
+	if (ret) {
+		pr_err("alg: acomp: batch compression failed for %s: ret=%d
+",
+		       algo, -ret);
+		goto out;
+	}
+
+	for (i = 0; i < TEST_ACOMP_BATCH_SIZE; i++) {
+		u8 *input = &bufs[3 * i * COMP_BUF_SIZE];
+
+		sg_init_one(&sgs[2 * i], input + COMP_BUF_SIZE, reqs[i]->dlen);
+		sg_init_one(&sgs[2 * i + 1], input + 2 * COMP_BUF_SIZE,
+			    COMP_BUF_SIZE);
+		acomp_request_set_params(reqs[i], &sgs[2 * i], &sgs[2 * i + 1],
+					 reqs[i]->dlen, COMP_BUF_SIZE);
+	}
+
+	ret = crypto_acomp_batch_decompress(reqs, errors,
+					    TEST_ACOMP_BATCH_SIZE);
+	if (ret) {
+		pr_err("alg: acomp: batch decompression failed for %s: ret=%d
+",
+		       algo, -ret);
+		goto out;
+	}
+
+	for (i = 0; i < TEST_ACOMP_BATCH_SIZE; i++) {
+		const struct comp_testvec *vec = &ctemplate[i % ctcount];
+		u8 *output = &bufs[(3 * i + 2) * COMP_BUF_SIZE];
+
+		if (reqs[i]->dlen != vec->inlen ||
+		    memcmp(output, vec->input, vec->inlen)) {
+			pr_err("alg: acomp: batch test failed on request %u for %s
+",
+			       i, algo);
+			ret = -EINVAL;
+			goto out;
+		}
+		if (reqs[i]->base.complete != crypto_req_done ||
+		    reqs[i]->base.data != &wait) {
+			pr_err("alg: acomp: batch did not restore the callback of request %u for %s
+",
+			       i, algo);
+			ret = -EINVAL;
+			goto out;
+		}
+	}
+
+	other_tfm = crypto_alloc_acomp(algo, 0, 0);
+	if (IS_ERR(other_tfm)) {
+		ret = PTR_ERR(other_tfm);
+		goto out;
+	}
+	acomp_request_free(reqs[1]);
+	reqs[1] = acomp_request_alloc(other_tfm);
+	if (!reqs[1]) {
+		ret = -ENOMEM;
+	} else {
+		ret = crypto_acomp_batch_compress(reqs, errors, 2);
+		if (ret != -EINVAL) {
+			pr_err("alg: acomp: batch across two tfms was not refused for %s: ret=%d
+",
+			       algo, -ret);
+			ret = -EINVAL;
+		} else {
+			ret = 0;
+		}
+		acomp_request_free(reqs[1]);
+		reqs[1] = NULL;
+	}
+	crypto_free_acomp(other_tfm);
+
+out:
+	for (i = 0; i < TEST_ACOMP_BATCH_SIZE; i++)
+		if (reqs[i])
+			acomp_request_free(reqs[i]);
+	kfree(sgs);
+	kfree(bufs);
+	return ret;
+}
+
 static int test_cprng(struct crypto_rng *tfm,
 		      const struct cprng_testvec *template,
 		      unsigned int tcount)
@@ -3735,6 +3956,10 @@ static int alg_test_comp(const struct alg_test_desc *desc, const char *driver,
 				 desc->suite.comp.decomp.vecs,
 				 desc->suite.comp.comp.count,
 				 desc->suite.comp.decomp.count);
+		if (!err)
+			err = test_acomp_batch(acomp,
+					       desc->suite.comp.comp.vecs,
+					       desc->suite.comp.comp.count);
 		crypto_free_acomp(acomp);
 	} else {
 		comp = crypto_alloc_comp(driver, type, mask);
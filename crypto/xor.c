@@ -14,45 +14,84 @@
 #include <linux/raid/xor.h>
 #include <linux/jiffies.h>
 #include <linux/preempt.h>
+#include <linux/math64.h>
+#include <linux/mutex.h>
+#include <linux/sysfs.h>
 #include <asm/xor.h>
 
 #ifndef XOR_SELECT_TEMPLATE
 #define XOR_SELECT_TEMPLATE(x) (x)
 #endif
 
+/*
+ * Requests are bucketed by length and each bucket gets the template that
+ * benchmarked fastest at that length: wide unrolled loops win on large
+ * stripes but can lose on short ones.  A bucket covers lengths up to its
+ * size, the last one covers everything larger.
+ */
+#define XOR_NR_CLASSES	3
+
+static const unsigned int xor_class_bytes[XOR_NR_CLASSES] = {
+	512, 4096, 16384,
+};
+
 /* The xor routines to use.  */
-static struct xor_block_template *active_template;
+static struct xor_block_template *active_template[XOR_NR_CLASSES];
+
+static inline struct xor_block_template *xor_template(unsigned int bytes)
+{
+	int i;
+
+	for (i = 0; i < XOR_NR_CLASSES - 1; i++)
+		if (bytes <= xor_class_bytes[i])
+			break;
+	return READ_ONCE(active_template[i]);
+}
 
 void
 xor_blocks(unsigned int src_count, unsigned int bytes, void *dest, void **srcs)
 {
+	struct xor_block_template *tmpl = xor_template(bytes);
 	unsigned long *p1, *p2, *p3, *p4;
 
 	p1 = (unsigned long *) srcs[0];
 	if (src_count == 1) {
-		active_template->do_2(bytes, dest, p1);
+		tmpl->do_2(bytes, dest, p1);
 		return;
 	}
 
 	p2 = (unsigned long *) srcs[1];
 	if (src_count == 2) {
-		active_template->do_3(bytes, dest, p1, p2);
+		tmpl->do_3(bytes, dest, p1, p2);
 		return;
 	}
 
 	p3 = (unsigned long *) srcs[2];
 	if (src_count == 3) {
-		active_template->do_4(bytes, dest, p1, p2, p3);
+		tmpl->do_4(bytes, dest, p1, p2, p3);
 		return;
 	}
 
 	p4 = (unsigned long *) srcs[3];
-	active_template->do_5(bytes, dest, p1, p2, p3, p4);
+	tmpl->do_5(bytes, dest, p1, p2, p3, p4);
 }
 EXPORT_SYMBOL(xor_blocks);
 
-/* Set of all registered templates.  */
-static struct xor_block_template *__initdata template_list;
+static void xor_set_templates(struct xor_block_template *tmpl)
+{
+	int i;
+
+	for (i = 0; i < XOR_NR_CLASSES; i++)
+		WRITE_ONCE(active_template[i], tmpl);
+}
+
+/*
+ * Set of all registered templates.  Kept after init so that the benchmark
+ * can be re-run from sysfs.
+ */
+static struct xor_block_template *template_list;
+static DEFINE_MUTEX(xor_bench_lock);
+static bool xor_calibrated;
 
 #ifndef MODULE
 static void __init do_xor_register(struct xor_block_template *tmpl)
@@ -63,32 +102,32 @@ static void __init do_xor_register(struct xor_block_template *tmpl)
 
 static int __init register_xor_blocks(void)
 {
-	active_template = XOR_SELECT_TEMPLATE(NULL);
+	struct xor_block_template *tmpl = XOR_SELECT_TEMPLATE(NULL);
 
-	if (!active_template) {
+	if (!tmpl) {
 #define xor_speed	do_xor_register
 		// register all the templates and pick the first as the default
 		XOR_TRY_TEMPLATES;
 #undef xor_speed
-		active_template = template_list;
+		tmpl = template_list;
 	}
+	xor_set_templates(tmpl);
 	return 0;
 }
 #endif
 
 #define BENCH_SIZE	4096
 #define REPS		800U
+/* room for two misaligned buffers of the largest class */
+#define BENCH_ORDER	4
 
-static void __init
-do_xor_speed(struct xor_block_template *tmpl, void *b1, void *b2)
+/* Returns MB/sec; the same amount of data is pushed through for every size. */
+static int xor_bench(struct xor_block_template *tmpl, void *b1, void *b2,
+		     unsigned int bytes)
 {
-	int speed;
-	unsigned long reps;
+	unsigned long reps, max_reps = REPS * BENCH_SIZE / bytes;
 	ktime_t min, start, t0;
 
-	tmpl->next = template_list;
-	template_list = tmpl;
-
 	preempt_disable();
 
 	reps = 0;
@@ -98,25 +137,63 @@ do_xor_speed(struct xor_block_template *tmpl, void *b1, void *b2)
 		cpu_relax();
 	do {
 		mb(); /* prevent loop optimization */
-		tmpl->do_2(BENCH_SIZE, b1, b2);
+		tmpl->do_2(bytes, b1, b2);
 		mb();
-	} while (reps++ < REPS || (t0 = ktime_get()) == start);
+	} while (reps++ < max_reps || (t0 = ktime_get()) == start);
 	min = ktime_sub(t0, start);
 
 	preempt_enable();
 
 	// bytes/ns == GB/s, multiply by 1000 to get MB/s [not MiB/s]
-	speed = (1000 * reps * BENCH_SIZE) / (unsigned int)ktime_to_ns(min);
-	tmpl->speed = speed;
+	return div64_u64(1000ULL * reps * bytes, ktime_to_ns(min));
+}
+
+static void __init
+do_xor_speed(struct xor_block_template *tmpl, void *b1, void *b2)
+{
+	tmpl->next = template_list;
+	template_list = tmpl;
+
+	tmpl->speed = xor_bench(tmpl, b1, b2, BENCH_SIZE);
 
-	pr_info("   %-16s: %5d MB/sec\n", tmpl->name, speed);
+	pr_info("   %-16s: %5d MB/sec\n", tmpl->name, tmpl->speed);
+}
+
+/* Benchmark every registered template at each size class, pick the fastest. */
+static void xor_select_templates(void *b1, void *b2, bool verbose)
+{
+	struct xor_block_template *f, *fastest;
+	int i, speed, best;
+
+	for (i = 0; i < XOR_NR_CLASSES; i++) {
+		fastest = NULL;
+		best = 0;
+		for (f = template_list; f; f = f->next) {
+			/* do_xor_speed() has just measured BENCH_SIZE at boot */
+			if (xor_class_bytes[i] != BENCH_SIZE || !verbose)
+				speed = xor_bench(f, b1, b2, xor_class_bytes[i]);
+			else
+				speed = f->speed;
+			if (xor_class_bytes[i] == BENCH_SIZE)
+				f->speed = speed;
+			if (!fastest || speed > best) {
+				fastest = f;
+				best = speed;
+			}
+		}
+		WRITE_ONCE(active_template[i], fastest);
+
+		if (verbose)
+			pr_info("xor: using function: %s (%d MB/sec) at %u bytes\n",
+				fastest->name, best, xor_class_bytes[i]);
+	}
 }
 
 static int __init
 calibrate_xor_blocks(void)
 {
 	void *b1, *b2;
-	struct xor_block_template *f, *fastest;
+	struct xor_block_template *fastest;
 
 	fastest = XOR_SELECT_TEMPLATE(NULL);
 
@@ -124,15 +201,16 @@ calibrate_xor_blocks(void)
 		printk(KERN_INFO "xor: automatically using best "
 				 "checksumming function   %-10s\n",
 		       fastest->name);
-		goto out;
+		xor_set_templates(fastest);
+		return 0;
 	}
 
-	b1 = (void *) __get_free_pages(GFP_KERNEL, 2);
+	b1 = (void *) __get_free_pages(GFP_KERNEL, BENCH_ORDER);
 	if (!b1) {
 		printk(KERN_WARNING "xor: Yikes!  No memory available.\n");
 		return -ENOMEM;
 	}
-	b2 = b1 + 2*PAGE_SIZE + BENCH_SIZE;
+	b2 = b1 + 2*PAGE_SIZE + xor_class_bytes[XOR_NR_CLASSES - 1];
 
 	/*
 	 * If this arch/cpu has a short-circuited selection, don't loop through
@@ -142,24 +220,73 @@ calibrate_xor_blocks(void)
 #define xor_speed(templ)	do_xor_speed((templ), b1, b2)
 
 	printk(KERN_INFO "xor: measuring software checksum speed\n");
+	mutex_lock(&xor_bench_lock);
 	template_list = NULL;
 	XOR_TRY_TEMPLATES;
-	fastest = template_list;
-	for (f = fastest; f; f = f->next)
-		if (f->speed > fastest->speed)
-			fastest = f;
-
-	pr_info("xor: using function: %s (%d MB/sec)\n",
-	       fastest->name, fastest->speed);
+	xor_select_templates(b1, b2, true);
+	xor_calibrated = true;
+	mutex_unlock(&xor_bench_lock);
 
 #undef xor_speed
 
-	free_pages((unsigned long)b1, 2);
-out:
-	active_template = fastest;
+	free_pages((unsigned long)b1, BENCH_ORDER);
 	return 0;
 }
 
+/*
+ * /sys/module/xor/parameters/benchmark: reading shows the template used
+ * for each size class, writing anything re-runs the benchmark, e.g. once
+ * the machine is in its steady state frequency and cache configuration.
+ */
+static int xor_benchmark_set(const char *val, const struct kernel_param *kp)
+{
+	void *b1, *b2;
+
+	mutex_lock(&xor_bench_lock);
+	/* boot time or a short-circuited selection: nothing to compare */
+	if (!xor_calibrated || !template_list) {
+		mutex_unlock(&xor_bench_lock);
+		return 0;
+	}
+
+	b1 = (void *) __get_free_pages(GFP_KERNEL, BENCH_ORDER);
+	if (!b1) {
+		mutex_unlock(&xor_bench_lock);
+		return -ENOMEM;
+	}
+	b2 = b1 + 2*PAGE_SIZE + xor_class_bytes[XOR_NR_CLASSES - 1];
+
+	xor_select_templates(b1, b2, false);
+	mutex_unlock(&xor_bench_lock);
+
+	free_pages((unsigned long)b1, BENCH_ORDER);
+	return 0;
+}
+
+static int xor_benchmark_get(char *buffer, const struct kernel_param *kp)
+{
+	struct xor_block_template *tmpl;
+	int i, len = 0;
+
+	for (i = 0; i < XOR_NR_CLASSES; i++) {
+		tmpl = READ_ONCE(active_template[i]);
+		if (i < XOR_NR_CLASSES - 1)
+			len += sysfs_emit_at(buffer, len, "<=%u", xor_class_bytes[i]);
+		else
+			len += sysfs_emit_at(buffer, len, ">%u", xor_class_bytes[i - 1]);
+		len += sysfs_emit_at(buffer, len, ": %s\n",
+				     tmpl ? tmpl->name : "none");
+	}
+	return len;
+}
+
+static const struct kernel_param_ops xor_benchmark_ops = {
+	.set	= xor_benchmark_set,
+	.get	= xor_benchmark_get,
+};
+module_param_cb(benchmark, &xor_benchmark_ops, NULL, 0644);
+MODULE_PARM_DESC(benchmark, "Per size class xor template; write to re-benchmark");
+
 static __exit void xor_exit(void) { }
 
 MODULE_DESCRIPTION("RAID-5 checksumming functions");
@@ -0,0 +1,680 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Latency simulating block device for benchmarking.
+ *
+ * Unlike null_blk and brd, which complete I/O as fast as they can, latblk
+ * models the service time of a real device: every request is held back for
+ * a delay drawn from a configurable distribution for its operation type,
+ * plus a penalty for each request already in flight on its queue and an
+ * occasional tail outlier. This makes it possible to reproduce production
+ * latency profiles in front of the I/O schedulers and io_uring without the
+ * hardware.
+ *
+ * Data is not stored: reads return zeroes and writes are discarded.
+ *
+ * Devices are created through configfs:
+ *
+ *	mkdir /sys/kernel/config/latblk/dev0
+ *	echo exponential > /sys/kernel/config/latblk/dev0/read_dist
+ *	echo 80 > /sys/kernel/config/latblk/dev0/read_lat_us
+ *	echo 100 > /sys/kernel/config/latblk/dev0/tail_ppm
+ *	echo 5000 > /sys/kernel/config/latblk/dev0/tail_lat_us
+ *	echo 1 > /sys/kernel/config/latblk/dev0/power
+ *
+ * Latency parameters may be changed while the device is powered; geometry
+ * (size_mb, nr_queues, queue_depth) is fixed once it is. Writes outside an
+ * attribute's limits fail with -EINVAL, and a sampled completion delay is
+ * capped at 60s.
+ */
+
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/blkdev.h>
+#include <linux/blk-mq.h>
+#include <linux/configfs.h>
+#include <linux/hrtimer.h>
+#include <linux/idr.h>
+#include <linux/int_log.h>
+#include <linux/kthread.h>
+#include <linux/math64.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/slab.h>
+
+enum latblk_op {
+	LATBLK_OP_READ,
+	LATBLK_OP_WRITE,
+	LATBLK_OP_OTHER,	/* flush, discard, write zeroes, ... */
+	LATBLK_NR_OPS,
+};
+
+enum latblk_dist {
+	LATBLK_DIST_FIXED,
+	LATBLK_DIST_UNIFORM,
+	LATBLK_DIST_EXP,
+};
+
+/* configfs attribute limits */
+#define LATBLK_MAX_SIZE_MB	((u64)LLONG_MAX >> 20)
+#define LATBLK_MAX_LAT_US	(10 * USEC_PER_SEC)
+#define LATBLK_MAX_QD_LAT_NS	NSEC_PER_SEC
+/* no sampled completion delay is longer than this */
+#define LATBLK_MAX_DELAY_NS	(60ULL * NSEC_PER_SEC)
+#define LATBLK_MAX_SLACK_NS	NSEC_PER_SEC
+
+static const char * const latblk_dist_names[] = {
+	[LATBLK_DIST_FIXED]	= "fixed",
+	[LATBLK_DIST_UNIFORM]	= "uniform",
+	[LATBLK_DIST_EXP]	= "exponential",
+};
+
+struct latblk_lat {
+	unsigned int		dist;
+	unsigned int		mean_us;
+};
+
+struct latblk_device;
+
+/*
+ * One per hardware queue. Requests wait in an rbtree ordered by their
+ * completion deadline until the queue's service thread completes them.
+ */
+struct latblk_queue {
+	struct latblk_device	*dev;
+	spinlock_t		lock;
+	struct rb_root_cached	pending;
+	unsigned int		inflight;
+	struct task_struct	*thread;
+};
+
+struct latblk_cmd {
+	struct rb_node		node;
+	u64			deadline;
+};
+
+struct latblk_device {
+	struct config_group	group;
+	struct mutex		lock;
+	int			index;
+	bool			powered;
+
+	/* geometry, fixed while powered */
+	u64			size_mb;
+	unsigned int		nr_queues;
+	unsigned int		queue_depth;
+
+	/* latency model, may change at any time */
+	struct latblk_lat	lat[LATBLK_NR_OPS];
+	unsigned int		tail_ppm;	/* outlier probability, per million */
+	unsigned int		tail_lat_us;	/* added to outliers */
+	unsigned int		qd_lat_ns;	/* added per request in flight */
+
+	struct blk_mq_tag_set	tag_set;
+	struct gendisk		*disk;
+	struct latblk_queue	*queues;
+};
+
+static int latblk_major;
+static DEFINE_IDA(latblk_indexes);
+
+static int latblk_set_timer_slack(const char *val, const struct kernel_param *kp)
+{
+	unsigned long ns;
+	int ret;
+
+	ret = kstrtoul(val, 0, &ns);
+	if (ret)
+		return ret;
+	if (ns > LATBLK_MAX_SLACK_NS)
+		return -EINVAL;
+	return param_set_ulong(val, kp);
+}
+
+static const struct kernel_param_ops latblk_timer_slack_ops = {
+	.set	= latblk_set_timer_slack,
+	.get	= param_get_ulong,
+};
+
+static unsigned long timer_slack_ns = 1000;
+module_param_cb(timer_slack_ns, &latblk_timer_slack_ops, &timer_slack_ns, 0644);
+MODULE_PARM_DESC(timer_slack_ns,
+	"Slack allowed when waiting for a completion deadline, at most 1s (default 1000)");
+
+static enum latblk_op latblk_rq_op(struct request *rq)
+{
+	switch (req_op(rq)) {
+	case REQ_OP_READ:
+		return LATBLK_OP_READ;
+	case REQ_OP_WRITE:
+		return LATBLK_OP_WRITE;
+	default:
+		return LATBLK_OP_OTHER;
+	}
+}
+
+/* ln(2) in 8.24 fixed point, to go with intlog2() */
+#define LATBLK_LN2_FP24		11629080ULL
+
+static u64 latblk_sample_ns(struct latblk_device *dev, enum latblk_op op,
+		unsigned int inflight)
+{
+	u64 mean = (u64)READ_ONCE(dev->lat[op].mean_us) * NSEC_PER_USEC;
+	unsigned int tail_ppm = READ_ONCE(dev->tail_ppm);
+	u64 ns;
+
+	switch (READ_ONCE(dev->lat[op].dist)) {
+	case LATBLK_DIST_UNIFORM:
+		ns = mul_u64_u32_shr(2 * mean, get_random_u32(), 32);
+		break;
+	case LATBLK_DIST_EXP: {
+		/* inverse CDF: -ln(u) = (32 - log2(u * 2^32)) * ln(2) */
+		u64 l = (32ULL << 24) - intlog2(get_random_u32() | 1);
+
+		ns = mul_u64_u64_shr(mul_u64_u64_shr(mean, l, 24),
+				     LATBLK_LN2_FP24, 24);
+		break;
+	}
+	default:
+		ns = mean;
+		break;
+	}
+
+	if (tail_ppm && get_random_u32_below(1000000) < tail_ppm)
+		ns += (u64)READ_ONCE(dev->tail_lat_us) * NSEC_PER_USEC;
+	ns += (u64)inflight * READ_ONCE(dev->qd_lat_ns);
+	return min_t(u64, ns, LATBLK_MAX_DELAY_NS);
+}
+
+static int latblk_thread(void *data)
+{
+	struct latblk_queue *lq = data;
+
+	while (!kthread_should_stop()) {
+		ktime_t expires = KTIME_MAX;
+		struct latblk_cmd *cmd;
+		struct rb_node *rb;
+
+		/* set the state before looking, queue_rq wakes us after adding */
+		set_current_state(TASK_IDLE);
+		spin_lock(&lq->lock);
+		while ((rb = rb_first_cached(&lq->pending))) {
+			cmd = rb_entry(rb, struct latblk_cmd, node);
+			if (cmd->deadline > ktime_get_ns()) {
+				expires = ns_to_ktime(cmd->deadline);
+				break;
+			}
+			rb_erase_cached(rb, &lq->pending);
+			lq->inflight--;
+			spin_unlock(&lq->lock);
+
+			__set_current_state(TASK_RUNNING);
+			blk_mq_complete_request(blk_mq_rq_from_pdu(cmd));
+			set_current_state(TASK_IDLE);
+
+			spin_lock(&lq->lock);
+		}
+		spin_unlock(&lq->lock);
+
+		if (kthread_should_stop())
+			break;
+		if (expires == KTIME_MAX)
+			schedule();
+		else
+			schedule_hrtimeout_range(&expires, timer_slack_ns,
+						 HRTIMER_MODE_ABS);
+	}
+	__set_current_state(TASK_RUNNING);
+	return 0;
+}
+
+static blk_status_t latblk_queue_rq(struct blk_mq_hw_ctx *hctx,
+		const struct blk_mq_queue_data *bd)
+{
+	struct latblk_queue *lq = hctx->driver_data;
+	struct request *rq = bd->rq;
+	struct latblk_cmd *cmd = blk_mq_rq_to_pdu(rq);
+	struct rb_node **link = &lq->pending.rb_root.rb_node, *parent = NULL;
+	bool leftmost = true;
+
+	blk_mq_start_request(rq);
+
+	if (req_op(rq) == REQ_OP_READ) {
+		struct req_iterator iter;
+		struct bio_vec bv;
+
+		rq_for_each_segment(bv, rq, iter)
+			memzero_bvec(&bv);
+	}
+
+	spin_lock(&lq->lock);
+	cmd->deadline = ktime_get_ns() +
+		latblk_sample_ns(lq->dev, latblk_rq_op(rq), lq->inflight);
+	while (*link) {
+		parent = *link;
+		if (cmd->deadline < rb_entry(parent, struct latblk_cmd,
+					     node)->deadline) {
+			link = &parent->rb_left;
+		} else {
+			link = &parent->rb_right;
+			leftmost = false;
+		}
+	}
+	rb_link_node(&cmd->node, parent, link);
+	rb_insert_color_cached(&cmd->node, &lq->pending, leftmost);
+	lq->inflight++;
+	spin_unlock(&lq->lock);
+
+	/* the thread only needs to know when the earliest deadline moved */
+	if (leftmost)
+		wake_up_process(lq->thread);
+	return BLK_STS_OK;
+}
+
+static void latblk_complete_rq(struct request *rq)
+{
+	blk_mq_end_request(rq, BLK_STS_OK);
+}
+
+static enum blk_eh_timer_return latblk_timeout(struct request *rq)
+{
+	/* simulated latencies may exceed the timeout, that's not an error */
+	return BLK_EH_RESET_TIMER;
+}
+
+static int latblk_init_hctx(struct blk_mq_hw_ctx *hctx, void *data,
+		unsigned int hctx_idx)
+{
+	struct latblk_device *dev = data;
+
+	hctx->driver_data = &dev->queues[hctx_idx];
+	return 0;
+}
+
+static const struct blk_mq_ops latblk_mq_ops = {
+	.queue_rq	= latblk_queue_rq,
+	.complete	= latblk_complete_rq,
+	.timeout	= latblk_timeout,
+	.init_hctx	= latblk_init_hctx,
+};
+
+static const struct block_device_operations latblk_fops = {
+	.owner		= THIS_MODULE,
+};
+
+static void latblk_stop_threads(struct latblk_device *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < dev->nr_queues; i++) {
+		if (dev->queues[i].thread)
+			kthread_stop(dev->queues[i].thread);
+	}
+}
+
+static int latblk_power_on(struct latblk_device *dev)
+{
+	struct queue_limits lim = {
+		.max_hw_discard_sectors	= UINT_MAX,
+		.max_write_zeroes_sectors = UINT_MAX,
+		.features		= BLK_FEAT_WRITE_CACHE | BLK_FEAT_FUA,
+	};
+	struct gendisk *disk;
+	unsigned int i;
+	int ret;
+
+	if (!dev->size_mb || !dev->nr_queues || !dev->queue_depth)
+		return -EINVAL;
+
+	dev->queues = kcalloc(dev->nr_queues, sizeof(*dev->queues),
+			      GFP_KERNEL);
+	if (!dev->queues)
+		return -ENOMEM;
+
+	for (i = 0; i < dev->nr_queues; i++) {
+		struct latblk_queue *lq = &dev->queues[i];
+
+		lq->dev = dev;
+		spin_lock_init(&lq->lock);
+		lq->pending = RB_ROOT_CACHED;
+		lq->thread = kthread_run(latblk_thread, lq, "latblk%d/%u",
+					 dev->index, i);
+		if (IS_ERR(lq->thread)) {
+			ret = PTR_ERR(lq->thread);
+			lq->thread = NULL;
+			goto out_stop_threads;
+		}
+	}
+
+	memset(&dev->tag_set, 0, sizeof(dev->tag_set));
+	dev->tag_set.ops = &latblk_mq_ops;
+	dev->tag_set.nr_hw_queues = dev->nr_queues;
+	dev->tag_set.queue_depth = dev->queue_depth;
+	dev->tag_set.numa_node = NUMA_NO_NODE;
+	dev->tag_set.cmd_size = sizeof(struct latblk_cmd);
+	dev->tag_set.flags = BLK_MQ_F_SHOULD_MERGE;
+	dev->tag_set.driver_data = dev;
+	ret = blk_mq_alloc_tag_set(&dev->tag_set);
+	if (ret)
+		goto out_stop_threads;
+
+	disk = blk_mq_alloc_disk(&dev->tag_set, &lim, dev);
+	if (IS_ERR(disk)) {
+		ret = PTR_ERR(disk);
+		goto out_free_tag_set;
+	}
+	disk->major = latblk_major;
+	disk->first_minor = dev->index;
+	disk->minors = 1;
+	disk->fops = &latblk_fops;
+	disk->private_data = dev;
+	snprintf(disk->disk_name, DISK_NAME_LEN, "latblk%d", dev->index);
+	set_capacity(disk, dev->size_mb << (20 - SECTOR_SHIFT));
+
+	ret = add_disk(disk);
+	if (ret)
+		goto out_put_disk;
+	dev->disk = disk;
+	return 0;
+
+out_put_disk:
+	put_disk(disk);
+out_free_tag_set:
+	blk_mq_free_tag_set(&dev->tag_set);
+out_stop_threads:
+	latblk_stop_threads(dev);
+	kfree(dev->queues);
+	dev->queues = NULL;
+	return ret;
+}
+
+static void latblk_power_off(struct latblk_device *dev)
+{
+	/* waits for in-flight requests, so the threads must still be running */
+	del_gendisk(dev->disk);
+	put_disk(dev->disk);
+	dev->disk = NULL;
+	blk_mq_free_tag_set(&dev->tag_set);
+	latblk_stop_threads(dev);
+	kfree(dev->queues);
+	dev->queues = NULL;
+}
+
+/*
+ * configfs interface
+ */
+static inline struct latblk_device *to_latblk_device(struct config_item *item)
+{
+	return container_of(to_config_group(item), struct latblk_device, group);
+}
+
+static ssize_t latblk_show_uint(unsigned int *val, char *page)
+{
+	return sysfs_emit(page, "%u\n", READ_ONCE(*val));
+}
+
+static ssize_t latblk_store_uint(struct latblk_device *dev, unsigned int *val,
+		const char *page, size_t count, bool geometry,
+		unsigned int min, unsigned int max)
+{
+	unsigned int v;
+	int ret;
+
+	ret = kstrtouint(page, 0, &v);
+	if (ret)
+		return ret;
+	if (v < min || v > max)
+		return -EINVAL;
+
+	mutex_lock(&dev->lock);
+	if (geometry && dev->powered)
+		ret = -EBUSY;
+	else
+		WRITE_ONCE(*val, v);
+	mutex_unlock(&dev->lock);
+	return ret ? ret : count;
+}
+
+#define LATBLK_UINT_ATTR(_name, _geometry, _min, _max)			\
+static ssize_t latblk_##_name##_show(struct config_item *item,		\
+		char *page)						\
+{									\
+	return latblk_show_uint(&to_latblk_device(item)->_name, page);	\
+}									\
+static ssize_t latblk_##_name##_store(struct config_item *item,	\
+		const char *page, size_t count)				\
+{									\
+	struct latblk_device *dev = to_latblk_device(item);		\
+									\
+	return latblk_store_uint(dev, &dev->_name, page, count,		\
+				 _geometry, _min, _max);		\
+}									\
+CONFIGFS_ATTR(latblk_, _name)
+
+LATBLK_UINT_ATTR(nr_queues, true, 1, nr_cpu_ids);
+LATBLK_UINT_ATTR(queue_depth, true, 1, BLK_MQ_MAX_DEPTH);
+LATBLK_UINT_ATTR(tail_ppm, false, 0, 1000000);
+LATBLK_UINT_ATTR(tail_lat_us, false, 0, LATBLK_MAX_LAT_US);
+LATBLK_UINT_ATTR(qd_lat_ns, false, 0, LATBLK_MAX_QD_LAT_NS);
+
+#define LATBLK_OP_ATTRS(_op, _idx)					\
+static ssize_t latblk_##_op##_lat_us_show(struct config_item *item,	\
+		char *page)						\
+{									\
+	return latblk_show_uint(						\
+		&to_latblk_device(item)->lat[_idx].mean_us, page);	\
+}									\
+static ssize_t latblk_##_op##_lat_us_store(struct config_item *item,	\
+		const char *page, size_t count)				\
+{									\
+	struct latblk_device *dev = to_latblk_device(item);		\
+									\
+	return latblk_store_uint(dev, &dev->lat[_idx].mean_us, page,	\
+				 count, false, 0, LATBLK_MAX_LAT_US);	\
+}									\
+CONFIGFS_ATTR(latblk_, _op##_lat_us);					\
+static ssize_t latblk_##_op##_dist_show(struct config_item *item,	\
+		char *page)						\
+{									\
+	unsigned int dist =						\
+		READ_ONCE(to_latblk_device(item)->lat[_idx].dist);	\
+									\
+	return sysfs_emit(page, "%s\n", latblk_dist_names[dist]);	\
+}									\
+static ssize_t latblk_##_op##_dist_store(struct config_item *item,	\
+		const char *page, size_t count)				\
+{									\
+	int dist = sysfs_match_string(latblk_dist_names, page);	\
+									\
+	if (dist < 0)							\
+		return dist;						\
+	WRITE_ONCE(to_latblk_device(item)->lat[_idx].dist, dist);	\
+	return count;							\
+}									\
+CONFIGFS_ATTR(latblk_, _op##_dist)
+
+LATBLK_OP_ATTRS(read, LATBLK_OP_READ);
+LATBLK_OP_ATTRS(write, LATBLK_OP_WRITE);
+LATBLK_OP_ATTRS(other, LATBLK_OP_OTHER);
+
+static ssize_t latblk_size_mb_show(struct config_item *item, char *page)
+{
+	return sysfs_emit(page, "%llu\n", to_latblk_device(item)->size_mb);
+}
+
+static ssize_t latblk_size_mb_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct latblk_device *dev = to_latblk_device(item);
+	u64 size;
+	int ret;
+
+	ret = kstrtou64(page, 0, &size);
+	if (ret)
+		return ret;
+	if (!size || size > LATBLK_MAX_SIZE_MB)
+		return -EINVAL;
+
+	mutex_lock(&dev->lock);
+	if (dev->powered)
+		ret = -EBUSY;
+	else
+		dev->size_mb = size;
+	mutex_unlock(&dev->lock);
+	return ret ? ret : count;
+}
+CONFIGFS_ATTR(latblk_, size_mb);
+
+static ssize_t latblk_index_show(struct config_item *item, char *page)
+{
+	return sysfs_emit(page, "%d\n", to_latblk_device(item)->index);
+}
+CONFIGFS_ATTR_RO(latblk_, index);
+
+static ssize_t latblk_power_show(struct config_item *item, char *page)
+{
+	return sysfs_emit(page, "%d\n", to_latblk_device(item)->powered);
+}
+
+static ssize_t latblk_power_store(struct config_item *item,
+		const char *page, size_t count)
+{
+	struct latblk_device *dev = to_latblk_device(item);
+	bool power;
+	int ret;
+
+	ret = kstrtobool(page, &power);
+	if (ret)
+		return ret;
+
+	mutex_lock(&dev->lock);
+	if (power && !dev->powered) {
+		ret = latblk_power_on(dev);
+		if (!ret)
+			dev->powered = true;
+	} else if (!power && dev->powered) {
+		latblk_power_off(dev);
+		dev->powered = false;
+	}
+	mutex_unlock(&dev->lock);
+	return ret ? ret : count;
+}
+CONFIGFS_ATTR(latblk_, power);
+
+static struct configfs_attribute *latblk_device_attrs[] = {
+	&latblk_attr_size_mb,
+	&latblk_attr_nr_queues,
+	&latblk_attr_queue_depth,
+	&latblk_attr_read_dist,
+	&latblk_attr_read_lat_us,
+	&latblk_attr_write_dist,
+	&latblk_attr_write_lat_us,
+	&latblk_attr_other_dist,
+	&latblk_attr_other_lat_us,
+	&latblk_attr_tail_ppm,
+	&latblk_attr_tail_lat_us,
+	&latblk_attr_qd_lat_ns,
+	&latblk_attr_index,
+	&latblk_attr_power,
+	NULL,
+};
+
+static void latblk_device_release(struct config_item *item)
+{
+	struct latblk_device *dev = to_latblk_device(item);
+
+	if (dev->powered)
+		latblk_power_off(dev);
+	ida_free(&latblk_indexes, dev->index);
+	kfree(dev);
+}
+
+static struct configfs_item_operations latblk_device_ops = {
+	.release	= latblk_device_release,
+};
+
+static const struct config_item_type latblk_device_type = {
+	.ct_item_ops	= &latblk_device_ops,
+	.ct_attrs	= latblk_device_attrs,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct config_group *latblk_group_make_group(struct config_group *group,
+		const char *name)
+{
+	struct latblk_device *dev;
+	int i;
+
+	dev = kzalloc(sizeof(*dev), GFP_KERNEL);
+	if (!dev)
+		return ERR_PTR(-ENOMEM);
+
+	dev->index = ida_alloc_max(&latblk_indexes, MINORMASK, GFP_KERNEL);
+	if (dev->index < 0) {
+		int ret = dev->index;
+
+		kfree(dev);
+		return ERR_PTR(ret);
+	}
+
+	mutex_init(&dev->lock);
+	dev->size_mb = 1024;
+	dev->nr_queues = 1;
+	dev->queue_depth = 128;
+	for (i = 0; i < LATBLK_NR_OPS; i++) {
+		dev->lat[i].dist = LATBLK_DIST_FIXED;
+		dev->lat[i].mean_us = 100;
+	}
+
+	config_group_init_type_name(&dev->group, name, &latblk_device_type);
+	return &dev->group;
+}
+
+static struct configfs_group_operations latblk_group_ops = {
+	.make_group	= latblk_group_make_group,
+};
+
+static const struct config_item_type latblk_group_type = {
+	.ct_group_ops	= &latblk_group_ops,
+	.ct_owner	= THIS_MODULE,
+};
+
+static struct configfs_subsystem latblk_subsys = {
+	.su_group = {
+		.cg_item = {
+			.ci_namebuf	= "latblk",
+			.ci_type	= &latblk_group_type,
+		},
+	},
+};
+
+static int __init latblk_init(void)
+{
+	int ret;
+
+	latblk_major = register_blkdev(0, "latblk");
+	if (latblk_major < 0)
+		return latblk_major;
+
+	config_group_init(&latblk_subsys.su_group);
+	mutex_init(&latblk_subsys.su_mutex);
+	ret = configfs_register_subsystem(&latblk_subsys);
+	if (ret) {
+		unregister_blkdev(latblk_major, "latblk");
+		return ret;
+	}
+
+	return 0;
+}
+
+static void __exit latblk_exit(void)
+{
+	configfs_unregister_subsystem(&latblk_subsys);
+	unregister_blkdev(latblk_major, "latblk");
+	ida_destroy(&latblk_indexes);
+}
+
+module_init(latblk_init);
+module_exit(latblk_exit);
+
+MODULE_DESCRIPTION("Latency simulating block device for benchmarking");
+MODULE_LICENSE("GPL");
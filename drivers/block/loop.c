@@ -82,6 +82,8 @@ struct loop_cmd {
 	struct list_head list_entry;
 	bool use_aio; /* use AIO interface to handle I/O */
 	atomic_t ref; /* only for aio */
+	bool nowait; /* aio issued with IOCB_NOWAIT from ->queue_rq() */
+	bool nowait_retry; /* IOCB_NOWAIT attempt failed, use the worker */
 	long ret;
 	struct kiocb iocb;
 	struct bio_vec *bvec;
@@ -357,6 +359,25 @@ static void lo_complete_rq(struct request *rq)
 	struct loop_cmd *cmd = blk_mq_rq_to_pdu(rq);
 	blk_status_t ret = BLK_STS_OK;
 
+	/*
+	 * An IOCB_NOWAIT request may also complete asynchronously with
+	 * -EAGAIN, and a short NOWAIT write only means the rest would have
+	 * blocked. Advance past what was done and let the worker issue the
+	 * remainder in blocking mode.
+	 */
+	if (cmd->nowait && (cmd->ret == -EAGAIN ||
+	    (req_op(rq) == REQ_OP_WRITE && cmd->ret >= 0 &&
+	     cmd->ret < blk_rq_bytes(rq)))) {
+		cmd->nowait = false;
+		cmd->nowait_retry = true;
+		if (cmd->ret > 0)
+			blk_update_request(rq, BLK_STS_OK, cmd->ret);
+		cmd->ret = 0;
+		blk_mq_requeue_request(rq, true);
+		return;
+	}
+	cmd->nowait_retry = false;
+
 	if (!cmd->use_aio || cmd->ret < 0 || cmd->ret == blk_rq_bytes(rq) ||
 	    req_op(rq) != REQ_OP_READ) {
 		if (cmd->ret < 0)
@@ -399,6 +420,12 @@ static void lo_rw_aio_do_completion(struct loop_cmd *cmd)
 		blk_mq_complete_request(rq);
 }
 
+/*
+ * Not gathered into an io_comp_batch: every iocb on the backing file ends in
+ * its own ->ki_complete() call from the end_io of the lower bio, so no context
+ * ever sees more than one of them. Only a poller would, and loop queues are
+ * not pollable.
+ */
 static void lo_rw_aio_complete(struct kiocb *iocb, long ret)
 {
 	struct loop_cmd *cmd = container_of(iocb, struct loop_cmd, iocb);
@@ -408,7 +435,7 @@ static void lo_rw_aio_complete(struct kiocb *iocb, long ret)
 }
 
 static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
-		     loff_t pos, int rw)
+		     loff_t pos, int rw, bool nowait)
 {
 	struct iov_iter iter;
 	struct req_iterator rq_iter;
@@ -427,9 +454,9 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	if (rq->bio != rq->biotail) {
 
 		bvec = kmalloc_array(nr_bvec, sizeof(struct bio_vec),
-				     GFP_NOIO);
+				     nowait ? GFP_NOWAIT : GFP_NOIO);
 		if (!bvec)
-			return -EIO;
+			return nowait ? -EAGAIN : -EIO;
 		cmd->bvec = bvec;
 
 		/*
@@ -462,6 +489,9 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	cmd->iocb.ki_filp = file;
 	cmd->iocb.ki_complete = lo_rw_aio_complete;
 	cmd->iocb.ki_flags = IOCB_DIRECT;
+	cmd->nowait = nowait;
+	if (nowait)
+		cmd->iocb.ki_flags |= IOCB_NOWAIT;
 	cmd->iocb.ki_ioprio = IOPRIO_PRIO_VALUE(IOPRIO_CLASS_NONE, 0);
 
 	if (rw == ITER_SOURCE)
@@ -469,6 +499,14 @@ static int lo_rw_aio(struct loop_device *lo, struct loop_cmd *cmd,
 	else
 		ret = file->f_op->read_iter(&cmd->iocb, &iter);
 
+	/* nothing was issued, let the worker retry it in blocking mode */
+	if (nowait && ret == -EAGAIN) {
+		cmd->nowait = false;
+		kfree(cmd->bvec);
+		cmd->bvec = NULL;
+		return -EAGAIN;
+	}
+
 	lo_rw_aio_do_completion(cmd);
 
 	if (ret != -EIOCBQUEUED)
@@ -506,12 +544,12 @@ static int do_req_filebacked(struct loop_device *lo, struct request *rq)
 		return lo_fallocate(lo, rq, pos, FALLOC_FL_PUNCH_HOLE);
 	case REQ_OP_WRITE:
 		if (cmd->use_aio)
-			return lo_rw_aio(lo, cmd, pos, ITER_SOURCE);
+			return lo_rw_aio(lo, cmd, pos, ITER_SOURCE, false);
 		else
 			return lo_write_simple(lo, rq, pos);
 	case REQ_OP_READ:
 		if (cmd->use_aio)
-			return lo_rw_aio(lo, cmd, pos, ITER_DEST);
+			return lo_rw_aio(lo, cmd, pos, ITER_DEST, false);
 		else
 			return lo_read_simple(lo, rq, pos);
 	default:
@@ -1832,10 +1870,58 @@ static const struct kernel_param_ops loop_hw_qdepth_param_ops = {
 device_param_cb(hw_queue_depth, &loop_hw_qdepth_param_ops, &hw_queue_depth, 0444);
 MODULE_PARM_DESC(hw_queue_depth, "Queue depth for each hardware queue. Default: " __stringify(LOOP_DEFAULT_HW_Q_DEPTH));
 
+static bool nowait_aio;
+module_param(nowait_aio, bool, 0444);
+MODULE_PARM_DESC(nowait_aio, "Issue direct I/O from the submission context with IOCB_NOWAIT before falling back to the per-cgroup workers. Makes the queues of new devices blocking. Default: false");
+
 MODULE_DESCRIPTION("Loopback device support");
 MODULE_LICENSE("GPL");
 MODULE_ALIAS_BLOCKDEV_MAJOR(LOOP_MAJOR);
 
+/*
+ * Issue a direct I/O request without going through the worker. This
+ * keeps as many requests in flight on the backing file as the tag set
+ * allows, instead of serializing their submission on one worker per
+ * cgroup. Returns -EAGAIN if the request has to be queued to the worker.
+ */
+static int loop_try_nowait_aio(struct loop_device *lo, struct loop_cmd *cmd)
+{
+	struct request *rq = blk_mq_rq_from_pdu(cmd);
+	loff_t pos = ((loff_t) blk_rq_pos(rq) << 9) + lo->lo_offset;
+	unsigned int noio_flags;
+	int rw, ret;
+
+	if (!(lo->tag_set.flags & BLK_MQ_F_BLOCKING))
+		return -EAGAIN;
+	/* already tried once and requeued by lo_complete_rq() */
+	if (cmd->nowait_retry)
+		return -EAGAIN;
+	if (!(lo->lo_backing_file->f_mode & FMODE_NOWAIT))
+		return -EAGAIN;
+	/* I/O has to be charged to the cgroup by its worker */
+	if (!queue_on_root_worker(cmd->blkcg_css))
+		return -EAGAIN;
+
+	switch (req_op(rq)) {
+	case REQ_OP_WRITE:
+		if (lo->lo_flags & LO_FLAGS_READ_ONLY)
+			return -EAGAIN;
+		rw = ITER_SOURCE;
+		break;
+	case REQ_OP_READ:
+		rw = ITER_DEST;
+		break;
+	default:
+		return -EAGAIN;
+	}
+
+	/* same as the worker, don't recurse into the loop device */
+	noio_flags = memalloc_noio_save();
+	ret = lo_rw_aio(lo, cmd, pos, rw, true);
+	memalloc_noio_restore(noio_flags);
+	return ret;
+}
+
 static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 		const struct blk_mq_queue_data *bd)
 {
@@ -1874,6 +1960,21 @@ static blk_status_t loop_queue_rq(struct blk_mq_hw_ctx *hctx,
 #endif
 	}
 #endif
+	if (cmd->use_aio) {
+		int ret = loop_try_nowait_aio(lo, cmd);
+
+		if (ret != -EAGAIN) {
+			if (cmd->memcg_css)
+				css_put(cmd->memcg_css);
+			if (ret) {
+				cmd->ret = -EIO;
+				if (likely(!blk_should_fake_timeout(rq->q)))
+					blk_mq_complete_request(rq);
+			}
+			return BLK_STS_OK;
+		}
+	}
+
 	loop_queue_work(lo, cmd);
 
 	return BLK_STS_OK;
@@ -2026,6 +2127,15 @@ static int loop_add(int i)
 	lo->tag_set.cmd_size = sizeof(struct loop_cmd);
 	lo->tag_set.flags = BLK_MQ_F_SHOULD_MERGE | BLK_MQ_F_STACKING |
 		BLK_MQ_F_NO_SCHED_BY_DEFAULT;
+	/*
+	 * Even with IOCB_NOWAIT, ->read_iter()/->write_iter() may sleep in
+	 * GFP_KERNEL allocations and on locks that are not I/O bound, which
+	 * is not allowed in a non-blocking ->queue_rq(). That changes how
+	 * blk-mq dispatches to every queue of the device, so it is only done
+	 * when nowait_aio was asked for.
+	 */
+	if (nowait_aio)
+		lo->tag_set.flags |= BLK_MQ_F_BLOCKING;
 	lo->tag_set.driver_data = lo;
 
 	err = blk_mq_alloc_tag_set(&lo->tag_set);
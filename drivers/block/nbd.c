@@ -33,7 +33,9 @@
 #include <linux/kernel.h>
 #include <linux/slab.h>
 #include <net/sock.h>
+#include <net/tcp.h>
 #include <linux/net.h>
+#include <linux/tcp.h>
 #include <linux/kthread.h>
 #include <linux/types.h>
 #include <linux/debugfs.h>
@@ -60,6 +62,7 @@ struct nbd_sock {
 	struct request *pending;
 	int sent;
 	bool dead;
+	bool corked;	/* TCP_CORK set by us for a burst, see nbd_sock_push() */
 	int fallback_index;
 	int cookie;
 };
@@ -325,6 +328,7 @@ static void nbd_mark_nsock_dead(struct nbd_device *nbd, struct nbd_sock *nsock,
 	nsock->dead = true;
 	nsock->pending = NULL;
 	nsock->sent = 0;
+	nsock->corked = false;
 }
 
 static int __nbd_set_size(struct nbd_device *nbd, loff_t bytesize,
@@ -614,12 +618,53 @@ static inline int was_interrupted(int result)
 	return result == -ERESTARTSYS || result == -EINTR;
 }
 
+/*
+ * While blk-mq has more requests lined up for a connection, a TCP socket is
+ * corked and every fragment but the last one of the burst is sent with
+ * MSG_MORE, so a burst of small commands goes out in full segments instead of
+ * one segment per command. A socket its owner corked already is left alone.
+ */
+static void nbd_sock_cork(struct nbd_sock *nsock)
+{
+	struct sock *sk;
+	bool corked;
+
+	lockdep_assert_held(&nsock->tx_lock);
+
+	if (nsock->corked || !nsock->sock)
+		return;
+	sk = nsock->sock->sk;
+	if (!sk_is_tcp(sk))
+		return;
+
+	lock_sock(sk);
+	corked = tcp_sk(sk)->nonagle & TCP_NAGLE_CORK;
+	release_sock(sk);
+	if (corked)
+		return;
+
+	tcp_sock_set_cork(sk, true);
+	nsock->corked = true;
+}
+
+/* Push out whatever a burst held back, once it ends */
+static void nbd_sock_push(struct nbd_sock *nsock)
+{
+	lockdep_assert_held(&nsock->tx_lock);
+
+	if (!nsock->corked)
+		return;
+	nsock->corked = false;
+	if (nsock->sock)
+		tcp_sock_set_cork(nsock->sock->sk, false);
+}
+
 /*
  * Returns BLK_STS_RESOURCE if the caller should retry after a delay.
  * Returns BLK_STS_IOERR if sending failed.
  */
 static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
-				 int index)
+				 int index, bool more)
 {
 	struct request *req = blk_mq_rq_from_pdu(cmd);
 	struct nbd_config *config = nbd->config;
@@ -637,6 +682,9 @@ static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
 	lockdep_assert_held(&cmd->lock);
 	lockdep_assert_held(&nsock->tx_lock);
 
+	if (more)
+		nbd_sock_cork(nsock);
+
 	iov_iter_kvec(&from, ITER_SOURCE, &iov, 1, sizeof(request));
 
 	type = req_to_nbd_cmd_type(req);
@@ -689,7 +737,7 @@ static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
 		req, nbdcmd_to_ascii(type),
 		(unsigned long long)blk_rq_pos(req) << 9, blk_rq_bytes(req));
 	result = sock_xmit(nbd, index, 1, &from,
-			(type == NBD_CMD_WRITE) ? MSG_MORE : 0, &sent);
+			(type == NBD_CMD_WRITE || more) ? MSG_MORE : 0, &sent);
 	trace_nbd_header_sent(req, handle);
 	if (result < 0) {
 		if (was_interrupted(result)) {
@@ -721,7 +769,7 @@ static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
 
 		bio_for_each_segment(bvec, bio, iter) {
 			bool is_last = !next && bio_iter_last(bvec, iter);
-			int flags = is_last ? 0 : MSG_MORE;
+			int flags = is_last && !more ? 0 : MSG_MORE;
 
 			dev_dbg(nbd_to_dev(nbd), "request %p: sending %d bytes data\n",
 				req, bvec.bv_len);
@@ -766,6 +814,8 @@ static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
 	trace_nbd_payload_sent(req, handle);
 	nsock->pending = NULL;
 	nsock->sent = 0;
+	if (!more)
+		nbd_sock_push(nsock);
 	__set_bit(NBD_CMD_INFLIGHT, &cmd->flags);
 	return BLK_STS_OK;
 
@@ -778,8 +828,35 @@ static blk_status_t nbd_send_cmd(struct nbd_device *nbd, struct nbd_cmd *cmd,
 	return BLK_STS_OK;
 }
 
+static void nbd_complete_batch(struct io_comp_batch *iob)
+{
+	blk_mq_end_request_batch(iob);
+}
+
+/*
+ * Receive @to in full. Requests batched in @iob are ended before the receive
+ * can block: take whatever the socket already holds without waiting, and only
+ * flush the batch and wait if that was not enough, even mid header or payload.
+ */
+static int nbd_recv(struct nbd_device *nbd, struct socket *sock,
+		    struct iov_iter *to, struct io_comp_batch *iob)
+{
+	int received = 0;
+	int result;
+
+	if (!rq_list_empty(iob->req_list)) {
+		result = __sock_xmit(nbd, sock, 0, to, MSG_DONTWAIT, &received);
+		if (result != -EAGAIN)
+			return result;
+		iob->complete(iob);
+		iob->complete = NULL;
+		iov_iter_advance(to, received);
+	}
+	return __sock_xmit(nbd, sock, 0, to, MSG_WAITALL, NULL);
+}
+
 static int nbd_read_reply(struct nbd_device *nbd, struct socket *sock,
-			  struct nbd_reply *reply)
+			  struct nbd_reply *reply, struct io_comp_batch *iob)
 {
 	struct kvec iov = {.iov_base = reply, .iov_len = sizeof(*reply)};
 	struct iov_iter to;
@@ -787,7 +864,7 @@ static int nbd_read_reply(struct nbd_device *nbd, struct socket *sock,
 
 	reply->magic = 0;
 	iov_iter_kvec(&to, ITER_DEST, &iov, 1, sizeof(*reply));
-	result = __sock_xmit(nbd, sock, 0, &to, MSG_WAITALL, NULL);
+	result = nbd_recv(nbd, sock, &to, iob);
 	if (result < 0) {
 		if (!nbd_disconnected(nbd->config))
 			dev_err(disk_to_dev(nbd->disk),
@@ -804,9 +881,33 @@ static int nbd_read_reply(struct nbd_device *nbd, struct socket *sock,
 	return 0;
 }
 
+/*
+ * Receive the payload for @bio straight into its pages, with a single
+ * recvmsg over the whole bvec table rather than one call per segment.
+ */
+static int nbd_recv_bio(struct nbd_device *nbd, int index, struct bio *bio,
+			struct io_comp_batch *iob)
+{
+	struct bvec_iter iter;
+	struct bio_vec bvec;
+	struct iov_iter to;
+	int nr_bvec = 0;
+
+	bio_for_each_bvec(bvec, bio, iter)
+		nr_bvec++;
+
+	iov_iter_bvec(&to, ITER_DEST,
+		      __bvec_iter_bvec(bio->bi_io_vec, bio->bi_iter), nr_bvec,
+		      bio->bi_iter.bi_size);
+	/* the first bvec may be partially consumed after a split */
+	to.iov_offset = bio->bi_iter.bi_bvec_done;
+	return nbd_recv(nbd, nbd->config->socks[index]->sock, &to, iob);
+}
+
 /* NULL returned = something went wrong, inform userspace */
 static struct nbd_cmd *nbd_handle_reply(struct nbd_device *nbd, int index,
-					struct nbd_reply *reply)
+					struct nbd_reply *reply,
+					struct io_comp_batch *iob)
 {
 	int result;
 	struct nbd_cmd *cmd;
@@ -870,13 +971,10 @@ static struct nbd_cmd *nbd_handle_reply(struct nbd_device *nbd, int index,
 
 	dev_dbg(nbd_to_dev(nbd), "request %p: got reply\n", req);
 	if (rq_data_dir(req) != WRITE) {
-		struct req_iterator iter;
-		struct bio_vec bvec;
-		struct iov_iter to;
+		struct bio *bio;
 
-		rq_for_each_segment(bvec, req, iter) {
-			iov_iter_bvec(&to, ITER_DEST, &bvec, 1, bvec.bv_len);
-			result = sock_xmit(nbd, index, 0, &to, MSG_WAITALL, NULL);
+		__rq_for_each_bio(bio, req) {
+			result = nbd_recv_bio(nbd, index, bio, iob);
 			if (result < 0) {
 				dev_err(disk_to_dev(nbd->disk), "Receive data failed (result %d)\n",
 					result);
@@ -893,8 +991,8 @@ static struct nbd_cmd *nbd_handle_reply(struct nbd_device *nbd, int index,
 				ret = -EIO;
 				goto out;
 			}
-			dev_dbg(nbd_to_dev(nbd), "request %p: got %d bytes data\n",
-				req, bvec.bv_len);
+			dev_dbg(nbd_to_dev(nbd), "request %p: got %u bytes data\n",
+				req, bio->bi_iter.bi_size);
 		}
 	}
 out:
@@ -912,13 +1010,18 @@ static void recv_work(struct work_struct *work)
 	struct nbd_config *config = nbd->config;
 	struct request_queue *q = nbd->disk->queue;
 	struct nbd_sock *nsock = args->nsock;
+	DEFINE_IO_COMP_BATCH(iob);
 	struct nbd_cmd *cmd;
 	struct request *rq;
 
 	while (1) {
 		struct nbd_reply reply;
 
-		if (nbd_read_reply(nbd, nsock->sock, &reply))
+		/*
+		 * Replies that arrived back to back are ended as one batch,
+		 * nbd_recv() flushes it before waiting for more data.
+		 */
+		if (nbd_read_reply(nbd, nsock->sock, &reply, &iob))
 			break;
 
 		/*
@@ -933,7 +1036,7 @@ static void recv_work(struct work_struct *work)
 			break;
 		}
 
-		cmd = nbd_handle_reply(nbd, args->index, &reply);
+		cmd = nbd_handle_reply(nbd, args->index, &reply, &iob);
 		if (IS_ERR(cmd)) {
 			percpu_ref_put(&q->q_usage_counter);
 			break;
@@ -947,11 +1050,15 @@ static void recv_work(struct work_struct *work)
 			complete = __test_and_clear_bit(NBD_CMD_INFLIGHT,
 							&cmd->flags);
 			mutex_unlock(&cmd->lock);
-			if (complete)
+			if (complete &&
+			    !blk_mq_add_to_batch(rq, &iob, cmd->status,
+						 nbd_complete_batch))
 				blk_mq_complete_request(rq);
 		}
 		percpu_ref_put(&q->q_usage_counter);
 	}
+	if (!rq_list_empty(iob.req_list))
+		iob.complete(&iob);
 
 	mutex_lock(&nsock->tx_lock);
 	nbd_mark_nsock_dead(nbd, nsock, 1);
@@ -1050,12 +1157,13 @@ static int wait_for_reconnect(struct nbd_device *nbd)
 	return !test_bit(NBD_RT_DISCONNECTED, &config->runtime_flags);
 }
 
-static blk_status_t nbd_handle_cmd(struct nbd_cmd *cmd, int index)
+static blk_status_t nbd_handle_cmd(struct nbd_cmd *cmd, int index, bool last)
 {
 	struct request *req = blk_mq_rq_from_pdu(cmd);
 	struct nbd_device *nbd = cmd->nbd;
 	struct nbd_config *config;
 	struct nbd_sock *nsock;
+	int queue_index = index;
 	blk_status_t ret;
 
 	lockdep_assert_held(&cmd->lock);
@@ -1106,11 +1214,16 @@ static blk_status_t nbd_handle_cmd(struct nbd_cmd *cmd, int index)
 	 */
 	blk_mq_start_request(req);
 	if (unlikely(nsock->pending && nsock->pending != req)) {
+		nbd_sock_push(nsock);
 		nbd_requeue_cmd(cmd);
 		ret = BLK_STS_OK;
 		goto out;
 	}
-	ret = nbd_send_cmd(nbd, cmd, index);
+	/*
+	 * Only hold data back on the connection that ->commit_rqs will flush,
+	 * not on a fallback.
+	 */
+	ret = nbd_send_cmd(nbd, cmd, index, !last && index == queue_index);
 out:
 	mutex_unlock(&nsock->tx_lock);
 	nbd_config_put(nbd);
@@ -1140,12 +1253,31 @@ static blk_status_t nbd_queue_rq(struct blk_mq_hw_ctx *hctx,
 	 * this case we need to return that we are busy, otherwise error out as
 	 * appropriate.
 	 */
-	ret = nbd_handle_cmd(cmd, hctx->queue_num);
+	ret = nbd_handle_cmd(cmd, hctx->queue_num, bd->last);
 	mutex_unlock(&cmd->lock);
 
 	return ret;
 }
 
+static void nbd_commit_rqs(struct blk_mq_hw_ctx *hctx)
+{
+	struct nbd_device *nbd = hctx->queue->tag_set->driver_data;
+	struct nbd_config *config;
+	struct nbd_sock *nsock;
+
+	config = nbd_get_config_unlocked(nbd);
+	if (!config)
+		return;
+
+	if (hctx->queue_num < config->num_connections) {
+		nsock = config->socks[hctx->queue_num];
+		mutex_lock(&nsock->tx_lock);
+		nbd_sock_push(nsock);
+		mutex_unlock(&nsock->tx_lock);
+	}
+	nbd_config_put(nbd);
+}
+
 static struct socket *nbd_get_socket(struct nbd_device *nbd, unsigned long fd,
 				     int *err)
 {
@@ -1223,6 +1355,7 @@ static int nbd_add_socket(struct nbd_device *nbd, unsigned long arg,
 	nsock->sock = sock;
 	nsock->pending = NULL;
 	nsock->sent = 0;
+	nsock->corked = false;
 	nsock->cookie = 0;
 	socks[config->num_connections++] = nsock;
 	atomic_inc(&config->live_connections);
@@ -1274,6 +1407,7 @@ static int nbd_reconnect_socket(struct nbd_device *nbd, unsigned long arg)
 		nsock->fallback_index = -1;
 		nsock->sock = sock;
 		nsock->dead = false;
+		nsock->corked = false;
 		INIT_WORK(&args->work, recv_work);
 		args->index = i;
 		args->nbd = nbd;
@@ -1815,6 +1949,7 @@ static int nbd_init_request(struct blk_mq_tag_set *set, struct request *rq,
 
 static const struct blk_mq_ops nbd_mq_ops = {
 	.queue_rq	= nbd_queue_rq,
+	.commit_rqs	= nbd_commit_rqs,
 	.complete	= nbd_complete_rq,
 	.init_request	= nbd_init_request,
 	.timeout	= nbd_xmit_timeout,
@@ -60,7 +60,9 @@
 		| UBLK_F_UNPRIVILEGED_DEV \
 		| UBLK_F_CMD_IOCTL_ENCODE \
 		| UBLK_F_USER_COPY \
-		| UBLK_F_ZONED)
+		| UBLK_F_ZONED \
+		| UBLK_F_AUTO_BUF_REG \
+		| UBLK_F_BATCH_IO)
 
 /* All UBLK_PARAM_TYPE_* should be included here */
 #define UBLK_PARAM_TYPE_ALL                                \
@@ -76,8 +78,15 @@ struct ublk_rq_data {
 struct ublk_uring_cmd_pdu {
 	struct ublk_queue *ubq;
 	u16 tag;
+
+	/* UBLK_F_BATCH_IO only, where fetched tags are written back */
+	u16 nr_elem;
+	u64 elem_addr;
 };
 
+/* pdu->tag of the per-queue UBLK_F_BATCH_IO command */
+#define UBLK_BATCH_IO_TAG	U16_MAX
+
 /*
  * io command is active: sqe cmd is received, and its cqe isn't done
  *
@@ -116,6 +125,13 @@ struct ublk_uring_cmd_pdu {
  */
 #define UBLK_IO_FLAG_NEED_GET_DATA 0x08
 
+/*
+ * UBLK_IO_FLAG_BUF_REGISTERED is set when the request buffer has been
+ * registered into the server's io_uring for UBLK_F_AUTO_BUF_REG, and is
+ * cleared once it is unregistered at commit time.
+ */
+#define UBLK_IO_FLAG_BUF_REGISTERED 0x10
+
 /* atomic RW with ubq->cancel_lock */
 #define UBLK_IO_FLAG_CANCELED	0x80000000
 
@@ -145,6 +161,15 @@ struct ublk_queue {
 	bool canceling;
 	unsigned short nr_io_ready;	/* how many ios setup */
 	spinlock_t		cancel_lock;
+
+	/*
+	 * UBLK_F_BATCH_IO: the armed batch command, and requests which
+	 * didn't fit into the last one, both protected by batch_lock
+	 */
+	spinlock_t		batch_lock;
+	struct io_uring_cmd	*batch_cmd;
+	struct llist_node	*batch_backlog;
+
 	struct ublk_device *dev;
 	struct ublk_io ios[];
 };
@@ -579,13 +604,26 @@ static inline bool ublk_support_user_copy(const struct ublk_queue *ubq)
 	return ubq->flags & UBLK_F_USER_COPY;
 }
 
+static inline bool ublk_support_auto_buf_reg(const struct ublk_queue *ubq)
+{
+	return ubq->flags & UBLK_F_AUTO_BUF_REG;
+}
+
+static inline bool ublk_support_batch_io(const struct ublk_queue *ubq)
+{
+	return ubq->flags & UBLK_F_BATCH_IO;
+}
+
 static inline bool ublk_need_req_ref(const struct ublk_queue *ubq)
 {
 	/*
 	 * read()/write() is involved in user copy, so request reference
 	 * has to be grabbed
+	 *
+	 * For auto buffer registration, io_uring keeps its own reference
+	 * until the registered buffer is released.
 	 */
-	return ublk_support_user_copy(ubq);
+	return ublk_support_user_copy(ubq) || ublk_support_auto_buf_reg(ubq);
 }
 
 static inline void ublk_init_req_ref(const struct ublk_queue *ubq,
@@ -867,7 +905,7 @@ static int ublk_map_io(const struct ublk_queue *ubq, const struct request *req,
 {
 	const unsigned int rq_bytes = blk_rq_bytes(req);
 
-	if (ublk_support_user_copy(ubq))
+	if (ublk_support_user_copy(ubq) || ublk_support_auto_buf_reg(ubq))
 		return rq_bytes;
 
 	/*
@@ -891,7 +929,7 @@ static int ublk_unmap_io(const struct ublk_queue *ubq,
 {
 	const unsigned int rq_bytes = blk_rq_bytes(req);
 
-	if (ublk_support_user_copy(ubq))
+	if (ublk_support_user_copy(ubq) || ublk_support_auto_buf_reg(ubq))
 		return rq_bytes;
 
 	if (ublk_need_unmap_req(req)) {
@@ -1097,13 +1135,79 @@ static inline void __ublk_abort_rq(struct ublk_queue *ubq,
 		blk_mq_end_request(rq, BLK_STS_IOERR);
 }
 
+/*
+ * Copy WRITE data into the server buffer and take the request reference.
+ * Returns false if the request has been requeued instead.
+ */
+static bool ublk_start_io(struct ublk_queue *ubq, struct request *req,
+			  struct ublk_io *io)
+{
+	unsigned int mapped_bytes = ublk_map_io(ubq, req, io);
+
+	/* partially mapped, update io descriptor */
+	if (unlikely(mapped_bytes != blk_rq_bytes(req))) {
+		/*
+		 * Nothing mapped, retry until we succeed.
+		 *
+		 * We may never succeed in mapping any bytes here because
+		 * of OOM. TODO: reserve one buffer with single page pinned
+		 * for providing forward progress guarantee.
+		 */
+		if (unlikely(!mapped_bytes)) {
+			blk_mq_requeue_request(req, false);
+			blk_mq_delay_kick_requeue_list(req->q,
+					UBLK_REQUEUE_DELAY_MS);
+			return false;
+		}
+
+		ublk_get_iod(ubq, req->tag)->nr_sectors =
+			mapped_bytes >> 9;
+	}
+
+	ublk_init_req_ref(ubq, req);
+	return true;
+}
+
+static void ublk_io_release(void *priv)
+{
+	struct request *req = priv;
+	struct ublk_queue *ubq = req->mq_hctx->driver_data;
+
+	ublk_put_req_ref(ubq, req);
+}
+
+/*
+ * Register the request pages as fixed buffer io->addr of the ring owning
+ * io->cmd, the buffer holds one request reference until io_uring releases
+ * it. Returns false if nothing was registered, the request then keeps
+ * just its dispatch reference.
+ */
+static bool ublk_auto_buf_reg(struct ublk_queue *ubq, struct request *req,
+			      struct ublk_io *io, unsigned int issue_flags)
+{
+	int ret;
+
+	if (!ublk_get_req_ref(ubq, req))
+		return false;
+
+	ret = io_buffer_register_bvec(io->cmd, req, ublk_io_release, io->addr,
+				      issue_flags);
+	if (ret) {
+		pr_warn("%s: register buf %llu for qid %d tag %d failed %d\n",
+				__func__, io->addr, ubq->q_id, req->tag, ret);
+		ublk_put_req_ref(ubq, req);
+		return false;
+	}
+	io->flags |= UBLK_IO_FLAG_BUF_REGISTERED;
+	return true;
+}
+
 static inline void __ublk_rq_task_work(struct request *req,
 				       unsigned issue_flags)
 {
 	struct ublk_queue *ubq = req->mq_hctx->driver_data;
 	int tag = req->tag;
 	struct ublk_io *io = &ubq->ios[tag];
-	unsigned int mapped_bytes;
 
 	pr_devel("%s: complete: op %d, qid %d tag %d io_flags %x addr %llx\n",
 			__func__, io->cmd->cmd_op, ubq->q_id, req->tag, io->flags,
@@ -1150,29 +1254,19 @@ static inline void __ublk_rq_task_work(struct request *req,
 				ublk_get_iod(ubq, req->tag)->addr);
 	}
 
-	mapped_bytes = ublk_map_io(ubq, req, io);
-
-	/* partially mapped, update io descriptor */
-	if (unlikely(mapped_bytes != blk_rq_bytes(req))) {
-		/*
-		 * Nothing mapped, retry until we succeed.
-		 *
-		 * We may never succeed in mapping any bytes here because
-		 * of OOM. TODO: reserve one buffer with single page pinned
-		 * for providing forward progress guarantee.
-		 */
-		if (unlikely(!mapped_bytes)) {
-			blk_mq_requeue_request(req, false);
-			blk_mq_delay_kick_requeue_list(req->q,
-					UBLK_REQUEUE_DELAY_MS);
-			return;
-		}
+	if (!ublk_start_io(ubq, req, io))
+		return;
 
-		ublk_get_iod(ubq, req->tag)->nr_sectors =
-			mapped_bytes >> 9;
+	/*
+	 * Still hand the tag to the server if registration failed, so that
+	 * it learns about the request and commits it, normally with an error.
+	 */
+	if (ublk_support_auto_buf_reg(ubq) && ublk_rq_has_data(req) &&
+	    !ublk_auto_buf_reg(ubq, req, io, issue_flags)) {
+		ubq_complete_io_cmd(io, UBLK_IO_RES_NEED_REG_BUF, issue_flags);
+		return;
 	}
 
-	ublk_init_req_ref(ubq, req);
 	ubq_complete_io_cmd(io, UBLK_IO_RES_OK, issue_flags);
 }
 
@@ -1195,10 +1289,120 @@ static void ublk_rq_task_work_cb(struct io_uring_cmd *cmd, unsigned issue_flags)
 	ublk_forward_io_cmds(ubq, issue_flags);
 }
 
+/* queue requests the last batch command had no room for */
+static void ublk_batch_add_backlog(struct ublk_queue *ubq,
+				   struct llist_node *list)
+{
+	struct llist_node **pos;
+
+	spin_lock(&ubq->batch_lock);
+	pos = &ubq->batch_backlog;
+	while (*pos)
+		pos = &(*pos)->next;
+	*pos = list;
+	spin_unlock(&ubq->batch_lock);
+}
+
+/* take backlogged requests followed by new ones, in dispatch order */
+static struct llist_node *ublk_batch_take_rqs(struct ublk_queue *ubq)
+{
+	struct llist_node *list, **pos;
+
+	spin_lock(&ubq->batch_lock);
+	list = ubq->batch_backlog;
+	ubq->batch_backlog = NULL;
+	spin_unlock(&ubq->batch_lock);
+
+	pos = &list;
+	while (*pos)
+		pos = &(*pos)->next;
+	*pos = llist_reverse_order(llist_del_all(&ubq->io_cmds));
+
+	return list;
+}
+
+static void ublk_batch_tw_cb(struct io_uring_cmd *cmd, unsigned issue_flags)
+{
+	struct ublk_uring_cmd_pdu *pdu = ublk_get_uring_cmd_pdu(cmd);
+	struct ublk_batch_io_elem __user *uelem =
+		u64_to_user_ptr(pdu->elem_addr);
+	struct ublk_queue *ubq = pdu->ubq;
+	struct llist_node *list = ublk_batch_take_rqs(ubq);
+	struct llist_node *node;
+	int nr = 0;
+
+	/* see __ublk_rq_task_work() */
+	if (unlikely(current != ubq->ubq_daemon || current->flags & PF_EXITING)) {
+		while (list) {
+			node = list;
+			list = list->next;
+			__ublk_abort_rq(ubq, blk_mq_rq_from_pdu(container_of(
+					node, struct ublk_rq_data, node)));
+		}
+		io_uring_cmd_done(cmd, UBLK_IO_RES_ABORT, 0, issue_flags);
+		return;
+	}
+
+	while (list && nr < pdu->nr_elem) {
+		struct request *req = blk_mq_rq_from_pdu(container_of(list,
+					struct ublk_rq_data, node));
+		struct ublk_io *io = &ubq->ios[req->tag];
+		const struct ublk_batch_io_elem elem = {
+			.tag	= req->tag,
+			.result	= UBLK_IO_RES_OK,
+		};
+
+		if (copy_to_user(&uelem[nr], &elem, sizeof(elem))) {
+			if (!nr)
+				nr = -EFAULT;
+			break;
+		}
+
+		node = list;
+		list = list->next;
+		if (!ublk_start_io(ubq, req, io))
+			continue;
+
+		io->flags |= UBLK_IO_FLAG_OWNED_BY_SRV;
+		io->flags &= ~UBLK_IO_FLAG_ACTIVE;
+		nr++;
+	}
+
+	/* whatever is left is delivered by the next batch command */
+	if (list)
+		ublk_batch_add_backlog(ubq, list);
+
+	io_uring_cmd_done(cmd, nr, 0, issue_flags);
+}
+
+/* hand queued requests to the armed batch command, if there is one */
+static void ublk_batch_kick(struct ublk_queue *ubq)
+{
+	struct io_uring_cmd *cmd;
+
+	spin_lock(&ubq->batch_lock);
+	cmd = ubq->batch_cmd;
+	ubq->batch_cmd = NULL;
+	spin_unlock(&ubq->batch_lock);
+
+	if (cmd)
+		io_uring_cmd_complete_in_task(cmd, ublk_batch_tw_cb);
+}
+
 static void ublk_queue_cmd(struct ublk_queue *ubq, struct request *rq)
 {
 	struct ublk_rq_data *data = blk_mq_rq_to_pdu(rq);
 
+	if (ublk_support_batch_io(ubq)) {
+		/*
+		 * Once the list is non-empty, the command has been kicked
+		 * already or the next armed one picks the requests up.
+		 */
+		if (llist_add(&data->node, &ubq->io_cmds))
+			ublk_batch_kick(ubq);
+		return;
+	}
+
 	if (llist_add(&data->node, &ubq->io_cmds)) {
 		struct ublk_io *io = &ubq->ios[rq->tag];
 
@@ -1231,6 +1435,10 @@ static enum blk_eh_timer_return ublk_timeout(struct request *rq)
 			nr_inflight++;
 	}
 
+	/* the queue's batch command is the only cancelable one */
+	if (ublk_support_batch_io(ubq) && !READ_ONCE(ubq->batch_cmd))
+		nr_inflight = ubq->q_depth;
+
 	/* cancelable uring_cmd can't help us if all commands are in-flight */
 	if (nr_inflight == ubq->q_depth) {
 		struct ublk_device *ub = ubq->dev;
@@ -1405,6 +1613,18 @@ static void ublk_abort_queue(struct ublk_device *ub, struct ublk_queue *ubq)
 			}
 		}
 	}
+
+	/*
+	 * Without an armed batch command nobody would pick up requests
+	 * which haven't been delivered to the server yet.
+	 */
+	if (ublk_support_batch_io(ubq)) {
+		struct llist_node *list = ublk_batch_take_rqs(ubq);
+		struct ublk_rq_data *data, *tmp;
+
+		llist_for_each_entry_safe(data, tmp, list, node)
+			__ublk_abort_rq(ubq, blk_mq_rq_from_pdu(data));
+	}
 }
 
 static bool ublk_abort_requests(struct ublk_device *ub, struct ublk_queue *ubq)
@@ -1439,6 +1659,21 @@ static bool ublk_abort_requests(struct ublk_device *ub, struct ublk_queue *ubq)
 	return true;
 }
 
+static void ublk_cancel_batch_cmd(struct ublk_queue *ubq,
+		unsigned int issue_flags)
+{
+	struct io_uring_cmd *cmd;
+
+	spin_lock(&ubq->batch_lock);
+	cmd = ubq->batch_cmd;
+	ubq->batch_cmd = NULL;
+	spin_unlock(&ubq->batch_lock);
+
+	/* a kicked command is completed by ublk_batch_tw_cb() */
+	if (cmd)
+		io_uring_cmd_done(cmd, UBLK_IO_RES_ABORT, 0, issue_flags);
+}
+
 static void ublk_cancel_cmd(struct ublk_queue *ubq, struct ublk_io *io,
 		unsigned int issue_flags)
 {
@@ -1474,7 +1709,8 @@ static void ublk_uring_cmd_cancel_fn(struct io_uring_cmd *cmd,
 	if (WARN_ON_ONCE(!ubq))
 		return;
 
-	if (WARN_ON_ONCE(pdu->tag >= ubq->q_depth))
+	if (WARN_ON_ONCE(pdu->tag >= ubq->q_depth &&
+			 pdu->tag != UBLK_BATCH_IO_TAG))
 		return;
 
 	task = io_uring_cmd_get_task(cmd);
@@ -1484,9 +1720,13 @@ static void ublk_uring_cmd_cancel_fn(struct io_uring_cmd *cmd,
 	ub = ubq->dev;
 	need_schedule = ublk_abort_requests(ub, ubq);
 
-	io = &ubq->ios[pdu->tag];
-	WARN_ON_ONCE(io->cmd != cmd);
-	ublk_cancel_cmd(ubq, io, issue_flags);
+	if (pdu->tag == UBLK_BATCH_IO_TAG) {
+		ublk_cancel_batch_cmd(ubq, issue_flags);
+	} else {
+		io = &ubq->ios[pdu->tag];
+		WARN_ON_ONCE(io->cmd != cmd);
+		ublk_cancel_cmd(ubq, io, issue_flags);
+	}
 
 	if (need_schedule) {
 		if (ublk_can_use_recovery(ub))
@@ -1505,6 +1745,11 @@ static void ublk_cancel_queue(struct ublk_queue *ubq)
 {
 	int i;
 
+	if (ublk_support_batch_io(ubq)) {
+		ublk_cancel_batch_cmd(ubq, IO_URING_F_UNLOCKED);
+		return;
+	}
+
 	for (i = 0; i < ubq->q_depth; i++)
 		ublk_cancel_cmd(ubq, &ubq->ios[i], IO_URING_F_UNLOCKED);
 }
@@ -1665,6 +1910,17 @@ static inline void ublk_fill_io_cmd(struct ublk_io *io,
 	io->addr = buf_addr;
 }
 
+static void ublk_auto_buf_unreg(struct ublk_io *io, struct io_uring_cmd *cmd,
+				unsigned int issue_flags)
+{
+	/*
+	 * The server may have dropped the buffer by itself, in which case
+	 * the request reference has been put already.
+	 */
+	io_buffer_unregister_bvec(cmd, io->addr, issue_flags);
+	io->flags &= ~UBLK_IO_FLAG_BUF_REGISTERED;
+}
+
 static inline void ublk_prep_cancel(struct io_uring_cmd *cmd,
 				    unsigned int issue_flags,
 				    struct ublk_queue *ubq, unsigned int tag)
@@ -1711,6 +1967,10 @@ static int __ublk_ch_uring_cmd(struct io_uring_cmd *cmd,
 
 	io = &ubq->ios[tag];
 
+	/* per-tag commands are replaced by COMMIT_AND_FETCH_BATCH */
+	if (ublk_support_batch_io(ubq))
+		goto out;
+
 	/* there is pending io cmd, something must be wrong */
 	if (io->flags & UBLK_IO_FLAG_ACTIVE) {
 		ret = -EBUSY;
@@ -1744,7 +2004,11 @@ static int __ublk_ch_uring_cmd(struct io_uring_cmd *cmd,
 		if (io->flags & UBLK_IO_FLAG_OWNED_BY_SRV)
 			goto out;
 
-		if (!ublk_support_user_copy(ubq)) {
+		if (ublk_support_auto_buf_reg(ubq)) {
+			/* addr is the fixed buffer index */
+			if (ub_cmd->addr > U16_MAX)
+				goto out;
+		} else if (!ublk_support_user_copy(ubq)) {
 			/*
 			 * FETCH_RQ has to provide IO buffer if NEED GET
 			 * DATA is not enabled
@@ -1766,7 +2030,11 @@ static int __ublk_ch_uring_cmd(struct io_uring_cmd *cmd,
 		if (!(io->flags & UBLK_IO_FLAG_OWNED_BY_SRV))
 			goto out;
 
-		if (!ublk_support_user_copy(ubq)) {
+		if (ublk_support_auto_buf_reg(ubq)) {
+			/* addr is the fixed buffer index */
+			if (ub_cmd->addr > U16_MAX)
+				goto out;
+		} else if (!ublk_support_user_copy(ubq)) {
 			/*
 			 * COMMIT_AND_FETCH_REQ has to provide IO buffer if
 			 * NEED GET DATA is not enabled or it is Read IO.
@@ -1783,6 +2051,9 @@ static int __ublk_ch_uring_cmd(struct io_uring_cmd *cmd,
 			goto out;
 		}
 
+		/* io->addr still holds the index the buffer was added at */
+		if (io->flags & UBLK_IO_FLAG_BUF_REGISTERED)
+			ublk_auto_buf_unreg(io, cmd, issue_flags);
 		ublk_fill_io_cmd(io, cmd, ub_cmd->addr);
 		ublk_commit_completion(ub, ub_cmd);
 		break;
@@ -1805,6 +2076,132 @@ static int __ublk_ch_uring_cmd(struct io_uring_cmd *cmd,
 	return -EIOCBQUEUED;
 }
 
+static int ublk_batch_commit_elem(struct ublk_device *ub,
+		struct ublk_queue *ubq, const struct ublk_batch_io_elem *elem)
+{
+	struct ublk_io *io;
+	struct request *req;
+
+	if (elem->tag >= ubq->q_depth)
+		return -EINVAL;
+	io = &ubq->ios[elem->tag];
+
+	switch (elem->flags) {
+	case UBLK_BATCH_IO_F_FETCH:
+		/* same rules as UBLK_IO_FETCH_REQ */
+		if (ublk_queue_ready(ubq))
+			return -EBUSY;
+		if (io->flags & (UBLK_IO_FLAG_ACTIVE | UBLK_IO_FLAG_OWNED_BY_SRV))
+			return -EINVAL;
+		/* io buffer is required unless user copy is used */
+		if (ublk_support_user_copy(ubq) ? elem->addr : !elem->addr)
+			return -EINVAL;
+
+		ublk_fill_io_cmd(io, NULL, elem->addr);
+		ublk_mark_io_ready(ub, ubq);
+		return 0;
+	case UBLK_BATCH_IO_F_COMMIT: {
+		/* same rules as UBLK_IO_COMMIT_AND_FETCH_REQ */
+		const struct ublksrv_io_cmd ub_cmd = {
+			.q_id	= ubq->q_id,
+			.tag	= elem->tag,
+			.result	= elem->result,
+			.addr	= elem->addr,
+		};
+
+		if (!(io->flags & UBLK_IO_FLAG_OWNED_BY_SRV))
+			return -EINVAL;
+
+		req = blk_mq_tag_to_rq(ub->tag_set.tags[ubq->q_id], elem->tag);
+		if (!ublk_support_user_copy(ubq)) {
+			if (!elem->addr)
+				return -EINVAL;
+		} else if (req_op(req) != REQ_OP_ZONE_APPEND && elem->addr) {
+			return -EINVAL;
+		}
+
+		ublk_fill_io_cmd(io, NULL, elem->addr);
+		ublk_commit_completion(ub, &ub_cmd);
+		return 0;
+	}
+	default:
+		return -EINVAL;
+	}
+}
+
+#define UBLK_BATCH_IO_CHUNK	16
+
+static int ublk_ch_batch_io_cmd(struct io_uring_cmd *cmd,
+		unsigned int issue_flags, const struct ublk_batch_io_cmd *bcmd)
+{
+	struct ublk_device *ub = cmd->file->private_data;
+	struct ublk_batch_io_elem __user *uelem =
+		u64_to_user_ptr(bcmd->elem_addr);
+	struct ublk_batch_io_elem elems[UBLK_BATCH_IO_CHUNK];
+	struct ublk_uring_cmd_pdu *pdu;
+	struct ublk_queue *ubq;
+	bool kick;
+	int ret = -EINVAL;
+	int i, j;
+
+	if (bcmd->q_id >= ub->dev_info.nr_hw_queues || bcmd->flags)
+		goto out;
+
+	ubq = ublk_get_queue(ub, bcmd->q_id);
+	if (!ublk_support_batch_io(ubq))
+		goto out;
+
+	if (ubq->ubq_daemon && ubq->ubq_daemon != current)
+		goto out;
+
+	if (!bcmd->nr_elem || bcmd->nr_elem > ubq->q_depth)
+		goto out;
+
+	for (i = 0; i < bcmd->nr_elem; i += UBLK_BATCH_IO_CHUNK) {
+		unsigned int nr = min_t(unsigned int, bcmd->nr_elem - i,
+					UBLK_BATCH_IO_CHUNK);
+
+		if (copy_from_user(elems, &uelem[i], nr * sizeof(elems[0]))) {
+			ret = -EFAULT;
+			goto out;
+		}
+		for (j = 0; j < nr; j++) {
+			ret = ublk_batch_commit_elem(ub, ubq, &elems[j]);
+			if (ret)
+				goto out;
+		}
+	}
+
+	/*
+	 * Arm the command for fetching. If requests are waiting already,
+	 * deliver them right away instead.
+	 */
+	pdu = ublk_get_uring_cmd_pdu(cmd);
+	pdu->nr_elem = bcmd->nr_elem;
+	pdu->elem_addr = bcmd->elem_addr;
+	ublk_prep_cancel(cmd, issue_flags, ubq, UBLK_BATCH_IO_TAG);
+
+	spin_lock(&ubq->batch_lock);
+	kick = ubq->batch_backlog || !llist_empty(&ubq->io_cmds);
+	if (!kick) {
+		if (ubq->batch_cmd) {
+			spin_unlock(&ubq->batch_lock);
+			ret = -EBUSY;
+			goto out;
+		}
+		ubq->batch_cmd = cmd;
+	}
+	spin_unlock(&ubq->batch_lock);
+
+	if (kick)
+		io_uring_cmd_complete_in_task(cmd, ublk_batch_tw_cb);
+	return -EIOCBQUEUED;
+
+ out:
+	io_uring_cmd_done(cmd, ret, 0, issue_flags);
+	return -EIOCBQUEUED;
+}
+
 static inline struct request *__ublk_check_and_get_req(struct ublk_device *ub,
 		struct ublk_queue *ubq, int tag, size_t offset)
 {
@@ -1852,6 +2249,19 @@ static inline int ublk_ch_uring_cmd_local(struct io_uring_cmd *cmd,
 
 	WARN_ON_ONCE(issue_flags & IO_URING_F_UNLOCKED);
 
+	if (cmd->cmd_op == UBLK_U_IO_COMMIT_AND_FETCH_BATCH) {
+		const struct ublk_batch_io_cmd *b_src =
+			io_uring_sqe_cmd(cmd->sqe);
+		const struct ublk_batch_io_cmd b_cmd = {
+			.q_id = READ_ONCE(b_src->q_id),
+			.nr_elem = READ_ONCE(b_src->nr_elem),
+			.flags = READ_ONCE(b_src->flags),
+			.elem_addr = READ_ONCE(b_src->elem_addr),
+		};
+
+		return ublk_ch_batch_io_cmd(cmd, issue_flags, &b_cmd);
+	}
+
 	return __ublk_ch_uring_cmd(cmd, issue_flags, &ub_cmd);
 }
 
@@ -2008,6 +2418,7 @@ static int ublk_init_queue(struct ublk_device *ub, int q_id)
 	int size;
 
 	spin_lock_init(&ubq->cancel_lock);
+	spin_lock_init(&ubq->batch_lock);
 	ubq->flags = ub->dev_info.flags;
 	ubq->q_id = q_id;
 	ubq->q_depth = ub->dev_info.queue_depth;
@@ -2391,8 +2802,31 @@ static int ublk_ctrl_add_dev(struct io_uring_cmd *cmd)
 		 */
 		if (info.flags & UBLK_F_USER_COPY)
 			return -EINVAL;
+
+		/* same for exposing request pages to the server's io_uring */
+		if (info.flags & UBLK_F_AUTO_BUF_REG)
+			return -EINVAL;
 	}
 
+	/* the request buffer can only be handed over in one way */
+	if ((info.flags & UBLK_F_AUTO_BUF_REG) &&
+	    (info.flags & (UBLK_F_USER_COPY | UBLK_F_NEED_GET_DATA)))
+		return -EINVAL;
+
+	/*
+	 * A reissued request gets its reference count reset while the old
+	 * server's io_uring may still hold the auto registered buffer
+	 */
+	if ((info.flags & UBLK_F_AUTO_BUF_REG) &&
+	    (info.flags & UBLK_F_USER_RECOVERY_REISSUE))
+		return -EINVAL;
+
+	/* batch commands have no per-tag command to requeue or re-arm */
+	if ((info.flags & UBLK_F_BATCH_IO) &&
+	    (info.flags & (UBLK_F_NEED_GET_DATA | UBLK_F_AUTO_BUF_REG |
+			   UBLK_F_USER_RECOVERY | UBLK_F_USER_RECOVERY_REISSUE)))
+		return -EINVAL;
+
 	/* the created device is always owned by current user */
 	ublk_store_owner_uid_gid(&info.owner_uid, &info.owner_gid);
 
@@ -16,6 +16,8 @@
 #include <linux/blk-mq-virtio.h>
 #include <linux/numa.h>
 #include <linux/vmalloc.h>
+#include <linux/irq_poll.h>
+#include <linux/dim.h>
 #include <uapi/linux/virtio_ring.h>
 
 #define PART_BITS 4
@@ -42,6 +44,19 @@ static unsigned int poll_queues;
 module_param(poll_queues, uint, 0644);
 MODULE_PARM_DESC(poll_queues, "The number of dedicated virtqueues for polling I/O");
 
+static unsigned int irq_poll_budget = 64;
+module_param(irq_poll_budget, uint, 0444);
+MODULE_PARM_DESC(irq_poll_budget,
+		 "Completions reaped per softirq poll before yielding, "
+		 "interrupts stay off while polling keeps finding completions. "
+		 "0 to reap everything from the interrupt handler.");
+
+static bool adaptive_coalescing = true;
+module_param(adaptive_coalescing, bool, 0444);
+MODULE_PARM_DESC(adaptive_coalescing,
+		 "Adjust interrupt coalescing to the completion rate with "
+		 "dynamic interrupt moderation. Requires irq_poll_budget.");
+
 static int major;
 static DEFINE_IDA(vd_index_ida);
 
@@ -51,6 +66,17 @@ struct virtio_blk_vq {
 	struct virtqueue *vq;
 	spinlock_t lock;
 	char name[VQ_NAME_LEN];
+
+	/* Completion polling for interrupt driven queues */
+	struct irq_poll iop;
+	bool iop_enabled;
+
+	/*
+	 * Interrupt moderation picked by dim: ask for the next interrupt only
+	 * once most outstanding buffers are used, instead of the next one.
+	 */
+	bool cb_delayed;
+	struct dim *dim;
 } ____cacheline_aligned_in_smp;
 
 struct virtio_blk {
@@ -357,6 +383,13 @@ static void virtblk_done(struct virtqueue *vq)
 	unsigned long flags;
 	unsigned int len;
 
+	/* Reap completions from softirq context, without interrupts */
+	if (vblk->vqs[qid].iop_enabled) {
+		virtqueue_disable_cb(vq);
+		irq_poll_sched(&vblk->vqs[qid].iop);
+		return;
+	}
+
 	spin_lock_irqsave(&vblk->vqs[qid].lock, flags);
 	do {
 		virtqueue_disable_cb(vq);
@@ -375,6 +408,126 @@ static void virtblk_done(struct virtqueue *vq)
 	spin_unlock_irqrestore(&vblk->vqs[qid].lock, flags);
 }
 
+/*
+ * The device is told to interrupt either for the next used buffer, or,
+ * under higher completion rates, only once about 3/4 of the outstanding
+ * buffers are used. Each profile entry only uses the comps field, there
+ * is no timer based moderation in the virtio-blk device interface.
+ */
+static const struct dim_cq_moder
+virtblk_dim_prof[RDMA_DIM_PARAMS_NUM_PROFILES] = {
+	{0, 0, 1,  0},
+	{0, 0, 1,  0},
+	{0, 0, 1,  0},
+	{0, 0, 4,  0},
+	{0, 0, 8,  0},
+	{0, 0, 8,  0},
+	{0, 0, 16, 0},
+	{0, 0, 16, 0},
+	{0, 0, 32, 0},
+};
+
+static void virtblk_dim_work(struct work_struct *w)
+{
+	struct dim *dim = container_of(w, struct dim, work);
+	struct virtio_blk_vq *vq = dim->priv;
+
+	WRITE_ONCE(vq->cb_delayed, virtblk_dim_prof[dim->profile_ix].comps > 1);
+	dim->state = DIM_START_MEASURE;
+}
+
+static int virtblk_irqpoll(struct irq_poll *iop, int budget)
+{
+	struct virtio_blk_vq *vq = container_of(iop, struct virtio_blk_vq, iop);
+	struct virtio_blk *vblk = vq->vq->vdev->priv;
+	struct virtblk_req *vbr;
+	unsigned long flags;
+	unsigned int len;
+	int found = 0;
+	bool armed;
+
+	spin_lock_irqsave(&vq->lock, flags);
+
+	while (found < budget &&
+	       (vbr = virtqueue_get_buf(vq->vq, &len)) != NULL) {
+		struct request *req = blk_mq_rq_from_pdu(vbr);
+
+		if (likely(!blk_should_fake_timeout(req->q)))
+			blk_mq_complete_request(req);
+		found++;
+	}
+
+	/*
+	 * Keep polling from softirq while the budget is used up, that is as
+	 * long as the queue is busy. Otherwise go back to interrupts.
+	 */
+	if (found < budget) {
+		irq_poll_complete(iop);
+		if (READ_ONCE(vq->cb_delayed))
+			armed = virtqueue_enable_cb_delayed(vq->vq);
+		else
+			armed = virtqueue_enable_cb(vq->vq);
+		if (!armed) {
+			virtqueue_disable_cb(vq->vq);
+			irq_poll_sched(iop);
+		}
+	}
+
+	/* In case queue is stopped waiting for more buffers. */
+	if (found)
+		blk_mq_start_stopped_hw_queues(vblk->disk->queue, true);
+	spin_unlock_irqrestore(&vq->lock, flags);
+
+	if (IS_ENABLED(CONFIG_DIMLIB) && vq->dim)
+		rdma_dim(vq->dim, found);
+
+	return found;
+}
+
+static void virtblk_init_vq_poll(struct virtio_blk_vq *vq)
+{
+	struct dim *dim;
+
+	if (!irq_poll_budget)
+		return;
+
+	irq_poll_init(&vq->iop, irq_poll_budget, virtblk_irqpoll);
+	vq->iop_enabled = true;
+
+	if (!IS_ENABLED(CONFIG_DIMLIB) || !adaptive_coalescing)
+		return;
+
+	/* Not fatal, the queue just keeps interrupting per completion */
+	dim = kzalloc(sizeof(*dim), GFP_KERNEL);
+	if (!dim)
+		return;
+
+	dim->state = DIM_START_MEASURE;
+	dim->tune_state = DIM_GOING_RIGHT;
+	dim->profile_ix = RDMA_DIM_START_PROFILE;
+	dim->priv = vq;
+	INIT_WORK(&dim->work, virtblk_dim_work);
+	vq->dim = dim;
+}
+
+/* Called once the device can't raise interrupts any more */
+static void virtblk_deinit_vqs_poll(struct virtio_blk *vblk)
+{
+	int i;
+
+	for (i = 0; i < vblk->num_vqs; i++) {
+		struct virtio_blk_vq *vq = &vblk->vqs[i];
+
+		if (vq->iop_enabled)
+			irq_poll_disable(&vq->iop);
+		if (vq->dim) {
+			cancel_work_sync(&vq->dim->work);
+			kfree(vq->dim);
+			vq->dim = NULL;
+		}
+	}
+}
+
 static void virtio_commit_rqs(struct blk_mq_hw_ctx *hctx)
 {
 	struct virtio_blk *vblk = hctx->queue->queuedata;
@@ -1027,6 +1180,11 @@ static int init_vq(struct virtio_blk *vblk)
 	for (i = 0; i < num_vqs; i++) {
 		spin_lock_init(&vblk->vqs[i].lock);
 		vblk->vqs[i].vq = vqs[i];
+		vblk->vqs[i].iop_enabled = false;
+		vblk->vqs[i].cb_delayed = false;
+		vblk->vqs[i].dim = NULL;
+		if (i < num_vqs - num_poll_vqs)
+			virtblk_init_vq_poll(&vblk->vqs[i]);
 	}
 	vblk->num_vqs = num_vqs;
 
@@ -1551,6 +1709,7 @@ static int virtblk_probe(struct virtio_device *vdev)
 out_free_tags:
 	blk_mq_free_tag_set(&vblk->tag_set);
 out_free_vq:
+	virtblk_deinit_vqs_poll(vblk);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk->vqs);
 out_free_vblk:
@@ -1579,6 +1738,7 @@ static void virtblk_remove(struct virtio_device *vdev)
 	/* Virtqueues are stopped, nothing can use vblk->vdev anymore. */
 	vblk->vdev = NULL;
 
+	virtblk_deinit_vqs_poll(vblk);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk->vqs);
 
@@ -1601,6 +1761,7 @@ static int virtblk_freeze(struct virtio_device *vdev)
 	/* Make sure no work handler is accessing the device. */
 	flush_work(&vblk->config_work);
 
+	virtblk_deinit_vqs_poll(vblk);
 	vdev->config->del_vqs(vdev);
 	kfree(vblk->vqs);
 
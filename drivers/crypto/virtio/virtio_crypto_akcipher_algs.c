@@ -254,8 +254,10 @@ static int __virtio_crypto_akcipher_do_req(struct virtio_crypto_akcipher_request
 
 		/* dst data */
 		dst_buf = kcalloc_node(req->dst_len, 1, GFP_KERNEL, node);
-		if (!dst_buf)
+		if (!dst_buf) {
+			ret = -ENOMEM;
 			goto free_src;
+		}
 
 		sg_init_one(&dstdata_sg, dst_buf, req->dst_len);
 		sgs[num_out + num_in++] = &dstdata_sg;
@@ -270,8 +272,8 @@ static int __virtio_crypto_akcipher_do_req(struct virtio_crypto_akcipher_request
 
 	spin_lock_irqsave(&data_vq->lock, flags);
 	ret = virtqueue_add_sgs(data_vq->vq, sgs, num_out, num_in, vc_req, GFP_ATOMIC);
-	virtqueue_kick(data_vq->vq);
 	spin_unlock_irqrestore(&data_vq->lock, flags);
+	/* -ENOSPC has the engine retry once the device completed a request */
 	if (ret)
 		goto err;
 
@@ -281,7 +283,7 @@ static int __virtio_crypto_akcipher_do_req(struct virtio_crypto_akcipher_request
 	kfree(dst_buf);
 free_src:
 	kfree(src_buf);
-	return -ENOMEM;
+	return ret;
 }
 
 static int virtio_crypto_rsa_do_req(struct crypto_engine *engine, void *vreq)
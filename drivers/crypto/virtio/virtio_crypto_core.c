@@ -94,6 +94,32 @@ static void virtcrypto_dataq_callback(struct virtqueue *vq)
 	tasklet_schedule(&dq->done_task);
 }
 
+/* Notify the device once for all requests an engine pump queued */
+static int virtcrypto_dataq_kick(struct crypto_engine *engine)
+{
+	struct virtio_device *vdev = dev_to_virtio(crypto_engine_get_dev(engine));
+	struct virtio_crypto *vcrypto = vdev->priv;
+	struct data_queue *dq;
+	unsigned long flags;
+	bool notify;
+	u32 i;
+
+	for (i = 0; i < vcrypto->max_data_queues; i++) {
+		dq = &vcrypto->data_vq[i];
+		if (dq->engine != engine)
+			continue;
+
+		spin_lock_irqsave(&dq->lock, flags);
+		notify = virtqueue_kick_prepare(dq->vq);
+		spin_unlock_irqrestore(&dq->lock, flags);
+		if (notify)
+			virtqueue_notify(dq->vq);
+		break;
+	}
+
+	return 0;
+}
+
 static int virtcrypto_find_vqs(struct virtio_crypto *vi)
 {
 	struct virtqueue_info *vqs_info;
@@ -145,6 +171,13 @@ static int virtcrypto_find_vqs(struct virtio_crypto *vi)
 			ret = -ENOMEM;
 			goto err_engine;
 		}
+		/* Keep the ring busy instead of one request per pump */
+		ret = crypto_engine_set_batch(vi->data_vq[i].engine,
+					      min_t(unsigned int, virtqueue_get_vring_size(vqs[i]),
+						    CRYPTO_ENGINE_MAX_INFLIGHT),
+					      virtcrypto_dataq_kick);
+		if (ret)
+			goto err_engine;
 		tasklet_init(&vi->data_vq[i].done_task, virtcrypto_done_task,
 				(unsigned long)&vi->data_vq[i]);
 	}
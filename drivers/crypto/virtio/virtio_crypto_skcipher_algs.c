@@ -448,7 +448,6 @@ __virtio_crypto_skcipher_do_req(struct virtio_crypto_sym_request *vc_sym_req,
 	spin_lock_irqsave(&data_vq->lock, flags);
 	err = virtqueue_add_sgs(data_vq->vq, sgs, num_out,
 				num_in, vc_req, GFP_ATOMIC);
-	virtqueue_kick(data_vq->vq);
 	spin_unlock_irqrestore(&data_vq->lock, flags);
 	if (unlikely(err < 0))
 		goto free_iv;
@@ -546,12 +545,11 @@ int virtio_crypto_skcipher_crypt_req(
 	struct data_queue *data_vq = vc_req->dataq;
 	int ret;
 
+	/* virtcrypto_dataq_kick() notifies the device once per engine pump */
 	ret = __virtio_crypto_skcipher_do_req(vc_sym_req, req, data_vq);
 	if (ret < 0)
 		return ret;
 
-	virtqueue_kick(data_vq->vq);
-
 	return 0;
 }
 
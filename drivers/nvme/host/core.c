@@ -3834,7 +3834,7 @@ static void nvme_alloc_ns(struct nvme_ctrl *ctrl, struct nvme_ns_info *info)
 	struct gendisk *disk;
 	int node = ctrl->numa_node;
 
-	ns = kzalloc_node(sizeof(*ns), GFP_KERNEL, node);
+	ns = kzalloc_node(nvme_ns_alloc_size(), GFP_KERNEL, node);
 	if (!ns)
 		return;
 
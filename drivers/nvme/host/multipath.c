@@ -18,6 +18,7 @@ static const char *nvme_iopolicy_names[] = {
 	[NVME_IOPOLICY_NUMA]	= "numa",
 	[NVME_IOPOLICY_RR]	= "round-robin",
 	[NVME_IOPOLICY_QD]      = "queue-depth",
+	[NVME_IOPOLICY_LAT]	= "latency",
 };
 
 static int iopolicy = NVME_IOPOLICY_NUMA;
@@ -32,6 +33,8 @@ static int nvme_set_iopolicy(const char *val, const struct kernel_param *kp)
 		iopolicy = NVME_IOPOLICY_RR;
 	else if (!strncmp(val, "queue-depth", 11))
 		iopolicy = NVME_IOPOLICY_QD;
+	else if (!strncmp(val, "latency", 7))
+		iopolicy = NVME_IOPOLICY_LAT;
 	else
 		return -EINVAL;
 
@@ -46,7 +49,7 @@ static int nvme_get_iopolicy(char *buf, const struct kernel_param *kp)
 module_param_call(iopolicy, nvme_set_iopolicy, nvme_get_iopolicy,
 	&iopolicy, 0644);
 MODULE_PARM_DESC(iopolicy,
-	"Default multipath I/O policy; 'numa' (default), 'round-robin' or 'queue-depth'");
+	"Default multipath I/O policy; 'numa' (default), 'round-robin', 'queue-depth' or 'latency'");
 
 void nvme_mpath_default_iopolicy(struct nvme_subsystem *subsys)
 {
@@ -131,9 +134,19 @@ void nvme_mpath_start_request(struct request *rq)
 	struct nvme_ns *ns = rq->q->queuedata;
 	struct gendisk *disk = ns->head->disk;
 
-	if (READ_ONCE(ns->head->subsys->iopolicy) == NVME_IOPOLICY_QD) {
+	switch (READ_ONCE(ns->head->subsys->iopolicy)) {
+	case NVME_IOPOLICY_QD:
 		atomic_inc(&ns->ctrl->nr_active);
 		nvme_req(rq)->flags |= NVME_MPATH_CNT_ACTIVE;
+		break;
+	case NVME_IOPOLICY_LAT:
+		if (blk_rq_is_passthrough(rq))
+			break;
+		nvme_req(rq)->flags |= NVME_MPATH_TRACK_LAT;
+		nvme_req(rq)->lat_start = ktime_get_ns();
+		break;
+	default:
+		break;
 	}
 
 	if (!blk_queue_io_stat(disk->queue) || blk_rq_is_passthrough(rq))
@@ -145,12 +158,35 @@ void nvme_mpath_start_request(struct request *rq)
 }
 EXPORT_SYMBOL_GPL(nvme_mpath_start_request);
 
+/* new samples are weighted 1/8 */
+#define NVME_LAT_EWMA_SHIFT	3
+
+static void nvme_mpath_update_lat(struct nvme_ns *ns, struct request *rq)
+{
+	struct nvme_path_lat *lat = &ns->lat[cpu_to_node(blk_mq_rq_cpu(rq))];
+	u64 sample = ktime_get_ns() - nvme_req(rq)->lat_start;
+	u64 ewma = READ_ONCE(lat->ewma_ns);
+
+	if (ewma)
+		ewma = ewma - (ewma >> NVME_LAT_EWMA_SHIFT) +
+			(sample >> NVME_LAT_EWMA_SHIFT);
+	else
+		ewma = sample;
+
+	WRITE_ONCE(lat->ewma_ns, ewma);
+	WRITE_ONCE(lat->weight,
+		   div64_u64(NSEC_PER_SEC, max_t(u64, ewma, NSEC_PER_USEC)));
+	WRITE_ONCE(lat->nr_samples, lat->nr_samples + 1);
+}
+
 void nvme_mpath_end_request(struct request *rq)
 {
 	struct nvme_ns *ns = rq->q->queuedata;
 
 	if (nvme_req(rq)->flags & NVME_MPATH_CNT_ACTIVE)
 		atomic_dec_if_positive(&ns->ctrl->nr_active);
+	if (nvme_req(rq)->flags & NVME_MPATH_TRACK_LAT)
+		nvme_mpath_update_lat(ns, rq);
 
 	if (!(nvme_req(rq)->flags & NVME_MPATH_IO_STATS))
 		return;
@@ -386,6 +422,58 @@ static struct nvme_ns *nvme_queue_depth_path(struct nvme_ns_head *head)
 	return best_opt ? best_opt : best_nonopt;
 }
 
+static inline u32 nvme_path_lat_weight(struct nvme_ns *ns, int node)
+{
+	u32 weight = READ_ONCE(ns->lat[node].weight);
+
+	/* treat paths without samples as fast so that they get probed */
+	return weight ? weight : NSEC_PER_SEC / NSEC_PER_USEC;
+}
+
+/*
+ * Pick a path at random, weighted by the inverse of its completion latency
+ * as seen from this node. Slow paths keep receiving a proportional share of
+ * I/O, which keeps their average current. Non-optimized paths are only
+ * used when no optimized path is available.
+ */
+static struct nvme_ns *nvme_latency_path(struct nvme_ns_head *head)
+{
+	enum nvme_ana_state state = NVME_ANA_NONOPTIMIZED;
+	struct nvme_ns *ns, *found = NULL;
+	int node = numa_node_id();
+	u32 total = 0, r;
+
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		if (nvme_path_is_disabled(ns))
+			continue;
+		if (ns->ana_state == NVME_ANA_OPTIMIZED &&
+		    state != NVME_ANA_OPTIMIZED) {
+			state = NVME_ANA_OPTIMIZED;
+			total = 0;
+		}
+		if (ns->ana_state == state)
+			total += nvme_path_lat_weight(ns, node);
+	}
+	if (!total)
+		return NULL;
+
+	r = get_random_u32_below(total);
+	list_for_each_entry_rcu(ns, &head->list, siblings) {
+		u32 weight;
+
+		if (nvme_path_is_disabled(ns) || ns->ana_state != state)
+			continue;
+		found = ns;
+		weight = nvme_path_lat_weight(ns, node);
+		if (r < weight)
+			break;
+		r -= weight;
+	}
+
+	/* weights may have moved under us, so "found" is the last candidate */
+	return found;
+}
+
 static inline bool nvme_path_is_optimized(struct nvme_ns *ns)
 {
 	return nvme_ctrl_state(ns->ctrl) == NVME_CTRL_LIVE &&
@@ -412,6 +500,8 @@ inline struct nvme_ns *nvme_find_path(struct nvme_ns_head *head)
 		return nvme_queue_depth_path(head);
 	case NVME_IOPOLICY_RR:
 		return nvme_round_robin_path(head);
+	case NVME_IOPOLICY_LAT:
+		return nvme_latency_path(head);
 	default:
 		return nvme_numa_path(head);
 	}
@@ -950,6 +1040,22 @@ static ssize_t ana_state_show(struct device *dev, struct device_attribute *attr,
 }
 DEVICE_ATTR_RO(ana_state);
 
+static ssize_t latency_stat_show(struct device *dev,
+		struct device_attribute *attr, char *buf)
+{
+	struct nvme_ns *ns = nvme_get_ns_from_dev(dev);
+	ssize_t len = 0;
+	int node;
+
+	/* one line per node: node, average latency (ns), samples */
+	for_each_node(node)
+		len += sysfs_emit_at(buf, len, "%d %llu %llu\n", node,
+				     READ_ONCE(ns->lat[node].ewma_ns),
+				     READ_ONCE(ns->lat[node].nr_samples));
+	return len;
+}
+DEVICE_ATTR_RO(latency_stat);
+
 static int nvme_lookup_ana_group_desc(struct nvme_ctrl *ctrl,
 		struct nvme_ana_group_desc *desc, void *data)
 {
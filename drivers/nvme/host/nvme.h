@@ -188,6 +188,7 @@ struct nvme_request {
 	u16			status;
 #ifdef CONFIG_NVME_MULTIPATH
 	unsigned long		start_time;
+	u64			lat_start;
 #endif
 	struct nvme_ctrl	*ctrl;
 };
@@ -202,6 +203,7 @@ enum {
 	NVME_REQ_USERCMD		= (1 << 1),
 	NVME_MPATH_IO_STATS		= (1 << 2),
 	NVME_MPATH_CNT_ACTIVE		= (1 << 3),
+	NVME_MPATH_TRACK_LAT		= (1 << 4),
 };
 
 static inline struct nvme_request *nvme_req(struct request *req)
@@ -416,6 +418,7 @@ enum nvme_iopolicy {
 	NVME_IOPOLICY_NUMA,
 	NVME_IOPOLICY_RR,
 	NVME_IOPOLICY_QD,
+	NVME_IOPOLICY_LAT,
 };
 
 struct nvme_subsystem {
@@ -513,6 +516,17 @@ enum nvme_ns_features {
 	NVME_NS_DEAC = 1 << 2,		/* DEAC bit in Write Zeores supported */
 };
 
+/*
+ * Completion latency of a path as seen from one NUMA node, used by the
+ * latency iopolicy. Updated locklessly from the completion path; the
+ * occasional lost update only makes the average slightly less precise.
+ */
+struct nvme_path_lat {
+	u64			ewma_ns;
+	u64			nr_samples;
+	u32			weight;		/* inverse of ewma_ns */
+} ____cacheline_aligned_in_smp;
+
 struct nvme_ns {
 	struct list_head list;
 
@@ -537,8 +551,22 @@ struct nvme_ns {
 	struct device		cdev_device;
 
 	struct nvme_fault_inject fault_inject;
+
+#ifdef CONFIG_NVME_MULTIPATH
+	/* completion latency per submitting NUMA node, see nvme_ns_alloc_size() */
+	struct nvme_path_lat lat[];
+#endif
 };
 
+static inline size_t nvme_ns_alloc_size(void)
+{
+#ifdef CONFIG_NVME_MULTIPATH
+	return struct_size_t(struct nvme_ns, lat, nr_node_ids);
+#else
+	return sizeof(struct nvme_ns);
+#endif
+}
+
 /* NVMe ns supports metadata actions by the controller (generate/strip) */
 static inline bool nvme_ns_has_pi(struct nvme_ns_head *head)
 {
@@ -776,7 +804,8 @@ static __always_inline void nvme_complete_batch(struct io_comp_batch *iob,
 	struct request *req;
 
 	rq_list_for_each(&iob->req_list, req) {
-		fn(req);
+		if (fn)
+			fn(req);
 		nvme_complete_batch_req(req);
 	}
 	blk_mq_end_request_batch(iob);
@@ -974,6 +1003,7 @@ static inline void nvme_trace_bio_complete(struct request *req)
 extern bool multipath;
 extern struct device_attribute dev_attr_ana_grpid;
 extern struct device_attribute dev_attr_ana_state;
+extern struct device_attribute dev_attr_latency_stat;
 extern struct device_attribute subsys_attr_iopolicy;
 
 static inline bool nvme_disk_is_ns_head(struct gendisk *disk)
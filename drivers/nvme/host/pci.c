@@ -15,6 +15,7 @@
 #include <linux/interrupt.h>
 #include <linux/io.h>
 #include <linux/kstrtox.h>
+#include <linux/maple_tree.h>
 #include <linux/memremap.h>
 #include <linux/mm.h>
 #include <linux/module.h>
@@ -144,6 +145,10 @@ struct nvme_dev {
 
 	mempool_t *iod_mempool;
 
+	/* buffers premapped via ->dma_map, keyed by their bio_vec array */
+	struct maple_tree premaps;
+	struct mutex premap_lock;
+
 	/* shadow doorbell buffer support: */
 	__le32 *dbbuf_dbs;
 	dma_addr_t dbbuf_dbs_dma_addr;
@@ -231,6 +236,7 @@ struct nvme_iod {
 	struct nvme_request req;
 	struct nvme_command cmd;
 	bool aborted;
+	bool premapped;		/* data is covered by a struct nvme_premap */
 	s8 nr_allocations;	/* PRP list pool allocations. 0 means small
 				   pool in use */
 	unsigned int dma_len;	/* length of single DMA segment mapping */
@@ -240,6 +246,27 @@ struct nvme_iod {
 	union nvme_descriptor list[NVME_MAX_NR_ALLOCATIONS];
 };
 
+/*
+ * A long-lived buffer (e.g. an io_uring fixed buffer) that was DMA mapped
+ * once through ->dma_map. Besides the per-bvec mappings it carries a PRP
+ * template: one entry per controller page of the whole buffer, laid out in
+ * coherent memory so that PRP2 of a request can point straight into it.
+ */
+struct nvme_premap {
+	struct nvme_dev *dev;
+	struct bio_vec *bvec;
+	int nr_vecs;
+	bool unmapped;		/* controller went away first */
+	unsigned int nr_prps;
+	__le64 *prps;
+	dma_addr_t prps_dma;
+	struct rcu_head rcu;
+	struct {
+		dma_addr_t addr;
+		unsigned int first_prp;
+	} vecs[] __counted_by(nr_vecs);
+};
+
 static inline unsigned int nvme_dbbuf_size(struct nvme_dev *dev)
 {
 	return dev->nr_allocated_queues * 8 * dev->db_stride;
@@ -541,6 +568,9 @@ static void nvme_unmap_data(struct nvme_dev *dev, struct request *req)
 {
 	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
 
+	if (iod->premapped)
+		return;
+
 	if (iod->dma_len) {
 		dma_unmap_page(dev->dev, iod->first_dma, iod->dma_len,
 			       rq_dma_dir(req));
@@ -766,6 +796,61 @@ static blk_status_t nvme_setup_sgl_simple(struct nvme_dev *dev,
 	return BLK_STS_OK;
 }
 
+/*
+ * Requests built from a premapped buffer reference its bio_vec array
+ * directly, so the PRPs are found with a lookup and some arithmetic. Only
+ * single-bio requests whose PRP list fits in one page of the template are
+ * handled here; anything else takes the regular mapping path.
+ */
+static bool nvme_setup_prp_premapped(struct nvme_dev *dev,
+		struct request *req, struct nvme_rw_command *cmnd)
+{
+	const unsigned int prps_per_page = NVME_CTRL_PAGE_SIZE >> 3;
+	struct nvme_iod *iod = blk_mq_rq_to_pdu(req);
+	struct bio *bio = req->bio;
+	unsigned int length = blk_rq_payload_bytes(req);
+	unsigned int first_prp_len, done, idx, nprps;
+	struct nvme_premap *pm;
+	struct bio_vec *bv;
+	dma_addr_t dma;
+
+	if (mtree_empty(&dev->premaps) || !bio || bio != req->biotail)
+		return false;
+
+	bv = bio->bi_io_vec + bio->bi_iter.bi_idx;
+	pm = mtree_load(&dev->premaps, (unsigned long)bv);
+	if (!pm || pm->unmapped)
+		return false;
+
+	idx = bv - pm->bvec;
+	done = bio->bi_iter.bi_bvec_done;
+	dma = pm->vecs[idx].addr + done;
+	first_prp_len = NVME_CTRL_PAGE_SIZE - (dma & (NVME_CTRL_PAGE_SIZE - 1));
+
+	cmnd->dptr.prp1 = cpu_to_le64(dma);
+	if (length <= first_prp_len) {
+		cmnd->dptr.prp2 = 0;
+	} else {
+		/* template index of the controller page after PRP1 */
+		idx = pm->vecs[idx].first_prp + 1 +
+			(((bv->bv_offset & (NVME_CTRL_PAGE_SIZE - 1)) + done) >>
+			 NVME_CTRL_PAGE_SHIFT);
+		if (length <= first_prp_len + NVME_CTRL_PAGE_SIZE) {
+			cmnd->dptr.prp2 = pm->prps[idx];
+		} else {
+			nprps = DIV_ROUND_UP(length - first_prp_len,
+					     NVME_CTRL_PAGE_SIZE);
+			if ((idx & (prps_per_page - 1)) + nprps > prps_per_page)
+				return false;
+			cmnd->dptr.prp2 = cpu_to_le64(pm->prps_dma +
+						      idx * sizeof(__le64));
+		}
+	}
+
+	iod->premapped = true;
+	return true;
+}
+
 static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 		struct nvme_command *cmnd)
 {
@@ -773,6 +858,9 @@ static blk_status_t nvme_map_data(struct nvme_dev *dev, struct request *req,
 	blk_status_t ret = BLK_STS_RESOURCE;
 	int rc;
 
+	if (nvme_setup_prp_premapped(dev, req, &cmnd->rw))
+		return BLK_STS_OK;
+
 	if (blk_rq_nr_phys_segments(req) == 1) {
 		struct nvme_queue *nvmeq = req->mq_hctx->driver_data;
 		struct bio_vec bv = req_bvec(req);
@@ -841,6 +929,7 @@ static blk_status_t nvme_prep_rq(struct nvme_dev *dev, struct request *req)
 	blk_status_t ret;
 
 	iod->aborted = false;
+	iod->premapped = false;
 	iod->nr_allocations = -1;
 	iod->sgt.nents = 0;
 
@@ -1707,6 +1796,136 @@ static const struct blk_mq_ops nvme_mq_admin_ops = {
 	.timeout	= nvme_timeout,
 };
 
+static void nvme_premap_release_dma(struct nvme_premap *pm)
+{
+	struct device *dmadev = pm->dev->dev;
+	int i;
+
+	for (i = 0; i < pm->nr_vecs; i++)
+		dma_unmap_page(dmadev, pm->vecs[i].addr, pm->bvec[i].bv_len,
+			       DMA_BIDIRECTIONAL);
+	dma_free_coherent(dmadev, pm->nr_prps * sizeof(__le64), pm->prps,
+			  pm->prps_dma);
+	pm->unmapped = true;
+}
+
+static void *nvme_pci_dma_map(struct request_queue *q, struct bio_vec *bvec,
+		int nr_vecs)
+{
+	struct nvme_ns *ns = q->queuedata;
+	struct nvme_dev *dev = to_nvme_dev(ns->ctrl);
+	struct nvme_premap *pm;
+	unsigned int nr_prps = 0;
+	int i, j, ret;
+
+	/* don't map for a controller that is resetting or going away */
+	if (nvme_ctrl_state(&dev->ctrl) != NVME_CTRL_LIVE)
+		return ERR_PTR(-ENODEV);
+
+	pm = kzalloc(struct_size(pm, vecs, nr_vecs), GFP_KERNEL);
+	if (!pm)
+		return ERR_PTR(-ENOMEM);
+	pm->dev = dev;
+	pm->bvec = bvec;
+	pm->nr_vecs = nr_vecs;
+
+	/* PRPs need every segment but the first/last to be page aligned */
+	for (i = 0; i < nr_vecs; i++) {
+		struct bio_vec *bv = &bvec[i];
+		unsigned int offset = bv->bv_offset & (NVME_CTRL_PAGE_SIZE - 1);
+
+		if ((i > 0 && offset) ||
+		    (i < nr_vecs - 1 &&
+		     ((offset + bv->bv_len) & (NVME_CTRL_PAGE_SIZE - 1))) ||
+		    is_pci_p2pdma_page(bv->bv_page)) {
+			ret = -EOPNOTSUPP;
+			goto out_free;
+		}
+		pm->vecs[i].first_prp = nr_prps;
+		nr_prps += DIV_ROUND_UP(offset + bv->bv_len, NVME_CTRL_PAGE_SIZE);
+	}
+
+	pm->nr_prps = nr_prps;
+	pm->prps = dma_alloc_coherent(dev->dev, nr_prps * sizeof(__le64),
+				      &pm->prps_dma, GFP_KERNEL);
+	if (!pm->prps) {
+		ret = -ENOMEM;
+		goto out_free;
+	}
+
+	for (i = 0; i < nr_vecs; i++) {
+		struct bio_vec *bv = &bvec[i];
+		dma_addr_t addr;
+
+		addr = dma_map_bvec(dev->dev, bv, DMA_BIDIRECTIONAL, 0);
+		if (dma_mapping_error(dev->dev, addr)) {
+			ret = -ENOMEM;
+			goto out_unmap;
+		}
+		pm->vecs[i].addr = addr;
+		/* syncing per I/O would defeat the purpose */
+		if (dma_need_sync(dev->dev, addr)) {
+			i++;
+			ret = -EOPNOTSUPP;
+			goto out_unmap;
+		}
+
+		addr &= ~(dma_addr_t)(NVME_CTRL_PAGE_SIZE - 1);
+		for (j = pm->vecs[i].first_prp;
+		     j < (i + 1 < nr_vecs ? pm->vecs[i + 1].first_prp : nr_prps);
+		     j++, addr += NVME_CTRL_PAGE_SIZE)
+			pm->prps[j] = cpu_to_le64(addr);
+	}
+
+	mutex_lock(&dev->premap_lock);
+	ret = mtree_insert_range(&dev->premaps, (unsigned long)bvec,
+			(unsigned long)(bvec + nr_vecs) - 1, pm, GFP_KERNEL);
+	mutex_unlock(&dev->premap_lock);
+	if (ret)
+		goto out_unmap;
+	return pm;
+
+out_unmap:
+	while (--i >= 0)
+		dma_unmap_page(dev->dev, pm->vecs[i].addr, bvec[i].bv_len,
+			       DMA_BIDIRECTIONAL);
+	dma_free_coherent(dev->dev, nr_prps * sizeof(__le64), pm->prps,
+			  pm->prps_dma);
+out_free:
+	kfree(pm);
+	return ERR_PTR(ret);
+}
+
+static void nvme_pci_dma_unmap(struct request_queue *q, void *dma_tag)
+{
+	struct nvme_premap *pm = dma_tag;
+	struct nvme_dev *dev = pm->dev;
+
+	mutex_lock(&dev->premap_lock);
+	mtree_erase(&dev->premaps, (unsigned long)pm->bvec);
+	if (!pm->unmapped)
+		nvme_premap_release_dma(pm);
+	mutex_unlock(&dev->premap_lock);
+	kfree_rcu(pm, rcu);
+}
+
+/*
+ * The controller is going away while buffers may still be mapped. Drop the
+ * DMA mappings now; the entries themselves are freed by ->dma_unmap.
+ */
+static void nvme_pci_release_premaps(struct nvme_dev *dev)
+{
+	struct nvme_premap *pm;
+	unsigned long index = 0;
+
+	mutex_lock(&dev->premap_lock);
+	mt_for_each(&dev->premaps, pm, index, ULONG_MAX) {
+		if (!pm->unmapped)
+			nvme_premap_release_dma(pm);
+	}
+	mutex_unlock(&dev->premap_lock);
+}
+
 static const struct blk_mq_ops nvme_mq_ops = {
 	.queue_rq	= nvme_queue_rq,
 	.queue_rqs	= nvme_queue_rqs,
@@ -1717,6 +1936,8 @@ static const struct blk_mq_ops nvme_mq_ops = {
 	.map_queues	= nvme_pci_map_queues,
 	.timeout	= nvme_timeout,
 	.poll		= nvme_poll,
+	.dma_map	= nvme_pci_dma_map,
+	.dma_unmap	= nvme_pci_dma_unmap,
 };
 
 static void nvme_dev_remove_admin(struct nvme_dev *dev)
@@ -2741,6 +2962,7 @@ static void nvme_pci_free_ctrl(struct nvme_ctrl *ctrl)
 	struct nvme_dev *dev = to_nvme_dev(ctrl);
 
 	nvme_free_tagset(dev);
+	mtree_destroy(&dev->premaps);
 	put_device(dev->dev);
 	kfree(dev->queues);
 	kfree(dev);
@@ -3015,6 +3237,8 @@ static struct nvme_dev *nvme_pci_alloc_dev(struct pci_dev *pdev,
 		return ERR_PTR(-ENOMEM);
 	INIT_WORK(&dev->ctrl.reset_work, nvme_reset_work);
 	mutex_init(&dev->shutdown_lock);
+	mt_init_flags(&dev->premaps, MT_FLAGS_USE_RCU);
+	mutex_init(&dev->premap_lock);
 
 	dev->nr_write_queues = write_queues;
 	dev->nr_poll_queues = poll_queues;
@@ -3226,6 +3450,7 @@ static void nvme_remove(struct pci_dev *pdev)
 	nvme_stop_ctrl(&dev->ctrl);
 	nvme_remove_namespaces(&dev->ctrl);
 	nvme_dev_disable(dev, true);
+	nvme_pci_release_premaps(dev);
 	nvme_free_host_mem(dev);
 	nvme_dev_remove_admin(dev);
 	nvme_dbbuf_dma_free(dev);
@@ -44,6 +44,9 @@ static bool wq_unbound;
 module_param(wq_unbound, bool, 0644);
 MODULE_PARM_DESC(wq_unbound, "Use unbound workqueue for nvme-tcp IO context (default false)");
 
+/* number of I/O queues, of all controllers, whose io_work runs on each CPU */
+static atomic_t nvme_tcp_cpu_queues[NR_CPUS];
+
 /*
  * TLS handshake timeout
  */
@@ -127,6 +130,7 @@ enum nvme_tcp_queue_flags {
 	NVME_TCP_Q_ALLOCATED	= 0,
 	NVME_TCP_Q_LIVE		= 1,
 	NVME_TCP_Q_POLLING	= 2,
+	NVME_TCP_Q_IO_CPU_SET	= 3,
 };
 
 enum nvme_tcp_recv_state {
@@ -153,6 +157,7 @@ struct nvme_tcp_queue {
 	size_t			data_remaining;
 	size_t			ddgst_remaining;
 	unsigned int		nr_cqe;
+	struct io_comp_batch	*iob;	/* only set under the socket lock */
 
 	/* send state */
 	struct nvme_tcp_request *request;
@@ -595,6 +600,25 @@ static void nvme_tcp_error_recovery(struct nvme_ctrl *ctrl)
 	queue_work(nvme_reset_wq, &to_tcp_ctrl(ctrl)->err_work);
 }
 
+static void nvme_tcp_complete_batch(struct io_comp_batch *iob)
+{
+	/* nothing to unmap, data is copied in and out of the socket */
+	nvme_complete_batch(iob, NULL);
+}
+
+/*
+ * Complete a request from the receive path. Successful completions are
+ * gathered in queue->iob and ended together once the socket is released.
+ */
+static void nvme_tcp_recv_complete(struct nvme_tcp_queue *queue,
+		struct request *rq, __le16 status, union nvme_result result)
+{
+	if (!nvme_try_complete_req(rq, status, result) &&
+	    !blk_mq_add_to_batch(rq, queue->iob, nvme_req(rq)->status,
+				 nvme_tcp_complete_batch))
+		nvme_complete_rq(rq);
+}
+
 static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 		struct nvme_completion *cqe)
 {
@@ -614,8 +638,7 @@ static int nvme_tcp_process_nvme_cqe(struct nvme_tcp_queue *queue,
 	if (req->status == cpu_to_le16(NVME_SC_SUCCESS))
 		req->status = cqe->status;
 
-	if (!nvme_try_complete_req(rq, req->status, cqe->result))
-		nvme_complete_rq(rq);
+	nvme_tcp_recv_complete(queue, rq, req->status, cqe->result);
 	queue->nr_cqe++;
 
 	return 0;
@@ -818,6 +841,14 @@ static inline void nvme_tcp_end_request(struct request *rq, u16 status)
 		nvme_complete_rq(rq);
 }
 
+static inline void nvme_tcp_recv_end_request(struct nvme_tcp_queue *queue,
+		struct request *rq, u16 status)
+{
+	union nvme_result res = {};
+
+	nvme_tcp_recv_complete(queue, rq, cpu_to_le16(status << 1), res);
+}
+
 static int nvme_tcp_recv_data(struct nvme_tcp_queue *queue, struct sk_buff *skb,
 			      unsigned int *offset, size_t *len)
 {
@@ -878,7 +909,7 @@ static int nvme_tcp_recv_data(struct nvme_tcp_queue *queue, struct sk_buff *skb,
 			queue->ddgst_remaining = NVME_TCP_DIGEST_LENGTH;
 		} else {
 			if (pdu->hdr.flags & NVME_TCP_F_DATA_SUCCESS) {
-				nvme_tcp_end_request(rq,
+				nvme_tcp_recv_end_request(queue, rq,
 						le16_to_cpu(req->status));
 				queue->nr_cqe++;
 			}
@@ -926,7 +957,7 @@ static int nvme_tcp_recv_ddgst(struct nvme_tcp_queue *queue,
 					pdu->command_id);
 		struct nvme_tcp_request *req = blk_mq_rq_to_pdu(rq);
 
-		nvme_tcp_end_request(rq, le16_to_cpu(req->status));
+		nvme_tcp_recv_end_request(queue, rq, le16_to_cpu(req->status));
 		queue->nr_cqe++;
 	}
 
@@ -1214,6 +1245,119 @@ static int nvme_tcp_try_send_ddgst(struct nvme_tcp_request *req)
 	return -EAGAIN;
 }
 
+/* maximum number of command PDUs coalesced into a single sendmsg */
+#define NVME_TCP_SEND_BATCH	16
+
+/*
+ * A request can join a send batch if nothing of it went out yet and any
+ * in-capsule data fits in a single segment that needs no data digest.
+ */
+static bool nvme_tcp_can_batch(struct nvme_tcp_request *req)
+{
+	if (req->state != NVME_TCP_SEND_CMD_PDU || req->offset)
+		return false;
+	if (!nvme_tcp_has_inline_data(req))
+		return true;
+	return !req->queue->data_digest &&
+		nvme_tcp_req_cur_length(req) == req->pdu_len &&
+		sendpages_ok(nvme_tcp_req_cur_page(req), req->pdu_len,
+			     nvme_tcp_req_cur_offset(req));
+}
+
+static unsigned int nvme_tcp_batch_add(struct nvme_tcp_request *req,
+		struct bio_vec *bvec)
+{
+	struct nvme_tcp_cmd_pdu *pdu = nvme_tcp_req_cmd_pdu(req);
+	struct nvme_tcp_queue *queue = req->queue;
+
+	if (queue->hdr_digest)
+		nvme_tcp_hdgst(queue->snd_hash, pdu, sizeof(*pdu));
+	bvec_set_virt(&bvec[0], pdu, sizeof(*pdu) + nvme_tcp_hdgst_len(queue));
+	if (!nvme_tcp_has_inline_data(req))
+		return 1;
+	bvec_set_page(&bvec[1], nvme_tcp_req_cur_page(req), req->pdu_len,
+		      nvme_tcp_req_cur_offset(req));
+	return 2;
+}
+
+/*
+ * Coalesce the command PDUs (and single segment in-capsule data) of the
+ * current request and those queued behind it into one sendmsg, instead of
+ * taking the socket lock once per PDU. Requests that were sent completely
+ * must not be touched afterwards, as their completion may already be racing
+ * in on the receive side.
+ */
+static int nvme_tcp_try_send_cmd_batch(struct nvme_tcp_queue *queue)
+{
+	struct nvme_tcp_request *reqs[NVME_TCP_SEND_BATCH];
+	unsigned int lens[NVME_TCP_SEND_BATCH];
+	struct bio_vec bvec[NVME_TCP_SEND_BATCH * 2];
+	struct msghdr msg = { .msg_flags = MSG_DONTWAIT | MSG_SPLICE_PAGES, };
+	unsigned int nr_reqs = 0, nr_bvec = 0, size = 0, i;
+	struct nvme_tcp_request *req = queue->request;
+	int ret;
+
+	for (;;) {
+		unsigned int n = nvme_tcp_batch_add(req, &bvec[nr_bvec]);
+
+		lens[nr_reqs] = bvec[nr_bvec].bv_len;
+		if (n > 1)
+			lens[nr_reqs] += bvec[nr_bvec + 1].bv_len;
+		size += lens[nr_reqs];
+		reqs[nr_reqs++] = req;
+		nr_bvec += n;
+
+		if (nr_reqs == NVME_TCP_SEND_BATCH)
+			break;
+		req = nvme_tcp_fetch_request(queue);
+		if (!req)
+			break;
+		if (!nvme_tcp_can_batch(req)) {
+			list_add(&req->entry, &queue->send_list);
+			break;
+		}
+	}
+
+	if (nvme_tcp_queue_more(queue))
+		msg.msg_flags |= MSG_MORE;
+	else
+		msg.msg_flags |= MSG_EOR;
+
+	iov_iter_bvec(&msg.msg_iter, ITER_SOURCE, bvec, nr_bvec, size);
+	ret = sock_sendmsg(queue->sock, &msg);
+	if (unlikely(ret <= 0)) {
+		/* nothing went out: the first request stays current */
+		while (--nr_reqs > 0)
+			list_add(&reqs[nr_reqs]->entry, &queue->send_list);
+		return ret;
+	}
+
+	for (i = 0; i < nr_reqs && ret >= lens[i]; i++)
+		ret -= lens[i];
+
+	if (i == nr_reqs) {
+		nvme_tcp_done_send_req(queue);
+		return 1;
+	}
+
+	/* put back what was not sent, in order */
+	for (nr_reqs--; nr_reqs > i; nr_reqs--)
+		list_add(&reqs[nr_reqs]->entry, &queue->send_list);
+
+	req = reqs[i];
+	queue->request = req;
+	if (ret < lens[i] - req->pdu_len) {
+		req->offset = ret;
+	} else {
+		/* the PDU went out, resume in the in-capsule data */
+		req->state = NVME_TCP_SEND_DATA;
+		if (ret > lens[i] - req->pdu_len)
+			nvme_tcp_advance_req(req,
+					     ret - (lens[i] - req->pdu_len));
+	}
+	return -EAGAIN;
+}
+
 static int nvme_tcp_try_send(struct nvme_tcp_queue *queue)
 {
 	struct nvme_tcp_request *req;
@@ -1228,6 +1372,11 @@ static int nvme_tcp_try_send(struct nvme_tcp_queue *queue)
 	req = queue->request;
 
 	noreclaim_flag = memalloc_noreclaim_save();
+	if (nvme_tcp_queue_more(queue) && nvme_tcp_can_batch(req)) {
+		ret = nvme_tcp_try_send_cmd_batch(queue);
+		goto done;
+	}
+
 	if (req->state == NVME_TCP_SEND_CMD_PDU) {
 		ret = nvme_tcp_try_send_cmd_pdu(req);
 		if (ret <= 0)
@@ -1264,7 +1413,13 @@ static int nvme_tcp_try_send(struct nvme_tcp_queue *queue)
 	return ret;
 }
 
-static int nvme_tcp_try_recv(struct nvme_tcp_queue *queue)
+/*
+ * read_sock() walks every queued skb and nvme_tcp_recv_skb() parses as many
+ * PDUs as each one holds. Completions found along the way are batched in
+ * @iob, if given, so they can be ended after the socket lock is dropped.
+ */
+static int nvme_tcp_try_recv(struct nvme_tcp_queue *queue,
+		struct io_comp_batch *iob)
 {
 	struct socket *sock = queue->sock;
 	struct sock *sk = sock->sk;
@@ -1275,7 +1430,9 @@ static int nvme_tcp_try_recv(struct nvme_tcp_queue *queue)
 	rd_desc.count = 1;
 	lock_sock(sk);
 	queue->nr_cqe = 0;
+	queue->iob = iob;
 	consumed = sock->ops->read_sock(sk, &rd_desc, nvme_tcp_recv_skb);
+	queue->iob = NULL;
 	release_sock(sk);
 	return consumed;
 }
@@ -1287,6 +1444,7 @@ static void nvme_tcp_io_work(struct work_struct *w)
 	unsigned long deadline = jiffies + msecs_to_jiffies(1);
 
 	do {
+		DEFINE_IO_COMP_BATCH(iob);
 		bool pending = false;
 		int result;
 
@@ -1299,7 +1457,9 @@ static void nvme_tcp_io_work(struct work_struct *w)
 				break;
 		}
 
-		result = nvme_tcp_try_recv(queue);
+		result = nvme_tcp_try_recv(queue, &iob);
+		if (!rq_list_empty(iob.req_list))
+			iob.complete(&iob);
 		if (result > 0)
 			pending = true;
 		else if (unlikely(result < 0))
@@ -1562,23 +1722,57 @@ static bool nvme_tcp_poll_queue(struct nvme_tcp_queue *queue)
 			  ctrl->io_queues[HCTX_TYPE_POLL];
 }
 
+/*
+ * Run io_work on one of the CPUs blk-mq maps to the queue's hctx, so that
+ * nvme_tcp_queue_request() can send directly from the submitting CPU, and
+ * pick the one the fewest queues of all controllers already run on.
+ * Needs the tag set's queue maps, so it is called when an I/O queue starts.
+ */
 static void nvme_tcp_set_queue_io_cpu(struct nvme_tcp_queue *queue)
 {
 	struct nvme_tcp_ctrl *ctrl = queue->ctrl;
-	int qid = nvme_tcp_queue_id(queue);
-	int n = 0;
+	struct blk_mq_tag_set *set = &ctrl->tag_set;
+	int qid = nvme_tcp_queue_id(queue) - 1;
+	int cpu, min_queues = INT_MAX, io_cpu;
+	unsigned int *mq_map = NULL;
+
+	queue->io_cpu = WORK_CPU_UNBOUND;
+	if (wq_unbound)
+		return;
 
 	if (nvme_tcp_default_queue(queue))
-		n = qid - 1;
+		mq_map = set->map[HCTX_TYPE_DEFAULT].mq_map;
 	else if (nvme_tcp_read_queue(queue))
-		n = qid - ctrl->io_queues[HCTX_TYPE_DEFAULT] - 1;
+		mq_map = set->map[HCTX_TYPE_READ].mq_map;
 	else if (nvme_tcp_poll_queue(queue))
-		n = qid - ctrl->io_queues[HCTX_TYPE_DEFAULT] -
-				ctrl->io_queues[HCTX_TYPE_READ] - 1;
-	if (wq_unbound)
-		queue->io_cpu = WORK_CPU_UNBOUND;
-	else
-		queue->io_cpu = cpumask_next_wrap(n - 1, cpu_online_mask, -1, false);
+		mq_map = set->map[HCTX_TYPE_POLL].mq_map;
+	if (WARN_ON_ONCE(!mq_map))
+		return;
+
+	io_cpu = WORK_CPU_UNBOUND;
+	for_each_online_cpu(cpu) {
+		int nr = atomic_read(&nvme_tcp_cpu_queues[cpu]);
+
+		if (mq_map[cpu] != qid)
+			continue;
+		if (nr < min_queues) {
+			io_cpu = cpu;
+			min_queues = nr;
+		}
+	}
+	if (io_cpu != WORK_CPU_UNBOUND) {
+		queue->io_cpu = io_cpu;
+		atomic_inc(&nvme_tcp_cpu_queues[io_cpu]);
+		set_bit(NVME_TCP_Q_IO_CPU_SET, &queue->flags);
+	}
+	dev_dbg(ctrl->ctrl.device, "queue %d: using cpu %d\n",
+		qid + 1, queue->io_cpu);
+}
+
+static void nvme_tcp_put_queue_io_cpu(struct nvme_tcp_queue *queue)
+{
+	if (test_and_clear_bit(NVME_TCP_Q_IO_CPU_SET, &queue->flags))
+		atomic_dec(&nvme_tcp_cpu_queues[queue->io_cpu]);
 }
 
 static void nvme_tcp_tls_done(void *data, int status, key_serial_t pskid)
@@ -1722,7 +1916,7 @@ static int nvme_tcp_alloc_queue(struct nvme_ctrl *nctrl, int qid,
 
 	queue->sock->sk->sk_allocation = GFP_ATOMIC;
 	queue->sock->sk->sk_use_task_frag = false;
-	nvme_tcp_set_queue_io_cpu(queue);
+	queue->io_cpu = WORK_CPU_UNBOUND;
 	queue->request = NULL;
 	queue->data_remaining = 0;
 	queue->ddgst_remaining = 0;
@@ -1847,6 +2041,7 @@ static void nvme_tcp_stop_queue(struct nvme_ctrl *nctrl, int qid)
 	mutex_lock(&queue->queue_lock);
 	if (test_and_clear_bit(NVME_TCP_Q_LIVE, &queue->flags))
 		__nvme_tcp_stop_queue(queue);
+	nvme_tcp_put_queue_io_cpu(queue);
 	/* Stopping the queue will disable TLS */
 	queue->tls_enabled = false;
 	mutex_unlock(&queue->queue_lock);
@@ -1878,16 +2073,19 @@ static int nvme_tcp_start_queue(struct nvme_ctrl *nctrl, int idx)
 	nvme_tcp_init_recv_ctx(queue);
 	nvme_tcp_setup_sock_ops(queue);
 
-	if (idx)
+	if (idx) {
+		nvme_tcp_set_queue_io_cpu(queue);
 		ret = nvmf_connect_io_queue(nctrl, idx);
-	else
+	} else {
 		ret = nvmf_connect_admin_queue(nctrl);
+	}
 
 	if (!ret) {
 		set_bit(NVME_TCP_Q_LIVE, &queue->flags);
 	} else {
 		if (test_bit(NVME_TCP_Q_ALLOCATED, &queue->flags))
 			__nvme_tcp_stop_queue(queue);
+		nvme_tcp_put_queue_io_cpu(queue);
 		dev_err(nctrl->device,
 			"failed to connect queue: %d ret=%d\n", idx, ret);
 	}
@@ -2631,7 +2829,7 @@ static int nvme_tcp_poll(struct blk_mq_hw_ctx *hctx, struct io_comp_batch *iob)
 	set_bit(NVME_TCP_Q_POLLING, &queue->flags);
 	if (sk_can_busy_loop(sk) && skb_queue_empty_lockless(&sk->sk_receive_queue))
 		sk_busy_loop(sk, true);
-	nvme_tcp_try_recv(queue);
+	nvme_tcp_try_recv(queue, iob);
 	clear_bit(NVME_TCP_Q_POLLING, &queue->flags);
 	return queue->nr_cqe;
 }
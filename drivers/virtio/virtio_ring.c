@@ -70,6 +70,8 @@
 struct vring_desc_state_split {
 	void *data;			/* Data for callback. */
 	struct vring_desc *indir_desc;	/* Indirect descriptor, if any. */
+	u32 total_in_len;		/* In-order: bytes the device may write. */
+	u16 num;			/* In-order: descriptors used by this buffer. */
 };
 
 struct vring_desc_state_packed {
@@ -103,6 +105,17 @@ struct vring_virtqueue_split {
 	struct vring_desc_state_split *desc_state;
 	struct vring_desc_extra *desc_extra;
 
+	/*
+	 * In-order only: head of the oldest buffer not yet returned, and the
+	 * used ring entry currently being consumed. A device may complete a
+	 * batch of buffers with a single used entry naming the last one while
+	 * still advancing used->idx by the size of the batch, so the entry is
+	 * cached until every buffer up to batch_last_id is gone.
+	 */
+	u16 used_head;
+	u32 batch_last_id;
+	u32 batch_last_len;
+
 	/* DMA address and size information */
 	dma_addr_t queue_dma_addr;
 	size_t queue_size_in_bytes;
@@ -172,6 +185,9 @@ struct vring_virtqueue {
 	/* Host publishes avail event idx */
 	bool event;
 
+	/* Host uses buffers in the order they were made available */
+	bool in_order;
+
 	/* Do DMA mapping by driver */
 	bool premapped;
 
@@ -554,6 +570,7 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 	struct scatterlist *sg;
 	struct vring_desc *desc;
 	unsigned int i, n, avail, descs_used, prev, err_idx;
+	u32 total_in_len = 0;
 	int head;
 	bool indirect;
 
@@ -631,6 +648,7 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 				goto unmap_release;
 
 			prev = i;
+			total_in_len += sg->length;
 			/* Note that we trust indirect descriptor
 			 * table since it use stream DMA mapping.
 			 */
@@ -681,6 +699,10 @@ static inline int virtqueue_add_split(struct virtqueue *_vq,
 		vq->split.desc_state[head].indir_desc = desc;
 	else
 		vq->split.desc_state[head].indir_desc = ctx;
+	if (vq->in_order) {
+		vq->split.desc_state[head].num = descs_used;
+		vq->split.desc_state[head].total_in_len = total_in_len;
+	}
 
 	/* Put entry in available array (but don't update avail->idx until they
 	 * do sync). */
@@ -762,10 +784,42 @@ static bool virtqueue_kick_prepare_split(struct virtqueue *_vq)
 	return needs_kick;
 }
 
+static void detach_indirect_split(struct vring_virtqueue *vq,
+				  unsigned int head, void **ctx)
+{
+	unsigned int j;
+
+	if (vq->indirect) {
+		struct vring_desc *indir_desc =
+				vq->split.desc_state[head].indir_desc;
+		u32 len;
+
+		/* Free the indirect table, if any, now that it's unmapped. */
+		if (!indir_desc)
+			return;
+
+		len = vq->split.desc_extra[head].len;
+
+		BUG_ON(!(vq->split.desc_extra[head].flags &
+				VRING_DESC_F_INDIRECT));
+		BUG_ON(len == 0 || len % sizeof(struct vring_desc));
+
+		if (vq->do_unmap) {
+			for (j = 0; j < len / sizeof(struct vring_desc); j++)
+				vring_unmap_one_split_indirect(vq, &indir_desc[j]);
+		}
+
+		kfree(indir_desc);
+		vq->split.desc_state[head].indir_desc = NULL;
+	} else if (ctx) {
+		*ctx = vq->split.desc_state[head].indir_desc;
+	}
+}
+
 static void detach_buf_split(struct vring_virtqueue *vq, unsigned int head,
 			     void **ctx)
 {
-	unsigned int i, j;
+	unsigned int i;
 	__virtio16 nextflag = cpu_to_virtio16(vq->vq.vdev, VRING_DESC_F_NEXT);
 
 	/* Clear data ptr. */
@@ -787,31 +841,31 @@ static void detach_buf_split(struct vring_virtqueue *vq, unsigned int head,
 	/* Plus final descriptor */
 	vq->vq.num_free++;
 
-	if (vq->indirect) {
-		struct vring_desc *indir_desc =
-				vq->split.desc_state[head].indir_desc;
-		u32 len;
+	detach_indirect_split(vq, head, ctx);
+}
 
-		/* Free the indirect table, if any, now that it's unmapped. */
-		if (!indir_desc)
-			return;
+/*
+ * In-order devices consume descriptors in the order they were made
+ * available, so the descriptor ring doubles as a FIFO: desc_extra[].next
+ * is left as the initial circular chain, a buffer always occupies
+ * desc_state[head].num consecutive slots, and freeing it is just a matter
+ * of accounting. No free list needs to be threaded through desc_extra.
+ */
+static void detach_buf_split_in_order(struct vring_virtqueue *vq,
+				      unsigned int head, void **ctx)
+{
+	struct vring_desc_state_split *state = &vq->split.desc_state[head];
+	unsigned int i, n, mask = vq->split.vring.num - 1;
 
-		len = vq->split.desc_extra[head].len;
+	/* Clear data ptr. */
+	state->data = NULL;
 
-		BUG_ON(!(vq->split.desc_extra[head].flags &
-				VRING_DESC_F_INDIRECT));
-		BUG_ON(len == 0 || len % sizeof(struct vring_desc));
+	for (i = head, n = 0; n < state->num; n++, i = (i + 1) & mask)
+		vring_unmap_one_split(vq, i);
 
-		if (vq->do_unmap) {
-			for (j = 0; j < len / sizeof(struct vring_desc); j++)
-				vring_unmap_one_split_indirect(vq, &indir_desc[j]);
-		}
+	vq->vq.num_free += state->num;
 
-		kfree(indir_desc);
-		vq->split.desc_state[head].indir_desc = NULL;
-	} else if (ctx) {
-		*ctx = vq->split.desc_state[head].indir_desc;
-	}
+	detach_indirect_split(vq, head, ctx);
 }
 
 static bool more_used_split(const struct vring_virtqueue *vq)
@@ -878,6 +932,94 @@ static void *virtqueue_get_buf_ctx_split(struct virtqueue *_vq,
 	return ret;
 }
 
+static void *virtqueue_get_buf_ctx_split_in_order(struct virtqueue *_vq,
+						  unsigned int *len,
+						  void **ctx)
+{
+	struct vring_virtqueue *vq = to_vvq(_vq);
+	unsigned int num = vq->split.vring.num;
+	unsigned int head;
+	void *ret;
+
+	START_USE(vq);
+
+	if (unlikely(vq->broken)) {
+		END_USE(vq);
+		return NULL;
+	}
+
+	if (vq->split.batch_last_id == UINT_MAX) {
+		u16 last_used;
+
+		if (!more_used_split(vq)) {
+			pr_debug("No more buffers in queue\n");
+			END_USE(vq);
+			return NULL;
+		}
+
+		/* Only get used array entries after they have been exposed by host. */
+		virtio_rmb(vq->weak_barriers);
+
+		last_used = (vq->last_used_idx & (num - 1));
+		vq->split.batch_last_id = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].id);
+		vq->split.batch_last_len = virtio32_to_cpu(_vq->vdev,
+				vq->split.vring.used->ring[last_used].len);
+
+		if (unlikely(vq->split.batch_last_id >= num)) {
+			BAD_RING(vq, "id %u out of range\n",
+				 vq->split.batch_last_id);
+			return NULL;
+		}
+		/* The batch must end on an outstanding buffer, or we'd walk past it. */
+		if (unlikely(!vq->split.desc_state[vq->split.batch_last_id].data)) {
+			BAD_RING(vq, "id %u is not a head!\n",
+				 vq->split.batch_last_id);
+			return NULL;
+		}
+	}
+
+	/*
+	 * Buffers complete in the order they were added, so the next one is
+	 * always the oldest outstanding head; only the last buffer of a batch
+	 * has its length reported by the device.
+	 */
+	head = vq->split.used_head;
+	if (unlikely(!vq->split.desc_state[head].data)) {
+		BAD_RING(vq, "id %u is not a head!\n", head);
+		return NULL;
+	}
+
+	if (head == vq->split.batch_last_id) {
+		*len = vq->split.batch_last_len;
+		vq->split.batch_last_id = UINT_MAX;
+	} else {
+		*len = vq->split.desc_state[head].total_in_len;
+	}
+
+	/* detach_buf_split_in_order clears data, so grab it now. */
+	ret = vq->split.desc_state[head].data;
+	vq->split.used_head = (head + vq->split.desc_state[head].num) &
+			      (num - 1);
+	detach_buf_split_in_order(vq, head, ctx);
+
+	/*
+	 * used->idx counts buffers, not used entries: the device skips the
+	 * ring slots of a batch it completed with a single entry, so the
+	 * next entry is read from where the batch ends.
+	 */
+	vq->last_used_idx++;
+	if (!(vq->split.avail_flags_shadow & VRING_AVAIL_F_NO_INTERRUPT))
+		virtio_store_mb(vq->weak_barriers,
+				&vring_used_event(&vq->split.vring),
+				cpu_to_virtio16(_vq->vdev, vq->last_used_idx));
+
+	LAST_ADD_TIME_INVALID(vq);
+
+	END_USE(vq);
+	return ret;
+}
+
 static void virtqueue_disable_cb_split(struct virtqueue *_vq)
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
@@ -984,7 +1126,10 @@ static void *virtqueue_detach_unused_buf_split(struct virtqueue *_vq)
 			continue;
 		/* detach_buf_split clears data, so grab it now. */
 		buf = vq->split.desc_state[i].data;
-		detach_buf_split(vq, i, NULL);
+		if (vq->in_order)
+			detach_buf_split_in_order(vq, i, NULL);
+		else
+			detach_buf_split(vq, i, NULL);
 		vq->split.avail_idx_shadow--;
 		vq->split.vring.avail->idx = cpu_to_virtio16(_vq->vdev,
 				vq->split.avail_idx_shadow);
@@ -994,6 +1139,10 @@ static void *virtqueue_detach_unused_buf_split(struct virtqueue *_vq)
 	/* That should have freed everything. */
 	BUG_ON(vq->vq.num_free != vq->split.vring.num);
 
+	/* Nothing is outstanding any more: restart the FIFO at free_head. */
+	vq->split.used_head = vq->free_head;
+	vq->split.batch_last_id = UINT_MAX;
+
 	END_USE(vq);
 	return NULL;
 }
@@ -1037,6 +1186,9 @@ static void virtqueue_reinit_split(struct vring_virtqueue *vq)
 
 	virtqueue_init(vq, num);
 
+	vq->split.used_head = vq->free_head;
+	vq->split.batch_last_id = UINT_MAX;
+
 	virtqueue_vring_init_split(&vq->split, vq);
 }
 
@@ -1047,6 +1199,8 @@ static void virtqueue_vring_attach_split(struct vring_virtqueue *vq,
 
 	/* Put everything in free lists. */
 	vq->free_head = 0;
+	vq->split.used_head = 0;
+	vq->split.batch_last_id = UINT_MAX;
 }
 
 static int vring_alloc_state_extra_split(struct vring_virtqueue_split *vring_split)
@@ -2096,6 +2250,7 @@ static struct virtqueue *vring_create_virtqueue_packed(
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = false;
 
 	if (virtio_has_feature(vdev, VIRTIO_F_ORDER_PLATFORM))
 		vq->weak_barriers = false;
@@ -2417,8 +2572,12 @@ void *virtqueue_get_buf_ctx(struct virtqueue *_vq, unsigned int *len,
 {
 	struct vring_virtqueue *vq = to_vvq(_vq);
 
-	return vq->packed_ring ? virtqueue_get_buf_ctx_packed(_vq, len, ctx) :
-				 virtqueue_get_buf_ctx_split(_vq, len, ctx);
+	if (vq->packed_ring)
+		return virtqueue_get_buf_ctx_packed(_vq, len, ctx);
+
+	return vq->in_order ?
+	       virtqueue_get_buf_ctx_split_in_order(_vq, len, ctx) :
+	       virtqueue_get_buf_ctx_split(_vq, len, ctx);
 }
 EXPORT_SYMBOL_GPL(virtqueue_get_buf_ctx);
 
@@ -2641,6 +2800,7 @@ static struct virtqueue *__vring_new_virtqueue(unsigned int index,
 	vq->indirect = virtio_has_feature(vdev, VIRTIO_RING_F_INDIRECT_DESC) &&
 		!context;
 	vq->event = virtio_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX);
+	vq->in_order = virtio_has_feature(vdev, VIRTIO_F_IN_ORDER);
 
 	if (virtio_has_feature(vdev, VIRTIO_F_ORDER_PLATFORM))
 		vq->weak_barriers = false;
@@ -2956,11 +3116,17 @@ void vring_transport_features(struct virtio_device *vdev)
 			break;
 		case VIRTIO_F_NOTIFICATION_DATA:
 			break;
+		case VIRTIO_F_IN_ORDER:
+			break;
 		default:
 			/* We don't understand this bit. */
 			__virtio_clear_bit(vdev, i);
 		}
 	}
+
+	/* The in-order fast path is only implemented for split rings. */
+	if (__virtio_test_bit(vdev, VIRTIO_F_RING_PACKED))
+		__virtio_clear_bit(vdev, VIRTIO_F_IN_ORDER);
 }
 EXPORT_SYMBOL_GPL(vring_transport_features);
 
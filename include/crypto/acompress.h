@@ -43,6 +43,9 @@ struct acomp_req {
  *
  * @compress:		Function performs a compress operation
  * @decompress:		Function performs a de-compress operation
+ * @batch_compress:	Optional, compresses an array of requests in one call
+ * @batch_decompress:	Optional, de-compresses an array of requests in one
+ *			call
  * @dst_free:		Frees destination buffer if allocated inside the
  *			algorithm
  * @reqsize:		Context size for (de)compression requests
@@ -51,6 +54,10 @@ struct acomp_req {
 struct crypto_acomp {
 	int (*compress)(struct acomp_req *req);
 	int (*decompress)(struct acomp_req *req);
+	int (*batch_compress)(struct acomp_req *reqs[], int errors[],
+			      unsigned int nr_reqs);
+	int (*batch_decompress)(struct acomp_req *reqs[], int errors[],
+				unsigned int nr_reqs);
 	void (*dst_free)(struct scatterlist *dst);
 	unsigned int reqsize;
 	struct crypto_tfm base;
@@ -265,4 +272,39 @@ static inline int crypto_acomp_decompress(struct acomp_req *req)
 	return crypto_acomp_reqtfm(req)->decompress(req);
 }
 
+/**
+ * crypto_acomp_batch_compress() -- Invoke compress on a batch of requests
+ *
+ * Submits all requests at once and returns when every one of them has
+ * completed. Software compressors spread large batches across CPUs. While
+ * the batch runs it owns the completion callbacks of the requests, they are
+ * left as they were on return. Must be called from a context that can sleep.
+ *
+ * @reqs:	array of compress requests, all allocated on the same tfm
+ * @errors:	array of @nr_reqs entries receiving the status of each request
+ * @nr_reqs:	number of requests in the batch
+ *
+ * Return:	zero if every request succeeded; otherwise the first error in
+ *		@errors, or an error code if the batch could not be submitted,
+ *		-EINVAL if the requests are not all on the same tfm
+ */
+int crypto_acomp_batch_compress(struct acomp_req *reqs[], int errors[],
+				unsigned int nr_reqs);
+
+/**
+ * crypto_acomp_batch_decompress() -- Invoke decompress on a batch of requests
+ *
+ * Like crypto_acomp_batch_compress(), for decompression.
+ *
+ * @reqs:	array of decompress requests, all allocated on the same tfm
+ * @errors:	array of @nr_reqs entries receiving the status of each request
+ * @nr_reqs:	number of requests in the batch
+ *
+ * Return:	zero if every request succeeded; otherwise the first error in
+ *		@errors, or an error code if the batch could not be submitted,
+ *		-EINVAL if the requests are not all on the same tfm
+ */
+int crypto_acomp_batch_decompress(struct acomp_req *reqs[], int errors[],
+				  unsigned int nr_reqs);
+
 #endif
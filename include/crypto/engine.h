@@ -17,6 +17,9 @@
 struct crypto_engine;
 struct device;
 
+/* Upper limit for crypto_engine_set_batch() */
+#define CRYPTO_ENGINE_MAX_INFLIGHT 256
+
 /*
  * struct crypto_engine_op - crypto hardware engine operations
  * @do_one_request: do encryption for current request
@@ -78,6 +81,10 @@ struct crypto_engine *crypto_engine_alloc_init_and_set(struct device *dev,
 						       bool retry_support,
 						       int (*cbk_do_batch)(struct crypto_engine *engine),
 						       bool rt, int qlen);
+int crypto_engine_set_batch(struct crypto_engine *engine,
+			    unsigned int max_inflight,
+			    int (*cbk_do_batch)(struct crypto_engine *engine));
+struct device *crypto_engine_get_dev(struct crypto_engine *engine);
 void crypto_engine_exit(struct crypto_engine *engine);
 
 int crypto_engine_register_aead(struct aead_engine_alg *alg);
@@ -191,6 +191,13 @@ struct shash_desc {
  *	      This is a counterpart to @init_tfm, used to remove
  *	      various changes set in @init_tfm.
  * @clone_tfm: Copy transform into new object, may allocate memory.
+ * @finup_mb: Optional, finish hashing @num_msgs equal length messages that
+ *	      share the state of @desc as their common prefix, writing one
+ *	      digest per message. Implementations that interleave independent
+ *	      messages provide this and may return -EOPNOTSUPP for inputs
+ *	      they cannot handle, in which case the messages are hashed one
+ *	      at a time.
+ * @mb_max_msgs: Most messages @finup_mb accepts in one call; 1 if unset.
  * @descsize: Size of the operational state for the message digest. This state
  * 	      size is the memory size that needs to be allocated for
  *	      shash_desc.__ctx
@@ -213,8 +220,12 @@ struct shash_alg {
 	int (*init_tfm)(struct crypto_shash *tfm);
 	void (*exit_tfm)(struct crypto_shash *tfm);
 	int (*clone_tfm)(struct crypto_shash *dst, struct crypto_shash *src);
+	int (*finup_mb)(struct shash_desc *desc, const u8 * const data[],
+			unsigned int len, u8 * const outs[],
+			unsigned int num_msgs);
 
 	unsigned int descsize;
+	unsigned int mb_max_msgs;
 
 	union {
 		struct HASH_ALG_COMMON;
@@ -944,6 +955,40 @@ int crypto_shash_final(struct shash_desc *desc, u8 *out);
 int crypto_shash_finup(struct shash_desc *desc, const u8 *data,
 		       unsigned int len, u8 *out);
 
+/**
+ * crypto_shash_mb_max_msgs() - maximum supported multibuffer interleaving
+ * @tfm: hash transformation object
+ *
+ * Return: the number of messages crypto_shash_finup_mb() hashes at once on
+ *	   this transform; 1 if the algorithm does not interleave messages.
+ */
+static inline unsigned int crypto_shash_mb_max_msgs(struct crypto_shash *tfm)
+{
+	return crypto_shash_alg(tfm)->mb_max_msgs;
+}
+
+/**
+ * crypto_shash_finup_mb() - multibuffer message hashing
+ * @desc: operational state for the common prefix of all messages
+ * @data: the remaining data of each message
+ * @len: length of each entry of @data
+ * @outs: output buffer for each message digest
+ * @num_msgs: number of messages
+ *
+ * Finishes @num_msgs messages that start from the state in @desc and each
+ * continue with @len bytes of their own, as crypto_shash_finup() would for
+ * each of them on a copy of @desc. Algorithms that support it hash the
+ * messages interleaved, which is faster than hashing them one at a time.
+ * More than crypto_shash_mb_max_msgs() messages are hashed one at a time.
+ * The state in @desc is consumed.
+ *
+ * Context: Any context.
+ * Return: 0 on success; < 0 if an error occurred.
+ */
+int crypto_shash_finup_mb(struct shash_desc *desc, const u8 * const data[],
+			  unsigned int len, u8 * const outs[],
+			  unsigned int num_msgs);
+
 static inline void shash_desc_zero(struct shash_desc *desc)
 {
 	memzero_explicit(desc,
@@ -659,6 +659,21 @@ struct blk_mq_ops {
 	 */
 	void (*map_queues)(struct blk_mq_tag_set *set);
 
+	/**
+	 * @dma_map: Map a long-lived buffer for DMA once, so that requests
+	 * whose data lies in @bvec can skip per-I/O mapping. Returns an
+	 * opaque cookie for @dma_unmap or an ERR_PTR. The caller guarantees
+	 * the bvec array stays valid until @dma_unmap is called.
+	 */
+	void *(*dma_map)(struct request_queue *q, struct bio_vec *bvec,
+			 int nr_vecs);
+
+	/**
+	 * @dma_unmap: Tear down a mapping created by @dma_map. No request
+	 * referencing the buffer may be in flight.
+	 */
+	void (*dma_unmap)(struct request_queue *q, void *dma_tag);
+
 #ifdef CONFIG_BLK_DEBUG_FS
 	/**
 	 * @show_rq: Used by the debugfs implementation to show driver-specific
@@ -1176,4 +1191,21 @@ static inline int blk_rq_map_sg(struct request_queue *q, struct request *rq,
 }
 void blk_dump_rq_flags(struct request *, char *);
 
+static inline void *blk_mq_dma_map(struct block_device *bdev,
+		struct bio_vec *bvec, int nr_vecs)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+
+	if (!queue_is_mq(q) || !q->mq_ops->dma_map)
+		return ERR_PTR(-EOPNOTSUPP);
+	return q->mq_ops->dma_map(q, bvec, nr_vecs);
+}
+
+static inline void blk_mq_dma_unmap(struct block_device *bdev, void *dma_tag)
+{
+	struct request_queue *q = bdev_get_queue(bdev);
+
+	q->mq_ops->dma_unmap(q, dma_tag);
+}
+
 #endif /* BLK_MQ_H */
@@ -2284,11 +2284,17 @@ int  generic_map_update_batch(struct bpf_map *map, struct file *map_file,
 int  generic_map_delete_batch(struct bpf_map *map,
 			      const union bpf_attr *attr,
 			      union bpf_attr __user *uattr);
+
+#define BPF_F_PERCPU_FOLD (BPF_F_PERCPU_SUM | BPF_F_PERCPU_MIN | BPF_F_PERCPU_MAX)
+int bpf_map_check_percpu_fold(const struct bpf_map *map, u64 elem_flags);
+void bpf_percpu_fold_value(const struct bpf_map *map, void *dst,
+			   const void *src, u64 elem_flags);
 struct bpf_map *bpf_map_get_curr_or_next(u32 *id);
 struct bpf_prog *bpf_prog_get_curr_or_next(u32 *id);
 
 int bpf_map_alloc_pages(const struct bpf_map *map, gfp_t gfp, int nid,
-			unsigned long nr_pages, struct page **page_array);
+			unsigned int order, unsigned long nr_pages,
+			struct page **page_array);
 #ifdef CONFIG_MEMCG
 void *bpf_map_kmalloc_node(const struct bpf_map *map, size_t size, gfp_t flags,
 			   int node);
@@ -510,6 +510,7 @@ struct bpf_verifier_state_list {
 	struct bpf_verifier_state state;
 	struct bpf_verifier_state_list *next;
 	int miss_cnt, hit_cnt;
+	u32 sig; /* see state_sig() */
 };
 
 struct bpf_loop_inline_state {
@@ -713,6 +714,7 @@ struct bpf_verifier_env {
 	bool test_reg_invariants;	/* fail verification on register invariants violations */
 	struct bpf_verifier_state *cur_state; /* current verifier state */
 	struct bpf_verifier_state_list **explored_states; /* search pruning optimization */
+	u32 explored_cnt; /* states currently linked into explored_states */
 	struct bpf_verifier_state_list *free_list;
 	struct bpf_map *used_maps[MAX_USED_MAPS]; /* array of map's used by eBPF program */
 	struct btf_mod_pair used_btfs[MAX_USED_BTFS]; /* array of BTF's used by BPF program */
@@ -767,6 +769,10 @@ struct bpf_verifier_env {
 	u32 peak_states;
 	/* longest register parentage chain walked for liveness marking */
 	u32 longest_mark_read_walk;
+	/* state pruning statistics, reported with BPF_LOG_STATS */
+	u32 prune_visits, prune_hits;
+	u32 states_compared, states_sig_skipped;
+	u64 states_scanned;
 	bpfptr_t fd_array;
 
 	/* bit mask to keep track of whether a register has been accessed
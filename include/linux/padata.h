@@ -27,18 +27,22 @@
  *
  * @list: List entry, to attach to the padata lists.
  * @pd: Pointer to the internal control structure.
+ * @shard: Shard the object is reordered in.
  * @cb_cpu: Callback cpu for serializatioon.
  * @seq_nr: Sequence number of the parallelized data object.
  * @info: Used to pass information from the parallel to the serial function.
+ * @reorder_ts: Time the object entered its reorder queue.
  * @parallel: Parallel execution function.
  * @serial: Serial complete function.
  */
 struct padata_priv {
 	struct list_head	list;
 	struct parallel_data	*pd;
+	struct padata_shard	*shard;
 	int			cb_cpu;
 	unsigned int		seq_nr;
 	int			info;
+	u64			reorder_ts;
 	void                    (*parallel)(struct padata_priv *padata);
 	void                    (*serial)(struct padata_priv *padata);
 };
@@ -78,6 +82,40 @@ struct padata_cpumask {
 	cpumask_var_t	cbcpu;
 };
 
+/**
+ * struct padata_shard - Parallelization and reordering state of the parallel
+ * CPUs of one NUMA node. Objects are serialized in order within a shard only.
+ *
+ * @pd: Backpointer to the internal control structure.
+ * @pcpu: The parallel CPUs of this shard.
+ * @node: NUMA node of @pcpu.
+ * @seq_nr: Sequence number of the last object submitted to this shard.
+ * @processed: Number of already processed objects.
+ * @cpu: Next CPU to be processed.
+ * @depth: Number of objects waiting in the reorder lists of this shard.
+ * @max_depth: Highest @depth seen.
+ * @reordered: Number of objects that went through the reorder lists.
+ * @wait_ns: Total time those objects spent in the reorder lists.
+ * @max_wait_ns: Longest time an object spent in the reorder lists.
+ * @reorder_work: work struct for reordering.
+ * @lock: Reorder lock.
+ */
+struct padata_shard {
+	struct parallel_data		*pd;
+	cpumask_var_t			pcpu;
+	int				node;
+	atomic_t			seq_nr;
+	unsigned int			processed;
+	int				cpu;
+	atomic_t			depth;
+	unsigned int			max_depth;
+	u64				reordered;
+	u64				wait_ns;
+	u64				max_wait_ns;
+	struct work_struct		reorder_work;
+	spinlock_t                      ____cacheline_aligned lock;
+};
+
 /**
  * struct parallel_data - Internal control structure, covers everything
  * that depends on the cpumask in use.
@@ -86,24 +124,20 @@ struct padata_cpumask {
  * @reorder_list: percpu reorder lists
  * @squeue: percpu padata queues used for serialuzation.
  * @refcnt: Number of objects holding a reference on this parallel_data.
- * @seq_nr: Sequence number of the parallelized data object.
- * @processed: Number of already processed objects.
- * @cpu: Next CPU to be processed.
  * @cpumask: The cpumasks in use for parallel and serial workers.
- * @reorder_work: work struct for reordering.
- * @lock: Reorder lock.
+ * @shards: One shard per NUMA node with parallel CPUs.
+ * @nr_shards: Number of @shards.
+ * @node_shard: Shard used for each node's callback CPUs.
  */
 struct parallel_data {
 	struct padata_shell		*ps;
 	struct padata_list		__percpu *reorder_list;
 	struct padata_serial_queue	__percpu *squeue;
 	refcount_t			refcnt;
-	unsigned int			seq_nr;
-	unsigned int			processed;
-	int				cpu;
 	struct padata_cpumask		cpumask;
-	struct work_struct		reorder_work;
-	spinlock_t                      ____cacheline_aligned lock;
+	struct padata_shard		*shards;
+	unsigned int			nr_shards;
+	struct padata_shard		**node_shard;
 };
 
 /**
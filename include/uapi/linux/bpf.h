@@ -96,7 +96,9 @@ struct bpf_lpm_trie_key_hdr {
 	__u32	prefixlen;
 };
 
-/* Key of an a BPF_MAP_TYPE_LPM_TRIE entry, with trailing byte array. */
+/* Key of an a BPF_MAP_TYPE_LPM_TRIE or BPF_MAP_TYPE_LPM_MULTIBIT entry,
+ * with trailing byte array.
+ */
 struct bpf_lpm_trie_key_u8 {
 	union {
 		struct bpf_lpm_trie_key_hdr	hdr;
@@ -659,6 +661,25 @@ union bpf_iter_link_info {
  *			returning the lock. This must be specified if the
  *			elements contain a spinlock.
  *
+ *		For maps of type **BPF_MAP_TYPE_{PERCPU_HASH, LRU_PERCPU_HASH,
+ *		PERCPU_ARRAY, PERCPU_CGROUP_STORAGE}** one of the following
+ *		may be specified to have the per-CPU copies of each value
+ *		folded into a single value in kernel, treating the value as
+ *		an array of **__u64**. The map's *value_size* must then be a
+ *		multiple of 8 and the values must not contain special fields.
+ *		Each element then takes *value_size* rather than
+ *		*value_size* rounded up to 8 times the number of possible
+ *		CPUs in the *values* buffer.
+ *
+ *		**BPF_F_PERCPU_SUM**
+ *			Sum the per-CPU copies.
+ *
+ *		**BPF_F_PERCPU_MIN**
+ *			Take the minimum of the per-CPU copies.
+ *
+ *		**BPF_F_PERCPU_MAX**
+ *			Take the maximum of the per-CPU copies.
+ *
  *		On success, *count* elements from the map are copied into the
  *		user buffer, with the keys copied into *keys* and the values
  *		copied into the corresponding indices in *values*.
@@ -1010,6 +1031,7 @@ enum bpf_map_type {
 	BPF_MAP_TYPE_USER_RINGBUF,
 	BPF_MAP_TYPE_CGRP_STORAGE,
 	BPF_MAP_TYPE_ARENA,
+	BPF_MAP_TYPE_LPM_MULTIBIT,
 	__MAX_BPF_MAP_TYPE
 };
 
@@ -1354,6 +1376,9 @@ enum {
 	BPF_NOEXIST	= 1, /* create new element if it didn't exist */
 	BPF_EXIST	= 2, /* update existing element */
 	BPF_F_LOCK	= 4, /* spin_lock-ed map_lookup/map_update */
+	BPF_F_PERCPU_SUM = 8, /* fold per-CPU values in lookup batch */
+	BPF_F_PERCPU_MIN = 16,
+	BPF_F_PERCPU_MAX = 32,
 };
 
 /* flags for BPF_MAP_CREATE command */
@@ -1412,6 +1437,38 @@ enum {
 
 /* Do not translate kernel bpf_arena pointers to user pointers */
 	BPF_F_NO_USER_CONV	= (1U << 18),
+
+/* Size the buckets of a BPF_F_NO_PREALLOC hash map to its element count,
+ * growing and shrinking them in the background as elements come and go.
+ */
+	BPF_F_RESIZABLE		= (1U << 19),
+
+/* Evict LRU hash map elements with per-CPU CLOCK (second chance) sharding
+ * instead of the global active/inactive lists.
+ */
+	BPF_F_CLOCK_LRU		= (1U << 20),
+
+/* One BPF_MAP_TYPE_RINGBUF ring per possible CPU behind a single map fd.
+ * Programs produce into the ring of the CPU they run on. The ring of CPU n
+ * is mmap()'ed like a regular ring buffer, starting at page offset
+ * n * (2 + 2 * max_entries / page_size). Polling the map fd reports data
+ * in any of the rings.
+ */
+	BPF_F_PERCPU_RING	= (1U << 21),
+
+/* Allocate and fault in bpf_arena memory in aligned 2MB chunks, physically
+ * contiguous when possible. A user fault in an unused chunk allocates the
+ * whole chunk. A contiguous chunk is mapped with one PMD unless transparent
+ * hugepages are set to "never"; otherwise a fault maps all allocated pages
+ * of its chunk.
+ */
+	BPF_F_ARENA_HUGE	= (1U << 22),
+
+/* Keep all bits of a BPF_MAP_TYPE_BLOOM_FILTER value within one 64-byte
+ * block, selected together with the bit positions by a single hash, so a
+ * lookup touches one cache line.
+ */
+	BPF_F_BLOOM_BLOCKED	= (1U << 23),
 };
 
 /* Flags for BPF_PROG_QUERY. */
@@ -1488,6 +1545,13 @@ union bpf_attr {
 		 *
 		 * BPF_MAP_TYPE_ARENA - contains the address where user space
 		 * is going to mmap() the arena. It has to be page aligned.
+		 *
+		 * BPF_MAP_TYPE_RINGBUF - the lowest 32 bits are a byte
+		 * threshold and the upper 32 bits a delay in microseconds
+		 * (at most one second). If set, consumers are woken up once
+		 * the threshold was produced since the last wakeup, or when
+		 * the delay expires, rather than for every record they are
+		 * waiting on. Both must be set, or neither.
 		 */
 		__u64	map_extra;
 
@@ -5138,7 +5202,8 @@ union bpf_attr {
  *
  *	Return
  *		The number of traversed map elements for success, **-EINVAL** for
- *		invalid **flags**.
+ *		invalid **flags**, **-EBUSY** if called from NMI on top of a
+ *		**BPF_F_RESIZABLE** hash map moving elements to a resized table.
  *
  * long bpf_snprintf(char *str, u32 str_size, const char *fmt, u64 *data, u32 data_len)
  *	Description
@@ -6482,6 +6547,7 @@ struct bpf_cpumap_val {
 		int   fd;	/* prog fd on map write */
 		__u32 id;	/* prog id on map read */
 	} bpf_prog;
+	__u32 batch_size; /* frames per kthread round, 0 for default */
 };
 
 enum sk_action {
@@ -612,6 +612,9 @@ enum io_uring_register_op {
 	/* clone registered buffers from source ring to current ring */
 	IORING_REGISTER_CLONE_BUFFERS		= 30,
 
+	/* DMA map registered buffers for a block device */
+	IORING_REGISTER_MAP_BUFFERS		= 31,
+
 	/* this goes last */
 	IORING_REGISTER_LAST,
 
@@ -707,6 +710,18 @@ struct io_uring_clone_buffers {
 	__u32	pad[6];
 };
 
+/*
+ * Argument for IORING_REGISTER_MAP_BUFFERS: pre-map registered buffers
+ * [buf_start, buf_end) for DMA by the block device open as @fd.
+ */
+struct io_uring_map_buffers {
+	__s32	fd;
+	__u32	buf_start;
+	__u32	buf_end;
+	__u32	flags;
+	__u32	pad[4];
+};
+
 struct io_uring_buf {
 	__u64	addr;
 	__u32	len;
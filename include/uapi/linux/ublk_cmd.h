@@ -87,6 +87,13 @@
 #define	UBLK_IO_COMMIT_AND_FETCH_REQ	0x21
 #define	UBLK_IO_NEED_GET_DATA	0x22
 
+/*
+ * COMMIT_AND_FETCH_BATCH: only used if ublksrv set UBLK_F_BATCH_IO. One
+ *      command per queue replaces the per-tag FETCH_REQ and
+ *      COMMIT_AND_FETCH_REQ commands, see struct ublk_batch_io_cmd.
+ */
+#define	UBLK_IO_COMMIT_AND_FETCH_BATCH	0x23
+
 /* Any new IO command should encode by __IOWR() */
 #define	UBLK_U_IO_FETCH_REQ		\
 	_IOWR('u', UBLK_IO_FETCH_REQ, struct ublksrv_io_cmd)
@@ -94,10 +101,19 @@
 	_IOWR('u', UBLK_IO_COMMIT_AND_FETCH_REQ, struct ublksrv_io_cmd)
 #define	UBLK_U_IO_NEED_GET_DATA		\
 	_IOWR('u', UBLK_IO_NEED_GET_DATA, struct ublksrv_io_cmd)
+#define	UBLK_U_IO_COMMIT_AND_FETCH_BATCH	\
+	_IOWR('u', UBLK_IO_COMMIT_AND_FETCH_BATCH, struct ublk_batch_io_cmd)
 
 /* only ABORT means that no re-fetch */
 #define UBLK_IO_RES_OK			0
 #define UBLK_IO_RES_NEED_GET_DATA	1
+/*
+ * UBLK_F_AUTO_BUF_REG: the request buffer couldn't be registered at the
+ * passed index, e.g. because it is out of the ring's buffer table. The
+ * request is owned by the server, which has no access to its data and
+ * should commit it with an error result.
+ */
+#define UBLK_IO_RES_NEED_REG_BUF	2
 #define UBLK_IO_RES_ABORT		(-ENODEV)
 
 #define UBLKSRV_CMD_BUF_OFFSET	0
@@ -190,6 +206,41 @@
  */
 #define UBLK_F_ZONED (1ULL << 8)
 
+/*
+ * Zero copy via io_uring fixed buffers
+ *
+ * When a request is dispatched to the ublk server, the driver registers
+ * the request's pages as a fixed buffer of the io_uring the FETCH or
+ * COMMIT_AND_FETCH command was issued on, at the buffer index passed in
+ * ublksrv_io_cmd->addr. The server then issues backend IO against that
+ * buffer (offset 0 up to the request size) with any fixed-buffer opcode,
+ * e.g. IORING_OP_READ_FIXED/IORING_OP_WRITE_FIXED, and no data is copied.
+ * The buffer is unregistered again when the request is committed. If
+ * registration fails, the command completes with UBLK_IO_RES_NEED_REG_BUF
+ * instead of UBLK_IO_RES_OK.
+ *
+ * The ring has to register a (sparse) buffer table large enough for the
+ * passed indexes beforehand. Can't be combined with UBLK_F_USER_COPY,
+ * UBLK_F_NEED_GET_DATA or UBLK_F_USER_RECOVERY_REISSUE, and isn't
+ * available for UBLK_F_UNPRIVILEGED_DEV.
+ */
+#define UBLK_F_AUTO_BUF_REG	(1ULL << 9)
+
+/*
+ * Batched io command handling
+ *
+ * Instead of one FETCH_REQ/COMMIT_AND_FETCH_REQ command per tag, the
+ * server keeps one UBLK_U_IO_COMMIT_AND_FETCH_BATCH command per queue in
+ * flight. Each command commits a vector of completed tags and completes
+ * once new requests are available, with the fetched tags written back to
+ * the same element array, so one uring_cmd covers many IOs in both
+ * directions.
+ *
+ * Can't be combined with UBLK_F_NEED_GET_DATA, UBLK_F_AUTO_BUF_REG or
+ * user recovery.
+ */
+#define UBLK_F_BATCH_IO		(1ULL << 10)
+
 /* device state */
 #define UBLK_S_DEV_DEAD	0
 #define UBLK_S_DEV_LIVE	1
@@ -330,12 +381,55 @@ struct ublksrv_io_cmd {
 		 * re-used to pass back the allocated LBA for
 		 * UBLK_IO_OP_ZONE_APPEND which actually depends on
 		 * UBLK_F_USER_COPY
+		 *
+		 * With UBLK_F_AUTO_BUF_REG, `addr` carries the io_uring fixed
+		 * buffer index the request buffer is registered at instead.
 		 */
 		__u64	addr;
 		__u64	zone_append_lba;
 	};
 };
 
+/* element of the tag array passed via ublk_batch_io_cmd->elem_addr */
+struct ublk_batch_io_elem {
+	__u16	tag;
+
+/* queue setup, replaces UBLK_IO_FETCH_REQ for this tag */
+#define UBLK_BATCH_IO_F_FETCH		(1U << 0)
+/* commit io result, replaces UBLK_IO_COMMIT_AND_FETCH_REQ for this tag */
+#define UBLK_BATCH_IO_F_COMMIT		(1U << 1)
+	__u16	flags;
+
+	/* io result for commit, UBLK_IO_RES_OK for fetched tags */
+	__s32	result;
+
+	/* io buffer for the next request of this tag, same as ublksrv_io_cmd */
+	union {
+		__u64	addr;
+		__u64	zone_append_lba;
+	};
+};
+
+/*
+ * issued to ublk driver via /dev/ublkcN for UBLK_F_BATCH_IO
+ *
+ * The first @nr_elem elements of the array at @elem_addr are committed in
+ * order; processing stops at the first invalid element, and the command
+ * fails with its error. Otherwise the command stays queued until requests
+ * are dispatched to this queue, then up to @nr_elem of them are written to
+ * the array (tag and result only) and cqe->res holds how many. The io
+ * descriptors are read from the mmapped descriptor area as usual.
+ *
+ * cqe->res may be zero if requests had to be retried, and is
+ * UBLK_IO_RES_ABORT once the queue is being torn down.
+ */
+struct ublk_batch_io_cmd {
+	__u16	q_id;
+	__u16	nr_elem;
+	__u32	flags;		/* reserved, must be zero */
+	__u64	elem_addr;
+};
+
 struct ublk_param_basic {
 #define UBLK_ATTR_READ_ONLY            (1 << 0)
 #define UBLK_ATTR_ROTATIONAL           (1 << 1)
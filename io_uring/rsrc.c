@@ -9,6 +9,8 @@
 #include <linux/hugetlb.h>
 #include <linux/compat.h>
 #include <linux/io_uring.h>
+#include <linux/io_uring/cmd.h>
+#include <linux/blk-mq.h>
 
 #include <uapi/linux/io_uring.h>
 
@@ -110,6 +112,16 @@ static int io_buffer_validate(struct iovec *iov)
 	return 0;
 }
 
+static void io_buffer_dma_unmap(struct io_mapped_ubuf *imu)
+{
+#ifdef CONFIG_BLOCK
+	blk_mq_dma_unmap(I_BDEV(imu->dma_file->f_mapping->host), imu->dma_tag);
+#endif
+	fput(imu->dma_file);
+	imu->dma_file = NULL;
+	imu->dma_tag = NULL;
+}
+
 static void io_buffer_unmap(struct io_ring_ctx *ctx, struct io_mapped_ubuf **slot)
 {
 	struct io_mapped_ubuf *imu = *slot;
@@ -119,10 +131,16 @@ static void io_buffer_unmap(struct io_ring_ctx *ctx, struct io_mapped_ubuf **slo
 	if (imu != &dummy_ubuf) {
 		if (!refcount_dec_and_test(&imu->refs))
 			return;
-		for (i = 0; i < imu->nr_bvecs; i++)
-			unpin_user_page(imu->bvec[i].bv_page);
-		if (imu->acct_pages)
-			io_unaccount_mem(ctx, imu->acct_pages);
+		if (imu->dma_file)
+			io_buffer_dma_unmap(imu);
+		if (imu->release) {
+			imu->release(imu->priv);
+		} else {
+			for (i = 0; i < imu->nr_bvecs; i++)
+				unpin_user_page(imu->bvec[i].bv_page);
+			if (imu->acct_pages)
+				io_unaccount_mem(ctx, imu->acct_pages);
+		}
 		kvfree(imu);
 	}
 }
@@ -996,6 +1014,11 @@ static int io_sqe_buffer_register(struct io_ring_ctx *ctx, struct iovec *iov,
 	imu->folio_shift = PAGE_SHIFT;
 	if (coalesced)
 		imu->folio_shift = data.folio_shift;
+	imu->release = NULL;
+	imu->priv = NULL;
+	imu->dir = (1 << ITER_SOURCE) | (1 << ITER_DEST);
+	imu->dma_file = NULL;
+	imu->dma_tag = NULL;
 	refcount_set(&imu->refs, 1);
 	off = (unsigned long) iov->iov_base & ((1UL << imu->folio_shift) - 1);
 	*pimu = imu;
@@ -1099,6 +1122,8 @@ int io_import_fixed(int ddir, struct iov_iter *iter,
 	/* not inside the mapped region */
 	if (unlikely(buf_addr < imu->ubuf || buf_end > (imu->ubuf + imu->len)))
 		return -EFAULT;
+	if (unlikely(!(imu->dir & (1 << ddir))))
+		return -EFAULT;
 
 	/*
 	 * Might not be a start of buffer, set size appropriately
@@ -1107,7 +1132,13 @@ int io_import_fixed(int ddir, struct iov_iter *iter,
 	offset = buf_addr - imu->ubuf;
 	iov_iter_bvec(iter, ddir, imu->bvec, imu->nr_bvecs, offset + len);
 
-	if (offset) {
+	/*
+	 * Kernel buffers come straight from a request's bio_vecs, which don't
+	 * share one segment size, so the folio_shift shortcut below is invalid.
+	 */
+	if (offset && imu->release) {
+		iov_iter_advance(iter, offset);
+	} else if (offset) {
 		/*
 		 * Don't use iov_iter_advance() here, as it's really slow for
 		 * using the latter parts of a big fixed buffer - it iterates
@@ -1147,6 +1178,117 @@ int io_import_fixed(int ddir, struct iov_iter *iter,
 	return 0;
 }
 
+/**
+ * io_buffer_register_bvec - register a request's pages as a fixed buffer
+ * @cmd:	uring_cmd issued on the ring the buffer is registered into
+ * @rq:		request whose bio_vecs back the buffer
+ * @release:	called with @rq once io_uring drops the last buffer reference
+ * @index:	fixed buffer slot, must be empty (sparse registered)
+ * @issue_flags: issue flags passed down from the uring_cmd handler
+ *
+ * Lets a driver hand the pages of an in-flight block request to the ring
+ * owning @cmd, so that subsequent READ_FIXED/WRITE_FIXED (or other fixed
+ * buffer users) operate directly on them. The buffer is addressed from
+ * offset 0 and only allows the data direction matching @rq.
+ */
+int io_buffer_register_bvec(struct io_uring_cmd *cmd, struct request *rq,
+			    void (*release)(void *), unsigned int index,
+			    unsigned int issue_flags)
+{
+	struct io_ring_ctx *ctx = cmd_to_io_kiocb(cmd)->ctx;
+	struct req_iterator rq_iter;
+	struct io_mapped_ubuf *imu;
+	struct bio_vec bv;
+	unsigned int nr_bvecs = 0;
+	int ret = 0;
+
+	io_ring_submit_lock(ctx, issue_flags);
+	if (!ctx->buf_data) {
+		ret = -ENXIO;
+		goto unlock;
+	}
+	if (index >= ctx->nr_user_bufs) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+	index = array_index_nospec(index, ctx->nr_user_bufs);
+	if (ctx->user_bufs[index] != &dummy_ubuf) {
+		ret = -EBUSY;
+		goto unlock;
+	}
+
+	imu = kvmalloc(struct_size(imu, bvec, blk_rq_nr_phys_segments(rq)),
+		       GFP_KERNEL);
+	if (!imu) {
+		ret = -ENOMEM;
+		goto unlock;
+	}
+
+	rq_for_each_bvec(bv, rq, rq_iter)
+		imu->bvec[nr_bvecs++] = bv;
+
+	imu->ubuf = 0;
+	imu->len = blk_rq_bytes(rq);
+	imu->nr_bvecs = nr_bvecs;
+	imu->folio_shift = PAGE_SHIFT;
+	imu->acct_pages = 0;
+	imu->release = release;
+	imu->priv = rq;
+	imu->dma_file = NULL;
+	imu->dma_tag = NULL;
+	/* WRITE requests are a data source, READ requests a destination */
+	imu->dir = 1 << (op_is_write(req_op(rq)) ? ITER_SOURCE : ITER_DEST);
+	refcount_set(&imu->refs, 1);
+
+	ctx->user_bufs[index] = imu;
+	*io_get_tag_slot(ctx->buf_data, index) = 0;
+unlock:
+	io_ring_submit_unlock(ctx, issue_flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(io_buffer_register_bvec);
+
+/**
+ * io_buffer_unregister_bvec - drop a buffer added by io_buffer_register_bvec
+ * @cmd:	uring_cmd issued on the ring holding the buffer
+ * @index:	fixed buffer slot
+ * @issue_flags: issue flags passed down from the uring_cmd handler
+ *
+ * The slot is emptied right away, while the ->release() callback runs once
+ * every request that already imported the buffer has completed.
+ */
+int io_buffer_unregister_bvec(struct io_uring_cmd *cmd, unsigned int index,
+			      unsigned int issue_flags)
+{
+	struct io_ring_ctx *ctx = cmd_to_io_kiocb(cmd)->ctx;
+	struct io_mapped_ubuf *imu;
+	int ret = 0;
+
+	io_ring_submit_lock(ctx, issue_flags);
+	if (!ctx->buf_data) {
+		ret = -ENXIO;
+		goto unlock;
+	}
+	if (index >= ctx->nr_user_bufs) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+	index = array_index_nospec(index, ctx->nr_user_bufs);
+	imu = ctx->user_bufs[index];
+	if (imu == &dummy_ubuf || !imu->release) {
+		ret = -EINVAL;
+		goto unlock;
+	}
+
+	ret = io_queue_rsrc_removal(ctx->buf_data, index, imu);
+	if (!ret)
+		ctx->user_bufs[index] = (struct io_mapped_ubuf *)&dummy_ubuf;
+unlock:
+	io_ring_submit_unlock(ctx, issue_flags);
+	return ret;
+}
+EXPORT_SYMBOL_GPL(io_buffer_unregister_bvec);
+
 static int io_clone_buffers(struct io_ring_ctx *ctx, struct io_ring_ctx *src_ctx)
 {
 	struct io_mapped_ubuf **user_bufs;
@@ -1237,3 +1379,76 @@ int io_register_clone_buffers(struct io_ring_ctx *ctx, void __user *arg)
 		fput(file);
 	return ret;
 }
+
+/*
+ * Ask the block device behind @fd to DMA map a range of registered buffers
+ * up front, so that I/O issued against them can skip per-request mapping.
+ * The mapping lives as long as the buffer itself and is dropped together
+ * with it in io_buffer_unmap().
+ */
+int io_register_map_buffers(struct io_ring_ctx *ctx, void __user *arg)
+{
+#ifdef CONFIG_BLOCK
+	struct io_uring_map_buffers map;
+	struct block_device *bdev;
+	struct file *file;
+	unsigned int i;
+	int ret = 0;
+
+	if (copy_from_user(&map, arg, sizeof(map)))
+		return -EFAULT;
+	if (map.flags || memchr_inv(map.pad, 0, sizeof(map.pad)))
+		return -EINVAL;
+	if (map.buf_start >= map.buf_end || map.buf_end > ctx->nr_user_bufs)
+		return -EINVAL;
+
+	file = fget(map.fd);
+	if (!file)
+		return -EBADF;
+	if (!S_ISBLK(file_inode(file)->i_mode)) {
+		ret = -EOPNOTSUPP;
+		goto out_fput;
+	}
+	bdev = I_BDEV(file->f_mapping->host);
+
+	for (i = map.buf_start; i < map.buf_end; i++) {
+		struct io_mapped_ubuf *imu = ctx->user_bufs[i];
+		void *tag;
+
+		if (imu == &dummy_ubuf)
+			continue;
+		if (imu->release) {
+			ret = -EINVAL;
+			break;
+		}
+		/* buffers may be shared with another ring through cloning */
+		if (cmpxchg(&imu->dma_file, NULL, file)) {
+			ret = -EBUSY;
+			break;
+		}
+		tag = blk_mq_dma_map(bdev, imu->bvec, imu->nr_bvecs);
+		if (IS_ERR(tag)) {
+			WRITE_ONCE(imu->dma_file, NULL);
+			ret = PTR_ERR(tag);
+			break;
+		}
+		imu->dma_tag = tag;
+		get_file(file);
+	}
+
+	/* all or nothing: undo what this call mapped */
+	if (ret) {
+		while (i-- > map.buf_start) {
+			struct io_mapped_ubuf *imu = ctx->user_bufs[i];
+
+			if (imu != &dummy_ubuf && imu->dma_file == file)
+				io_buffer_dma_unmap(imu);
+		}
+	}
+out_fput:
+	fput(file);
+	return ret;
+#else
+	return -EOPNOTSUPP;
+#endif
+}
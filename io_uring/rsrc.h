@@ -47,6 +47,14 @@ struct io_mapped_ubuf {
 	unsigned int    folio_shift;
 	refcount_t	refs;
 	unsigned long	acct_pages;
+	/* set for kernel owned buffers, see io_buffer_register_bvec() */
+	void		(*release)(void *);
+	void		*priv;
+	/* allowed ITER_* directions for kernel buffers, as a bitmask */
+	u8		dir;
+	/* block device premapping, see io_register_map_buffers() */
+	struct file	*dma_file;
+	void		*dma_tag;
 	struct bio_vec	bvec[] __counted_by(nr_bvecs);
 };
 
@@ -68,6 +76,7 @@ int io_import_fixed(int ddir, struct iov_iter *iter,
 			   u64 buf_addr, size_t len);
 
 int io_register_clone_buffers(struct io_ring_ctx *ctx, void __user *arg);
+int io_register_map_buffers(struct io_ring_ctx *ctx, void __user *arg);
 void __io_sqe_buffers_unregister(struct io_ring_ctx *ctx);
 int io_sqe_buffers_unregister(struct io_ring_ctx *ctx);
 int io_sqe_buffers_register(struct io_ring_ctx *ctx, void __user *arg,
@@ -6,6 +6,8 @@
 #include <linux/btf_ids.h>
 #include <linux/vmalloc.h>
 #include <linux/pagemap.h>
+#include <linux/mman.h>
+#include <linux/pfn_t.h>
 
 /*
  * bpf_arena is a sparsely populated shared memory region between bpf program and
@@ -34,12 +36,26 @@
  * bpf program can allocate a page via bpf_arena_alloc_pages() kfunc
  * which will insert it into kernel vm_area.
  * The later fault-in from user space will populate that page into user vma.
+ *
+ * With BPF_F_ARENA_HUGE the arena is handled in 2M chunks instead, aligned
+ * in user address space: a user fault in a chunk nothing was allocated in
+ * yet allocates all of it, as one physically contiguous block when possible.
+ * A chunk that is one such block is mapped into the user vma with a single
+ * PMD, unless THP is set to "never" (the vma is VM_HUGEPAGE, so "madvise"
+ * is enough), otherwise every fault maps all allocated pages of its chunk, so
+ * prefaulting the arena with MADV_POPULATE_WRITE takes one fault per chunk.
+ * The pages of a block stay order-0 pages, since bpf_arena_free_pages()
+ * frees them one by one; zapping part of a chunk drops its PMD and the rest
+ * faults back in with PTEs.
  */
 
 /* number of bytes addressable by LDX/STX insn with 16-bit 'off' field */
 #define GUARD_SZ (1ull << sizeof_field(struct bpf_insn, off) * 8)
 #define KERN_VM_SZ (SZ_4G + GUARD_SZ)
 
+#define ARENA_HUGE_ORDER get_order(SZ_2M)
+#define ARENA_HUGE_PAGES (SZ_2M >> PAGE_SHIFT)
+
 struct bpf_arena {
 	struct bpf_map map;
 	u64 user_vm_start;
@@ -102,7 +118,8 @@ static struct bpf_map *arena_map_alloc(union bpf_attr *attr)
 	    /* BPF_F_MMAPABLE must be set */
 	    !(attr->map_flags & BPF_F_MMAPABLE) ||
 	    /* No unsupported flags present */
-	    (attr->map_flags & ~(BPF_F_SEGV_ON_FAULT | BPF_F_MMAPABLE | BPF_F_NO_USER_CONV)))
+	    (attr->map_flags & ~(BPF_F_SEGV_ON_FAULT | BPF_F_MMAPABLE | BPF_F_NO_USER_CONV |
+				 BPF_F_ARENA_HUGE)))
 		return ERR_PTR(-EINVAL);
 
 	if (attr->map_extra & ~PAGE_MASK)
@@ -253,6 +270,122 @@ static void arena_vm_close(struct vm_area_struct *vma)
 
 #define MT_ENTRY ((void *)&arena_map_ops) /* unused. has to be valid pointer */
 
+/*
+ * Allocate page_cnt pages for the user addresses starting at uaddr. Every 2M
+ * aligned chunk the range fully covers gets one naturally aligned 2M block,
+ * so that it can be mapped with a PMD; the partial chunks at either end get
+ * order-0 pages.
+ */
+static int arena_alloc_pages_huge(struct bpf_arena *arena, int node_id,
+				  unsigned long uaddr, long page_cnt,
+				  struct page **pages)
+{
+	long i, j, n;
+	int order, ret;
+
+	for (i = 0; i < page_cnt; i += n) {
+		unsigned long addr = uaddr + i * PAGE_SIZE;
+
+		if (IS_ALIGNED(addr, SZ_2M) && page_cnt - i >= ARENA_HUGE_PAGES) {
+			order = ARENA_HUGE_ORDER;
+			n = ARENA_HUGE_PAGES;
+		} else {
+			order = 0;
+			n = min_t(long, page_cnt - i,
+				  (round_down(addr, SZ_2M) + SZ_2M - addr) >> PAGE_SHIFT);
+		}
+		ret = bpf_map_alloc_pages(&arena->map, GFP_KERNEL | __GFP_ZERO,
+					  node_id, order, n, pages + i);
+		if (ret) {
+			for (j = 0; j < i; j++)
+				__free_page(pages[j]);
+			return ret;
+		}
+	}
+	return 0;
+}
+
+/* Allocate the whole chunk around pgoff if none of it is allocated yet */
+static int arena_alloc_chunk(struct bpf_arena *arena, long pgoff)
+{
+	long page_cnt_max = (arena->user_vm_end - arena->user_vm_start) >> PAGE_SHIFT;
+	u64 kern_vm_start = bpf_arena_get_kern_vm_start(arena);
+	unsigned long chunk, start, end;
+	long i, first, page_cnt;
+	struct page **pages;
+	u32 uaddr32;
+	int ret;
+
+	/* chunks are aligned in user address space, not in arena offsets */
+	chunk = round_down(arena->user_vm_start + pgoff * PAGE_SIZE, SZ_2M);
+	start = max(chunk, arena->user_vm_start);
+	end = min(chunk + SZ_2M, arena->user_vm_start + page_cnt_max * PAGE_SIZE);
+	first = (start - arena->user_vm_start) >> PAGE_SHIFT;
+	page_cnt = (end - start) >> PAGE_SHIFT;
+
+	ret = mtree_insert_range(&arena->mt, first, first + page_cnt - 1,
+				 MT_ENTRY, GFP_KERNEL);
+	if (ret)
+		return ret;
+
+	pages = kvcalloc(page_cnt, sizeof(struct page *), GFP_KERNEL);
+	if (!pages) {
+		ret = -ENOMEM;
+		goto out;
+	}
+
+	ret = arena_alloc_pages_huge(arena, NUMA_NO_NODE, start, page_cnt, pages);
+	if (ret)
+		goto out_free_pages;
+
+	uaddr32 = (u32)start;
+	ret = vm_area_map_pages(arena->kern_vm, kern_vm_start + uaddr32,
+				kern_vm_start + uaddr32 + page_cnt * PAGE_SIZE, pages);
+	if (ret) {
+		for (i = 0; i < page_cnt; i++)
+			__free_page(pages[i]);
+		goto out_free_pages;
+	}
+	kvfree(pages);
+	return 0;
+
+out_free_pages:
+	kvfree(pages);
+out:
+	mtree_erase(&arena->mt, first);
+	return ret;
+}
+
+/* Map the allocated pages of the chunk around the fault into the vma.
+ * The faulting page itself is installed by the caller via vmf->page.
+ */
+static void arena_map_chunk(struct bpf_arena *arena, struct vm_fault *vmf)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	long kbase = bpf_arena_get_kern_vm_start(arena);
+	unsigned long addr, end;
+	struct page *page;
+
+	/*
+	 * vma->vm_start is not the arena start once the vma was split, so go
+	 * from user_vm_start, and leave chunks this vma only partly covers to
+	 * be faulted in page by page.
+	 */
+	addr = round_down(arena->user_vm_start + vmf->pgoff * PAGE_SIZE, SZ_2M);
+	end = addr + SZ_2M;
+	if (addr < vma->vm_start || end > vma->vm_end)
+		return;
+	for (; addr < end; addr += PAGE_SIZE) {
+		if (addr == (vmf->address & PAGE_MASK))
+			continue;
+		page = vmalloc_to_page((void *)(kbase + (u32)addr));
+		if (!page)
+			continue;
+		/* -EBUSY for pages this vma already maps */
+		vm_insert_page(vma, addr, page);
+	}
+}
+
 static vm_fault_t arena_vm_fault(struct vm_fault *vmf)
 {
 	struct bpf_map *map = vmf->vma->vm_file->private_data;
@@ -274,12 +407,19 @@ static vm_fault_t arena_vm_fault(struct vm_fault *vmf)
 		/* User space requested to segfault when page is not allocated by bpf prog */
 		return VM_FAULT_SIGSEGV;
 
+	if ((arena->map.map_flags & BPF_F_ARENA_HUGE) &&
+	    !arena_alloc_chunk(arena, vmf->pgoff)) {
+		page = vmalloc_to_page((void *)kaddr);
+		goto out;
+	}
+
+	/* Part of the chunk is in use, allocate just this page */
 	ret = mtree_insert(&arena->mt, vmf->pgoff, MT_ENTRY, GFP_KERNEL);
 	if (ret)
 		return VM_FAULT_SIGSEGV;
 
 	/* Account into memcg of the process that created bpf_arena */
-	ret = bpf_map_alloc_pages(map, GFP_KERNEL | __GFP_ZERO, NUMA_NO_NODE, 1, &page);
+	ret = bpf_map_alloc_pages(map, GFP_KERNEL | __GFP_ZERO, NUMA_NO_NODE, 0, 1, &page);
 	if (ret) {
 		mtree_erase(&arena->mt, vmf->pgoff);
 		return VM_FAULT_SIGSEGV;
@@ -292,15 +432,61 @@ static vm_fault_t arena_vm_fault(struct vm_fault *vmf)
 		return VM_FAULT_SIGSEGV;
 	}
 out:
+	if (arena->map.map_flags & BPF_F_ARENA_HUGE)
+		arena_map_chunk(arena, vmf);
 	page_ref_add(page, 1);
 	vmf->page = page;
 	return 0;
 }
 
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+/* Map a chunk that is one naturally aligned 2M block with a single PMD */
+static vm_fault_t arena_vm_huge_fault(struct vm_fault *vmf, unsigned int order)
+{
+	struct vm_area_struct *vma = vmf->vma;
+	struct bpf_map *map = vma->vm_file->private_data;
+	struct bpf_arena *arena = container_of(map, struct bpf_arena, map);
+	unsigned long addr = vmf->address & PMD_MASK;
+	struct page *page;
+	long kbase, i;
+
+	if (order != PMD_ORDER || PMD_SIZE != SZ_2M ||
+	    !(map->map_flags & BPF_F_ARENA_HUGE))
+		return VM_FAULT_FALLBACK;
+	if (addr < vma->vm_start || addr + PMD_SIZE > vma->vm_end ||
+	    addr < arena->user_vm_start)
+		return VM_FAULT_FALLBACK;
+
+	kbase = bpf_arena_get_kern_vm_start(arena);
+
+	guard(mutex)(&arena->lock);
+	page = vmalloc_to_page((void *)(kbase + (u32)addr));
+	if (!page) {
+		/* arena_vm_fault() raises SIGSEGV for BPF_F_SEGV_ON_FAULT */
+		if (map->map_flags & BPF_F_SEGV_ON_FAULT)
+			return VM_FAULT_FALLBACK;
+		if (arena_alloc_chunk(arena, (addr - arena->user_vm_start) >> PAGE_SHIFT))
+			return VM_FAULT_FALLBACK;
+		page = vmalloc_to_page((void *)(kbase + (u32)addr));
+	}
+
+	if (!IS_ALIGNED(page_to_pfn(page), ARENA_HUGE_PAGES))
+		return VM_FAULT_FALLBACK;
+	for (i = 1; i < ARENA_HUGE_PAGES; i++)
+		if (vmalloc_to_page((void *)(kbase + (u32)(addr + i * PAGE_SIZE))) != page + i)
+			return VM_FAULT_FALLBACK;
+
+	return vmf_insert_pfn_pmd(vmf, page_to_pfn_t(page), vmf->flags & FAULT_FLAG_WRITE);
+}
+#endif
+
 static const struct vm_operations_struct arena_vm_ops = {
 	.open		= arena_vm_open,
 	.close		= arena_vm_close,
 	.fault          = arena_vm_fault,
+#ifdef CONFIG_TRANSPARENT_HUGEPAGE
+	.huge_fault	= arena_vm_huge_fault,
+#endif
 };
 
 static unsigned long arena_get_unmapped_area(struct file *filp, unsigned long addr,
@@ -329,6 +515,10 @@ static unsigned long arena_get_unmapped_area(struct file *filp, unsigned long ad
 	ret = mm_get_unmapped_area(current->mm, filp, addr, len * 2, 0, flags);
 	if (IS_ERR_VALUE(ret))
 		return ret;
+	/* let PMDs map whole chunks when we get to pick the address */
+	if ((map->map_flags & BPF_F_ARENA_HUGE) && !arena->user_vm_start &&
+	    !(flags & MAP_FIXED) && len >= SZ_2M)
+		ret = round_up(ret, SZ_2M);
 	if ((ret >> 32) == ((ret + len - 1) >> 32))
 		return ret;
 	if (WARN_ON_ONCE(arena->user_vm_start))
@@ -372,6 +562,13 @@ static int arena_map_mmap(struct bpf_map *map, struct vm_area_struct *vma)
 	 * potential change of user_vm_start.
 	 */
 	vm_flags_set(vma, VM_DONTEXPAND);
+	/*
+	 * vm_insert_page() of the rest of a chunk on fault. VM_HUGEPAGE
+	 * gets arena_vm_huge_fault() called under the THP "madvise" policy
+	 * too; "never" still keeps the arena on PTEs.
+	 */
+	if (map->map_flags & BPF_F_ARENA_HUGE)
+		vm_flags_set(vma, VM_MIXEDMAP | VM_HUGEPAGE);
 	vma->vm_ops = &arena_vm_ops;
 	return 0;
 }
@@ -453,8 +650,13 @@ static long arena_alloc_pages(struct bpf_arena *arena, long uaddr, long page_cnt
 	if (ret)
 		goto out_free_pages;
 
-	ret = bpf_map_alloc_pages(&arena->map, GFP_KERNEL | __GFP_ZERO,
-				  node_id, page_cnt, pages);
+	if (arena->map.map_flags & BPF_F_ARENA_HUGE)
+		ret = arena_alloc_pages_huge(arena, node_id,
+					     arena->user_vm_start + pgoff * PAGE_SIZE,
+					     page_cnt, pages);
+	else
+		ret = bpf_map_alloc_pages(&arena->map, GFP_KERNEL | __GFP_ZERO,
+					  node_id, 0, page_cnt, pages);
 	if (ret)
 		goto out;
 
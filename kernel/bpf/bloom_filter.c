@@ -7,16 +7,28 @@
 #include <linux/err.h>
 #include <linux/jhash.h>
 #include <linux/random.h>
+#include <linux/siphash.h>
 #include <linux/btf_ids.h>
 
 #define BLOOM_CREATE_FLAG_MASK \
-	(BPF_F_NUMA_NODE | BPF_F_ZERO_SEED | BPF_F_ACCESS_MASK)
+	(BPF_F_NUMA_NODE | BPF_F_ZERO_SEED | BPF_F_ACCESS_MASK | \
+	 BPF_F_BLOOM_BLOCKED)
+
+/* BPF_F_BLOOM_BLOCKED: all bits of a value live in one cache line sized,
+ * aligned block of the bitset
+ */
+#define BLOOM_BLOCK_BYTES	64
+#define BLOOM_BLOCK_BITS	(BLOOM_BLOCK_BYTES * BITS_PER_BYTE)
 
 struct bpf_bloom_filter {
 	struct bpf_map map;
 	u32 bitset_mask;
 	u32 hash_seed;
 	u32 nr_hash_funcs;
+	/* blocked variant only */
+	u32 block_mask;
+	siphash_key_t block_key;
+	unsigned long *blocks;
 	unsigned long bitset[];
 };
 
@@ -33,12 +45,40 @@ static u32 hash(struct bpf_bloom_filter *bloom, void *value,
 	return h & bloom->bitset_mask;
 }
 
+/* One 64-bit hash per value: the upper half picks the block, the lower
+ * half seeds double hashing of the bit positions within it. Returns the
+ * block and fills in the positions as a block sized mask.
+ */
+static unsigned long *bloom_block(struct bpf_bloom_filter *bloom, void *value,
+				  u32 value_size, unsigned long *mask)
+{
+	u64 h = siphash(value, value_size, &bloom->block_key);
+	u32 i, pos = h % BLOOM_BLOCK_BITS;
+	u32 step = (u32)(h / BLOOM_BLOCK_BITS) | 1;
+
+	bitmap_zero(mask, BLOOM_BLOCK_BITS);
+	for (i = 0; i < bloom->nr_hash_funcs; i++) {
+		__set_bit(pos, mask);
+		pos = (pos + step) % BLOOM_BLOCK_BITS;
+	}
+
+	return bloom->blocks + ((h >> 32) & bloom->block_mask) *
+			       BITS_TO_LONGS(BLOOM_BLOCK_BITS);
+}
+
 static long bloom_map_peek_elem(struct bpf_map *map, void *value)
 {
 	struct bpf_bloom_filter *bloom =
 		container_of(map, struct bpf_bloom_filter, map);
+	DECLARE_BITMAP(mask, BLOOM_BLOCK_BITS);
+	unsigned long *block;
 	u32 i, h;
 
+	if (bloom->blocks) {
+		block = bloom_block(bloom, value, map->value_size, mask);
+		return bitmap_subset(mask, block, BLOOM_BLOCK_BITS) ? 0 : -ENOENT;
+	}
+
 	for (i = 0; i < bloom->nr_hash_funcs; i++) {
 		h = hash(bloom, value, map->value_size, i);
 		if (!test_bit(h, bloom->bitset))
@@ -52,11 +92,20 @@ static long bloom_map_push_elem(struct bpf_map *map, void *value, u64 flags)
 {
 	struct bpf_bloom_filter *bloom =
 		container_of(map, struct bpf_bloom_filter, map);
+	DECLARE_BITMAP(mask, BLOOM_BLOCK_BITS);
+	unsigned long *block;
 	u32 i, h;
 
 	if (flags != BPF_ANY)
 		return -EINVAL;
 
+	if (bloom->blocks) {
+		block = bloom_block(bloom, value, map->value_size, mask);
+		for_each_set_bit(i, mask, BLOOM_BLOCK_BITS)
+			set_bit(i, block);
+		return 0;
+	}
+
 	for (i = 0; i < bloom->nr_hash_funcs; i++) {
 		h = hash(bloom, value, map->value_size, i);
 		set_bit(h, bloom->bitset);
@@ -96,7 +145,9 @@ static struct bpf_map *bloom_map_alloc(union bpf_attr *attr)
 {
 	u32 bitset_bytes, bitset_mask, nr_hash_funcs, nr_bits;
 	int numa_node = bpf_map_attr_numa_node(attr);
+	bool blocked = attr->map_flags & BPF_F_BLOOM_BLOCKED;
 	struct bpf_bloom_filter *bloom;
+	u32 min_bits = BITS_PER_LONG;
 
 	if (attr->key_size != 0 || attr->value_size == 0 ||
 	    attr->max_entries == 0 ||
@@ -134,8 +185,10 @@ static struct bpf_map *bloom_map_alloc(union bpf_attr *attr)
 		bitset_bytes = BITS_TO_BYTES(U32_MAX);
 		bitset_mask = U32_MAX;
 	} else {
-		if (nr_bits <= BITS_PER_LONG)
-			nr_bits = BITS_PER_LONG;
+		if (blocked)
+			min_bits = BLOOM_BLOCK_BITS;
+		if (nr_bits <= min_bits)
+			nr_bits = min_bits;
 		else
 			nr_bits = roundup_pow_of_two(nr_bits);
 		bitset_bytes = BITS_TO_BYTES(nr_bits);
@@ -143,6 +196,9 @@ static struct bpf_map *bloom_map_alloc(union bpf_attr *attr)
 	}
 
 	bitset_bytes = roundup(bitset_bytes, sizeof(unsigned long));
+	/* room to align the blocks to a cache line */
+	if (blocked)
+		bitset_bytes += BLOOM_BLOCK_BYTES;
 	bloom = bpf_map_area_alloc(sizeof(*bloom) + bitset_bytes, numa_node);
 
 	if (!bloom)
@@ -153,8 +209,14 @@ static struct bpf_map *bloom_map_alloc(union bpf_attr *attr)
 	bloom->nr_hash_funcs = nr_hash_funcs;
 	bloom->bitset_mask = bitset_mask;
 
-	if (!(attr->map_flags & BPF_F_ZERO_SEED))
+	if (blocked) {
+		bloom->blocks = PTR_ALIGN(bloom->bitset, BLOOM_BLOCK_BYTES);
+		bloom->block_mask = ((u64)bitset_mask + 1) / BLOOM_BLOCK_BITS - 1;
+		if (!(attr->map_flags & BPF_F_ZERO_SEED))
+			get_random_bytes(&bloom->block_key, sizeof(bloom->block_key));
+	} else if (!(attr->map_flags & BPF_F_ZERO_SEED)) {
 		bloom->hash_seed = get_random_u32();
+	}
 
 	return &bloom->map;
 }
@@ -197,6 +259,8 @@ static u64 bloom_map_mem_usage(const struct bpf_map *map)
 	bloom = container_of(map, struct bpf_bloom_filter, map);
 	bitset_bytes = BITS_TO_BYTES((u64)bloom->bitset_mask + 1);
 	bitset_bytes = roundup(bitset_bytes, sizeof(unsigned long));
+	if (bloom->blocks)
+		bitset_bytes += BLOOM_BLOCK_BYTES;
 	return sizeof(*bloom) + bitset_bytes;
 }
 
@@ -13,6 +13,10 @@
 #define PERCPU_FREE_TARGET		(4)
 #define PERCPU_NR_SCANS			PERCPU_FREE_TARGET
 
+#define CLOCK_FREE_TARGET		(64)
+#define CLOCK_FREE_LOW			(CLOCK_FREE_TARGET / 4)
+#define CLOCK_NR_SCANS			(2 * CLOCK_FREE_TARGET)
+
 /* Helpers to get the local list index */
 #define LOCAL_LIST_IDX(t)	((t) - BPF_LOCAL_LIST_T_OFFSET)
 #define LOCAL_FREE_LIST_IDX	LOCAL_LIST_IDX(BPF_LRU_LOCAL_LIST_T_FREE)
@@ -496,9 +500,226 @@ static struct bpf_lru_node *bpf_common_lru_pop_free(struct bpf_lru *lru,
 	return node;
 }
 
+/* Clock LRU
+ *
+ * Each CPU owns a shard holding a ring of in-use nodes and a cache of
+ * free ones.  A lookup only sets node->ref.  The clock hand sweeps the
+ * ring, clearing the ref bit of referenced nodes (second chance) and
+ * evicting the others in batches.  The free cache is refilled from
+ * irq_work once it runs low, so an update normally only takes one node
+ * off its own shard under an uncontended lock.
+ */
+static struct bpf_lru_node *__bpf_clock_pop_free(struct bpf_lru_clock *c)
+{
+	struct bpf_lru_node *node;
+
+	node = list_first_entry_or_null(&c->free, struct bpf_lru_node, list);
+	if (node) {
+		list_del(&node->list);
+		WRITE_ONCE(c->nr_free, c->nr_free - 1);
+	}
+
+	return node;
+}
+
+static void __bpf_clock_add(struct bpf_lru *lru, struct bpf_lru_clock *c,
+			    int cpu, struct bpf_lru_node *node, u32 hash)
+{
+	*(u32 *)((void *)node + lru->hash_offset) = hash;
+	node->cpu = cpu;
+	node->type = BPF_LRU_LIST_T_ACTIVE;
+	bpf_lru_node_clear_ref(node);
+	/* Right behind the hand: the last one the next sweep looks at */
+	list_add_tail(&node->list, c->hand);
+}
+
+static void __bpf_clock_move_to_free(struct bpf_lru_clock *c,
+				     struct bpf_lru_node *node)
+{
+	if (c->hand == &node->list)
+		c->hand = node->list.next;
+
+	node->type = BPF_LRU_LIST_T_FREE;
+	bpf_lru_node_clear_ref(node);
+	list_move(&node->list, &c->free);
+	WRITE_ONCE(c->nr_free, c->nr_free + 1);
+}
+
+/* Advance the hand until nr nodes are evicted or lru->nr_scans nodes have
+ * been looked at.  With force, the scan goes on for another nr_scans
+ * nodes ignoring the ref bit, so a non-empty ring always gives something
+ * back.
+ */
+static unsigned int __bpf_clock_sweep(struct bpf_lru *lru,
+				      struct bpf_lru_clock *c,
+				      unsigned int nr, bool force)
+{
+	unsigned int budget = force ? 2 * lru->nr_scans : lru->nr_scans;
+	unsigned int i, nfreed = 0;
+	struct bpf_lru_node *node;
+	struct list_head *cur;
+
+	for (i = 0; i < budget && nfreed < nr && !list_empty(&c->ring); i++) {
+		cur = c->hand;
+		if (cur == &c->ring)
+			cur = cur->next;
+		node = list_entry(cur, struct bpf_lru_node, list);
+		c->hand = cur->next;
+
+		if (bpf_lru_node_is_ref(node) && i < lru->nr_scans) {
+			bpf_lru_node_clear_ref(node);
+			continue;
+		}
+
+		if (lru->del_from_htab(lru->del_arg, node)) {
+			__bpf_clock_move_to_free(c, node);
+			nfreed++;
+		}
+	}
+
+	return nfreed;
+}
+
+/* Free nodes parked on other shards are taken before anything is evicted,
+ * so a map that is not full does not lose elements.  At most half of a
+ * remote cache is taken to keep the shards from trading nodes back and
+ * forth.
+ */
+static unsigned int bpf_clock_steal_free(struct bpf_lru *lru,
+					 struct bpf_lru_clock *c,
+					 unsigned int nr)
+{
+	struct bpf_lru_clock *steal_c;
+	unsigned int n, nstolen = 0;
+	unsigned long flags;
+	LIST_HEAD(stolen);
+	int steal;
+
+	for (steal = get_next_cpu(c->cpu); steal != c->cpu && nstolen < nr;
+	     steal = get_next_cpu(steal)) {
+		steal_c = per_cpu_ptr(lru->clock_lru, steal);
+		if (!READ_ONCE(steal_c->nr_free))
+			continue;
+
+		raw_spin_lock_irqsave(&steal_c->lock, flags);
+		n = min(nr - nstolen, DIV_ROUND_UP(steal_c->nr_free, 2));
+		nstolen += n;
+		WRITE_ONCE(steal_c->nr_free, steal_c->nr_free - n);
+		while (n--)
+			list_move(steal_c->free.next, &stolen);
+		raw_spin_unlock_irqrestore(&steal_c->lock, flags);
+	}
+
+	if (nstolen) {
+		raw_spin_lock_irqsave(&c->lock, flags);
+		list_splice(&stolen, &c->free);
+		WRITE_ONCE(c->nr_free, c->nr_free + nstolen);
+		raw_spin_unlock_irqrestore(&c->lock, flags);
+	}
+
+	return nstolen;
+}
+
+static void bpf_clock_lru_refill(struct bpf_lru *lru, struct bpf_lru_clock *c)
+{
+	unsigned int nfree = READ_ONCE(c->nr_free);
+	unsigned long flags;
+
+	if (nfree >= CLOCK_FREE_TARGET)
+		return;
+
+	nfree += bpf_clock_steal_free(lru, c, CLOCK_FREE_TARGET - nfree);
+	if (nfree >= CLOCK_FREE_TARGET)
+		return;
+
+	raw_spin_lock_irqsave(&c->lock, flags);
+	if (c->nr_free < CLOCK_FREE_TARGET)
+		__bpf_clock_sweep(lru, c, CLOCK_FREE_TARGET - c->nr_free, false);
+	raw_spin_unlock_irqrestore(&c->lock, flags);
+}
+
+static void bpf_clock_lru_refill_work(struct irq_work *work)
+{
+	struct bpf_lru_clock *c = container_of(work, struct bpf_lru_clock,
+					       refill_work);
+
+	bpf_clock_lru_refill(c->lru, c);
+}
+
+static struct bpf_lru_node *bpf_clock_lru_pop_free(struct bpf_lru *lru,
+						   u32 hash)
+{
+	struct bpf_lru_clock *c, *steal_c;
+	struct bpf_lru_node *node;
+	unsigned long flags;
+	int cpu = raw_smp_processor_id();
+	int steal;
+	bool low;
+
+	c = per_cpu_ptr(lru->clock_lru, cpu);
+
+	raw_spin_lock_irqsave(&c->lock, flags);
+
+	node = __bpf_clock_pop_free(c);
+	if (node)
+		__bpf_clock_add(lru, c, cpu, node, hash);
+	low = c->nr_free < CLOCK_FREE_LOW;
+
+	raw_spin_unlock_irqrestore(&c->lock, flags);
+
+	if (node) {
+		if (low)
+			irq_work_queue(&c->refill_work);
+		return node;
+	}
+
+	/* The irq_work has not caught up with us, refill inline */
+	bpf_clock_lru_refill(lru, c);
+
+	raw_spin_lock_irqsave(&c->lock, flags);
+
+	node = __bpf_clock_pop_free(c);
+	if (!node && __bpf_clock_sweep(lru, c, 1, true))
+		node = __bpf_clock_pop_free(c);
+	if (node)
+		__bpf_clock_add(lru, c, cpu, node, hash);
+
+	raw_spin_unlock_irqrestore(&c->lock, flags);
+
+	if (node)
+		return node;
+
+	/* Our own ring is empty.  Evict from the other shards in RR. */
+	for (steal = get_next_cpu(cpu); steal != cpu;
+	     steal = get_next_cpu(steal)) {
+		steal_c = per_cpu_ptr(lru->clock_lru, steal);
+
+		raw_spin_lock_irqsave(&steal_c->lock, flags);
+
+		node = __bpf_clock_pop_free(steal_c);
+		if (!node && __bpf_clock_sweep(lru, steal_c, 1, true))
+			node = __bpf_clock_pop_free(steal_c);
+
+		raw_spin_unlock_irqrestore(&steal_c->lock, flags);
+
+		if (node)
+			break;
+	}
+
+	if (node) {
+		raw_spin_lock_irqsave(&c->lock, flags);
+		__bpf_clock_add(lru, c, cpu, node, hash);
+		raw_spin_unlock_irqrestore(&c->lock, flags);
+	}
+
+	return node;
+}
+
 struct bpf_lru_node *bpf_lru_pop_free(struct bpf_lru *lru, u32 hash)
 {
-	if (lru->percpu)
+	if (lru->clock)
+		return bpf_clock_lru_pop_free(lru, hash);
+	else if (lru->percpu)
 		return bpf_percpu_lru_pop_free(lru, hash);
 	else
 		return bpf_common_lru_pop_free(lru, hash);
@@ -553,9 +774,27 @@ static void bpf_percpu_lru_push_free(struct bpf_lru *lru,
 	raw_spin_unlock_irqrestore(&l->lock, flags);
 }
 
+static void bpf_clock_lru_push_free(struct bpf_lru *lru,
+				    struct bpf_lru_node *node)
+{
+	struct bpf_lru_clock *c;
+	unsigned long flags;
+
+	c = per_cpu_ptr(lru->clock_lru, node->cpu);
+
+	raw_spin_lock_irqsave(&c->lock, flags);
+
+	if (!WARN_ON_ONCE(node->type == BPF_LRU_LIST_T_FREE))
+		__bpf_clock_move_to_free(c, node);
+
+	raw_spin_unlock_irqrestore(&c->lock, flags);
+}
+
 void bpf_lru_push_free(struct bpf_lru *lru, struct bpf_lru_node *node)
 {
-	if (lru->percpu)
+	if (lru->clock)
+		bpf_clock_lru_push_free(lru, node);
+	else if (lru->percpu)
 		bpf_percpu_lru_push_free(lru, node);
 	else
 		bpf_common_lru_push_free(lru, node);
@@ -610,10 +849,37 @@ static void bpf_percpu_lru_populate(struct bpf_lru *lru, void *buf,
 	}
 }
 
+static void bpf_clock_lru_populate(struct bpf_lru *lru, void *buf,
+				   u32 node_offset, u32 elem_size,
+				   u32 nr_elems)
+{
+	struct bpf_lru_clock *c;
+	int cpu = -1;
+	u32 i;
+
+	/* Spread the nodes so every shard starts with a free cache */
+	for (i = 0; i < nr_elems; i++) {
+		struct bpf_lru_node *node;
+
+		cpu = get_next_cpu(cpu);
+		c = per_cpu_ptr(lru->clock_lru, cpu);
+		node = (struct bpf_lru_node *)(buf + node_offset);
+		node->cpu = cpu;
+		node->type = BPF_LRU_LIST_T_FREE;
+		bpf_lru_node_clear_ref(node);
+		list_add(&node->list, &c->free);
+		c->nr_free++;
+		buf += elem_size;
+	}
+}
+
 void bpf_lru_populate(struct bpf_lru *lru, void *buf, u32 node_offset,
 		      u32 elem_size, u32 nr_elems)
 {
-	if (lru->percpu)
+	if (lru->clock)
+		bpf_clock_lru_populate(lru, buf, node_offset, elem_size,
+				       nr_elems);
+	else if (lru->percpu)
 		bpf_percpu_lru_populate(lru, buf, node_offset, elem_size,
 					nr_elems);
 	else
@@ -648,12 +914,36 @@ static void bpf_lru_list_init(struct bpf_lru_list *l)
 	raw_spin_lock_init(&l->lock);
 }
 
-int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
-		 del_from_htab_func del_from_htab, void *del_arg)
+static void bpf_lru_clock_init(struct bpf_lru *lru, struct bpf_lru_clock *c,
+			       int cpu)
+{
+	INIT_LIST_HEAD(&c->ring);
+	INIT_LIST_HEAD(&c->free);
+	c->hand = &c->ring;
+	c->nr_free = 0;
+	c->cpu = cpu;
+	c->lru = lru;
+	init_irq_work(&c->refill_work, bpf_clock_lru_refill_work);
+
+	raw_spin_lock_init(&c->lock);
+}
+
+int bpf_lru_init(struct bpf_lru *lru, bool percpu, bool clock,
+		 u32 hash_offset, del_from_htab_func del_from_htab,
+		 void *del_arg)
 {
 	int cpu;
 
-	if (percpu) {
+	if (clock) {
+		lru->clock_lru = alloc_percpu(struct bpf_lru_clock);
+		if (!lru->clock_lru)
+			return -ENOMEM;
+
+		for_each_possible_cpu(cpu)
+			bpf_lru_clock_init(lru, per_cpu_ptr(lru->clock_lru, cpu),
+					   cpu);
+		lru->nr_scans = CLOCK_NR_SCANS;
+	} else if (percpu) {
 		lru->percpu_lru = alloc_percpu(struct bpf_lru_list);
 		if (!lru->percpu_lru)
 			return -ENOMEM;
@@ -684,6 +974,7 @@ int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 	}
 
 	lru->percpu = percpu;
+	lru->clock = clock;
 	lru->del_from_htab = del_from_htab;
 	lru->del_arg = del_arg;
 	lru->hash_offset = hash_offset;
@@ -691,9 +982,23 @@ int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
 	return 0;
 }
 
+/* Wait for the background eviction before the elements go away */
+void bpf_lru_sync(struct bpf_lru *lru)
+{
+	int cpu;
+
+	if (!lru->clock)
+		return;
+
+	for_each_possible_cpu(cpu)
+		irq_work_sync(&per_cpu_ptr(lru->clock_lru, cpu)->refill_work);
+}
+
 void bpf_lru_destroy(struct bpf_lru *lru)
 {
-	if (lru->percpu)
+	if (lru->clock)
+		free_percpu(lru->clock_lru);
+	else if (lru->percpu)
 		free_percpu(lru->percpu_lru);
 	else
 		free_percpu(lru->common_lru.local_list);
@@ -5,6 +5,7 @@
 #define __BPF_LRU_LIST_H_
 
 #include <linux/cache.h>
+#include <linux/irq_work.h>
 #include <linux/list.h>
 #include <linux/spinlock_types.h>
 
@@ -48,18 +49,35 @@ struct bpf_common_lru {
 	struct bpf_lru_locallist __percpu *local_list;
 };
 
+struct bpf_lru;
+
+struct bpf_lru_clock {
+	raw_spinlock_t lock;
+	/* In-use nodes, swept by the clock hand */
+	struct list_head ring;
+	/* The next node the clock looks at, may be &ring itself */
+	struct list_head *hand;
+	struct list_head free;
+	unsigned int nr_free;
+	int cpu;
+	struct bpf_lru *lru;
+	struct irq_work refill_work;
+} ____cacheline_aligned_in_smp;
+
 typedef bool (*del_from_htab_func)(void *arg, struct bpf_lru_node *node);
 
 struct bpf_lru {
 	union {
 		struct bpf_common_lru common_lru;
 		struct bpf_lru_list __percpu *percpu_lru;
+		struct bpf_lru_clock __percpu *clock_lru;
 	};
 	del_from_htab_func del_from_htab;
 	void *del_arg;
 	unsigned int hash_offset;
 	unsigned int nr_scans;
 	bool percpu;
+	bool clock;
 };
 
 static inline void bpf_lru_node_set_ref(struct bpf_lru_node *node)
@@ -68,10 +86,12 @@ static inline void bpf_lru_node_set_ref(struct bpf_lru_node *node)
 		WRITE_ONCE(node->ref, 1);
 }
 
-int bpf_lru_init(struct bpf_lru *lru, bool percpu, u32 hash_offset,
-		 del_from_htab_func del_from_htab, void *delete_arg);
+int bpf_lru_init(struct bpf_lru *lru, bool percpu, bool clock,
+		 u32 hash_offset, del_from_htab_func del_from_htab,
+		 void *delete_arg);
 void bpf_lru_populate(struct bpf_lru *lru, void *buf, u32 node_offset,
 		      u32 elem_size, u32 nr_elems);
+void bpf_lru_sync(struct bpf_lru *lru);
 void bpf_lru_destroy(struct bpf_lru *lru);
 struct bpf_lru_node *bpf_lru_pop_free(struct bpf_lru *lru, u32 hash);
 void bpf_lru_push_free(struct bpf_lru *lru, struct bpf_lru_node *node);
@@ -35,6 +35,7 @@
 
 #include <linux/netdevice.h>   /* netif_receive_skb_list */
 #include <linux/etherdevice.h> /* eth_type_trans */
+#include <net/gro.h>           /* gro_normal_list */
 
 /* General idea: XDP packets getting XDP redirected to another CPU,
  * will maximum be stored/queued for one driver ->poll() call.  It is
@@ -69,6 +70,15 @@ struct bpf_cpu_map_entry {
 	struct bpf_cpumap_val value;
 	struct bpf_prog *prog;
 
+	/* kthread scratch: value.batch_size frames followed by as many skbs */
+	void **frames;
+
+	/* The NAPI instance is never scheduled, it only carries the GRO
+	 * state for skbs the kthread passes up the stack.
+	 */
+	struct net_device *gro_dev;
+	struct napi_struct napi;
+
 	struct completion kthread_running;
 	struct rcu_work free_work;
 };
@@ -87,7 +97,8 @@ static struct bpf_map *cpu_map_alloc(union bpf_attr *attr)
 	/* check sanity of attributes */
 	if (attr->max_entries == 0 || attr->key_size != 4 ||
 	    (value_size != offsetofend(struct bpf_cpumap_val, qsize) &&
-	     value_size != offsetofend(struct bpf_cpumap_val, bpf_prog.fd)) ||
+	     value_size != offsetofend(struct bpf_cpumap_val, bpf_prog.fd) &&
+	     value_size != offsetofend(struct bpf_cpumap_val, batch_size)) ||
 	    attr->map_flags & ~BPF_F_NUMA_NODE)
 		return ERR_PTR(-EINVAL);
 
@@ -233,6 +244,7 @@ static int cpu_map_bpf_prog_run_xdp(struct bpf_cpu_map_entry *rcpu,
 }
 
 #define CPUMAP_BATCH 8
+#define CPUMAP_BATCH_MAX 64
 
 static int cpu_map_bpf_prog_run(struct bpf_cpu_map_entry *rcpu, void **frames,
 				int xdp_n, struct xdp_cpumap_stats *stats,
@@ -261,6 +273,29 @@ static int cpu_map_bpf_prog_run(struct bpf_cpu_map_entry *rcpu, void **frames,
 	return nframes;
 }
 
+static int cpu_map_napi_poll(struct napi_struct *napi, int budget)
+{
+	return 0;
+}
+
+static void cpu_map_gro_receive(struct bpf_cpu_map_entry *rcpu,
+				struct list_head *list, bool empty)
+{
+	struct sk_buff *skb, *tmp;
+
+	list_for_each_entry_safe(skb, tmp, list, list) {
+		skb_list_del_init(skb);
+		napi_gro_receive(&rcpu->napi, skb);
+	}
+
+	/* Same policy as napi_complete_done(): while more frames are queued
+	 * only flush GRO packets held for over a tick, otherwise flush all
+	 * of them so nothing is held while the kthread sleeps.
+	 */
+	napi_gro_flush(&rcpu->napi, !empty && HZ >= 1000);
+	gro_normal_list(&rcpu->napi);
+}
+
 static int cpu_map_kthread_run(void *data)
 {
 	struct bpf_cpu_map_entry *rcpu = data;
@@ -277,10 +312,11 @@ static int cpu_map_kthread_run(void *data)
 	while (!kthread_should_stop() || !__ptr_ring_empty(rcpu->queue)) {
 		struct xdp_cpumap_stats stats = {}; /* zero stats */
 		unsigned int kmem_alloc_drops = 0, sched = 0;
+		u32 batch = rcpu->value.batch_size;
 		gfp_t gfp = __GFP_ZERO | GFP_ATOMIC;
+		void **frames = rcpu->frames;
+		void **skbs = frames + batch;
 		int i, n, m, nframes, xdp_n;
-		void *frames[CPUMAP_BATCH];
-		void *skbs[CPUMAP_BATCH];
 		LIST_HEAD(list);
 
 		/* Release CPU reschedule checks */
@@ -304,8 +340,7 @@ static int cpu_map_kthread_run(void *data)
 		 * kthread CPU pinned. Lockless access to ptr_ring
 		 * consume side valid as no-resize allowed of queue.
 		 */
-		n = __ptr_ring_consume_batched(rcpu->queue, frames,
-					       CPUMAP_BATCH);
+		n = __ptr_ring_consume_batched(rcpu->queue, frames, batch);
 		for (i = 0, xdp_n = 0; i < n; i++) {
 			void *f = frames[i];
 			struct page *page;
@@ -361,7 +396,7 @@ static int cpu_map_kthread_run(void *data)
 		trace_xdp_cpumap_kthread(rcpu->map_id, n, kmem_alloc_drops,
 					 sched, &stats);
 
-		netif_receive_skb_list(&list);
+		cpu_map_gro_receive(rcpu, &list, __ptr_ring_empty(rcpu->queue));
 		local_bh_enable(); /* resched point, may call do_softirq() */
 	}
 	__set_current_state(TASK_RUNNING);
@@ -394,6 +429,7 @@ static struct bpf_cpu_map_entry *
 __cpu_map_entry_alloc(struct bpf_map *map, struct bpf_cpumap_val *value,
 		      u32 cpu)
 {
+	u32 batch = value->batch_size ?: CPUMAP_BATCH;
 	int numa, err, i, fd = value->bpf_prog.fd;
 	gfp_t gfp = GFP_KERNEL | __GFP_NOWARN;
 	struct bpf_cpu_map_entry *rcpu;
@@ -427,12 +463,23 @@ __cpu_map_entry_alloc(struct bpf_map *map, struct bpf_cpumap_val *value,
 	if (err)
 		goto free_queue;
 
+	rcpu->frames = bpf_map_kmalloc_node(map, 2 * batch * sizeof(void *),
+					    gfp, numa);
+	if (!rcpu->frames)
+		goto free_ptr_ring;
+
+	rcpu->gro_dev = alloc_netdev_dummy(0);
+	if (!rcpu->gro_dev)
+		goto free_frames;
+	netif_napi_add(rcpu->gro_dev, &rcpu->napi, cpu_map_napi_poll);
+
 	rcpu->cpu    = cpu;
 	rcpu->map_id = map->id;
 	rcpu->value.qsize  = value->qsize;
+	rcpu->value.batch_size = batch;
 
 	if (fd > 0 && __cpu_map_load_bpf_program(rcpu, map, fd))
-		goto free_ptr_ring;
+		goto free_gro;
 
 	/* Setup kthread */
 	init_completion(&rcpu->kthread_running);
@@ -457,6 +504,11 @@ __cpu_map_entry_alloc(struct bpf_map *map, struct bpf_cpumap_val *value,
 free_prog:
 	if (rcpu->prog)
 		bpf_prog_put(rcpu->prog);
+free_gro:
+	netif_napi_del(&rcpu->napi);
+	free_netdev(rcpu->gro_dev);
+free_frames:
+	kfree(rcpu->frames);
 free_ptr_ring:
 	ptr_ring_cleanup(rcpu->queue, NULL);
 free_queue:
@@ -487,6 +539,10 @@ static void __cpu_map_entry_free(struct work_struct *work)
 
 	if (rcpu->prog)
 		bpf_prog_put(rcpu->prog);
+	/* The kthread flushed GRO before exiting with an empty queue */
+	netif_napi_del(&rcpu->napi);
+	free_netdev(rcpu->gro_dev);
+	kfree(rcpu->frames);
 	/* The queue should be empty at this point */
 	__cpu_map_ring_cleanup(rcpu->queue);
 	ptr_ring_cleanup(rcpu->queue, NULL);
@@ -547,6 +603,8 @@ static long cpu_map_update_elem(struct bpf_map *map, void *key, void *value,
 		return -EEXIST;
 	if (unlikely(cpumap_value.qsize > 16384)) /* sanity limit on qsize */
 		return -EOVERFLOW;
+	if (unlikely(cpumap_value.batch_size > CPUMAP_BATCH_MAX))
+		return -EINVAL;
 
 	/* Make sure CPU is a valid possible cpu */
 	if (key_cpu >= nr_cpumask_bits || !cpu_possible(key_cpu))
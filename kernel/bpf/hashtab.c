@@ -6,12 +6,14 @@
 #include <linux/btf.h>
 #include <linux/jhash.h>
 #include <linux/filter.h>
+#include <linux/irq_work.h>
 #include <linux/rculist_nulls.h>
 #include <linux/rcupdate_wait.h>
 #include <linux/random.h>
 #include <uapi/linux/btf.h>
 #include <linux/rcupdate_trace.h>
 #include <linux/btf_ids.h>
+#include <linux/workqueue.h>
 #include "percpu_freelist.h"
 #include "bpf_lru_list.h"
 #include "map_in_map.h"
@@ -19,7 +21,8 @@
 
 #define HTAB_CREATE_FLAG_MASK						\
 	(BPF_F_NO_PREALLOC | BPF_F_NO_COMMON_LRU | BPF_F_NUMA_NODE |	\
-	 BPF_F_ACCESS_MASK | BPF_F_ZERO_SEED)
+	 BPF_F_ACCESS_MASK | BPF_F_ZERO_SEED | BPF_F_RESIZABLE |	\
+	 BPF_F_CLOCK_LRU)
 
 #define BATCH_OPS(_name)			\
 	.map_lookup_batch =			\
@@ -84,11 +87,42 @@ struct bucket {
 #define HASHTAB_MAP_LOCK_COUNT 8
 #define HASHTAB_MAP_LOCK_MASK (HASHTAB_MAP_LOCK_COUNT - 1)
 
+/*
+ * The bucket array. A BPF_F_RESIZABLE map replaces it incrementally: the
+ * resize worker publishes the new array in future_tbl, then moves the old
+ * buckets over one at a time, in order, under their bucket locks. Buckets
+ * below rehash have been moved. Lookups that miss in a table retry in its
+ * future_tbl, and updates that lock a moved bucket retry there as well, so
+ * neither has to wait for the resize to finish. Only once every bucket has
+ * moved does the new array become htab->tbl.
+ *
+ * A resizable table never has fewer than HASHTAB_MAP_LOCK_COUNT buckets,
+ * so the map_locked slot of a hash is the same in every table.
+ *
+ * The nulls value terminating each bucket is n_buckets | index, which is
+ * unique across tables of different sizes.
+ *
+ * Walks of the whole map go over min_buckets logical buckets instead, see
+ * htab_walk_pin().
+ */
+struct htab_table {
+	struct htab_table __rcu *future_tbl;
+	u32 n_buckets;
+	u32 rehash;
+	struct bucket buckets[];
+};
+
+#define HTAB_RESIZE_MIN_BUCKETS 64
+/* restarts of a bucket walk while a resize is moving elements away */
+#define HTAB_RESIZE_LOOKUP_RETRIES 4
+/* wait this long before queueing another resize after one failed */
+#define HTAB_RESIZE_BACKOFF HZ
+
 struct bpf_htab {
 	struct bpf_map map;
 	struct bpf_mem_alloc ma;
 	struct bpf_mem_alloc pcpu_ma;
-	struct bucket *buckets;
+	struct htab_table __rcu *tbl;
 	void *elems;
 	union {
 		struct pcpu_freelist freelist;
@@ -101,11 +135,20 @@ struct bpf_htab {
 	struct percpu_counter pcount;
 	atomic_t count;
 	bool use_percpu_counter;
-	u32 n_buckets;	/* number of hash buckets */
+	u32 n_buckets;	/* number of hash buckets in tbl */
 	u32 elem_size;	/* size of each element in bytes */
 	u32 hashrnd;
 	struct lock_class_key lockdep_key;
 	int __percpu *map_locked[HASHTAB_MAP_LOCK_COUNT];
+	/* BPF_F_RESIZABLE only */
+	u32 min_buckets;
+	u32 max_buckets;
+	atomic_t resize_queued;
+	unsigned long resize_after;	/* jiffies, backoff after a failure */
+	struct mutex resize_mutex;	/* held for a whole resize */
+	atomic_t walkers;		/* logical buckets pinned by walks */
+	struct irq_work resize_irq_work;
+	struct work_struct resize_work;
 };
 
 /* each htab element is struct htab_elem + key + value */
@@ -134,14 +177,33 @@ static inline bool htab_is_prealloc(const struct bpf_htab *htab)
 	return !(htab->map.map_flags & BPF_F_NO_PREALLOC);
 }
 
-static void htab_init_buckets(struct bpf_htab *htab)
+static inline bool htab_is_resizable(const struct bpf_htab *htab)
+{
+	return htab->map.map_flags & BPF_F_RESIZABLE;
+}
+
+/* Readers hold one of the RCU flavours, see the WARN_ON_ONCE()s below */
+static inline struct htab_table *htab_table(const struct bpf_htab *htab)
+{
+	return rcu_dereference_raw(htab->tbl);
+}
+
+static inline u32 htab_table_nulls(const struct htab_table *tbl, u32 hash)
+{
+	return tbl->n_buckets | (hash & (tbl->n_buckets - 1));
+}
+
+static void htab_init_table(struct bpf_htab *htab, struct htab_table *tbl,
+			    u32 n_buckets)
 {
 	unsigned int i;
 
-	for (i = 0; i < htab->n_buckets; i++) {
-		INIT_HLIST_NULLS_HEAD(&htab->buckets[i].head, i);
-		raw_spin_lock_init(&htab->buckets[i].raw_lock);
-		lockdep_set_class(&htab->buckets[i].raw_lock,
+	tbl->n_buckets = n_buckets;
+	for (i = 0; i < n_buckets; i++) {
+		INIT_HLIST_NULLS_HEAD(&tbl->buckets[i].head,
+				      htab_table_nulls(tbl, i));
+		raw_spin_lock_init(&tbl->buckets[i].raw_lock);
+		lockdep_set_class(&tbl->buckets[i].raw_lock,
 					  &htab->lockdep_key);
 		cond_resched();
 	}
@@ -182,6 +244,8 @@ static inline void htab_unlock_bucket(const struct bpf_htab *htab,
 }
 
 static bool htab_lru_map_delete_node(void *arg, struct bpf_lru_node *node);
+static void htab_resize_irq_work(struct irq_work *work);
+static void htab_resize_work(struct work_struct *work);
 
 static bool htab_is_lru(const struct bpf_htab *htab)
 {
@@ -351,6 +415,7 @@ static int prealloc_init(struct bpf_htab *htab)
 	if (htab_is_lru(htab))
 		err = bpf_lru_init(&htab->lru,
 				   htab->map.map_flags & BPF_F_NO_COMMON_LRU,
+				   htab->map.map_flags & BPF_F_CLOCK_LRU,
 				   offsetof(struct htab_elem, hash) -
 				   offsetof(struct htab_elem, lru_node),
 				   htab_lru_map_delete_node,
@@ -425,6 +490,8 @@ static int htab_map_alloc_check(union bpf_attr *attr)
 	bool percpu_lru = (attr->map_flags & BPF_F_NO_COMMON_LRU);
 	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
 	bool zero_seed = (attr->map_flags & BPF_F_ZERO_SEED);
+	bool resizable = (attr->map_flags & BPF_F_RESIZABLE);
+	bool clock_lru = (attr->map_flags & BPF_F_CLOCK_LRU);
 	int numa_node = bpf_map_attr_numa_node(attr);
 
 	BUILD_BUG_ON(offsetof(struct htab_elem, fnode.next) !=
@@ -441,9 +508,19 @@ static int htab_map_alloc_check(union bpf_attr *attr)
 	if (!lru && percpu_lru)
 		return -EINVAL;
 
+	/* the clock LRU is already sharded per CPU */
+	if ((!lru || percpu_lru) && clock_lru)
+		return -EINVAL;
+
 	if (lru && !prealloc)
 		return -ENOTSUPP;
 
+	/* moving elements between tables needs bpf_mem_alloc'ed elements */
+	if (resizable && (prealloc ||
+			  (attr->map_type != BPF_MAP_TYPE_HASH &&
+			   attr->map_type != BPF_MAP_TYPE_PERCPU_HASH)))
+		return -EINVAL;
+
 	if (numa_node != NUMA_NO_NODE && (percpu || percpu_lru))
 		return -EINVAL;
 
@@ -482,6 +559,7 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	 */
 	bool percpu_lru = (attr->map_flags & BPF_F_NO_COMMON_LRU);
 	bool prealloc = !(attr->map_flags & BPF_F_NO_PREALLOC);
+	struct htab_table *tbl;
 	struct bpf_htab *htab;
 	int err, i;
 
@@ -525,16 +603,29 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	if (htab->n_buckets > U32_MAX / sizeof(struct bucket))
 		goto free_htab;
 
+	if (htab_is_resizable(htab)) {
+		/* start small, max_entries only bounds the growth */
+		htab->max_buckets = max_t(u32, htab->n_buckets,
+					  HASHTAB_MAP_LOCK_COUNT);
+		htab->min_buckets = min_t(u32, htab->max_buckets,
+					  HTAB_RESIZE_MIN_BUCKETS);
+		htab->n_buckets = htab->min_buckets;
+		mutex_init(&htab->resize_mutex);
+		htab->resize_after = jiffies;
+		init_irq_work(&htab->resize_irq_work, htab_resize_irq_work);
+		INIT_WORK(&htab->resize_work, htab_resize_work);
+	}
+
 	err = bpf_map_init_elem_count(&htab->map);
 	if (err)
 		goto free_htab;
 
 	err = -ENOMEM;
-	htab->buckets = bpf_map_area_alloc(htab->n_buckets *
-					   sizeof(struct bucket),
-					   htab->map.numa_node);
-	if (!htab->buckets)
+	tbl = bpf_map_area_alloc(struct_size(tbl, buckets, htab->n_buckets),
+				 htab->map.numa_node);
+	if (!tbl)
 		goto free_elem_count;
+	RCU_INIT_POINTER(htab->tbl, tbl);
 
 	for (i = 0; i < HASHTAB_MAP_LOCK_COUNT; i++) {
 		htab->map_locked[i] = bpf_map_alloc_percpu(&htab->map,
@@ -550,7 +641,7 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 	else
 		htab->hashrnd = get_random_u32();
 
-	htab_init_buckets(htab);
+	htab_init_table(htab, tbl, htab->n_buckets);
 
 /* compute_batch_value() computes batch value as num_online_cpus() * 2
  * and __percpu_counter_compare() needs
@@ -609,7 +700,7 @@ static struct bpf_map *htab_map_alloc(union bpf_attr *attr)
 		percpu_counter_destroy(&htab->pcount);
 	for (i = 0; i < HASHTAB_MAP_LOCK_COUNT; i++)
 		free_percpu(htab->map_locked[i]);
-	bpf_map_area_free(htab->buckets);
+	bpf_map_area_free(tbl);
 	bpf_mem_alloc_destroy(&htab->pcpu_ma);
 	bpf_mem_alloc_destroy(&htab->ma);
 free_elem_count:
@@ -629,12 +720,9 @@ static inline u32 htab_map_hash(const void *key, u32 key_len, u32 hashrnd)
 
 static inline struct bucket *__select_bucket(struct bpf_htab *htab, u32 hash)
 {
-	return &htab->buckets[hash & (htab->n_buckets - 1)];
-}
+	struct htab_table *tbl = htab_table(htab);
 
-static inline struct hlist_nulls_head *select_bucket(struct bpf_htab *htab, u32 hash)
-{
-	return &__select_bucket(htab, hash)->head;
+	return &tbl->buckets[hash & (tbl->n_buckets - 1)];
 }
 
 /* this lookup function can only be called with bucket lock taken */
@@ -655,24 +743,171 @@ static struct htab_elem *lookup_elem_raw(struct hlist_nulls_head *head, u32 hash
  * the unlikely event when elements moved from one bucket into another
  * while link list is being walked
  */
-static struct htab_elem *lookup_nulls_elem_raw(struct hlist_nulls_head *head,
-					       u32 hash, void *key,
-					       u32 key_size, u32 n_buckets)
+static struct htab_elem *__lookup_nulls_elem_raw(struct htab_table *tbl,
+						 u32 hash, void *key,
+						 u32 key_size)
 {
+	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
+	unsigned int retries = 0;
 	struct htab_elem *l;
 
+	head = &tbl->buckets[hash & (tbl->n_buckets - 1)].head;
 again:
 	hlist_nulls_for_each_entry_rcu(l, n, head, hash_node)
 		if (l->hash == hash && !memcmp(&l->key, key, key_size))
 			return l;
 
-	if (unlikely(get_nulls_value(n) != (hash & (n_buckets - 1))))
-		goto again;
+	if (unlikely(get_nulls_value(n) != htab_table_nulls(tbl, hash))) {
+		/*
+		 * While a resize runs, the element we followed out of the
+		 * bucket may be the tail htab_move_bucket() is moving, and
+		 * the mover may be the context this program interrupted, so
+		 * restarting until it is unlinked could spin forever. Moving
+		 * a tail skips nothing behind it, and the caller goes on to
+		 * look in future_tbl, so give up after a few restarts.
+		 */
+		if (!rcu_access_pointer(tbl->future_tbl) ||
+		    ++retries < HTAB_RESIZE_LOOKUP_RETRIES)
+			goto again;
+	}
 
 	return NULL;
 }
 
+/* as above, and also looks in the table a resize is moving elements to */
+static struct htab_elem *lookup_nulls_elem_raw(struct htab_table *tbl,
+					       u32 hash, void *key,
+					       u32 key_size)
+{
+	struct htab_elem *l;
+
+	for (;;) {
+		l = __lookup_nulls_elem_raw(tbl, hash, key, key_size);
+		if (l)
+			return l;
+
+		tbl = rcu_dereference_raw(tbl->future_tbl);
+		if (likely(!tbl))
+			return NULL;
+		/*
+		 * An element that was moved after we passed its old bucket
+		 * was linked into the future table first. Pairs with the
+		 * smp_store_release() in htab_move_bucket().
+		 */
+		smp_rmb();
+	}
+}
+
+/*
+ * Logical buckets a walk of the map goes over. Every table of a resizable map
+ * has a multiple of min_buckets buckets, so logical bucket i is made of the
+ * buckets congruent to i modulo min_buckets in the table and in its future
+ * table, and an element stays in the same logical bucket across resizes. A
+ * moved bucket is empty, elements added to it since are in the future table.
+ */
+static u32 htab_walk_buckets(const struct bpf_htab *htab)
+{
+	return htab_is_resizable(htab) ? htab->min_buckets : htab->n_buckets;
+}
+
+/*
+ * Pin logical bucket @i for a walk under RCU and return the table to walk
+ * it in. While any bucket is pinned, htab_move_bucket() doesn't start
+ * moving another one, and a move of one of ours that is already under way
+ * is waited for. That can't be done from NMI on top of the move, which
+ * fails with -EBUSY, as updates do.
+ */
+static int htab_walk_pin(struct bpf_htab *htab, u32 i,
+			 struct htab_table **ptbl)
+{
+	struct htab_table *tbl;
+	unsigned long flags;
+	struct bucket *b;
+	u32 rehash;
+	int ret;
+
+	if (!htab_is_resizable(htab)) {
+		*ptbl = htab_table(htab);
+		return 0;
+	}
+
+	atomic_inc(&htab->walkers);
+	/* pairs with smp_mb() in htab_move_bucket() */
+	smp_mb__after_atomic();
+
+	tbl = htab_table(htab);
+	rehash = READ_ONCE(tbl->rehash);
+	if (rcu_access_pointer(tbl->future_tbl) && rehash < tbl->n_buckets &&
+	    (rehash & (htab->min_buckets - 1)) == i) {
+		b = &tbl->buckets[rehash];
+		ret = htab_lock_bucket(htab, b, rehash, &flags);
+		if (ret) {
+			atomic_dec(&htab->walkers);
+			return ret;
+		}
+		htab_unlock_bucket(htab, b, rehash, flags);
+	}
+
+	*ptbl = tbl;
+	return 0;
+}
+
+static void htab_walk_unpin(struct bpf_htab *htab)
+{
+	if (!htab_is_resizable(htab))
+		return;
+
+	/* done reading the buckets before a move may start */
+	smp_mb__before_atomic();
+	atomic_dec(&htab->walkers);
+}
+
+/* The @pos-th bucket of logical bucket @i, NULL past the last one */
+static struct hlist_nulls_head *htab_walk_head(struct htab_table *tbl,
+					       u32 n_walk, u32 i, u32 pos)
+{
+	struct htab_table *future;
+	u32 idx = i + pos * n_walk;
+
+	if (idx < tbl->n_buckets)
+		return &tbl->buckets[idx].head;
+
+	future = rcu_dereference_raw(tbl->future_tbl);
+	idx -= tbl->n_buckets;
+	if (future && idx < future->n_buckets)
+		return &future->buckets[idx].head;
+	return NULL;
+}
+
+/*
+ * Lock the bucket @hash belongs to, following a resize in progress to the
+ * future table if the bucket has already been moved there.
+ */
+static int htab_lock_select_bucket(struct bpf_htab *htab, u32 hash,
+				   struct bucket **pb, unsigned long *pflags)
+{
+	struct htab_table *tbl = htab_table(htab);
+	struct bucket *b;
+	u32 idx;
+	int ret;
+
+	for (;;) {
+		idx = hash & (tbl->n_buckets - 1);
+		b = &tbl->buckets[idx];
+		ret = htab_lock_bucket(htab, b, hash, pflags);
+		if (ret)
+			return ret;
+		if (likely(idx >= READ_ONCE(tbl->rehash)))
+			break;
+		htab_unlock_bucket(htab, b, hash, *pflags);
+		tbl = rcu_dereference_raw(tbl->future_tbl);
+	}
+
+	*pb = b;
+	return 0;
+}
+
 /* Called from syscall or from eBPF program directly, so
  * arguments have to match bpf_map_lookup_elem() exactly.
  * The return value is adjusted by BPF instructions
@@ -681,7 +916,6 @@ static struct htab_elem *lookup_nulls_elem_raw(struct hlist_nulls_head *head,
 static void *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
-	struct hlist_nulls_head *head;
 	struct htab_elem *l;
 	u32 hash, key_size;
 
@@ -692,9 +926,7 @@ static void *__htab_map_lookup_elem(struct bpf_map *map, void *key)
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	head = select_bucket(htab, hash);
-
-	l = lookup_nulls_elem_raw(head, hash, key, key_size, htab->n_buckets);
+	l = lookup_nulls_elem_raw(htab_table(htab), hash, key, key_size);
 
 	return l;
 }
@@ -839,54 +1071,67 @@ static int htab_map_get_next_key(struct bpf_map *map, void *key, void *next_key)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_nulls_head *head;
+	struct hlist_nulls_node *n;
 	struct htab_elem *l, *next_l;
-	u32 hash, key_size;
-	int i = 0;
+	struct htab_table *tbl;
+	u32 hash, key_size, n_walk, i = 0, pos;
+	bool found = false;
+	int ret;
 
 	WARN_ON_ONCE(!rcu_read_lock_held());
 
 	key_size = map->key_size;
+	n_walk = htab_walk_buckets(htab);
 
 	if (!key)
 		goto find_first_elem;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
+	i = hash & (n_walk - 1);
 
-	head = select_bucket(htab, hash);
-
-	/* lookup the key */
-	l = lookup_nulls_elem_raw(head, hash, key, key_size, htab->n_buckets);
-
-	if (!l)
-		goto find_first_elem;
-
-	/* key was found, get next key in the same bucket */
-	next_l = hlist_nulls_entry_safe(rcu_dereference_raw(hlist_nulls_next_rcu(&l->hash_node)),
-				  struct htab_elem, hash_node);
+	ret = htab_walk_pin(htab, i, &tbl);
+	if (ret)
+		return ret;
 
-	if (next_l) {
-		/* if next elem in this hash list is non-zero, just return it */
-		memcpy(next_key, next_l->key, key_size);
-		return 0;
+	/* lookup the key and get the next key in the same logical bucket */
+	for (pos = 0; (head = htab_walk_head(tbl, n_walk, i, pos)); pos++) {
+		hlist_nulls_for_each_entry_rcu(l, n, head, hash_node) {
+			if (found) {
+				memcpy(next_key, l->key, key_size);
+				htab_walk_unpin(htab);
+				return 0;
+			}
+			if (l->hash == hash && !memcmp(&l->key, key, key_size))
+				found = true;
+		}
 	}
+	htab_walk_unpin(htab);
 
-	/* no more elements in this hash list, go to the next bucket */
-	i = hash & (htab->n_buckets - 1);
-	i++;
+	/* no more elements in this logical bucket, go to the next one */
+	if (found)
+		i++;
+	else
+		i = 0;
 
 find_first_elem:
-	/* iterate over buckets */
-	for (; i < htab->n_buckets; i++) {
-		head = select_bucket(htab, i);
-
-		/* pick first element in the bucket */
-		next_l = hlist_nulls_entry_safe(rcu_dereference_raw(hlist_nulls_first_rcu(head)),
-					  struct htab_elem, hash_node);
-		if (next_l) {
-			/* if it's not empty, just return it */
-			memcpy(next_key, next_l->key, key_size);
-			return 0;
+	/* iterate over logical buckets */
+	for (; i < n_walk; i++) {
+		ret = htab_walk_pin(htab, i, &tbl);
+		if (ret)
+			return ret;
+
+		/* pick first element in the logical bucket */
+		for (pos = 0; (head = htab_walk_head(tbl, n_walk, i, pos)); pos++) {
+			next_l = hlist_nulls_entry_safe(rcu_dereference_raw(hlist_nulls_first_rcu(head)),
+						  struct htab_elem, hash_node);
+			if (next_l) {
+				/* if it's not empty, just return it */
+				memcpy(next_key, next_l->key, key_size);
+				htab_walk_unpin(htab);
+				return 0;
+			}
 		}
+		htab_walk_unpin(htab);
 	}
 
 	/* iterated over all buckets and all elements */
@@ -920,6 +1165,30 @@ static bool is_map_full(struct bpf_htab *htab)
 	return atomic_read(&htab->count) >= htab->map.max_entries;
 }
 
+static u32 htab_elem_count(struct bpf_htab *htab)
+{
+	if (htab->use_percpu_counter)
+		return percpu_counter_read_positive(&htab->pcount);
+	return atomic_read(&htab->count);
+}
+
+/* Keep a resizable map between 1/4 and 3/4 of an element per bucket */
+static void htab_resize_check(struct bpf_htab *htab)
+{
+	u32 n_buckets = READ_ONCE(htab->n_buckets);
+	u32 count = htab_elem_count(htab);
+
+	if ((count > n_buckets / 4 * 3 && n_buckets < htab->max_buckets) ||
+	    (count < n_buckets / 4 && n_buckets > htab->min_buckets)) {
+		/* programs can get here from any context, even NMI */
+		if (time_before(jiffies, READ_ONCE(htab->resize_after)))
+			return;
+		if (!atomic_read(&htab->resize_queued) &&
+		    !atomic_xchg(&htab->resize_queued, 1))
+			irq_work_queue(&htab->resize_irq_work);
+	}
+}
+
 static void inc_elem_count(struct bpf_htab *htab)
 {
 	bpf_map_inc_elem_count(&htab->map);
@@ -928,6 +1197,9 @@ static void inc_elem_count(struct bpf_htab *htab)
 		percpu_counter_add_batch(&htab->pcount, 1, PERCPU_COUNTER_BATCH);
 	else
 		atomic_inc(&htab->count);
+
+	if (htab_is_resizable(htab))
+		htab_resize_check(htab);
 }
 
 static void dec_elem_count(struct bpf_htab *htab)
@@ -938,6 +1210,159 @@ static void dec_elem_count(struct bpf_htab *htab)
 		percpu_counter_add_batch(&htab->pcount, -1, PERCPU_COUNTER_BATCH);
 	else
 		atomic_dec(&htab->count);
+
+	if (htab_is_resizable(htab))
+		htab_resize_check(htab);
+}
+
+/* Size a resized table for about half an element per bucket */
+static u32 htab_resize_target(struct bpf_htab *htab)
+{
+	u32 count = htab_elem_count(htab);
+
+	if (count >= htab->max_buckets / 2)
+		return htab->max_buckets;
+	return roundup_pow_of_two(max_t(u32, count * 2, htab->min_buckets));
+}
+
+/*
+ * Move bucket @idx of @old_tbl to @new_tbl and mark it moved. Returns false
+ * without moving anything while a walk has a logical bucket pinned.
+ */
+static bool htab_move_bucket(struct bpf_htab *htab, struct htab_table *old_tbl,
+			     struct htab_table *new_tbl, u32 idx)
+{
+	struct hlist_nulls_node *end = (struct hlist_nulls_node *)
+		NULLS_MARKER(htab_table_nulls(old_tbl, idx));
+	struct bucket *old_b = &old_tbl->buckets[idx], *b;
+	struct hlist_nulls_head *head = &old_b->head;
+	struct hlist_nulls_node **pprev, *n;
+	struct htab_elem *l;
+	unsigned long flags;
+	bool moved = false;
+	int i;
+
+	/*
+	 * Hold every map_locked slot of this CPU, so that a program running
+	 * from NMI in the middle of this gets -EBUSY instead of spinning on
+	 * one of the two bucket locks.
+	 */
+	preempt_disable();
+	local_irq_save(flags);
+	for (i = 0; i < HASHTAB_MAP_LOCK_COUNT; i++)
+		__this_cpu_inc(*(htab->map_locked[i]));
+	raw_spin_lock(&old_b->raw_lock);
+
+	/*
+	 * Pairs with smp_mb__after_atomic() in htab_walk_pin(): either we see
+	 * the walk, or it sees the rehash we start from and waits for this
+	 * bucket on its lock.
+	 */
+	smp_mb();
+	if (atomic_read(&htab->walkers)) {
+		raw_spin_unlock(&old_b->raw_lock);
+		goto out;
+	}
+
+	/*
+	 * Move the tail each time, as rhashtable does. It is linked into the
+	 * new bucket before it is unlinked from the old one, so a lookup that
+	 * misses it in the old bucket is sure to find it in the future table.
+	 * A lookup standing on it follows it into the new bucket, and as
+	 * nothing follows a tail in the old bucket, it skips nothing there.
+	 */
+	while (!is_a_nulls(n = rcu_dereference_raw(hlist_nulls_first_rcu(head)))) {
+		pprev = &head->first;
+		while (!is_a_nulls(n->next)) {
+			pprev = &n->next;
+			n = n->next;
+		}
+		l = container_of(n, struct htab_elem, hash_node);
+		b = &new_tbl->buckets[l->hash & (new_tbl->n_buckets - 1)];
+
+		raw_spin_lock_nested(&b->raw_lock, SINGLE_DEPTH_NESTING);
+		hlist_nulls_add_head_rcu(n, &b->head);
+		raw_spin_unlock(&b->raw_lock);
+
+		/* pairs with smp_rmb() in lookup_nulls_elem_raw() */
+		smp_store_release(pprev, end);
+	}
+	WRITE_ONCE(old_tbl->rehash, idx + 1);
+
+	raw_spin_unlock(&old_b->raw_lock);
+	moved = true;
+out:
+	for (i = 0; i < HASHTAB_MAP_LOCK_COUNT; i++)
+		__this_cpu_dec(*(htab->map_locked[i]));
+	local_irq_restore(flags);
+	preempt_enable();
+	return moved;
+}
+
+static void htab_resize_work(struct work_struct *work)
+{
+	struct bpf_htab *htab = container_of(work, struct bpf_htab, resize_work);
+	struct htab_table *old_tbl, *new_tbl;
+	u32 n_buckets, i;
+
+	mutex_lock(&htab->resize_mutex);
+	old_tbl = rcu_dereference_protected(htab->tbl,
+				lockdep_is_held(&htab->resize_mutex));
+	n_buckets = htab_resize_target(htab);
+	if (n_buckets == old_tbl->n_buckets)
+		goto out;
+
+	new_tbl = bpf_map_kvcalloc(&htab->map, 1,
+				   struct_size(new_tbl, buckets, n_buckets),
+				   GFP_KERNEL | __GFP_NOWARN);
+	if (!new_tbl) {
+		/* don't let every update queue another attempt right away */
+		WRITE_ONCE(htab->resize_after, jiffies + HTAB_RESIZE_BACKOFF);
+		goto out;
+	}
+	htab_init_table(htab, new_tbl, n_buckets);
+
+	rcu_assign_pointer(old_tbl->future_tbl, new_tbl);
+	for (i = 0; i < old_tbl->n_buckets; i++) {
+		/* walks pin a logical bucket for a short while only */
+		while (!htab_move_bucket(htab, old_tbl, new_tbl, i))
+			cond_resched();
+		cond_resched();
+	}
+
+	rcu_assign_pointer(htab->tbl, new_tbl);
+	WRITE_ONCE(htab->n_buckets, n_buckets);
+
+	/* sleepable programs walk the buckets under RCU tasks trace */
+	synchronize_rcu_mult(call_rcu, call_rcu_tasks_trace);
+	bpf_map_area_free(old_tbl);
+out:
+	mutex_unlock(&htab->resize_mutex);
+	atomic_set(&htab->resize_queued, 0);
+}
+
+/*
+ * Keep the buckets of a resizable map where they are, for walks from
+ * syscall context that must not miss elements.
+ */
+static void htab_resize_lock(struct bpf_htab *htab)
+{
+	if (htab_is_resizable(htab))
+		mutex_lock(&htab->resize_mutex);
+}
+
+static void htab_resize_unlock(struct bpf_htab *htab)
+{
+	if (htab_is_resizable(htab))
+		mutex_unlock(&htab->resize_mutex);
+}
+
+static void htab_resize_irq_work(struct irq_work *work)
+{
+	struct bpf_htab *htab = container_of(work, struct bpf_htab,
+					     resize_irq_work);
+
+	queue_work(system_unbound_wq, &htab->resize_work);
 }
 
 
@@ -1120,15 +1545,12 @@ static long htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
-	head = &b->head;
-
 	if (unlikely(map_flags & BPF_F_LOCK)) {
 		if (unlikely(!btf_record_has_field(map->record, BPF_SPIN_LOCK)))
 			return -EINVAL;
 		/* find an element without taking the bucket lock */
-		l_old = lookup_nulls_elem_raw(head, hash, key, key_size,
-					      htab->n_buckets);
+		l_old = lookup_nulls_elem_raw(htab_table(htab), hash, key,
+					      key_size);
 		ret = check_flags(htab, l_old, map_flags);
 		if (ret)
 			return ret;
@@ -1145,10 +1567,11 @@ static long htab_map_update_elem(struct bpf_map *map, void *key, void *value,
 		 */
 	}
 
-	ret = htab_lock_bucket(htab, b, hash, &flags);
+	ret = htab_lock_select_bucket(htab, hash, &b, &flags);
 	if (ret)
 		return ret;
 
+	head = &b->head;
 	l_old = lookup_elem_raw(head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
@@ -1292,13 +1715,11 @@ static long __htab_percpu_map_update_elem(struct bpf_map *map, void *key,
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
 
-	b = __select_bucket(htab, hash);
-	head = &b->head;
-
-	ret = htab_lock_bucket(htab, b, hash, &flags);
+	ret = htab_lock_select_bucket(htab, hash, &b, &flags);
 	if (ret)
 		return ret;
 
+	head = &b->head;
 	l_old = lookup_elem_raw(head, hash, key, key_size);
 
 	ret = check_flags(htab, l_old, map_flags);
@@ -1424,13 +1845,12 @@ static long htab_map_delete_elem(struct bpf_map *map, void *key)
 	key_size = map->key_size;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
-	b = __select_bucket(htab, hash);
-	head = &b->head;
 
-	ret = htab_lock_bucket(htab, b, hash, &flags);
+	ret = htab_lock_select_bucket(htab, hash, &b, &flags);
 	if (ret)
 		return ret;
 
+	head = &b->head;
 	l = lookup_elem_raw(head, hash, key, key_size);
 
 	if (l) {
@@ -1482,14 +1902,15 @@ static long htab_lru_map_delete_elem(struct bpf_map *map, void *key)
 
 static void delete_all_elements(struct bpf_htab *htab)
 {
+	struct htab_table *tbl = rcu_dereference_protected(htab->tbl, true);
 	int i;
 
 	/* It's called from a worker thread, so disable migration here,
 	 * since bpf_mem_cache_free() relies on that.
 	 */
 	migrate_disable();
-	for (i = 0; i < htab->n_buckets; i++) {
-		struct hlist_nulls_head *head = select_bucket(htab, i);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		struct hlist_nulls_head *head = &tbl->buckets[i].head;
 		struct hlist_nulls_node *n;
 		struct htab_elem *l;
 
@@ -1504,11 +1925,14 @@ static void delete_all_elements(struct bpf_htab *htab)
 
 static void htab_free_malloced_timers_and_wq(struct bpf_htab *htab)
 {
+	struct htab_table *tbl;
 	int i;
 
+	htab_resize_lock(htab);
 	rcu_read_lock();
-	for (i = 0; i < htab->n_buckets; i++) {
-		struct hlist_nulls_head *head = select_bucket(htab, i);
+	tbl = htab_table(htab);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		struct hlist_nulls_head *head = &tbl->buckets[i].head;
 		struct hlist_nulls_node *n;
 		struct htab_elem *l;
 
@@ -1524,6 +1948,7 @@ static void htab_free_malloced_timers_and_wq(struct bpf_htab *htab)
 		cond_resched_rcu();
 	}
 	rcu_read_unlock();
+	htab_resize_unlock(htab);
 }
 
 static void htab_map_free_timers_and_wq(struct bpf_map *map)
@@ -1554,6 +1979,12 @@ static void htab_map_free(struct bpf_map *map)
 	 * underneath and is responsible for waiting for callbacks to finish
 	 * during bpf_mem_alloc_destroy().
 	 */
+	if (htab_is_lru(htab))
+		bpf_lru_sync(&htab->lru);
+	if (htab_is_resizable(htab)) {
+		irq_work_sync(&htab->resize_irq_work);
+		cancel_work_sync(&htab->resize_work);
+	}
 	if (!htab_is_prealloc(htab)) {
 		delete_all_elements(htab);
 	} else {
@@ -1563,7 +1994,7 @@ static void htab_map_free(struct bpf_map *map)
 
 	bpf_map_free_elem_count(map);
 	free_percpu(htab->extra_elems);
-	bpf_map_area_free(htab->buckets);
+	bpf_map_area_free(rcu_dereference_protected(htab->tbl, true));
 	bpf_mem_alloc_destroy(&htab->pcpu_ma);
 	bpf_mem_alloc_destroy(&htab->ma);
 	if (htab->use_percpu_counter)
@@ -1610,13 +2041,12 @@ static int __htab_map_lookup_and_delete_elem(struct bpf_map *map, void *key,
 	key_size = map->key_size;
 
 	hash = htab_map_hash(key, key_size, htab->hashrnd);
-	b = __select_bucket(htab, hash);
-	head = &b->head;
 
-	ret = htab_lock_bucket(htab, b, hash, &bflags);
+	ret = htab_lock_select_bucket(htab, hash, &b, &bflags);
 	if (ret)
 		return ret;
 
+	head = &b->head;
 	l = lookup_elem_raw(head, hash, key, key_size);
 	if (!l) {
 		ret = -ENOENT;
@@ -1706,6 +2136,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	struct htab_elem *node_to_free = NULL;
 	u64 elem_map_flags, map_flags;
 	struct hlist_nulls_head *head;
+	struct htab_table *tbl;
 	struct hlist_nulls_node *n;
 	unsigned long flags = 0;
 	bool locked = false;
@@ -1714,10 +2145,14 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	int ret = 0;
 
 	elem_map_flags = attr->batch.elem_flags;
-	if ((elem_map_flags & ~BPF_F_LOCK) ||
+	if ((elem_map_flags & ~(BPF_F_LOCK | BPF_F_PERCPU_FOLD)) ||
 	    ((elem_map_flags & BPF_F_LOCK) && !btf_record_has_field(map->record, BPF_SPIN_LOCK)))
 		return -EINVAL;
 
+	ret = bpf_map_check_percpu_fold(map, elem_map_flags);
+	if (ret)
+		return ret;
+
 	map_flags = attr->batch.flags;
 	if (map_flags)
 		return -EINVAL;
@@ -1733,14 +2168,19 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	if (ubatch && copy_from_user(&batch, ubatch, sizeof(batch)))
 		return -EFAULT;
 
-	if (batch >= htab->n_buckets)
-		return -ENOENT;
+	htab_resize_lock(htab);
+	/* can't change until we drop the resize lock */
+	tbl = htab_table(htab);
+	if (batch >= tbl->n_buckets) {
+		ret = -ENOENT;
+		goto out;
+	}
 
 	key_size = htab->map.key_size;
 	roundup_key_size = round_up(htab->map.key_size, 8);
 	value_size = htab->map.value_size;
 	size = round_up(value_size, 8);
-	if (is_percpu)
+	if (is_percpu && !(elem_map_flags & BPF_F_PERCPU_FOLD))
 		value_size = size * num_possible_cpus();
 	total = 0;
 	/* while experimenting with hash tables with sizes ranging from 10 to
@@ -1765,7 +2205,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 again_nocopy:
 	dst_key = keys;
 	dst_val = values;
-	b = &htab->buckets[batch];
+	b = &tbl->buckets[batch];
 	head = &b->head;
 	/* do not grab the lock unless need it (bucket_cnt > 0). */
 	if (locked) {
@@ -1818,7 +2258,24 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	hlist_nulls_for_each_entry_safe(l, n, head, hash_node) {
 		memcpy(dst_key, l->key, key_size);
 
-		if (is_percpu) {
+		if (is_percpu && (elem_map_flags & BPF_F_PERCPU_FOLD)) {
+			void __percpu *pptr;
+			bool first = true;
+			int cpu;
+
+			/* no special fields, see bpf_map_check_percpu_fold() */
+			pptr = htab_elem_get_ptr(l, map->key_size);
+			for_each_possible_cpu(cpu) {
+				if (first)
+					copy_map_value_long(map, dst_val,
+							    per_cpu_ptr(pptr, cpu));
+				else
+					bpf_percpu_fold_value(map, dst_val,
+							      per_cpu_ptr(pptr, cpu),
+							      elem_map_flags);
+				first = false;
+			}
+		} else if (is_percpu) {
 			int off = 0, cpu;
 			void __percpu *pptr;
 
@@ -1878,7 +2335,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 	/* If we are not copying data, we can go to next bucket and avoid
 	 * unlocking the rcu.
 	 */
-	if (!bucket_cnt && (batch + 1 < htab->n_buckets)) {
+	if (!bucket_cnt && (batch + 1 < tbl->n_buckets)) {
 		batch++;
 		goto again_nocopy;
 	}
@@ -1895,7 +2352,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 
 	total += bucket_cnt;
 	batch++;
-	if (batch >= htab->n_buckets) {
+	if (batch >= tbl->n_buckets) {
 		ret = -ENOENT;
 		goto after_loop;
 	}
@@ -1912,6 +2369,7 @@ __htab_map_lookup_and_delete_batch(struct bpf_map *map,
 		ret = -EFAULT;
 
 out:
+	htab_resize_unlock(htab);
 	kvfree(keys);
 	kvfree(values);
 	return ret;
@@ -1990,7 +2448,9 @@ struct bpf_iter_seq_hash_map_info {
 	struct bpf_map *map;
 	struct bpf_htab *htab;
 	void *percpu_value_buf; // non-zero means percpu hash
-	u32 bucket_id;
+	struct htab_table *tbl;	/* of the pinned bucket_id */
+	u32 bucket_id;		/* logical bucket, see htab_walk_buckets() */
+	u32 bucket_pos;
 	u32 skip_elems;
 };
 
@@ -1998,19 +2458,17 @@ static struct htab_elem *
 bpf_hash_map_seq_find_next(struct bpf_iter_seq_hash_map_info *info,
 			   struct htab_elem *prev_elem)
 {
-	const struct bpf_htab *htab = info->htab;
+	struct bpf_htab *htab = info->htab;
+	u32 n_walk = htab_walk_buckets(htab);
 	u32 skip_elems = info->skip_elems;
 	u32 bucket_id = info->bucket_id;
 	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
+	struct htab_table *tbl;
 	struct htab_elem *elem;
-	struct bucket *b;
-	u32 i, count;
-
-	if (bucket_id >= htab->n_buckets)
-		return NULL;
+	u32 i, pos, count;
 
-	/* try to find next elem in the same bucket */
+	/* try to find next elem in the same logical bucket */
 	if (prev_elem) {
 		/* no update/deletion on this bucket, prev_elem should be still valid
 		 * and we won't skip elements.
@@ -2020,27 +2478,47 @@ bpf_hash_map_seq_find_next(struct bpf_iter_seq_hash_map_info *info,
 		if (elem)
 			return elem;
 
-		/* not found, unlock and go to the next bucket */
-		b = &htab->buckets[bucket_id++];
+		for (pos = info->bucket_pos + 1;
+		     (head = htab_walk_head(info->tbl, n_walk, bucket_id, pos));
+		     pos++) {
+			n = rcu_dereference_raw(hlist_nulls_first_rcu(head));
+			elem = hlist_nulls_entry_safe(n, struct htab_elem, hash_node);
+			if (elem) {
+				info->bucket_pos = pos;
+				return elem;
+			}
+		}
+
+		/* not found, unpin and go to the next logical bucket */
+		bucket_id++;
+		htab_walk_unpin(htab);
 		rcu_read_unlock();
 		skip_elems = 0;
 	}
 
-	for (i = bucket_id; i < htab->n_buckets; i++) {
-		b = &htab->buckets[i];
+	for (i = bucket_id; i < n_walk; i++) {
 		rcu_read_lock();
+		/* from process context, never on top of a bucket move */
+		if (WARN_ON_ONCE(htab_walk_pin(htab, i, &tbl))) {
+			rcu_read_unlock();
+			break;
+		}
 
 		count = 0;
-		head = &b->head;
-		hlist_nulls_for_each_entry_rcu(elem, n, head, hash_node) {
-			if (count >= skip_elems) {
-				info->bucket_id = i;
-				info->skip_elems = count;
-				return elem;
+		for (pos = 0; (head = htab_walk_head(tbl, n_walk, i, pos)); pos++) {
+			hlist_nulls_for_each_entry_rcu(elem, n, head, hash_node) {
+				if (count >= skip_elems) {
+					info->tbl = tbl;
+					info->bucket_id = i;
+					info->bucket_pos = pos;
+					info->skip_elems = count;
+					return elem;
+				}
+				count++;
 			}
-			count++;
 		}
 
+		htab_walk_unpin(htab);
 		rcu_read_unlock();
 		skip_elems = 0;
 	}
@@ -2119,10 +2597,14 @@ static int bpf_hash_map_seq_show(struct seq_file *seq, void *v)
 
 static void bpf_hash_map_seq_stop(struct seq_file *seq, void *v)
 {
-	if (!v)
+	struct bpf_iter_seq_hash_map_info *info = seq->private;
+
+	if (!v) {
 		(void)__bpf_hash_map_seq_show(seq, NULL);
-	else
+	} else {
+		htab_walk_unpin(info->htab);
 		rcu_read_unlock();
+	}
 }
 
 static int bpf_iter_init_hash_map(void *priv_data,
@@ -2177,14 +2659,16 @@ static long bpf_for_each_hash_elem(struct bpf_map *map, bpf_callback_t callback_
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
 	struct hlist_nulls_head *head;
 	struct hlist_nulls_node *n;
+	struct htab_table *tbl;
 	struct htab_elem *elem;
 	u32 roundup_key_size;
-	int i, num_elems = 0;
+	u32 n_walk, i, pos;
+	int num_elems = 0;
 	void __percpu *pptr;
-	struct bucket *b;
 	void *key, *val;
 	bool is_percpu;
 	u64 ret = 0;
+	int err;
 
 	if (flags != 0)
 		return -EINVAL;
@@ -2197,28 +2681,37 @@ static long bpf_for_each_hash_elem(struct bpf_map *map, bpf_callback_t callback_
 	 */
 	if (is_percpu)
 		migrate_disable();
-	for (i = 0; i < htab->n_buckets; i++) {
-		b = &htab->buckets[i];
+	n_walk = htab_walk_buckets(htab);
+	for (i = 0; i < n_walk; i++) {
 		rcu_read_lock();
-		head = &b->head;
-		hlist_nulls_for_each_entry_rcu(elem, n, head, hash_node) {
-			key = elem->key;
-			if (is_percpu) {
-				/* current cpu value for percpu map */
-				pptr = htab_elem_get_ptr(elem, map->key_size);
-				val = this_cpu_ptr(pptr);
-			} else {
-				val = elem->key + roundup_key_size;
-			}
-			num_elems++;
-			ret = callback_fn((u64)(long)map, (u64)(long)key,
-					  (u64)(long)val, (u64)(long)callback_ctx, 0);
-			/* return value: 0 - continue, 1 - stop and return */
-			if (ret) {
-				rcu_read_unlock();
-				goto out;
+		err = htab_walk_pin(htab, i, &tbl);
+		if (err) {
+			rcu_read_unlock();
+			num_elems = err;
+			goto out;
+		}
+		for (pos = 0; (head = htab_walk_head(tbl, n_walk, i, pos)); pos++) {
+			hlist_nulls_for_each_entry_rcu(elem, n, head, hash_node) {
+				key = elem->key;
+				if (is_percpu) {
+					/* current cpu value for percpu map */
+					pptr = htab_elem_get_ptr(elem, map->key_size);
+					val = this_cpu_ptr(pptr);
+				} else {
+					val = elem->key + roundup_key_size;
+				}
+				num_elems++;
+				ret = callback_fn((u64)(long)map, (u64)(long)key,
+						  (u64)(long)val, (u64)(long)callback_ctx, 0);
+				/* return value: 0 - continue, 1 - stop and return */
+				if (ret) {
+					htab_walk_unpin(htab);
+					rcu_read_unlock();
+					goto out;
+				}
 			}
 		}
+		htab_walk_unpin(htab);
 		rcu_read_unlock();
 	}
 out:
@@ -2237,7 +2730,7 @@ static u64 htab_map_mem_usage(const struct bpf_map *map)
 	u64 num_entries;
 	u64 usage = sizeof(struct bpf_htab);
 
-	usage += sizeof(struct bucket) * htab->n_buckets;
+	usage += sizeof(struct bucket) * READ_ONCE(htab->n_buckets);
 	usage += sizeof(int) * num_possible_cpus() * HASHTAB_MAP_LOCK_COUNT;
 	if (prealloc) {
 		num_entries = map->max_entries;
@@ -2512,13 +3005,14 @@ static int fd_htab_map_alloc_check(union bpf_attr *attr)
 static void fd_htab_map_free(struct bpf_map *map)
 {
 	struct bpf_htab *htab = container_of(map, struct bpf_htab, map);
+	struct htab_table *tbl = rcu_dereference_protected(htab->tbl, true);
 	struct hlist_nulls_node *n;
 	struct hlist_nulls_head *head;
 	struct htab_elem *l;
 	int i;
 
-	for (i = 0; i < htab->n_buckets; i++) {
-		head = select_bucket(htab, i);
+	for (i = 0; i < tbl->n_buckets; i++) {
+		head = &tbl->buckets[i].head;
 
 		hlist_nulls_for_each_entry_safe(l, n, head, hash_node) {
 			void *ptr = fd_htab_map_get_ptr(map, l);
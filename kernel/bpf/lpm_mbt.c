@@ -0,0 +1,783 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Multibit longest prefix match map
+ */
+
+#include <linux/bpf.h>
+#include <linux/btf.h>
+#include <linux/err.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <uapi/linux/btf.h>
+#include <linux/btf_ids.h>
+
+/* BPF_MAP_TYPE_LPM_MULTIBIT takes the same keys as BPF_MAP_TYPE_LPM_TRIE,
+ * but trades memory for lookup speed: instead of walking a binary trie bit
+ * by bit, it walks a stride 8 multibit trie byte by byte, so an IPv4
+ * lookup touches at most 4 cache lines and an IPv6 one at most 16.
+ *
+ * Level n of the trie is a node with 256 slots indexed by byte n of the
+ * key. A slot either points to a child node for the next byte, or holds
+ * the longest prefix ending at this level that covers it (controlled
+ * prefix expansion), or NULL. A prefix of length L lives on level
+ * (L - 1) / 8 and covers 2^(8 * (level + 1) - L) slots there.
+ *
+ * Slots that have no prefix of their own fall back to the node's def,
+ * which is the best match from the levels above. When a slot points to a
+ * child, the slot's own prefix is pushed into that child's def, so a
+ * lookup never has to remember candidates on the way down:
+ *
+ *	e = slots[key[0]]; while (e is a node) e = node->slots[key[++n]];
+ *	return e ?: node->def;
+ *
+ * Prefixes shorter than a whole byte on a level are also kept in the
+ * node's pfx heap, indexed by (1 << len) + bits like an ART table, so the
+ * slots they cover can be recomputed on update and delete. Full byte
+ * prefixes are recognized by their prefixlen in the slots. The /0 prefix
+ * is the def of the root node.
+ *
+ * Lookups are lockless under RCU; updates and deletes serialize on the
+ * map lock and free replaced leaves and emptied nodes after a grace
+ * period.
+ */
+
+#define LPM_MBT_STRIDE		8
+#define LPM_MBT_SLOTS		(1 << LPM_MBT_STRIDE)
+
+/* low bit of a slot tags a child node */
+#define LPM_MBT_CHILD		1UL
+
+struct lpm_mbt_leaf {
+	struct rcu_head			rcu;
+	u32				prefixlen;
+	u8				data[];
+};
+
+struct lpm_mbt_pfx {
+	union {
+		/* heap indices 0 and 1 are never used */
+		struct rcu_head		rcu;
+		struct lpm_mbt_leaf __rcu *leaf[LPM_MBT_SLOTS];
+	};
+};
+
+struct lpm_mbt_node {
+	/* best match for slots without a prefix of their own */
+	struct lpm_mbt_leaf __rcu	*def;
+	struct lpm_mbt_pfx __rcu	*pfx;
+	struct lpm_mbt_node		*parent;
+	struct rcu_head			rcu;
+	/* prefixes ending on this level and child nodes */
+	u16				nr_pfx;
+	u16				nr_children;
+	u8				level;
+	u8				parent_slot;
+	void __rcu			*slots[LPM_MBT_SLOTS];
+};
+
+struct lpm_mbt {
+	struct bpf_map			map;
+	size_t				n_entries;
+	size_t				n_nodes;
+	size_t				n_pfx;
+	size_t				max_prefixlen;
+	size_t				data_size;
+	spinlock_t			lock;
+	struct lpm_mbt_node		root;
+};
+
+static bool mbt_is_child(const void *e)
+{
+	return (unsigned long)e & LPM_MBT_CHILD;
+}
+
+static struct lpm_mbt_node *mbt_child(const void *e)
+{
+	return (void *)((unsigned long)e & ~LPM_MBT_CHILD);
+}
+
+/* Update side accessors, all called with trie->lock held */
+static void *mbt_slot(const struct lpm_mbt_node *n, u32 s)
+{
+	return rcu_dereference_protected(n->slots[s], 1);
+}
+
+static struct lpm_mbt_leaf *mbt_def(const struct lpm_mbt_node *n)
+{
+	return rcu_dereference_protected(n->def, 1);
+}
+
+static struct lpm_mbt_leaf *mbt_pfx(const struct lpm_mbt_node *n, u32 idx)
+{
+	struct lpm_mbt_pfx *pfx = rcu_dereference_protected(n->pfx, 1);
+
+	return pfx ? rcu_dereference_protected(pfx->leaf[idx], 1) : NULL;
+}
+
+/* The full byte prefix of slot s, if there is one */
+static struct lpm_mbt_leaf *mbt_exact(const struct lpm_mbt_node *n, u32 s)
+{
+	void *e = mbt_slot(n, s);
+	struct lpm_mbt_leaf *leaf;
+
+	leaf = mbt_is_child(e) ? mbt_def(mbt_child(e)) : e;
+	if (leaf && leaf->prefixlen == (n->level + 1) * LPM_MBT_STRIDE)
+		return leaf;
+	return NULL;
+}
+
+/* The longest prefix shorter than a byte covering slot s */
+static struct lpm_mbt_leaf *mbt_cover(const struct lpm_mbt_node *n, u32 s)
+{
+	struct lpm_mbt_leaf *leaf;
+	u32 idx;
+
+	if (!rcu_access_pointer(n->pfx))
+		return NULL;
+
+	for (idx = (LPM_MBT_SLOTS + s) >> 1; idx > 1; idx >>= 1) {
+		leaf = mbt_pfx(n, idx);
+		if (leaf)
+			return leaf;
+	}
+	return NULL;
+}
+
+static void mbt_set_def(struct lpm_mbt_node *n, struct lpm_mbt_leaf *def)
+{
+	void *e;
+	u32 s;
+
+	if (mbt_def(n) == def)
+		return;
+
+	rcu_assign_pointer(n->def, def);
+
+	/* children of slots without an own prefix inherit the def */
+	if (!n->nr_children)
+		return;
+	for (s = 0; s < LPM_MBT_SLOTS; s++) {
+		e = mbt_slot(n, s);
+		if (mbt_is_child(e) && !mbt_exact(n, s) && !mbt_cover(n, s))
+			mbt_set_def(mbt_child(e), def);
+	}
+}
+
+/* Recompute slot s of n after its prefixes changed, exact is the full
+ * byte prefix of the slot after the change.
+ */
+static void mbt_refresh_slot(struct lpm_mbt_node *n, u32 s,
+			     struct lpm_mbt_leaf *exact)
+{
+	struct lpm_mbt_leaf *own = exact ?: mbt_cover(n, s);
+	void *e = mbt_slot(n, s);
+
+	if (mbt_is_child(e))
+		mbt_set_def(mbt_child(e), own ?: mbt_def(n));
+	else
+		rcu_assign_pointer(n->slots[s], own);
+}
+
+static void mbt_refresh_range(struct lpm_mbt_node *n, u32 k, u32 bits)
+{
+	u32 s, first = bits << (LPM_MBT_STRIDE - k);
+	u32 last = first + (1U << (LPM_MBT_STRIDE - k));
+
+	for (s = first; s < last; s++)
+		mbt_refresh_slot(n, s, mbt_exact(n, s));
+}
+
+static struct lpm_mbt_node *mbt_node_alloc(struct lpm_mbt *trie,
+					   struct lpm_mbt_node *parent, u32 s)
+{
+	struct lpm_mbt_node *n;
+
+	n = bpf_map_kzalloc(&trie->map, sizeof(*n), GFP_NOWAIT | __GFP_NOWARN);
+	if (!n)
+		return NULL;
+
+	n->level = parent->level + 1;
+	n->parent = parent;
+	n->parent_slot = s;
+	RCU_INIT_POINTER(n->def, mbt_exact(parent, s) ?: mbt_cover(parent, s) ?:
+				 mbt_def(parent));
+	trie->n_nodes++;
+
+	return n;
+}
+
+/* Unlink and free nodes left without prefixes and children, bottom up */
+static void mbt_prune(struct lpm_mbt *trie, struct lpm_mbt_node *n)
+{
+	struct lpm_mbt_node *parent;
+	struct lpm_mbt_leaf *exact;
+	u32 s;
+
+	while (n != &trie->root && !n->nr_pfx && !n->nr_children) {
+		parent = n->parent;
+		s = n->parent_slot;
+
+		exact = mbt_exact(parent, s);
+		rcu_assign_pointer(parent->slots[s], exact ?: mbt_cover(parent, s));
+		parent->nr_children--;
+
+		if (rcu_access_pointer(n->pfx)) {
+			kfree_rcu(rcu_dereference_protected(n->pfx, 1), rcu);
+			trie->n_pfx--;
+		}
+		kfree_rcu(n, rcu);
+		trie->n_nodes--;
+		n = parent;
+	}
+}
+
+/* Walk down to the node holding prefixes of length plen, optionally
+ * creating the missing levels on the way.
+ */
+static struct lpm_mbt_node *mbt_walk(struct lpm_mbt *trie, const u8 *data,
+				     u32 plen, bool create)
+{
+	struct lpm_mbt_node *n = &trie->root, *child;
+	u32 d, level = (plen - 1) / LPM_MBT_STRIDE;
+	void *e;
+
+	for (d = 0; d < level; d++) {
+		e = mbt_slot(n, data[d]);
+		if (mbt_is_child(e)) {
+			n = mbt_child(e);
+			continue;
+		}
+		if (!create)
+			return NULL;
+
+		child = mbt_node_alloc(trie, n, data[d]);
+		if (!child) {
+			mbt_prune(trie, n);
+			return NULL;
+		}
+		rcu_assign_pointer(n->slots[data[d]],
+				   (void *)((unsigned long)child | LPM_MBT_CHILD));
+		n->nr_children++;
+		n = child;
+	}
+
+	return n;
+}
+
+/* pfx heap index of a prefix ending k bits into byte b */
+static u32 mbt_pfx_idx(u32 k, u8 b)
+{
+	return (1U << k) + (b >> (LPM_MBT_STRIDE - k));
+}
+
+static struct lpm_mbt_leaf *mbt_partial(const struct lpm_mbt_node *n, u8 b,
+					u32 k)
+{
+	struct lpm_mbt_leaf *leaf;
+	struct lpm_mbt_pfx *pfx;
+	u32 idx;
+
+	pfx = rcu_dereference_check(n->pfx, rcu_read_lock_bh_held());
+	if (pfx && k) {
+		for (idx = mbt_pfx_idx(k, b); idx > 1; idx >>= 1) {
+			leaf = rcu_dereference_check(pfx->leaf[idx],
+						     rcu_read_lock_bh_held());
+			if (leaf)
+				return leaf;
+		}
+	}
+	return rcu_dereference_check(n->def, rcu_read_lock_bh_held());
+}
+
+static struct lpm_mbt_leaf *mbt_lookup(struct lpm_mbt *trie,
+				       const struct bpf_lpm_trie_key_u8 *key)
+{
+	const struct lpm_mbt_node *n = &trie->root;
+	u32 d, plen = key->prefixlen;
+	void *e;
+
+	for (d = 0; (d + 1) * LPM_MBT_STRIDE <= plen; d++) {
+		e = rcu_dereference_check(n->slots[key->data[d]],
+					  rcu_read_lock_bh_held());
+		if (!mbt_is_child(e))
+			return e ?: rcu_dereference_check(n->def,
+							  rcu_read_lock_bh_held());
+		n = mbt_child(e);
+	}
+
+	/* The key ends inside byte d, only shorter prefixes there match */
+	return mbt_partial(n, key->data[d], plen - d * LPM_MBT_STRIDE);
+}
+
+/* Called from syscall or from eBPF program */
+static void *mbt_lookup_elem(struct bpf_map *map, void *_key)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+	struct bpf_lpm_trie_key_u8 *key = _key;
+	struct lpm_mbt_leaf *leaf;
+
+	if (key->prefixlen > trie->max_prefixlen)
+		return NULL;
+
+	leaf = mbt_lookup(trie, key);
+	if (!leaf)
+		return NULL;
+
+	return leaf->data + trie->data_size;
+}
+
+static struct lpm_mbt_leaf *mbt_leaf_alloc(struct lpm_mbt *trie,
+					   const struct bpf_lpm_trie_key_u8 *key,
+					   const void *value)
+{
+	struct lpm_mbt_leaf *leaf;
+	size_t size = sizeof(*leaf) + trie->data_size + trie->map.value_size;
+	u32 i, bits;
+
+	leaf = bpf_map_kmalloc_node(&trie->map, size, GFP_NOWAIT | __GFP_NOWARN,
+				    trie->map.numa_node);
+	if (!leaf)
+		return NULL;
+
+	/* store the prefix with the bits past prefixlen cleared */
+	leaf->prefixlen = key->prefixlen;
+	for (i = 0; i < trie->data_size; i++) {
+		bits = min_t(u32, LPM_MBT_STRIDE,
+			     key->prefixlen - min_t(u32, key->prefixlen, i * 8));
+		leaf->data[i] = bits ? key->data[i] & (0xff00 >> bits) : 0;
+	}
+	memcpy(leaf->data + trie->data_size, value, trie->map.value_size);
+
+	return leaf;
+}
+
+static int mbt_check_flags(struct lpm_mbt_leaf *old, u64 flags)
+{
+	if (old && flags == BPF_NOEXIST)
+		return -EEXIST;
+	if (!old && flags == BPF_EXIST)
+		return -ENOENT;
+	return 0;
+}
+
+/* Called from syscall or from eBPF program */
+static long mbt_update_elem(struct bpf_map *map, void *_key, void *value,
+			    u64 flags)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+	struct bpf_lpm_trie_key_u8 *key = _key;
+	struct lpm_mbt_leaf *leaf, *old;
+	struct lpm_mbt_pfx *pfx;
+	struct lpm_mbt_node *n;
+	unsigned long irq_flags;
+	u32 plen, k, idx;
+	u8 b;
+	int ret;
+
+	if (unlikely(flags > BPF_EXIST))
+		return -EINVAL;
+
+	plen = key->prefixlen;
+	if (plen > trie->max_prefixlen)
+		return -EINVAL;
+
+	leaf = mbt_leaf_alloc(trie, key, value);
+	if (!leaf)
+		return -ENOMEM;
+
+	spin_lock_irqsave(&trie->lock, irq_flags);
+
+	if (!plen) {
+		old = mbt_def(&trie->root);
+		ret = mbt_check_flags(old, flags);
+		if (ret)
+			goto out;
+		if (!old && trie->n_entries == trie->map.max_entries) {
+			ret = -ENOSPC;
+			goto out;
+		}
+		mbt_set_def(&trie->root, leaf);
+		goto done;
+	}
+
+	n = mbt_walk(trie, key->data, plen, false);
+	b = key->data[(plen - 1) / LPM_MBT_STRIDE];
+	k = plen - ((plen - 1) / LPM_MBT_STRIDE) * LPM_MBT_STRIDE;
+	if (!n)
+		old = NULL;
+	else if (k == LPM_MBT_STRIDE)
+		old = mbt_exact(n, b);
+	else
+		old = mbt_pfx(n, mbt_pfx_idx(k, b));
+
+	ret = mbt_check_flags(old, flags);
+	if (ret)
+		goto out;
+	if (!old && trie->n_entries == trie->map.max_entries) {
+		ret = -ENOSPC;
+		goto out;
+	}
+
+	if (!n) {
+		n = mbt_walk(trie, key->data, plen, true);
+		if (!n) {
+			ret = -ENOMEM;
+			goto out;
+		}
+	}
+
+	if (k == LPM_MBT_STRIDE) {
+		mbt_refresh_slot(n, b, leaf);
+	} else {
+		pfx = rcu_dereference_protected(n->pfx, 1);
+		if (!pfx) {
+			pfx = bpf_map_kzalloc(&trie->map, sizeof(*pfx),
+					      GFP_NOWAIT | __GFP_NOWARN);
+			if (!pfx) {
+				mbt_prune(trie, n);
+				ret = -ENOMEM;
+				goto out;
+			}
+			rcu_assign_pointer(n->pfx, pfx);
+			trie->n_pfx++;
+		}
+		idx = mbt_pfx_idx(k, b);
+		rcu_assign_pointer(pfx->leaf[idx], leaf);
+		mbt_refresh_range(n, k, b >> (LPM_MBT_STRIDE - k));
+	}
+	if (!old)
+		n->nr_pfx++;
+
+done:
+	if (!old)
+		trie->n_entries++;
+	spin_unlock_irqrestore(&trie->lock, irq_flags);
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+
+out:
+	spin_unlock_irqrestore(&trie->lock, irq_flags);
+	kfree(leaf);
+	return ret;
+}
+
+/* Called from syscall or from eBPF program */
+static long mbt_delete_elem(struct bpf_map *map, void *_key)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+	struct bpf_lpm_trie_key_u8 *key = _key;
+	struct lpm_mbt_leaf *old = NULL;
+	struct lpm_mbt_node *n;
+	unsigned long irq_flags;
+	u32 plen, k, idx;
+	u8 b;
+
+	plen = key->prefixlen;
+	if (plen > trie->max_prefixlen)
+		return -EINVAL;
+
+	spin_lock_irqsave(&trie->lock, irq_flags);
+
+	if (!plen) {
+		old = mbt_def(&trie->root);
+		if (old)
+			mbt_set_def(&trie->root, NULL);
+		goto out;
+	}
+
+	n = mbt_walk(trie, key->data, plen, false);
+	if (!n)
+		goto out;
+
+	b = key->data[(plen - 1) / LPM_MBT_STRIDE];
+	k = plen - ((plen - 1) / LPM_MBT_STRIDE) * LPM_MBT_STRIDE;
+	if (k == LPM_MBT_STRIDE) {
+		old = mbt_exact(n, b);
+		if (!old)
+			goto out;
+		mbt_refresh_slot(n, b, NULL);
+	} else {
+		idx = mbt_pfx_idx(k, b);
+		old = mbt_pfx(n, idx);
+		if (!old)
+			goto out;
+		RCU_INIT_POINTER(rcu_dereference_protected(n->pfx, 1)->leaf[idx],
+				 NULL);
+		mbt_refresh_range(n, k, b >> (LPM_MBT_STRIDE - k));
+	}
+	n->nr_pfx--;
+	mbt_prune(trie, n);
+
+out:
+	if (old)
+		trie->n_entries--;
+	spin_unlock_irqrestore(&trie->lock, irq_flags);
+	if (!old)
+		return -ENOENT;
+
+	kfree_rcu(old, rcu);
+	return 0;
+}
+
+#define LPM_MBT_DATA_SIZE_MAX	16
+#define LPM_MBT_DATA_SIZE_MIN	1
+
+#define LPM_MBT_VAL_SIZE_MAX	(KMALLOC_MAX_SIZE - LPM_MBT_DATA_SIZE_MAX - \
+				 sizeof(struct lpm_mbt_leaf))
+#define LPM_MBT_VAL_SIZE_MIN	1
+
+#define LPM_MBT_KEY_SIZE(X)	(sizeof(struct bpf_lpm_trie_key_u8) + (X))
+#define LPM_MBT_KEY_SIZE_MAX	LPM_MBT_KEY_SIZE(LPM_MBT_DATA_SIZE_MAX)
+#define LPM_MBT_KEY_SIZE_MIN	LPM_MBT_KEY_SIZE(LPM_MBT_DATA_SIZE_MIN)
+
+#define LPM_MBT_CREATE_FLAG_MASK	(BPF_F_NO_PREALLOC | BPF_F_NUMA_NODE | \
+					 BPF_F_ACCESS_MASK)
+
+static struct bpf_map *mbt_alloc(union bpf_attr *attr)
+{
+	struct lpm_mbt *trie;
+
+	/* check sanity of attributes */
+	if (attr->max_entries == 0 ||
+	    !(attr->map_flags & BPF_F_NO_PREALLOC) ||
+	    attr->map_flags & ~LPM_MBT_CREATE_FLAG_MASK ||
+	    !bpf_map_flags_access_ok(attr->map_flags) ||
+	    attr->key_size < LPM_MBT_KEY_SIZE_MIN ||
+	    attr->key_size > LPM_MBT_KEY_SIZE_MAX ||
+	    attr->value_size < LPM_MBT_VAL_SIZE_MIN ||
+	    attr->value_size > LPM_MBT_VAL_SIZE_MAX)
+		return ERR_PTR(-EINVAL);
+
+	trie = bpf_map_area_alloc(sizeof(*trie), NUMA_NO_NODE);
+	if (!trie)
+		return ERR_PTR(-ENOMEM);
+
+	/* copy mandatory map attributes */
+	bpf_map_init_from_attr(&trie->map, attr);
+	trie->data_size = attr->key_size -
+			  offsetof(struct bpf_lpm_trie_key_u8, data);
+	trie->max_prefixlen = trie->data_size * 8;
+
+	spin_lock_init(&trie->lock);
+
+	return &trie->map;
+}
+
+/* Free the leaves owned by n and everything below it */
+static void mbt_free_node(struct lpm_mbt_node *n)
+{
+	struct lpm_mbt_pfx *pfx;
+	struct lpm_mbt_leaf *exact;
+	u32 s, idx;
+	void *e;
+
+	for (s = 0; s < LPM_MBT_SLOTS; s++) {
+		/* look at the child's def before it goes away */
+		exact = mbt_exact(n, s);
+		e = mbt_slot(n, s);
+		if (mbt_is_child(e))
+			mbt_free_node(mbt_child(e));
+		kfree(exact);
+	}
+
+	pfx = rcu_dereference_protected(n->pfx, 1);
+	if (pfx) {
+		for (idx = 2; idx < LPM_MBT_SLOTS; idx++)
+			kfree(rcu_dereference_protected(pfx->leaf[idx], 1));
+		kfree(pfx);
+	}
+
+	if (n->parent)
+		kfree(n);
+}
+
+static void mbt_free(struct bpf_map *map)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+
+	mbt_free_node(&trie->root);
+	kfree(rcu_dereference_protected(trie->root.def, 1));
+	bpf_map_area_free(trie);
+}
+
+/* Readers' view of a slot's full byte prefix, see mbt_exact() */
+static struct lpm_mbt_leaf *mbt_next_exact(const struct lpm_mbt_node *n,
+					   u32 s, struct lpm_mbt_node **child)
+{
+	struct lpm_mbt_leaf *leaf;
+	void *e;
+
+	e = rcu_dereference(n->slots[s]);
+	*child = mbt_is_child(e) ? mbt_child(e) : NULL;
+	leaf = *child ? rcu_dereference((*child)->def) : e;
+	if (leaf && leaf->prefixlen == (n->level + 1) * LPM_MBT_STRIDE)
+		return leaf;
+	return NULL;
+}
+
+/* The first prefix at or after slot s of n in iteration order, going up
+ * the trie once n is exhausted.
+ */
+static struct lpm_mbt_leaf *mbt_next_slot(struct lpm_mbt_node *n, u32 s)
+{
+	struct lpm_mbt_node *child;
+	struct lpm_mbt_leaf *leaf;
+	struct lpm_mbt_pfx *pfx;
+	u32 idx;
+
+	for (;;) {
+		for (; s < LPM_MBT_SLOTS; s++) {
+			leaf = mbt_next_exact(n, s, &child);
+			if (leaf)
+				return leaf;
+			if (!child)
+				continue;
+
+			/* descend: shorter prefixes first, then the slots */
+			n = child;
+			s = -1;
+			pfx = rcu_dereference(n->pfx);
+			if (!pfx)
+				continue;
+			for (idx = 2; idx < LPM_MBT_SLOTS; idx++) {
+				leaf = rcu_dereference(pfx->leaf[idx]);
+				if (leaf)
+					return leaf;
+			}
+		}
+
+		if (!n->parent)
+			return NULL;
+		s = n->parent_slot + 1;
+		n = n->parent;
+	}
+}
+
+/* The next prefix after pfx heap index idx of n */
+static struct lpm_mbt_leaf *mbt_next_pfx(struct lpm_mbt_node *n, u32 idx)
+{
+	struct lpm_mbt_leaf *leaf;
+	struct lpm_mbt_pfx *pfx;
+
+	pfx = rcu_dereference(n->pfx);
+	if (pfx) {
+		for (; idx < LPM_MBT_SLOTS; idx++) {
+			leaf = rcu_dereference(pfx->leaf[idx]);
+			if (leaf)
+				return leaf;
+		}
+	}
+	return mbt_next_slot(n, 0);
+}
+
+static struct lpm_mbt_node *mbt_find_node(struct lpm_mbt *trie,
+					  const u8 *data, u32 plen)
+{
+	struct lpm_mbt_node *n = &trie->root;
+	u32 d, level = (plen - 1) / LPM_MBT_STRIDE;
+	void *e;
+
+	for (d = 0; d < level; d++) {
+		e = rcu_dereference(n->slots[data[d]]);
+		if (!mbt_is_child(e))
+			return NULL;
+		n = mbt_child(e);
+	}
+	return n;
+}
+
+/* Iteration order is the /0 prefix, then for each node its prefixes
+ * shorter than a byte by heap index, then for each slot its full byte
+ * prefix followed by the child's subtree.
+ */
+static int mbt_get_next_key(struct bpf_map *map, void *_key, void *_next_key)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+	struct bpf_lpm_trie_key_u8 *key = _key, *next_key = _next_key;
+	struct lpm_mbt_leaf *leaf = NULL, *cur = NULL;
+	struct lpm_mbt_node *n;
+	u32 plen, k, idx;
+	u8 b;
+
+	if (key && key->prefixlen <= trie->max_prefixlen) {
+		plen = key->prefixlen;
+		if (!plen) {
+			cur = rcu_dereference(trie->root.def);
+			if (cur)
+				leaf = mbt_next_pfx(&trie->root, 2);
+		} else if ((n = mbt_find_node(trie, key->data, plen))) {
+			struct lpm_mbt_node *child;
+
+			b = key->data[(plen - 1) / LPM_MBT_STRIDE];
+			k = plen - ((plen - 1) / LPM_MBT_STRIDE) * LPM_MBT_STRIDE;
+			if (k == LPM_MBT_STRIDE) {
+				cur = mbt_next_exact(n, b, &child);
+				if (cur && child)
+					leaf = mbt_next_pfx(child, 2);
+				else if (cur)
+					leaf = mbt_next_slot(n, b + 1);
+			} else {
+				struct lpm_mbt_pfx *pfx = rcu_dereference(n->pfx);
+
+				idx = mbt_pfx_idx(k, b);
+				cur = pfx ? rcu_dereference(pfx->leaf[idx]) : NULL;
+				if (cur)
+					leaf = mbt_next_pfx(n, idx + 1);
+			}
+		}
+	}
+
+	/* For a missing key, start over from the first prefix */
+	if (!cur) {
+		leaf = rcu_dereference(trie->root.def);
+		if (!leaf)
+			leaf = mbt_next_pfx(&trie->root, 2);
+	}
+	if (!leaf)
+		return -ENOENT;
+
+	next_key->prefixlen = leaf->prefixlen;
+	memcpy(next_key->data, leaf->data, trie->data_size);
+	return 0;
+}
+
+static int mbt_check_btf(const struct bpf_map *map,
+			 const struct btf *btf,
+			 const struct btf_type *key_type,
+			 const struct btf_type *value_type)
+{
+	/* Keys must have struct bpf_lpm_trie_key_u8 embedded. */
+	return BTF_INFO_KIND(key_type->info) != BTF_KIND_STRUCT ?
+	       -EINVAL : 0;
+}
+
+static u64 mbt_mem_usage(const struct bpf_map *map)
+{
+	struct lpm_mbt *trie = container_of(map, struct lpm_mbt, map);
+	u64 usage = sizeof(*trie), elem_size;
+
+	elem_size = sizeof(struct lpm_mbt_leaf) + trie->data_size +
+		    trie->map.value_size;
+	usage += elem_size * READ_ONCE(trie->n_entries);
+	usage += sizeof(struct lpm_mbt_node) * READ_ONCE(trie->n_nodes);
+	usage += sizeof(struct lpm_mbt_pfx) * READ_ONCE(trie->n_pfx);
+	return usage;
+}
+
+BTF_ID_LIST_SINGLE(mbt_map_btf_ids, struct, lpm_mbt)
+const struct bpf_map_ops lpm_mbt_map_ops = {
+	.map_meta_equal = bpf_map_meta_equal,
+	.map_alloc = mbt_alloc,
+	.map_free = mbt_free,
+	.map_get_next_key = mbt_get_next_key,
+	.map_lookup_elem = mbt_lookup_elem,
+	.map_update_elem = mbt_update_elem,
+	.map_delete_elem = mbt_delete_elem,
+	.map_lookup_batch = generic_map_lookup_batch,
+	.map_update_batch = generic_map_update_batch,
+	.map_delete_batch = generic_map_delete_batch,
+	.map_check_btf = mbt_check_btf,
+	.map_mem_usage = mbt_mem_usage,
+	.map_btf_id = &mbt_map_btf_ids[0],
+};
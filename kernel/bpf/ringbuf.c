@@ -1,6 +1,7 @@
 #include <linux/bpf.h>
 #include <linux/btf.h>
 #include <linux/err.h>
+#include <linux/hrtimer.h>
 #include <linux/irq_work.h>
 #include <linux/slab.h>
 #include <linux/filter.h>
@@ -12,7 +13,7 @@
 #include <uapi/linux/btf.h>
 #include <linux/btf_ids.h>
 
-#define RINGBUF_CREATE_FLAG_MASK (BPF_F_NUMA_NODE)
+#define RINGBUF_CREATE_FLAG_MASK (BPF_F_NUMA_NODE | BPF_F_PERCPU_RING)
 
 /* non-mmap()'able part of bpf_ringbuf (everything up to consumer page) */
 #define RINGBUF_PGOFF \
@@ -23,10 +24,24 @@
 
 #define RINGBUF_MAX_RECORD_SZ (UINT_MAX/4)
 
+/* map_extra of BPF_MAP_TYPE_RINGBUF: wakeup byte threshold in the low 32
+ * bits, maximum wakeup delay in usecs in the high 32 bits.
+ */
+#define RINGBUF_WAKEUP_BYTES(extra)	((u32)(extra))
+#define RINGBUF_WAKEUP_USECS(extra)	((u32)((extra) >> 32))
+#define RINGBUF_MAX_WAKEUP_USECS	USEC_PER_SEC
+
 struct bpf_ringbuf {
-	wait_queue_head_t waitq;
+	wait_queue_head_t *waitq;
 	struct irq_work work;
 	u64 mask;
+	/* Wakeup coalescing, disabled when wakeup_bytes is 0 */
+	u32 wakeup_bytes;
+	u32 wakeup_usecs;
+	unsigned long wakeup_pos;
+	int wakeup_timer_armed;
+	struct irq_work timer_work;
+	struct hrtimer wakeup_timer;
 	struct page **pages;
 	int nr_pages;
 	raw_spinlock_t spinlock ____cacheline_aligned_in_smp;
@@ -78,6 +93,10 @@ struct bpf_ringbuf {
 struct bpf_ringbuf_map {
 	struct bpf_map map;
 	struct bpf_ringbuf *rb;
+	/* BPF_F_PERCPU_RING: one ring per possible CPU, indexed by CPU id */
+	struct bpf_ringbuf **percpu_rb;
+	/* woken up by all the rings of the map */
+	wait_queue_head_t waitq;
 };
 
 /* 8-byte ring buffer record header structure */
@@ -147,11 +166,42 @@ static struct bpf_ringbuf *bpf_ringbuf_area_alloc(size_t data_sz, int numa_node)
 	return NULL;
 }
 
+static void __bpf_ringbuf_wakeup(struct bpf_ringbuf *rb)
+{
+	WRITE_ONCE(rb->wakeup_pos, smp_load_acquire(&rb->producer_pos));
+	wake_up_all(rb->waitq);
+}
+
 static void bpf_ringbuf_notify(struct irq_work *work)
 {
 	struct bpf_ringbuf *rb = container_of(work, struct bpf_ringbuf, work);
 
-	wake_up_all(&rb->waitq);
+	__bpf_ringbuf_wakeup(rb);
+}
+
+static enum hrtimer_restart bpf_ringbuf_wakeup_timer(struct hrtimer *timer)
+{
+	struct bpf_ringbuf *rb = container_of(timer, struct bpf_ringbuf,
+					      wakeup_timer);
+
+	WRITE_ONCE(rb->wakeup_timer_armed, 0);
+	if (READ_ONCE(rb->wakeup_pos) != smp_load_acquire(&rb->producer_pos))
+		__bpf_ringbuf_wakeup(rb);
+
+	return HRTIMER_NORESTART;
+}
+
+/* hrtimers can't be armed from NMI, which is where a lot of ring buffer
+ * producers run, so bounce through irq_work.  This happens at most once
+ * per wakeup_usecs period.
+ */
+static void bpf_ringbuf_arm_timer(struct irq_work *work)
+{
+	struct bpf_ringbuf *rb = container_of(work, struct bpf_ringbuf,
+					      timer_work);
+
+	hrtimer_start(&rb->wakeup_timer, us_to_ktime(rb->wakeup_usecs),
+		      HRTIMER_MODE_REL_SOFT);
 }
 
 /* Maximum size of ring buffer area is limited by 32-bit page offset within
@@ -165,7 +215,9 @@ static void bpf_ringbuf_notify(struct irq_work *work)
  * considering that the maximum value of data_sz is (4GB - 1), there
  * will be no overflow, so just note the size limit in the comments.
  */
-static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
+static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, u64 map_extra,
+					     wait_queue_head_t *waitq,
+					     int numa_node)
 {
 	struct bpf_ringbuf *rb;
 
@@ -175,10 +227,17 @@ static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
 
 	raw_spin_lock_init(&rb->spinlock);
 	atomic_set(&rb->busy, 0);
-	init_waitqueue_head(&rb->waitq);
+	rb->waitq = waitq;
 	init_irq_work(&rb->work, bpf_ringbuf_notify);
+	init_irq_work(&rb->timer_work, bpf_ringbuf_arm_timer);
+	hrtimer_init(&rb->wakeup_timer, CLOCK_MONOTONIC, HRTIMER_MODE_REL_SOFT);
+	rb->wakeup_timer.function = bpf_ringbuf_wakeup_timer;
 
 	rb->mask = data_sz - 1;
+	rb->wakeup_bytes = RINGBUF_WAKEUP_BYTES(map_extra);
+	rb->wakeup_usecs = RINGBUF_WAKEUP_USECS(map_extra);
+	rb->wakeup_pos = 0;
+	rb->wakeup_timer_armed = 0;
 	rb->consumer_pos = 0;
 	rb->producer_pos = 0;
 	rb->pending_pos = 0;
@@ -186,28 +245,101 @@ static struct bpf_ringbuf *bpf_ringbuf_alloc(size_t data_sz, int numa_node)
 	return rb;
 }
 
+static void bpf_ringbuf_free(struct bpf_ringbuf *rb);
+
+/* Each ring takes RINGBUF_POS_PAGES + 2 * data pages of the map's mmap()
+ * offset space, rings are laid out back to back in CPU id order.
+ */
+static unsigned long ringbuf_percpu_stride(const struct bpf_map *map)
+{
+	return RINGBUF_POS_PAGES + 2 * (map->max_entries >> PAGE_SHIFT);
+}
+
+static int ringbuf_map_alloc_percpu(struct bpf_ringbuf_map *rb_map,
+				    union bpf_attr *attr)
+{
+	struct bpf_ringbuf *rb;
+	int cpu;
+
+	rb_map->percpu_rb = bpf_map_area_alloc(nr_cpu_ids *
+					       sizeof(*rb_map->percpu_rb),
+					       NUMA_NO_NODE);
+	if (!rb_map->percpu_rb)
+		return -ENOMEM;
+
+	for_each_possible_cpu(cpu) {
+		rb = bpf_ringbuf_alloc(attr->max_entries, attr->map_extra,
+				       &rb_map->waitq, cpu_to_node(cpu));
+		if (!rb)
+			return -ENOMEM;
+		rb_map->percpu_rb[cpu] = rb;
+	}
+
+	return 0;
+}
+
+static void ringbuf_map_free_rings(struct bpf_ringbuf_map *rb_map)
+{
+	int cpu;
+
+	if (!rb_map->percpu_rb) {
+		if (rb_map->rb)
+			bpf_ringbuf_free(rb_map->rb);
+		return;
+	}
+
+	for_each_possible_cpu(cpu)
+		if (rb_map->percpu_rb[cpu])
+			bpf_ringbuf_free(rb_map->percpu_rb[cpu]);
+	bpf_map_area_free(rb_map->percpu_rb);
+}
+
 static struct bpf_map *ringbuf_map_alloc(union bpf_attr *attr)
 {
 	struct bpf_ringbuf_map *rb_map;
+	int err;
 
 	if (attr->map_flags & ~RINGBUF_CREATE_FLAG_MASK)
 		return ERR_PTR(-EINVAL);
 
+	/* per-CPU rings are placed on their CPU's node */
+	if ((attr->map_flags & BPF_F_PERCPU_RING) &&
+	    (attr->map_type != BPF_MAP_TYPE_RINGBUF ||
+	     attr->map_flags & BPF_F_NUMA_NODE))
+		return ERR_PTR(-EINVAL);
+
 	if (attr->key_size || attr->value_size ||
 	    !is_power_of_2(attr->max_entries) ||
 	    !PAGE_ALIGNED(attr->max_entries))
 		return ERR_PTR(-EINVAL);
 
+	/* both the byte threshold and the delay bound, or neither */
+	if (attr->map_extra &&
+	    (!RINGBUF_WAKEUP_BYTES(attr->map_extra) ||
+	     RINGBUF_WAKEUP_BYTES(attr->map_extra) >= attr->max_entries ||
+	     !RINGBUF_WAKEUP_USECS(attr->map_extra) ||
+	     RINGBUF_WAKEUP_USECS(attr->map_extra) > RINGBUF_MAX_WAKEUP_USECS))
+		return ERR_PTR(-EINVAL);
+
 	rb_map = bpf_map_area_alloc(sizeof(*rb_map), NUMA_NO_NODE);
 	if (!rb_map)
 		return ERR_PTR(-ENOMEM);
 
 	bpf_map_init_from_attr(&rb_map->map, attr);
+	init_waitqueue_head(&rb_map->waitq);
 
-	rb_map->rb = bpf_ringbuf_alloc(attr->max_entries, rb_map->map.numa_node);
-	if (!rb_map->rb) {
+	if (attr->map_flags & BPF_F_PERCPU_RING) {
+		err = ringbuf_map_alloc_percpu(rb_map, attr);
+	} else {
+		rb_map->rb = bpf_ringbuf_alloc(attr->max_entries,
+					       attr->map_extra, &rb_map->waitq,
+					       rb_map->map.numa_node);
+		err = rb_map->rb ? 0 : -ENOMEM;
+	}
+	if (err) {
+		ringbuf_map_free_rings(rb_map);
 		bpf_map_area_free(rb_map);
-		return ERR_PTR(-ENOMEM);
+		return ERR_PTR(err);
 	}
 
 	return &rb_map->map;
@@ -221,6 +353,9 @@ static void bpf_ringbuf_free(struct bpf_ringbuf *rb)
 	struct page **pages = rb->pages;
 	int i, nr_pages = rb->nr_pages;
 
+	irq_work_sync(&rb->timer_work);
+	hrtimer_cancel(&rb->wakeup_timer);
+
 	vunmap(rb);
 	for (i = 0; i < nr_pages; i++)
 		__free_page(pages[i]);
@@ -232,7 +367,7 @@ static void ringbuf_map_free(struct bpf_map *map)
 	struct bpf_ringbuf_map *rb_map;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	bpf_ringbuf_free(rb_map->rb);
+	ringbuf_map_free_rings(rb_map);
 	bpf_map_area_free(rb_map);
 }
 
@@ -261,19 +396,31 @@ static int ringbuf_map_get_next_key(struct bpf_map *map, void *key,
 static int ringbuf_map_mmap_kern(struct bpf_map *map, struct vm_area_struct *vma)
 {
 	struct bpf_ringbuf_map *rb_map;
+	unsigned long pgoff = vma->vm_pgoff;
+	struct bpf_ringbuf *rb;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	rb = rb_map->rb;
+
+	if (rb_map->percpu_rb) {
+		unsigned long stride = ringbuf_percpu_stride(map);
+		unsigned long cpu = pgoff / stride;
+
+		if (cpu >= nr_cpu_ids || !rb_map->percpu_rb[cpu])
+			return -EINVAL;
+		rb = rb_map->percpu_rb[cpu];
+		pgoff -= cpu * stride;
+	}
 
 	if (vma->vm_flags & VM_WRITE) {
 		/* allow writable mapping for the consumer_pos only */
-		if (vma->vm_pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
+		if (pgoff != 0 || vma->vm_end - vma->vm_start != PAGE_SIZE)
 			return -EPERM;
 	} else {
 		vm_flags_clear(vma, VM_MAYWRITE);
 	}
 	/* remap_vmalloc_range() checks size and offset constraints */
-	return remap_vmalloc_range(vma, rb_map->rb,
-				   vma->vm_pgoff + RINGBUF_PGOFF);
+	return remap_vmalloc_range(vma, rb, pgoff + RINGBUF_PGOFF);
 }
 
 static int ringbuf_map_mmap_user(struct bpf_map *map, struct vm_area_struct *vma)
@@ -310,15 +457,39 @@ static u32 ringbuf_total_data_sz(const struct bpf_ringbuf *rb)
 	return rb->mask + 1;
 }
 
+/* The ring BPF programs running on this CPU produce into */
+static struct bpf_ringbuf *ringbuf_map_rb(struct bpf_map *map)
+{
+	struct bpf_ringbuf_map *rb_map;
+
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
+	if (rb_map->percpu_rb)
+		return rb_map->percpu_rb[raw_smp_processor_id()];
+	return rb_map->rb;
+}
+
+static bool ringbuf_map_has_data(struct bpf_ringbuf_map *rb_map)
+{
+	int cpu;
+
+	if (!rb_map->percpu_rb)
+		return ringbuf_avail_data_sz(rb_map->rb);
+
+	for_each_possible_cpu(cpu)
+		if (ringbuf_avail_data_sz(rb_map->percpu_rb[cpu]))
+			return true;
+	return false;
+}
+
 static __poll_t ringbuf_map_poll_kern(struct bpf_map *map, struct file *filp,
 				      struct poll_table_struct *pts)
 {
 	struct bpf_ringbuf_map *rb_map;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	poll_wait(filp, &rb_map->rb->waitq, pts);
+	poll_wait(filp, &rb_map->waitq, pts);
 
-	if (ringbuf_avail_data_sz(rb_map->rb))
+	if (ringbuf_map_has_data(rb_map))
 		return EPOLLIN | EPOLLRDNORM;
 	return 0;
 }
@@ -329,7 +500,7 @@ static __poll_t ringbuf_map_poll_user(struct bpf_map *map, struct file *filp,
 	struct bpf_ringbuf_map *rb_map;
 
 	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	poll_wait(filp, &rb_map->rb->waitq, pts);
+	poll_wait(filp, &rb_map->waitq, pts);
 
 	if (ringbuf_avail_data_sz(rb_map->rb) < ringbuf_total_data_sz(rb_map->rb))
 		return EPOLLOUT | EPOLLWRNORM;
@@ -338,17 +509,23 @@ static __poll_t ringbuf_map_poll_user(struct bpf_map *map, struct file *filp,
 
 static u64 ringbuf_map_mem_usage(const struct bpf_map *map)
 {
-	struct bpf_ringbuf *rb;
+	struct bpf_ringbuf_map *rb_map;
 	int nr_data_pages;
 	int nr_meta_pages;
 	u64 usage = sizeof(struct bpf_ringbuf_map);
+	u64 ring_usage;
 
-	rb = container_of(map, struct bpf_ringbuf_map, map)->rb;
-	usage += (u64)rb->nr_pages << PAGE_SHIFT;
+	rb_map = container_of(map, struct bpf_ringbuf_map, map);
 	nr_meta_pages = RINGBUF_NR_META_PAGES;
 	nr_data_pages = map->max_entries >> PAGE_SHIFT;
-	usage += (nr_meta_pages + 2 * nr_data_pages) * sizeof(struct page *);
-	return usage;
+	ring_usage = (u64)(nr_meta_pages + nr_data_pages) << PAGE_SHIFT;
+	ring_usage += (nr_meta_pages + 2 * nr_data_pages) * sizeof(struct page *);
+
+	if (!rb_map->percpu_rb)
+		return usage + ring_usage;
+
+	usage += nr_cpu_ids * sizeof(*rb_map->percpu_rb);
+	return usage + num_possible_cpus() * ring_usage;
 }
 
 BTF_ID_LIST_SINGLE(ringbuf_map_btf_ids, struct, bpf_ringbuf_map)
@@ -405,17 +582,21 @@ bpf_ringbuf_restore_from_rec(struct bpf_ringbuf_hdr *hdr)
 	return (void*)((addr & PAGE_MASK) - off);
 }
 
-static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
+/* Reserve nr back-to-back records of the given size under a single lock
+ * acquisition.  Records are round_up(size + BPF_RINGBUF_HDR_SZ, 8) bytes
+ * apart, use bpf_ringbuf_next_rec() to walk them.
+ */
+static void *__bpf_ringbuf_reserve_n(struct bpf_ringbuf *rb, u64 size, u32 nr)
 {
 	unsigned long cons_pos, prod_pos, new_prod_pos, pend_pos, flags;
 	struct bpf_ringbuf_hdr *hdr;
-	u32 len, pg_off, tmp_size, hdr_len;
+	u32 len, pg_off, tmp_size, hdr_len, i;
 
-	if (unlikely(size > RINGBUF_MAX_RECORD_SZ))
+	if (unlikely(size > RINGBUF_MAX_RECORD_SZ || !nr))
 		return NULL;
 
 	len = round_up(size + BPF_RINGBUF_HDR_SZ, 8);
-	if (len > ringbuf_total_data_sz(rb))
+	if (len > ringbuf_total_data_sz(rb) / nr)
 		return NULL;
 
 	cons_pos = smp_load_acquire(&rb->consumer_pos);
@@ -429,7 +610,7 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 
 	pend_pos = rb->pending_pos;
 	prod_pos = rb->producer_pos;
-	new_prod_pos = prod_pos + len;
+	new_prod_pos = prod_pos + (unsigned long)len * nr;
 
 	while (pend_pos < prod_pos) {
 		hdr = (void *)rb->data + (pend_pos & rb->mask);
@@ -454,10 +635,12 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 		return NULL;
 	}
 
-	hdr = (void *)rb->data + (prod_pos & rb->mask);
-	pg_off = bpf_ringbuf_rec_pg_off(rb, hdr);
-	hdr->len = size | BPF_RINGBUF_BUSY_BIT;
-	hdr->pg_off = pg_off;
+	for (i = nr; i > 0; i--) {
+		hdr = (void *)rb->data + ((prod_pos + (i - 1) * len) & rb->mask);
+		pg_off = bpf_ringbuf_rec_pg_off(rb, hdr);
+		hdr->len = size | BPF_RINGBUF_BUSY_BIT;
+		hdr->pg_off = pg_off;
+	}
 
 	/* pairs with consumer's smp_load_acquire() */
 	smp_store_release(&rb->producer_pos, new_prod_pos);
@@ -467,15 +650,25 @@ static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 	return (void *)hdr + BPF_RINGBUF_HDR_SZ;
 }
 
-BPF_CALL_3(bpf_ringbuf_reserve, struct bpf_map *, map, u64, size, u64, flags)
+static void *__bpf_ringbuf_reserve(struct bpf_ringbuf *rb, u64 size)
 {
-	struct bpf_ringbuf_map *rb_map;
+	return __bpf_ringbuf_reserve_n(rb, size, 1);
+}
+
+static void *bpf_ringbuf_next_rec(struct bpf_ringbuf *rb, void *sample, u32 len)
+{
+	unsigned long rec_pos = sample - BPF_RINGBUF_HDR_SZ - (void *)rb->data;
+
+	return (void *)rb->data + ((rec_pos + len) & rb->mask) +
+	       BPF_RINGBUF_HDR_SZ;
+}
 
+BPF_CALL_3(bpf_ringbuf_reserve, struct bpf_map *, map, u64, size, u64, flags)
+{
 	if (unlikely(flags))
 		return 0;
 
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	return (unsigned long)__bpf_ringbuf_reserve(rb_map->rb, size);
+	return (unsigned long)__bpf_ringbuf_reserve(ringbuf_map_rb(map), size);
 }
 
 const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
@@ -486,15 +679,54 @@ const struct bpf_func_proto bpf_ringbuf_reserve_proto = {
 	.arg3_type	= ARG_ANYTHING,
 };
 
-static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
+/* Wake up once wakeup_bytes were produced since the last wakeup, or after
+ * wakeup_usecs at the latest, instead of on every record the consumer is
+ * waiting for.
+ */
+static void bpf_ringbuf_coalesce_wakeup(struct bpf_ringbuf *rb)
+{
+	unsigned long prod_pos = smp_load_acquire(&rb->producer_pos);
+
+	if (prod_pos - READ_ONCE(rb->wakeup_pos) >= rb->wakeup_bytes)
+		irq_work_queue(&rb->work);
+	else if (!READ_ONCE(rb->wakeup_timer_armed) &&
+		 !xchg(&rb->wakeup_timer_armed, 1))
+		irq_work_queue(&rb->timer_work);
+}
+
+/* Notify about the records in [rec_pos, rec_pos + len) being committed */
+static void bpf_ringbuf_commit_notify(struct bpf_ringbuf *rb,
+				      unsigned long rec_pos, unsigned long len,
+				      u64 flags)
+{
+	unsigned long cons_pos;
+
+	if (flags & BPF_RB_FORCE_WAKEUP) {
+		irq_work_queue(&rb->work);
+		return;
+	}
+	if (flags & BPF_RB_NO_WAKEUP)
+		return;
+
+	if (rb->wakeup_bytes) {
+		bpf_ringbuf_coalesce_wakeup(rb);
+		return;
+	}
+
+	/* if consumer caught up and is waiting for our record, notify about
+	 * new data availability
+	 */
+	cons_pos = smp_load_acquire(&rb->consumer_pos) & rb->mask;
+	if (((cons_pos - rec_pos) & rb->mask) < len)
+		irq_work_queue(&rb->work);
+}
+
+static struct bpf_ringbuf *bpf_ringbuf_rec_commit(void *sample, bool discard)
 {
-	unsigned long rec_pos, cons_pos;
 	struct bpf_ringbuf_hdr *hdr;
-	struct bpf_ringbuf *rb;
 	u32 new_len;
 
 	hdr = sample - BPF_RINGBUF_HDR_SZ;
-	rb = bpf_ringbuf_restore_from_rec(hdr);
 	new_len = hdr->len ^ BPF_RINGBUF_BUSY_BIT;
 	if (discard)
 		new_len |= BPF_RINGBUF_DISCARD_BIT;
@@ -502,16 +734,17 @@ static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
 	/* update record header with correct final size prefix */
 	xchg(&hdr->len, new_len);
 
-	/* if consumer caught up and is waiting for our record, notify about
-	 * new data availability
-	 */
-	rec_pos = (void *)hdr - (void *)rb->data;
-	cons_pos = smp_load_acquire(&rb->consumer_pos) & rb->mask;
+	return bpf_ringbuf_restore_from_rec(hdr);
+}
 
-	if (flags & BPF_RB_FORCE_WAKEUP)
-		irq_work_queue(&rb->work);
-	else if (cons_pos == rec_pos && !(flags & BPF_RB_NO_WAKEUP))
-		irq_work_queue(&rb->work);
+static void bpf_ringbuf_commit(void *sample, u64 flags, bool discard)
+{
+	struct bpf_ringbuf_hdr *hdr = sample - BPF_RINGBUF_HDR_SZ;
+	struct bpf_ringbuf *rb;
+
+	rb = bpf_ringbuf_rec_commit(sample, discard);
+	bpf_ringbuf_commit_notify(rb, (void *)hdr - (void *)rb->data,
+				  BPF_RINGBUF_HDR_SZ, flags);
 }
 
 BPF_CALL_2(bpf_ringbuf_submit, void *, sample, u64, flags)
@@ -543,14 +776,12 @@ const struct bpf_func_proto bpf_ringbuf_discard_proto = {
 BPF_CALL_4(bpf_ringbuf_output, struct bpf_map *, map, void *, data, u64, size,
 	   u64, flags)
 {
-	struct bpf_ringbuf_map *rb_map;
 	void *rec;
 
 	if (unlikely(flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP)))
 		return -EINVAL;
 
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-	rec = __bpf_ringbuf_reserve(rb_map->rb, size);
+	rec = __bpf_ringbuf_reserve(ringbuf_map_rb(map), size);
 	if (!rec)
 		return -EAGAIN;
 
@@ -572,7 +803,8 @@ BPF_CALL_2(bpf_ringbuf_query, struct bpf_map *, map, u64, flags)
 {
 	struct bpf_ringbuf *rb;
 
-	rb = container_of(map, struct bpf_ringbuf_map, map)->rb;
+	/* for BPF_F_PERCPU_RING maps, this CPU's ring */
+	rb = ringbuf_map_rb(map);
 
 	switch (flags) {
 	case BPF_RB_AVAIL_DATA:
@@ -598,7 +830,6 @@ const struct bpf_func_proto bpf_ringbuf_query_proto = {
 BPF_CALL_4(bpf_ringbuf_reserve_dynptr, struct bpf_map *, map, u32, size, u64, flags,
 	   struct bpf_dynptr_kern *, ptr)
 {
-	struct bpf_ringbuf_map *rb_map;
 	void *sample;
 	int err;
 
@@ -613,9 +844,7 @@ BPF_CALL_4(bpf_ringbuf_reserve_dynptr, struct bpf_map *, map, u32, size, u64, fl
 		return err;
 	}
 
-	rb_map = container_of(map, struct bpf_ringbuf_map, map);
-
-	sample = __bpf_ringbuf_reserve(rb_map->rb, size);
+	sample = __bpf_ringbuf_reserve(ringbuf_map_rb(map), size);
 	if (!sample) {
 		bpf_dynptr_set_null(ptr);
 		return -EINVAL;
@@ -806,3 +1035,71 @@ const struct bpf_func_proto bpf_user_ringbuf_drain_proto = {
 	.arg3_type	= ARG_PTR_TO_STACK_OR_NULL,
 	.arg4_type	= ARG_ANYTHING,
 };
+
+__bpf_kfunc_start_defs();
+
+/**
+ * bpf_ringbuf_output_batch() - Copy an array of records into a ring buffer
+ * @p__map: BPF_MAP_TYPE_RINGBUF map
+ * @data: @data__sz / @rec_size records of @rec_size bytes each
+ * @data__sz: Size of @data
+ * @rec_size: Size of a single record
+ * @flags: BPF_RB_NO_WAKEUP or BPF_RB_FORCE_WAKEUP
+ *
+ * Same as calling bpf_ringbuf_output() for each record, but the ring buffer
+ * lock is only taken once and at most one wakeup is sent for the batch.
+ * Either all or none of the records are submitted.
+ *
+ * Return: the number of records submitted, -EINVAL for invalid arguments,
+ * or -EAGAIN if the ring buffer does not have room for the batch.
+ */
+__bpf_kfunc int bpf_ringbuf_output_batch(void *p__map, void *data, u32 data__sz,
+					 u32 rec_size, u64 flags)
+{
+	struct bpf_map *map = p__map;
+	struct bpf_ringbuf *rb;
+	void *sample, *rec;
+	u32 len, nr, i;
+
+	if (map->map_type != BPF_MAP_TYPE_RINGBUF || !rec_size ||
+	    data__sz % rec_size ||
+	    flags & ~(BPF_RB_NO_WAKEUP | BPF_RB_FORCE_WAKEUP))
+		return -EINVAL;
+
+	nr = data__sz / rec_size;
+	if (!nr)
+		return -EINVAL;
+
+	rb = ringbuf_map_rb(map);
+	sample = __bpf_ringbuf_reserve_n(rb, rec_size, nr);
+	if (!sample)
+		return -EAGAIN;
+
+	len = round_up(rec_size + BPF_RINGBUF_HDR_SZ, 8);
+	for (i = 0, rec = sample; i < nr; i++) {
+		memcpy(rec, data + i * rec_size, rec_size);
+		bpf_ringbuf_rec_commit(rec, false /* discard */);
+		rec = bpf_ringbuf_next_rec(rb, rec, len);
+	}
+
+	bpf_ringbuf_commit_notify(rb, sample - BPF_RINGBUF_HDR_SZ - (void *)rb->data,
+				  (unsigned long)len * nr, flags);
+	return nr;
+}
+
+__bpf_kfunc_end_defs();
+
+BTF_KFUNCS_START(ringbuf_kfuncs)
+BTF_ID_FLAGS(func, bpf_ringbuf_output_batch)
+BTF_KFUNCS_END(ringbuf_kfuncs)
+
+static const struct btf_kfunc_id_set ringbuf_kfunc_set = {
+	.owner = THIS_MODULE,
+	.set   = &ringbuf_kfuncs,
+};
+
+static int __init ringbuf_kfunc_init(void)
+{
+	return register_btf_kfunc_id_set(BPF_PROG_TYPE_UNSPEC, &ringbuf_kfunc_set);
+}
+late_initcall(ringbuf_kfunc_init);
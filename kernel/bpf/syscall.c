@@ -129,12 +129,17 @@ bool bpf_map_write_active(const struct bpf_map *map)
 	return atomic64_read(&map->writecnt) != 0;
 }
 
+static bool bpf_map_has_percpu_values(const struct bpf_map *map)
+{
+	return map->map_type == BPF_MAP_TYPE_PERCPU_HASH ||
+	       map->map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH ||
+	       map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+	       map->map_type == BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE;
+}
+
 static u32 bpf_map_value_size(const struct bpf_map *map)
 {
-	if (map->map_type == BPF_MAP_TYPE_PERCPU_HASH ||
-	    map->map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH ||
-	    map->map_type == BPF_MAP_TYPE_PERCPU_ARRAY ||
-	    map->map_type == BPF_MAP_TYPE_PERCPU_CGROUP_STORAGE)
+	if (bpf_map_has_percpu_values(map))
 		return round_up(map->value_size, 8) * num_possible_cpus();
 	else if (IS_FD_MAP(map))
 		return sizeof(u32);
@@ -482,10 +487,15 @@ static void bpf_map_release_memcg(struct bpf_map *map)
 }
 #endif
 
+/* Allocate nr_pages order-0 pages. With a non-zero order, try to take them
+ * as physically contiguous blocks of that order first, split into
+ * individual pages so callers can free them one by one.
+ */
 int bpf_map_alloc_pages(const struct bpf_map *map, gfp_t gfp, int nid,
-			unsigned long nr_pages, struct page **pages)
+			unsigned int order, unsigned long nr_pages,
+			struct page **pages)
 {
-	unsigned long i, j;
+	unsigned long i = 0, j;
 	struct page *pg;
 	int ret = 0;
 #ifdef CONFIG_MEMCG
@@ -494,11 +504,23 @@ int bpf_map_alloc_pages(const struct bpf_map *map, gfp_t gfp, int nid,
 	memcg = bpf_map_get_memcg(map);
 	old_memcg = set_active_memcg(memcg);
 #endif
-	for (i = 0; i < nr_pages; i++) {
-		pg = alloc_pages_node(nid, gfp | __GFP_ACCOUNT, 0);
+	while (i < nr_pages) {
+		if (order && nr_pages - i >= 1UL << order) {
+			pg = alloc_pages_node(nid, gfp | __GFP_ACCOUNT |
+					      __GFP_NORETRY | __GFP_NOWARN, order);
+			if (pg) {
+				split_page(pg, order);
+				for (j = 0; j < 1UL << order; j++)
+					pages[i++] = pg + j;
+				continue;
+			}
+			/* don't keep trying once memory is fragmented */
+			order = 0;
+		}
 
+		pg = alloc_pages_node(nid, gfp | __GFP_ACCOUNT, 0);
 		if (pg) {
-			pages[i] = pg;
+			pages[i++] = pg;
 			continue;
 		}
 		for (j = 0; j < i; j++)
@@ -1234,6 +1256,7 @@ static int map_create(union bpf_attr *attr)
 
 	if (attr->map_type != BPF_MAP_TYPE_BLOOM_FILTER &&
 	    attr->map_type != BPF_MAP_TYPE_ARENA &&
+	    attr->map_type != BPF_MAP_TYPE_RINGBUF &&
 	    attr->map_extra != 0)
 		return -EINVAL;
 
@@ -1315,6 +1338,7 @@ static int map_create(union bpf_attr *attr)
 	case BPF_MAP_TYPE_CGRP_STORAGE:
 	case BPF_MAP_TYPE_BLOOM_FILTER:
 	case BPF_MAP_TYPE_LPM_TRIE:
+	case BPF_MAP_TYPE_LPM_MULTIBIT:
 	case BPF_MAP_TYPE_REUSEPORT_SOCKARRAY:
 	case BPF_MAP_TYPE_STACK_TRACE:
 	case BPF_MAP_TYPE_QUEUE:
@@ -1865,6 +1889,40 @@ int generic_map_update_batch(struct bpf_map *map, struct file *map_file,
 	return err;
 }
 
+/* BPF_F_PERCPU_{SUM,MIN,MAX} batch lookups fold the per-CPU copies of
+ * a value into one, treating it as an array of u64.
+ */
+int bpf_map_check_percpu_fold(const struct bpf_map *map, u64 elem_flags)
+{
+	u64 fold = elem_flags & BPF_F_PERCPU_FOLD;
+
+	if (!fold)
+		return 0;
+	if (hweight64(fold) != 1 || !bpf_map_has_percpu_values(map) ||
+	    map->value_size % sizeof(u64) || !IS_ERR_OR_NULL(map->record))
+		return -EINVAL;
+	return 0;
+}
+
+/* Fold one more CPU's copy @src into @dst, which holds the first copy */
+void bpf_percpu_fold_value(const struct bpf_map *map, void *dst,
+			   const void *src, u64 elem_flags)
+{
+	u32 i, n = map->value_size / sizeof(u64);
+	const u64 *s = src;
+	u64 *d = dst, v;
+
+	for (i = 0; i < n; i++) {
+		v = READ_ONCE(s[i]);
+		if (elem_flags & BPF_F_PERCPU_SUM)
+			d[i] += v;
+		else if (elem_flags & BPF_F_PERCPU_MIN)
+			d[i] = min(d[i], v);
+		else
+			d[i] = max(d[i], v);
+	}
+}
+
 #define MAP_LOOKUP_RETRIES 3
 
 int generic_map_lookup_batch(struct bpf_map *map,
@@ -1876,17 +1934,25 @@ int generic_map_lookup_batch(struct bpf_map *map,
 	void __user *values = u64_to_user_ptr(attr->batch.values);
 	void __user *keys = u64_to_user_ptr(attr->batch.keys);
 	void *buf, *buf_prevkey, *prev_key, *key, *value;
+	u64 elem_flags = attr->batch.elem_flags;
 	int err, retry = MAP_LOOKUP_RETRIES;
-	u32 value_size, cp, max_count;
+	u32 value_size, out_size, cp, max_count;
+	u32 cpu, nr_cpus;
 
-	if (attr->batch.elem_flags & ~BPF_F_LOCK)
+	if (elem_flags & ~(BPF_F_LOCK | BPF_F_PERCPU_FOLD))
 		return -EINVAL;
 
-	if ((attr->batch.elem_flags & BPF_F_LOCK) &&
+	if ((elem_flags & BPF_F_LOCK) &&
 	    !btf_record_has_field(map->record, BPF_SPIN_LOCK))
 		return -EINVAL;
 
+	err = bpf_map_check_percpu_fold(map, elem_flags);
+	if (err)
+		return err;
+
 	value_size = bpf_map_value_size(map);
+	out_size = elem_flags & BPF_F_PERCPU_FOLD ? map->value_size : value_size;
+	nr_cpus = num_possible_cpus();
 
 	max_count = attr->batch.count;
 	if (!max_count)
@@ -1921,7 +1987,7 @@ int generic_map_lookup_batch(struct bpf_map *map,
 		if (err)
 			break;
 		err = bpf_map_copy_value(map, key, value,
-					 attr->batch.elem_flags);
+					 elem_flags & ~BPF_F_PERCPU_FOLD);
 
 		if (err == -ENOENT) {
 			if (retry) {
@@ -1940,7 +2006,13 @@ int generic_map_lookup_batch(struct bpf_map *map,
 			err = -EFAULT;
 			goto free_buf;
 		}
-		if (copy_to_user(values + cp * value_size, value, value_size)) {
+		if (elem_flags & BPF_F_PERCPU_FOLD) {
+			for (cpu = 1; cpu < nr_cpus; cpu++)
+				bpf_percpu_fold_value(map, value,
+						      value + cpu * map->value_size,
+						      elem_flags);
+		}
+		if (copy_to_user(values + cp * out_size, value, out_size)) {
 			err = -EFAULT;
 			goto free_buf;
 		}
@@ -17,6 +17,7 @@
 #include <linux/vmalloc.h>
 #include <linux/stringify.h>
 #include <linux/bsearch.h>
+#include <linux/jhash.h>
 #include <linux/sort.h>
 #include <linux/perf_event.h>
 #include <linux/ctype.h>
@@ -1472,6 +1473,26 @@ static struct bpf_verifier_state_list **explored_state(struct bpf_verifier_env *
 	return &env->explored_states[(idx ^ state->callsite) % state_htab_size(env)];
 }
 
+/* Signature of the parts of a verifier state that states_equal() requires
+ * to match exactly at every exact_level. Checkpoints at the same insn whose
+ * signature differs from the current state can't be equal to it, so
+ * is_state_visited() skips the full register and stack comparison for them.
+ * States compared with equal signatures may of course still differ.
+ */
+static u32 state_sig(const struct bpf_verifier_state *st)
+{
+	u32 h, i;
+
+	h = jhash_3words(st->curframe, st->active_preempt_lock,
+			 st->active_rcu_lock | st->in_sleepable << 1 |
+			 !!st->active_lock.id << 2, 0);
+	h = jhash(&st->active_lock.ptr, sizeof(st->active_lock.ptr), h);
+	for (i = 0; i <= st->curframe; i++)
+		h = jhash_2words(st->frame[i]->callsite,
+				 st->frame[i]->acquired_refs, h);
+	return h;
+}
+
 static bool same_callsites(struct bpf_verifier_state *a, struct bpf_verifier_state *b)
 {
 	int fr;
@@ -17581,6 +17602,8 @@ static bool states_equal(struct bpf_verifier_env *env,
 {
 	int i;
 
+	env->states_compared++;
+
 	if (old->curframe != cur->curframe)
 		return false;
 
@@ -17877,6 +17900,9 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 	struct bpf_verifier_state *cur = env->cur_state, *new, *loop_entry;
 	int i, j, n, err, states_cnt = 0;
 	bool force_new_state, add_new_state, force_exact;
+	u32 sig;
+
+	env->prune_visits++;
 
 	force_new_state = env->test_state_freq || is_force_checkpoint(env, insn_idx) ||
 			  /* Avoid accumulating infinitely long jmp history */
@@ -17899,12 +17925,23 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 	sl = *pprev;
 
 	clean_live_states(env, insn_idx, cur);
+	sig = state_sig(cur);
 
 	while (sl) {
 		states_cnt++;
 		if (sl->state.insn_idx != insn_idx)
 			goto next;
 
+		if (sl->sig != sig) {
+			/* states_equal() fails for any exact_level, take
+			 * the same path as if it had been called
+			 */
+			env->states_sig_skipped++;
+			if (sl->state.branches)
+				goto skip_inf_loop_check;
+			goto miss;
+		}
+
 		if (sl->state.branches) {
 			struct bpf_func_state *frame = sl->state.frame[sl->state.curframe];
 
@@ -18060,6 +18097,7 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 				update_loop_entry(cur, loop_entry);
 hit:
 			sl->hit_cnt++;
+			env->prune_hits++;
 			/* reached equivalent register/stack state,
 			 * prune the search.
 			 * Registers read by the continuation are read by us.
@@ -18107,6 +18145,7 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 			 * speed up verification
 			 */
 			*pprev = sl->next;
+			env->explored_cnt--;
 			if (sl->state.frame[0]->regs[0].live & REG_LIVE_DONE &&
 			    !sl->state.used_as_loop_entry) {
 				u32 br = sl->state.branches;
@@ -18133,6 +18172,7 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 		sl = *pprev;
 	}
 
+	env->states_scanned += states_cnt;
 	if (env->max_states_per_insn < states_cnt)
 		env->max_states_per_insn = states_cnt;
 
@@ -18179,8 +18219,10 @@ static int is_state_visited(struct bpf_verifier_env *env, int insn_idx)
 	cur->first_insn_idx = insn_idx;
 	cur->dfs_depth = new->dfs_depth + 1;
 	clear_jmp_history(cur);
+	new_sl->sig = sig;
 	new_sl->next = *explored_state(env, insn_idx);
 	*explored_state(env, insn_idx) = new_sl;
+	env->explored_cnt++;
 	/* connect new state to parentage chain. Current frame needs all
 	 * registers connected. Only r6 - r9 of the callers are alive (pushed
 	 * to the stack implicitly by JITs) so in callers' frames connect just
@@ -21488,13 +21530,17 @@ static void free_states(struct bpf_verifier_env *env)
 	if (!env->explored_states)
 		return;
 
-	for (i = 0; i < state_htab_size(env); i++) {
+	/* Every global subprog pass ends here, don't walk the whole
+	 * prog->len sized table once all states it added are gone.
+	 */
+	for (i = 0; i < state_htab_size(env) && env->explored_cnt; i++) {
 		sl = env->explored_states[i];
 
 		while (sl) {
 			sln = sl->next;
 			free_verifier_state(&sl->state, false);
 			kfree(sl);
+			env->explored_cnt--;
 			sl = sln;
 		}
 		env->explored_states[i] = NULL;
@@ -21712,6 +21758,7 @@ static int do_check_main(struct bpf_verifier_env *env)
 
 static void print_verification_stats(struct bpf_verifier_env *env)
 {
+	u32 avg;
 	int i;
 
 	if (env->log.level & BPF_LOG_STATS) {
@@ -21726,6 +21773,14 @@ static void print_verification_stats(struct bpf_verifier_env *env)
 				verbose(env, "+");
 		}
 		verbose(env, "\n");
+		avg = env->prune_visits ?
+		      div_u64(env->states_scanned * 100, env->prune_visits) : 0;
+		verbose(env, "pruning visits %u hits %u (%u%%) states_per_visit %u.%02u "
+			"compared %u sig_skipped %u\n",
+			env->prune_visits, env->prune_hits,
+			env->prune_visits ? env->prune_hits * 100 / env->prune_visits : 0,
+			avg / 100, avg % 100, env->states_compared,
+			env->states_sig_skipped);
 	}
 	verbose(env, "processed %d insns (limit %d) max_states_per_insn %d "
 		"total_states %d peak_states %d mark_read %d\n",
@@ -17,8 +17,10 @@
 #include <linux/err.h>
 #include <linux/cpu.h>
 #include <linux/padata.h>
+#include <linux/math64.h>
 #include <linux/mutex.h>
 #include <linux/sched.h>
+#include <linux/sched/clock.h>
 #include <linux/slab.h>
 #include <linux/sysfs.h>
 #include <linux/rcupdate.h>
@@ -47,26 +49,26 @@ struct padata_mt_job_state {
 static void padata_free_pd(struct parallel_data *pd);
 static void __init padata_mt_helper(struct work_struct *work);
 
-static int padata_index_to_cpu(struct parallel_data *pd, int cpu_index)
+static int padata_index_to_cpu(struct padata_shard *shard, int cpu_index)
 {
 	int cpu, target_cpu;
 
-	target_cpu = cpumask_first(pd->cpumask.pcpu);
+	target_cpu = cpumask_first(shard->pcpu);
 	for (cpu = 0; cpu < cpu_index; cpu++)
-		target_cpu = cpumask_next(target_cpu, pd->cpumask.pcpu);
+		target_cpu = cpumask_next(target_cpu, shard->pcpu);
 
 	return target_cpu;
 }
 
-static int padata_cpu_hash(struct parallel_data *pd, unsigned int seq_nr)
+static int padata_cpu_hash(struct padata_shard *shard, unsigned int seq_nr)
 {
 	/*
 	 * Hash the sequence numbers to the cpus by taking
 	 * seq_nr mod. number of cpus in use.
 	 */
-	int cpu_index = seq_nr % cpumask_weight(pd->cpumask.pcpu);
+	int cpu_index = seq_nr % cpumask_weight(shard->pcpu);
 
-	return padata_index_to_cpu(pd, cpu_index);
+	return padata_index_to_cpu(shard, cpu_index);
 }
 
 static struct padata_work *padata_work_alloc(void)
@@ -166,6 +168,10 @@ static void padata_parallel_worker(struct work_struct *parallel_work)
  *          (i.e. cpumask.cbcpu), this function selects a fallback CPU and if
  *          none found, returns -EINVAL.
  *
+ * The object is parallelized and reordered by the shard of the NUMA node
+ * of its serialization CPU, so objects are serialized in the order they were
+ * submitted among those whose @cb_cpu is on the same node.
+ *
  * The parallelization callback function will run with BHs off.
  * Note: Every object which is parallelized by padata_do_parallel
  * must be seen by padata_do_serial.
@@ -177,6 +183,7 @@ int padata_do_parallel(struct padata_shell *ps,
 {
 	struct padata_instance *pinst = ps->pinst;
 	int i, cpu, cpu_index, err;
+	struct padata_shard *shard;
 	struct parallel_data *pd;
 	struct padata_work *pw;
 
@@ -207,11 +214,13 @@ int padata_do_parallel(struct padata_shell *ps,
 		goto out;
 
 	refcount_inc(&pd->refcnt);
+	shard = pd->node_shard[cpu_to_node(*cb_cpu)];
 	padata->pd = pd;
+	padata->shard = shard;
 	padata->cb_cpu = *cb_cpu;
+	padata->seq_nr = atomic_inc_return(&shard->seq_nr);
 
 	spin_lock(&padata_works_lock);
-	padata->seq_nr = ++pd->seq_nr;
 	pw = padata_work_alloc();
 	spin_unlock(&padata_works_lock);
 
@@ -224,7 +233,7 @@ int padata_do_parallel(struct padata_shell *ps,
 
 	if (pw) {
 		padata_work_init(pw, padata_parallel_worker, padata, 0);
-		queue_work(pinst->parallel_wq, &pw->pw_work);
+		queue_work_node(shard->node, pinst->parallel_wq, &pw->pw_work);
 	}
 
 	return 0;
@@ -236,7 +245,8 @@ int padata_do_parallel(struct padata_shell *ps,
 EXPORT_SYMBOL(padata_do_parallel);
 
 /*
- * padata_find_next - Find the next object that needs serialization.
+ * padata_find_next - Find the next object of a shard that needs
+ * serialization.
  *
  * Return:
  * * A pointer to the control struct of the next object that needs
@@ -245,14 +255,15 @@ EXPORT_SYMBOL(padata_do_parallel);
  *   be parallel processed by another cpu and is not yet present in
  *   the cpu's reorder queue.
  */
-static struct padata_priv *padata_find_next(struct parallel_data *pd,
+static struct padata_priv *padata_find_next(struct padata_shard *shard,
 					    bool remove_object)
 {
 	struct padata_priv *padata;
 	struct padata_list *reorder;
-	int cpu = pd->cpu;
+	int cpu = shard->cpu;
+	u64 wait;
 
-	reorder = per_cpu_ptr(pd->reorder_list, cpu);
+	reorder = per_cpu_ptr(shard->pd->reorder_list, cpu);
 
 	spin_lock(&reorder->lock);
 	if (list_empty(&reorder->list)) {
@@ -266,23 +277,31 @@ static struct padata_priv *padata_find_next(struct parallel_data *pd,
 	 * Checks the rare case where two or more parallel jobs have hashed to
 	 * the same CPU and one of the later ones finishes first.
 	 */
-	if (padata->seq_nr != pd->processed) {
+	if (padata->seq_nr != shard->processed) {
 		spin_unlock(&reorder->lock);
 		return NULL;
 	}
 
 	if (remove_object) {
 		list_del_init(&padata->list);
-		++pd->processed;
-		pd->cpu = cpumask_next_wrap(cpu, pd->cpumask.pcpu, -1, false);
+		++shard->processed;
+		shard->cpu = cpumask_next_wrap(cpu, shard->pcpu, -1, false);
+
+		atomic_dec(&shard->depth);
+		wait = local_clock() - padata->reorder_ts;
+		shard->reordered++;
+		shard->wait_ns += wait;
+		if (wait > shard->max_wait_ns)
+			shard->max_wait_ns = wait;
 	}
 
 	spin_unlock(&reorder->lock);
 	return padata;
 }
 
-static void padata_reorder(struct parallel_data *pd)
+static void padata_reorder(struct padata_shard *shard)
 {
+	struct parallel_data *pd = shard->pd;
 	struct padata_instance *pinst = pd->ps->pinst;
 	int cb_cpu;
 	struct padata_priv *padata;
@@ -299,11 +318,11 @@ static void padata_reorder(struct parallel_data *pd)
 	 * moment. Therefore we use a trylock and let the holder of the lock
 	 * care for all the objects enqueued during the holdtime of the lock.
 	 */
-	if (!spin_trylock_bh(&pd->lock))
+	if (!spin_trylock_bh(&shard->lock))
 		return;
 
 	while (1) {
-		padata = padata_find_next(pd, true);
+		padata = padata_find_next(shard, true);
 
 		/*
 		 * If the next object that needs serialization is parallel
@@ -323,30 +342,30 @@ static void padata_reorder(struct parallel_data *pd)
 		queue_work_on(cb_cpu, pinst->serial_wq, &squeue->work);
 	}
 
-	spin_unlock_bh(&pd->lock);
+	spin_unlock_bh(&shard->lock);
 
 	/*
 	 * The next object that needs serialization might have arrived to
 	 * the reorder queues in the meantime.
 	 *
-	 * Ensure reorder queue is read after pd->lock is dropped so we see
+	 * Ensure reorder queue is read after shard->lock is dropped so we see
 	 * new objects from another task in padata_do_serial.  Pairs with
 	 * smp_mb in padata_do_serial.
 	 */
 	smp_mb();
 
-	reorder = per_cpu_ptr(pd->reorder_list, pd->cpu);
-	if (!list_empty(&reorder->list) && padata_find_next(pd, false))
-		queue_work(pinst->serial_wq, &pd->reorder_work);
+	reorder = per_cpu_ptr(pd->reorder_list, shard->cpu);
+	if (!list_empty(&reorder->list) && padata_find_next(shard, false))
+		queue_work(pinst->serial_wq, &shard->reorder_work);
 }
 
 static void invoke_padata_reorder(struct work_struct *work)
 {
-	struct parallel_data *pd;
+	struct padata_shard *shard;
 
 	local_bh_disable();
-	pd = container_of(work, struct parallel_data, reorder_work);
-	padata_reorder(pd);
+	shard = container_of(work, struct padata_shard, reorder_work);
+	padata_reorder(shard);
 	local_bh_enable();
 }
 
@@ -395,10 +414,17 @@ static void padata_serial_worker(struct work_struct *serial_work)
 void padata_do_serial(struct padata_priv *padata)
 {
 	struct parallel_data *pd = padata->pd;
-	int hashed_cpu = padata_cpu_hash(pd, padata->seq_nr);
+	struct padata_shard *shard = padata->shard;
+	int hashed_cpu = padata_cpu_hash(shard, padata->seq_nr);
 	struct padata_list *reorder = per_cpu_ptr(pd->reorder_list, hashed_cpu);
 	struct padata_priv *cur;
 	struct list_head *pos;
+	unsigned int depth;
+
+	padata->reorder_ts = local_clock();
+	depth = atomic_inc_return(&shard->depth);
+	if (depth > READ_ONCE(shard->max_depth))
+		WRITE_ONCE(shard->max_depth, depth);
 
 	spin_lock(&reorder->lock);
 	/* Sort in ascending order of sequence number. */
@@ -413,12 +439,12 @@ void padata_do_serial(struct padata_priv *padata)
 
 	/*
 	 * Ensure the addition to the reorder list is ordered correctly
-	 * with the trylock of pd->lock in padata_reorder.  Pairs with smp_mb
-	 * in padata_reorder.
+	 * with the trylock of shard->lock in padata_reorder.  Pairs with
+	 * smp_mb in padata_reorder.
 	 */
 	smp_mb();
 
-	padata_reorder(pd);
+	padata_reorder(shard);
 }
 EXPORT_SYMBOL(padata_do_serial);
 
@@ -583,6 +609,77 @@ static void padata_init_reorder_list(struct parallel_data *pd)
 	}
 }
 
+static void padata_free_shards(struct parallel_data *pd)
+{
+	unsigned int i;
+
+	if (pd->shards)
+		for (i = 0; i < pd->nr_shards; i++)
+			free_cpumask_var(pd->shards[i].pcpu);
+	kfree(pd->shards);
+	kfree(pd->node_shard);
+}
+
+/*
+ * Split the parallel CPUs into one shard per NUMA node. Nodes without
+ * parallel CPUs have their callback CPUs served by the other nodes' shards
+ * in turn.
+ */
+static int padata_init_shards(struct parallel_data *pd)
+{
+	struct padata_shard *shard;
+	unsigned int i, nr = 0;
+	int nid;
+
+	for_each_node(nid)
+		if (cpumask_intersects(pd->cpumask.pcpu, cpumask_of_node(nid)))
+			nr++;
+
+	pd->nr_shards = max(nr, 1U);
+	pd->shards = kcalloc(pd->nr_shards, sizeof(*pd->shards), GFP_KERNEL);
+	pd->node_shard = kcalloc(nr_node_ids, sizeof(*pd->node_shard),
+				 GFP_KERNEL);
+	if (!pd->shards || !pd->node_shard)
+		return -ENOMEM;
+
+	for (i = 0; i < pd->nr_shards; i++) {
+		shard = &pd->shards[i];
+		if (!zalloc_cpumask_var(&shard->pcpu, GFP_KERNEL))
+			return -ENOMEM;
+
+		shard->pd = pd;
+		shard->node = NUMA_NO_NODE;
+		atomic_set(&shard->seq_nr, -1);
+		spin_lock_init(&shard->lock);
+		INIT_WORK(&shard->reorder_work, invoke_padata_reorder);
+	}
+
+	/* Without any parallel CPU, keep a single shard for the empty mask. */
+	if (!nr)
+		cpumask_copy(pd->shards[0].pcpu, pd->cpumask.pcpu);
+
+	i = 0;
+	for_each_node(nid) {
+		if (!cpumask_intersects(pd->cpumask.pcpu, cpumask_of_node(nid)))
+			continue;
+
+		shard = &pd->shards[i++];
+		cpumask_and(shard->pcpu, pd->cpumask.pcpu, cpumask_of_node(nid));
+		shard->node = nid;
+		pd->node_shard[nid] = shard;
+	}
+
+	i = 0;
+	for_each_node(nid)
+		if (!pd->node_shard[nid])
+			pd->node_shard[nid] = &pd->shards[i++ % pd->nr_shards];
+
+	for (i = 0; i < pd->nr_shards; i++)
+		pd->shards[i].cpu = cpumask_first(pd->shards[i].pcpu);
+
+	return 0;
+}
+
 /* Allocate and initialize the internal cpumask dependend resources. */
 static struct parallel_data *padata_alloc_pd(struct padata_shell *ps)
 {
@@ -611,16 +708,18 @@ static struct parallel_data *padata_alloc_pd(struct padata_shell *ps)
 	cpumask_and(pd->cpumask.pcpu, pinst->cpumask.pcpu, cpu_online_mask);
 	cpumask_and(pd->cpumask.cbcpu, pinst->cpumask.cbcpu, cpu_online_mask);
 
+	if (padata_init_shards(pd))
+		goto err_free_shards;
+
 	padata_init_reorder_list(pd);
 	padata_init_squeues(pd);
-	pd->seq_nr = -1;
 	refcount_set(&pd->refcnt, 1);
-	spin_lock_init(&pd->lock);
-	pd->cpu = cpumask_first(pd->cpumask.pcpu);
-	INIT_WORK(&pd->reorder_work, invoke_padata_reorder);
 
 	return pd;
 
+err_free_shards:
+	padata_free_shards(pd);
+	free_cpumask_var(pd->cpumask.cbcpu);
 err_free_pcpu:
 	free_cpumask_var(pd->cpumask.pcpu);
 err_free_squeue:
@@ -635,6 +734,7 @@ static struct parallel_data *padata_alloc_pd(struct padata_shell *ps)
 
 static void padata_free_pd(struct parallel_data *pd)
 {
+	padata_free_shards(pd);
 	free_cpumask_var(pd->cpumask.pcpu);
 	free_cpumask_var(pd->cpumask.cbcpu);
 	free_percpu(pd->reorder_list);
@@ -938,17 +1038,61 @@ static ssize_t store_cpumask(struct padata_instance *pinst,
 	static struct padata_sysfs_entry _name##_attr = \
 		__ATTR(_name, 0400, _show_name, NULL)
 
+static ssize_t show_reorder_stats(struct padata_instance *pinst,
+				  struct attribute *attr, char *buf)
+{
+	struct padata_shard *shard;
+	struct parallel_data *pd;
+	struct padata_shell *ps;
+	unsigned int i, n = 0;
+	unsigned int depth, max_depth;
+	u64 reordered, wait_ns, max_wait_ns;
+	int len = 0;
+
+	mutex_lock(&pinst->lock);
+	list_for_each_entry(ps, &pinst->pslist, list) {
+		pd = rcu_dereference_protected(ps->pd,
+					       lockdep_is_held(&pinst->lock));
+		for (i = 0; i < pd->nr_shards; i++) {
+			shard = &pd->shards[i];
+
+			spin_lock_bh(&shard->lock);
+			depth = atomic_read(&shard->depth);
+			max_depth = READ_ONCE(shard->max_depth);
+			reordered = shard->reordered;
+			wait_ns = shard->wait_ns;
+			max_wait_ns = shard->max_wait_ns;
+			spin_unlock_bh(&shard->lock);
+
+			len += sysfs_emit_at(buf, len,
+					     "shell %u node %d: depth %u max_depth %u reordered %llu avg_wait_ns %llu max_wait_ns %llu\n",
+					     n, shard->node, depth, max_depth,
+					     reordered,
+					     reordered ? div64_u64(wait_ns, reordered) : 0,
+					     max_wait_ns);
+		}
+		n++;
+	}
+	mutex_unlock(&pinst->lock);
+
+	return len;
+}
+
 PADATA_ATTR_RW(serial_cpumask, show_cpumask, store_cpumask);
 PADATA_ATTR_RW(parallel_cpumask, show_cpumask, store_cpumask);
+PADATA_ATTR_RO(reorder_stats, show_reorder_stats);
 
 /*
  * Padata sysfs provides the following objects:
  * serial_cpumask   [RW] - cpumask for serial workers
  * parallel_cpumask [RW] - cpumask for parallel workers
+ * reorder_stats    [RO] - reorder queue depth and wait time of each shard
+ *                         of each shell, reset when the cpumasks change
  */
 static struct attribute *padata_default_attrs[] = {
 	&serial_cpumask_attr.attr,
 	&parallel_cpumask_attr.attr,
+	&reorder_stats_attr.attr,
 	NULL,
 };
 ATTRIBUTE_GROUPS(padata_default);
@@ -18,6 +18,8 @@
 #else
 #include <linux/module.h>
 #include <linux/gfp.h>
+#include <linux/mutex.h>
+#include <linux/sysfs.h>
 /* In .bss so it's zeroed */
 const char raid6_empty_zero_page[PAGE_SIZE] __attribute__((aligned(256)));
 EXPORT_SYMBOL(raid6_empty_zero_page);
@@ -131,6 +133,54 @@ const struct raid6_recov_calls *const raid6_recov_algos[] = {
 #define RAID6_TEST_DISKS	8
 #define RAID6_TEST_DISKS_ORDER	3
 
+/*
+ * gen_syndrome() is benchmarked at each of these per-disk lengths and
+ * requests are dispatched to the winner of the smallest class they fit
+ * in, the last class taking everything larger.  Unrolled SIMD loops that
+ * win on large stripes pay for their setup on short ones.
+ */
+#define RAID6_NR_CLASSES	3
+#define RAID6_BENCH_CLASS	1	/* the one benchmarked at full length */
+
+static const size_t raid6_class_bytes[RAID6_NR_CLASSES] = {
+	1024, 4096, 16384,
+};
+
+/* Each test disk is large enough for the biggest class */
+#define RAID6_TEST_DISK_ORDER	(PAGE_SHIFT < 14 ? 14 - PAGE_SHIFT : 0)
+#define RAID6_TEST_DISK_BYTES	(PAGE_SIZE << RAID6_TEST_DISK_ORDER)
+#define RAID6_TEST_ORDER	(RAID6_TEST_DISKS_ORDER + RAID6_TEST_DISK_ORDER)
+
+static const struct raid6_calls *raid6_class_gen[RAID6_NR_CLASSES];
+static const struct raid6_calls *raid6_class_xor[RAID6_NR_CLASSES];
+
+static inline int raid6_size_class(size_t bytes)
+{
+	int i;
+
+	for (i = 0; i < RAID6_NR_CLASSES - 1; i++)
+		if (bytes <= raid6_class_bytes[i])
+			break;
+	return i;
+}
+
+static void raid6_gen_syndrome(int disks, size_t bytes, void **ptrs)
+{
+	const struct raid6_calls *algo;
+
+	algo = READ_ONCE(raid6_class_gen[raid6_size_class(bytes)]);
+	algo->gen_syndrome(disks, bytes, ptrs);
+}
+
+static void raid6_xor_syndrome(int disks, int start, int stop, size_t bytes,
+			       void **ptrs)
+{
+	const struct raid6_calls *algo;
+
+	algo = READ_ONCE(raid6_class_xor[raid6_size_class(bytes)]);
+	algo->xor_syndrome(disks, start, stop, bytes, ptrs);
+}
+
 static inline const struct raid6_recov_calls *raid6_choose_recov(void)
 {
 	const struct raid6_recov_calls *const *algo;
@@ -152,45 +202,130 @@ static inline const struct raid6_recov_calls *raid6_choose_recov(void)
 	return best;
 }
 
-static inline const struct raid6_calls *raid6_choose_gen(
-	void *(*const dptrs)[RAID6_TEST_DISKS], const int disks)
+static inline unsigned long raid6_mbps(unsigned long perf, int disks,
+				       size_t bytes, int time_lg2)
+{
+	return ((u64)perf * HZ * (disks - 2) * bytes) >> (20 + time_lg2);
+}
+
+/* Number of calls that fit in 1 << time_lg2 jiffies */
+static unsigned long raid6_time(const struct raid6_calls *algo, bool xor,
+				void **dptrs, int disks, size_t bytes,
+				int time_lg2)
 {
-	unsigned long perf, bestgenperf, j0, j1;
 	int start = (disks>>1)-1, stop = disks-3;	/* work on the second half of the disks */
+	unsigned long perf = 0, j0, j1;
+
+	preempt_disable();
+	j0 = jiffies;
+	while ((j1 = jiffies) == j0)
+		cpu_relax();
+	while (time_before(jiffies, j1 + (1 << time_lg2))) {
+		if (xor)
+			algo->xor_syndrome(disks, start, stop, bytes, dptrs);
+		else
+			algo->gen_syndrome(disks, bytes, dptrs);
+		perf++;
+	}
+	preempt_enable();
+
+	return perf;
+}
+
+/*
+ * Fill raid6_class_gen[] and raid6_class_xor[].  A class whose winner has
+ * no xor_syndrome() borrows the fastest candidate that does, so rmw stays
+ * usable once enabled.  Returns the winner of RAID6_BENCH_CLASS and its
+ * score in @genperf.
+ */
+static const struct raid6_calls *raid6_choose_classes(void **dptrs,
+						      const int disks,
+						      unsigned long *genperf,
+						      bool verbose)
+{
+	const struct raid6_calls *xor;
+	const struct raid6_calls *best[RAID6_NR_CLASSES] = { };
+	const struct raid6_calls *xbest[RAID6_NR_CLASSES] = { };
+	unsigned long perf, bestperf[RAID6_NR_CLASSES] = { };
+	unsigned long xbestperf[RAID6_NR_CLASSES] = { };
 	const struct raid6_calls *const *algo;
-	const struct raid6_calls *best;
+	int i, time_lg2;
+
+	for (algo = raid6_algos; *algo; algo++) {
+		if ((*algo)->valid && !(*algo)->valid())
+			continue;
 
-	for (bestgenperf = 0, best = NULL, algo = raid6_algos; *algo; algo++) {
-		if (!best || (*algo)->priority >= best->priority) {
-			if ((*algo)->valid && !(*algo)->valid())
+		for (i = 0; i < RAID6_NR_CLASSES; i++) {
+			if (best[i] && (*algo)->priority < best[i]->priority)
 				continue;
 
-			if (!IS_ENABLED(CONFIG_RAID6_PQ_BENCHMARK)) {
-				best = *algo;
-				break;
+			/* the extra classes get half the time each */
+			time_lg2 = RAID6_TIME_JIFFIES_LG2 -
+				   (i != RAID6_BENCH_CLASS);
+			perf = raid6_time(*algo, false, dptrs, disks,
+					  raid6_class_bytes[i], time_lg2);
+			/* normalise to the full length run */
+			perf <<= RAID6_TIME_JIFFIES_LG2 - time_lg2;
+
+			if (perf > bestperf[i]) {
+				bestperf[i] = perf;
+				best[i] = *algo;
+			}
+			if ((*algo)->xor_syndrome && perf > xbestperf[i]) {
+				xbestperf[i] = perf;
+				xbest[i] = *algo;
 			}
+			if (verbose && i == RAID6_BENCH_CLASS)
+				pr_info("raid6: %-8s gen() %5ld MB/s\n",
+					(*algo)->name,
+					raid6_mbps(perf, disks,
+						   raid6_class_bytes[i],
+						   RAID6_TIME_JIFFIES_LG2));
+		}
+	}
 
-			perf = 0;
+	if (!best[RAID6_BENCH_CLASS])
+		return NULL;
+
+	for (i = 0; i < RAID6_NR_CLASSES; i++) {
+		WRITE_ONCE(raid6_class_gen[i], best[i]);
+		if (best[i]->xor_syndrome)
+			xor = best[i];
+		else
+			xor = xbest[i] ?: xbest[RAID6_BENCH_CLASS];
+		if (xor)
+			WRITE_ONCE(raid6_class_xor[i], xor);
+
+		if (verbose && i != RAID6_BENCH_CLASS)
+			pr_info("raid6: using algorithm %s gen() %ld MB/s at %zu bytes\n",
+				best[i]->name,
+				raid6_mbps(bestperf[i], disks,
+					   raid6_class_bytes[i],
+					   RAID6_TIME_JIFFIES_LG2),
+				raid6_class_bytes[i]);
+	}
 
-			preempt_disable();
-			j0 = jiffies;
-			while ((j1 = jiffies) == j0)
-				cpu_relax();
-			while (time_before(jiffies,
-					    j1 + (1<<RAID6_TIME_JIFFIES_LG2))) {
-				(*algo)->gen_syndrome(disks, PAGE_SIZE, *dptrs);
-				perf++;
-			}
-			preempt_enable();
+	*genperf = bestperf[RAID6_BENCH_CLASS];
+	return best[RAID6_BENCH_CLASS];
+}
 
-			if (perf > bestgenperf) {
-				bestgenperf = perf;
+static inline const struct raid6_calls *raid6_choose_gen(
+	void **dptrs, const int disks)
+{
+	const struct raid6_calls *const *algo;
+	const struct raid6_calls *best = NULL;
+	unsigned long perf = 0;
+	int i;
+
+	if (!IS_ENABLED(CONFIG_RAID6_PQ_BENCHMARK)) {
+		for (algo = raid6_algos; *algo; algo++) {
+			if (!(*algo)->valid || (*algo)->valid()) {
 				best = *algo;
+				break;
 			}
-			pr_info("raid6: %-8s gen() %5ld MB/s\n", (*algo)->name,
-				(perf * HZ * (disks-2)) >>
-				(20 - PAGE_SHIFT + RAID6_TIME_JIFFIES_LG2));
 		}
+	} else {
+		best = raid6_choose_classes(dptrs, disks, &perf, true);
 	}
 
 	if (!best) {
@@ -206,35 +341,57 @@ static inline const struct raid6_calls *raid6_choose_gen(
 		goto out;
 	}
 
+	/*
+	 * Dispatch on length from here on.  Whether rmw is offered still
+	 * depends on the page sized winner only, as it did before.
+	 */
+	raid6_call.gen_syndrome = raid6_gen_syndrome;
+	raid6_call.xor_syndrome = best->xor_syndrome ? raid6_xor_syndrome : NULL;
+
+	i = RAID6_BENCH_CLASS;
 	pr_info("raid6: using algorithm %s gen() %ld MB/s\n",
 		best->name,
-		(bestgenperf * HZ * (disks - 2)) >>
-		(20 - PAGE_SHIFT + RAID6_TIME_JIFFIES_LG2));
+		raid6_mbps(perf, disks, raid6_class_bytes[i],
+			   RAID6_TIME_JIFFIES_LG2));
 
 	if (best->xor_syndrome) {
-		perf = 0;
-
-		preempt_disable();
-		j0 = jiffies;
-		while ((j1 = jiffies) == j0)
-			cpu_relax();
-		while (time_before(jiffies,
-				   j1 + (1 << RAID6_TIME_JIFFIES_LG2))) {
-			best->xor_syndrome(disks, start, stop,
-					   PAGE_SIZE, *dptrs);
-			perf++;
-		}
-		preempt_enable();
-
+		perf = raid6_time(best, true, dptrs, disks,
+				  raid6_class_bytes[i], RAID6_TIME_JIFFIES_LG2);
 		pr_info("raid6: .... xor() %ld MB/s, rmw enabled\n",
-			(perf * HZ * (disks - 2)) >>
-			(20 - PAGE_SHIFT + RAID6_TIME_JIFFIES_LG2 + 1));
+			raid6_mbps(perf, disks, raid6_class_bytes[i],
+				   RAID6_TIME_JIFFIES_LG2 + 1));
 	}
 
 out:
 	return best;
 }
 
+/* Allocate the test disks and fill them circularly with the gfmul table */
+static char *raid6_alloc_test_disks(void **dptrs, const int disks)
+{
+	char *disk_ptr, *p;
+	size_t len;
+	int i;
+
+	disk_ptr = (char *)__get_free_pages(GFP_KERNEL, RAID6_TEST_ORDER);
+	if (!disk_ptr)
+		return NULL;
+
+	p = disk_ptr;
+	for (i = 0; i < disks; i++)
+		dptrs[i] = p + RAID6_TEST_DISK_BYTES * i;
+
+	for (len = (disks - 2) * RAID6_TEST_DISK_BYTES; len >= 65536;
+	     len -= 65536) {
+		memcpy(p, raid6_gfmul, 65536);
+		p += 65536;
+	}
+
+	if (len)
+		memcpy(p, raid6_gfmul, len);
+
+	return disk_ptr;
+}
 
 /* Try to pick the best algorithm */
 /* This code uses the gfmul table as convenient data set to abuse */
@@ -245,41 +402,90 @@ int __init raid6_select_algo(void)
 
 	const struct raid6_calls *gen_best;
 	const struct raid6_recov_calls *rec_best;
-	char *disk_ptr, *p;
 	void *dptrs[RAID6_TEST_DISKS];
-	int i, cycle;
+	char *disk_ptr;
 
-	/* prepare the buffer and fill it circularly with gfmul table */
-	disk_ptr = (char *)__get_free_pages(GFP_KERNEL, RAID6_TEST_DISKS_ORDER);
+	disk_ptr = raid6_alloc_test_disks(dptrs, disks);
 	if (!disk_ptr) {
 		pr_err("raid6: Yikes!  No memory available.\n");
 		return -ENOMEM;
 	}
 
-	p = disk_ptr;
-	for (i = 0; i < disks; i++)
-		dptrs[i] = p + PAGE_SIZE * i;
-
-	cycle = ((disks - 2) * PAGE_SIZE) / 65536;
-	for (i = 0; i < cycle; i++) {
-		memcpy(p, raid6_gfmul, 65536);
-		p += 65536;
-	}
-
-	if ((disks - 2) * PAGE_SIZE % 65536)
-		memcpy(p, raid6_gfmul, (disks - 2) * PAGE_SIZE % 65536);
-
 	/* select raid gen_syndrome function */
-	gen_best = raid6_choose_gen(&dptrs, disks);
+	gen_best = raid6_choose_gen(dptrs, disks);
 
 	/* select raid recover functions */
 	rec_best = raid6_choose_recov();
 
-	free_pages((unsigned long)disk_ptr, RAID6_TEST_DISKS_ORDER);
+	free_pages((unsigned long)disk_ptr, RAID6_TEST_ORDER);
 
 	return gen_best && rec_best ? 0 : -EINVAL;
 }
 
+#ifdef __KERNEL__
+static DEFINE_MUTEX(raid6_bench_lock);
+
+/*
+ * /sys/module/raid6_pq/parameters/benchmark: reading shows the gen()
+ * algorithm used for each size class, writing anything re-runs the
+ * benchmark.  Only the per-class tables change; raid6_call, and with it
+ * whether rmw is offered, stays as chosen at boot.
+ */
+static int raid6_benchmark_set(const char *val, const struct kernel_param *kp)
+{
+	void *dptrs[RAID6_TEST_DISKS];
+	unsigned long perf;
+	char *disk_ptr;
+
+	/* boot time, or no benchmark configured: nothing to redo */
+	if (!IS_ENABLED(CONFIG_RAID6_PQ_BENCHMARK) || !raid6_class_gen[0])
+		return 0;
+
+	disk_ptr = raid6_alloc_test_disks(dptrs, RAID6_TEST_DISKS);
+	if (!disk_ptr)
+		return -ENOMEM;
+
+	mutex_lock(&raid6_bench_lock);
+	raid6_choose_classes(dptrs, RAID6_TEST_DISKS, &perf, false);
+	mutex_unlock(&raid6_bench_lock);
+
+	free_pages((unsigned long)disk_ptr, RAID6_TEST_ORDER);
+	return 0;
+}
+
+static int raid6_benchmark_get(char *buffer, const struct kernel_param *kp)
+{
+	const struct raid6_calls *gen, *xor;
+	int i, len = 0;
+
+	for (i = 0; i < RAID6_NR_CLASSES; i++) {
+		gen = READ_ONCE(raid6_class_gen[i]);
+		xor = READ_ONCE(raid6_class_xor[i]);
+		if (i < RAID6_NR_CLASSES - 1)
+			len += sysfs_emit_at(buffer, len, "<=%zu",
+					     raid6_class_bytes[i]);
+		else
+			len += sysfs_emit_at(buffer, len, ">%zu",
+					     raid6_class_bytes[i - 1]);
+		/* without CONFIG_RAID6_PQ_BENCHMARK there is only raid6_call */
+		if (!gen) {
+			gen = &raid6_call;
+			xor = raid6_call.xor_syndrome ? &raid6_call : NULL;
+		}
+		len += sysfs_emit_at(buffer, len, ": gen %s xor %s\n",
+				     gen->name, xor ? xor->name : "none");
+	}
+	return len;
+}
+
+static const struct kernel_param_ops raid6_benchmark_ops = {
+	.set	= raid6_benchmark_set,
+	.get	= raid6_benchmark_get,
+};
+module_param_cb(benchmark, &raid6_benchmark_ops, NULL, 0644);
+MODULE_PARM_DESC(benchmark, "Per size class gen()/xor() algorithm; write to re-benchmark");
+#endif
+
 static void raid6_exit(void)
 {
 	do { } while (0);
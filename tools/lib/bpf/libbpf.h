@@ -1335,7 +1335,8 @@ LIBBPF_API int ring_buffer__epoll_fd(const struct ring_buffer *rb);
  * @param rb A ringbuffer manager object.
  * @param idx An index into the ringbuffers contained within the ringbuffer
  * manager object. The index is 0-based and corresponds to the order in which
- * ring_buffer__add was called.
+ * ring_buffer__add was called. A BPF_F_PERCPU_RING map adds one ring per
+ * possible CPU, in CPU id order.
  * @return A ringbuffer object on success; NULL and errno set if the index is
  * invalid.
  */
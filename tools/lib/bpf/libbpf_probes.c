@@ -295,6 +295,7 @@ static int probe_map_create(enum bpf_map_type map_type)
 		value_size	= sizeof(__u64);
 		break;
 	case BPF_MAP_TYPE_LPM_TRIE:
+	case BPF_MAP_TYPE_LPM_MULTIBIT:
 		key_size	= sizeof(__u64);
 		value_size	= sizeof(__u64);
 		opts.map_flags	= BPF_F_NO_PREALLOC;
@@ -30,6 +30,10 @@ struct ring {
 	unsigned long *producer_pos;
 	unsigned long mask;
 	int map_fd;
+	/* number of rings sharing map_fd's epoll registration, starting with
+	 * this one; more than one for BPF_F_PERCPU_RING maps
+	 */
+	int fd_ring_cnt;
 };
 
 struct ring_buffer {
@@ -71,15 +75,58 @@ static void ringbuf_free_ring(struct ring_buffer *rb, struct ring *r)
 	free(r);
 }
 
+static int ringbuf_map_ring(struct ring_buffer *rb, struct ring *r,
+			    __u32 max_entries, __u64 off)
+{
+	int map_fd = r->map_fd;
+	__u64 mmap_sz;
+	void *tmp;
+	int err;
+
+	/* Map writable consumer page */
+	tmp = mmap(NULL, rb->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, off);
+	if (tmp == MAP_FAILED) {
+		err = -errno;
+		pr_warn("ringbuf: failed to mmap consumer page for map fd=%d: %d\n",
+			map_fd, err);
+		return err;
+	}
+	r->consumer_pos = tmp;
+
+	/* Map read-only producer page and data pages. We map twice as big
+	 * data size to allow simple reading of samples that wrap around the
+	 * end of a ring buffer. See kernel implementation for details.
+	 */
+	mmap_sz = rb->page_size + 2 * (__u64)max_entries;
+	if (mmap_sz != (__u64)(size_t)mmap_sz) {
+		pr_warn("ringbuf: ring buffer size (%u) is too big\n", max_entries);
+		return -E2BIG;
+	}
+	tmp = mmap(NULL, (size_t)mmap_sz, PROT_READ, MAP_SHARED, map_fd,
+		   off + rb->page_size);
+	if (tmp == MAP_FAILED) {
+		err = -errno;
+		pr_warn("ringbuf: failed to mmap data pages for map fd=%d: %d\n",
+			map_fd, err);
+		return err;
+	}
+	r->producer_pos = tmp;
+	r->data = tmp + rb->page_size;
+
+	return 0;
+}
+
 /* Add extra RINGBUF maps to this ring buffer manager */
 int ring_buffer__add(struct ring_buffer *rb, int map_fd,
 		     ring_buffer_sample_fn sample_cb, void *ctx)
 {
 	struct bpf_map_info info;
 	__u32 len = sizeof(info);
+	int i, n, cpu_cnt = 0;
+	bool *cpus = NULL;
 	struct epoll_event *e;
 	struct ring *r;
-	__u64 mmap_sz;
+	__u64 stride;
 	void *tmp;
 	int err;
 
@@ -99,55 +146,58 @@ int ring_buffer__add(struct ring_buffer *rb, int map_fd,
 		return libbpf_err(-EINVAL);
 	}
 
-	tmp = libbpf_reallocarray(rb->rings, rb->ring_cnt + 1, sizeof(*rb->rings));
-	if (!tmp)
-		return libbpf_err(-ENOMEM);
+	if (info.map_flags & BPF_F_PERCPU_RING) {
+		err = parse_cpu_mask_file("/sys/devices/system/cpu/possible",
+					  &cpus, &cpu_cnt);
+		if (err) {
+			pr_warn("ringbuf: failed to get possible CPUs: %d\n", err);
+			return libbpf_err(err);
+		}
+		for (i = 0, n = 0; i < cpu_cnt; i++)
+			n += cpus[i];
+	} else {
+		n = 1;
+	}
+
+	tmp = libbpf_reallocarray(rb->rings, rb->ring_cnt + n, sizeof(*rb->rings));
+	if (!tmp) {
+		err = -ENOMEM;
+		goto err_free_cpus;
+	}
 	rb->rings = tmp;
 
-	tmp = libbpf_reallocarray(rb->events, rb->ring_cnt + 1, sizeof(*rb->events));
-	if (!tmp)
-		return libbpf_err(-ENOMEM);
+	tmp = libbpf_reallocarray(rb->events, rb->ring_cnt + n, sizeof(*rb->events));
+	if (!tmp) {
+		err = -ENOMEM;
+		goto err_free_cpus;
+	}
 	rb->events = tmp;
 
-	r = calloc(1, sizeof(*r));
-	if (!r)
-		return libbpf_err(-ENOMEM);
-	rb->rings[rb->ring_cnt] = r;
+	/* per-CPU rings are laid out back to back by CPU id in the map's
+	 * mmap() offset space, see BPF_F_PERCPU_RING
+	 */
+	stride = 2 * (__u64)rb->page_size + 2 * (__u64)info.max_entries;
+	for (i = 0, n = 0; i < (cpus ? cpu_cnt : 1); i++) {
+		if (cpus && !cpus[i])
+			continue;
 
-	r->map_fd = map_fd;
-	r->sample_cb = sample_cb;
-	r->ctx = ctx;
-	r->mask = info.max_entries - 1;
+		r = calloc(1, sizeof(*r));
+		if (!r) {
+			err = -ENOMEM;
+			goto err_out;
+		}
+		rb->rings[rb->ring_cnt + n++] = r;
 
-	/* Map writable consumer page */
-	tmp = mmap(NULL, rb->page_size, PROT_READ | PROT_WRITE, MAP_SHARED, map_fd, 0);
-	if (tmp == MAP_FAILED) {
-		err = -errno;
-		pr_warn("ringbuf: failed to mmap consumer page for map fd=%d: %d\n",
-			map_fd, err);
-		goto err_out;
-	}
-	r->consumer_pos = tmp;
+		r->map_fd = map_fd;
+		r->sample_cb = sample_cb;
+		r->ctx = ctx;
+		r->mask = info.max_entries - 1;
 
-	/* Map read-only producer page and data pages. We map twice as big
-	 * data size to allow simple reading of samples that wrap around the
-	 * end of a ring buffer. See kernel implementation for details.
-	 */
-	mmap_sz = rb->page_size + 2 * (__u64)info.max_entries;
-	if (mmap_sz != (__u64)(size_t)mmap_sz) {
-		err = -E2BIG;
-		pr_warn("ringbuf: ring buffer size (%u) is too big\n", info.max_entries);
-		goto err_out;
-	}
-	tmp = mmap(NULL, (size_t)mmap_sz, PROT_READ, MAP_SHARED, map_fd, rb->page_size);
-	if (tmp == MAP_FAILED) {
-		err = -errno;
-		pr_warn("ringbuf: failed to mmap data pages for map fd=%d: %d\n",
-			map_fd, err);
-		goto err_out;
+		err = ringbuf_map_ring(rb, r, info.max_entries, i * stride);
+		if (err)
+			goto err_out;
 	}
-	r->producer_pos = tmp;
-	r->data = tmp + rb->page_size;
+	rb->rings[rb->ring_cnt]->fd_ring_cnt = n;
 
 	e = &rb->events[rb->ring_cnt];
 	memset(e, 0, sizeof(*e));
@@ -161,11 +211,15 @@ int ring_buffer__add(struct ring_buffer *rb, int map_fd,
 		goto err_out;
 	}
 
-	rb->ring_cnt++;
+	rb->ring_cnt += n;
+	free(cpus);
 	return 0;
 
 err_out:
-	ringbuf_free_ring(rb, r);
+	for (i = 0; i < n; i++)
+		ringbuf_free_ring(rb, rb->rings[rb->ring_cnt + i]);
+err_free_cpus:
+	free(cpus);
 	return libbpf_err(err);
 }
 
@@ -344,12 +398,14 @@ int ring_buffer__poll(struct ring_buffer *rb, int timeout_ms)
 
 	for (i = 0; i < cnt; i++) {
 		__u32 ring_id = rb->events[i].data.fd;
-		struct ring *ring = rb->rings[ring_id];
+		int j, ring_cnt = rb->rings[ring_id]->fd_ring_cnt;
 
-		err = ringbuf_process_ring(ring, INT_MAX);
-		if (err < 0)
-			return libbpf_err(err);
-		res += err;
+		for (j = 0; j < ring_cnt; j++) {
+			err = ringbuf_process_ring(rb->rings[ring_id + j], INT_MAX);
+			if (err < 0)
+				return libbpf_err(err);
+			res += err;
+		}
 	}
 	if (res > INT_MAX)
 		res = INT_MAX;
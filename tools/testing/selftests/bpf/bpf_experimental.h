@@ -582,4 +582,13 @@ extern int bpf_wq_set_callback_impl(struct bpf_wq *wq,
 		unsigned int flags__k, void *aux__ign) __ksym;
 #define bpf_wq_set_callback(timer, cb, flags) \
 	bpf_wq_set_callback_impl(timer, cb, flags, NULL)
+
+/* Description
+ *	Submit *data__sz* / *rec_size* records of *rec_size* bytes each to
+ *	the ring buffer *map* taking its lock only once.
+ * Returns
+ *	Number of records submitted, -EAGAIN if they don't fit, or -EINVAL.
+ */
+extern int bpf_ringbuf_output_batch(void *map, void *data, __u32 data__sz,
+				    __u32 rec_size, __u64 flags) __weak __ksym;
 #endif
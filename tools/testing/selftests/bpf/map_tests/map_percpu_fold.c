@@ -0,0 +1,224 @@
+// SPDX-License-Identifier: GPL-2.0
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include <bpf_util.h>
+#include <test_maps.h>
+
+#define MAX_ENTRIES	64
+/* per-CPU copies of value[0] count up from key * BASE, value[1] down */
+#define BASE		(1ULL << 32)
+
+static int nr_cpus;
+
+struct fold_val {
+	__u64 up;
+	__u64 down;
+};
+
+static const char *fold_to_s(__u64 fold)
+{
+	switch (fold) {
+	case BPF_F_PERCPU_SUM:
+		return "SUM";
+	case BPF_F_PERCPU_MIN:
+		return "MIN";
+	case BPF_F_PERCPU_MAX:
+		return "MAX";
+	default:
+		return "<define-me>";
+	}
+}
+
+static void fill_map(int map_fd)
+{
+	struct fold_val *vals;
+	__u32 key;
+	int cpu, err;
+
+	vals = calloc(nr_cpus, sizeof(*vals));
+	CHECK(!vals, "calloc", "error: %s\n", strerror(errno));
+
+	for (key = 0; key < MAX_ENTRIES; key++) {
+		for (cpu = 0; cpu < nr_cpus; cpu++) {
+			vals[cpu].up = key * BASE + cpu;
+			vals[cpu].down = (key + 1) * BASE - cpu;
+		}
+		err = bpf_map_update_elem(map_fd, &key, vals, BPF_ANY);
+		CHECK(err, "bpf_map_update_elem", "error: %s\n", strerror(errno));
+	}
+	free(vals);
+}
+
+static void check_folded(__u32 key, const struct fold_val *val, __u64 fold)
+{
+	__u64 n = nr_cpus, up, down;
+
+	switch (fold) {
+	case BPF_F_PERCPU_SUM:
+		up = n * key * BASE + n * (n - 1) / 2;
+		down = n * (key + 1) * BASE - n * (n - 1) / 2;
+		break;
+	case BPF_F_PERCPU_MIN:
+		up = key * BASE;
+		down = (key + 1) * BASE - (n - 1);
+		break;
+	default:
+		up = key * BASE + (n - 1);
+		down = (key + 1) * BASE;
+		break;
+	}
+
+	CHECK(val->up != up || val->down != down, fold_to_s(fold),
+	      "key %u: got %llu/%llu, expected %llu/%llu\n", key,
+	      (unsigned long long)val->up, (unsigned long long)val->down,
+	      (unsigned long long)up, (unsigned long long)down);
+}
+
+static void lookup_folded(int map_fd, __u64 fold)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+		.elem_flags = fold,
+	);
+	struct fold_val vals[MAX_ENTRIES];
+	__u32 keys[MAX_ENTRIES];
+	bool seen[MAX_ENTRIES] = {};
+	__u32 count, total = 0, i;
+	__u64 batch = 0;
+	int err;
+
+	/* a few elements at a time, values packed at value_size */
+	do {
+		count = MAX_ENTRIES - total < 16 ? MAX_ENTRIES - total : 16;
+		err = bpf_map_lookup_batch(map_fd, total ? &batch : NULL, &batch,
+					   keys + total, vals + total, &count,
+					   &opts);
+		CHECK(err && errno != ENOENT, "bpf_map_lookup_batch",
+		      "%s: error: %s\n", fold_to_s(fold), strerror(errno));
+		total += count;
+	} while (!err && total < MAX_ENTRIES);
+
+	CHECK(total != MAX_ENTRIES, "bpf_map_lookup_batch",
+	      "%s: total %u, expected %u\n", fold_to_s(fold), total,
+	      MAX_ENTRIES);
+
+	for (i = 0; i < total; i++) {
+		CHECK(keys[i] >= MAX_ENTRIES || seen[keys[i]], "keys",
+		      "%s: bad or repeated key %u\n", fold_to_s(fold), keys[i]);
+		seen[keys[i]] = true;
+		check_folded(keys[i], &vals[i], fold);
+	}
+}
+
+static void test_fold(enum bpf_map_type type)
+{
+	__u32 max_entries = MAX_ENTRIES;
+	int map_fd;
+
+	/* leave LRU maps enough room to not evict anything */
+	if (type == BPF_MAP_TYPE_LRU_PERCPU_HASH)
+		max_entries += nr_cpus * 256;
+	map_fd = bpf_map_create(type, "percpu_fold", sizeof(__u32),
+				sizeof(struct fold_val), max_entries, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+
+	fill_map(map_fd);
+	lookup_folded(map_fd, BPF_F_PERCPU_SUM);
+	lookup_folded(map_fd, BPF_F_PERCPU_MIN);
+	lookup_folded(map_fd, BPF_F_PERCPU_MAX);
+
+	close(map_fd);
+}
+
+static int lookup_one(int map_fd, __u64 elem_flags)
+{
+	DECLARE_LIBBPF_OPTS(bpf_map_batch_opts, opts,
+		.elem_flags = elem_flags,
+	);
+	char vals[MAX_ENTRIES * sizeof(struct fold_val)];
+	__u32 keys[MAX_ENTRIES], count = 1;
+	__u64 batch;
+
+	return bpf_map_lookup_batch(map_fd, NULL, &batch, keys, vals, &count,
+				    &opts);
+}
+
+static void test_fold_reject(void)
+{
+	__u32 key = 0;
+	__u64 *vals;
+	int map_fd, err;
+
+	vals = calloc(nr_cpus, sizeof(struct fold_val));
+	CHECK(!vals, "calloc", "error: %s\n", strerror(errno));
+
+	/* only one way of folding at a time */
+	map_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_HASH, "percpu_fold",
+				sizeof(__u32), sizeof(struct fold_val),
+				MAX_ENTRIES, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+	err = bpf_map_update_elem(map_fd, &key, vals, BPF_ANY);
+	CHECK(err, "bpf_map_update_elem", "error: %s\n", strerror(errno));
+	err = lookup_one(map_fd, BPF_F_PERCPU_SUM | BPF_F_PERCPU_MAX);
+	CHECK(err != -EINVAL, "SUM|MAX", "unexpected result %d\n", err);
+	err = lookup_one(map_fd, BPF_F_PERCPU_MIN | BPF_F_PERCPU_MAX);
+	CHECK(err != -EINVAL, "MIN|MAX", "unexpected result %d\n", err);
+	close(map_fd);
+
+	/* values are folded as arrays of u64 */
+	map_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_HASH, "percpu_fold",
+				sizeof(__u32), sizeof(__u32), MAX_ENTRIES, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+	err = bpf_map_update_elem(map_fd, &key, vals, BPF_ANY);
+	CHECK(err, "bpf_map_update_elem", "error: %s\n", strerror(errno));
+	err = lookup_one(map_fd, BPF_F_PERCPU_SUM);
+	CHECK(err != -EINVAL, "value_size 4", "unexpected result %d\n", err);
+	close(map_fd);
+
+	map_fd = bpf_map_create(BPF_MAP_TYPE_PERCPU_ARRAY, "percpu_fold",
+				sizeof(__u32), 12, MAX_ENTRIES, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+	err = lookup_one(map_fd, BPF_F_PERCPU_MIN);
+	CHECK(err != -EINVAL, "value_size 12", "unexpected result %d\n", err);
+	close(map_fd);
+
+	/* nothing to fold in maps without per-CPU values */
+	map_fd = bpf_map_create(BPF_MAP_TYPE_HASH, "percpu_fold",
+				sizeof(__u32), sizeof(struct fold_val),
+				MAX_ENTRIES, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+	err = bpf_map_update_elem(map_fd, &key, vals, BPF_ANY);
+	CHECK(err, "bpf_map_update_elem", "error: %s\n", strerror(errno));
+	err = lookup_one(map_fd, BPF_F_PERCPU_SUM);
+	CHECK(err != -EINVAL, "hash", "unexpected result %d\n", err);
+	close(map_fd);
+
+	map_fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, "percpu_fold",
+				sizeof(__u32), sizeof(struct fold_val),
+				MAX_ENTRIES, NULL);
+	CHECK(map_fd < 0, "bpf_map_create", "error: %s\n", strerror(errno));
+	err = lookup_one(map_fd, BPF_F_PERCPU_MAX);
+	CHECK(err != -EINVAL, "array", "unexpected result %d\n", err);
+	close(map_fd);
+
+	free(vals);
+}
+
+void test_map_percpu_fold(void)
+{
+	nr_cpus = libbpf_num_possible_cpus();
+	CHECK(nr_cpus < 0, "nr_cpus checking",
+	      "error: get possible cpus failed\n");
+
+	test_fold(BPF_MAP_TYPE_PERCPU_HASH);
+	test_fold(BPF_MAP_TYPE_LRU_PERCPU_HASH);
+	test_fold(BPF_MAP_TYPE_PERCPU_ARRAY);
+	test_fold_reject();
+
+	printf("%s:PASS\n", __func__);
+}
@@ -0,0 +1,102 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+#include <sys/mman.h>
+#include "arena_huge.skel.h"
+
+#define SZ_2M		(1UL << 21)
+#define MAGIC		0x5a5a5a5a5a5a5a5aULL
+
+static bool run_prog(struct arena_huge *skel, struct bpf_program *prog,
+		     void *addr)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, opts);
+	int err;
+
+	skel->bss->addr = (__u64)(unsigned long)addr;
+	err = bpf_prog_test_run_opts(bpf_program__fd(prog), &opts);
+	return ASSERT_OK(err, "bpf_prog_test_run") &&
+	       ASSERT_OK(opts.retval, "retval");
+}
+
+static void test_chunks(void)
+{
+	long page_size = getpagesize();
+	struct arena_huge *skel;
+	size_t arena_sz;
+	char *area;
+
+	skel = arena_huge__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "arena_huge__open_and_load"))
+		return;
+
+	/* no __arena globals, so this is just the start of the arena */
+	area = bpf_map__initial_value(skel->maps.arena, &arena_sz);
+	if (!ASSERT_OK_PTR(area, "arena area"))
+		goto out;
+	arena_sz = bpf_map__max_entries(skel->maps.arena) * page_size;
+	/* so that chunks line up with PMDs */
+	ASSERT_EQ((unsigned long)area % SZ_2M, 0, "arena alignment");
+
+	/* a user fault in an untouched chunk allocates all of it */
+	*(volatile __u64 *)area = MAGIC;
+	if (!run_prog(skel, skel->progs.alloc_page, area + page_size))
+		goto out;
+	if (skel->bss->skip) {
+		printf("%s:SKIP:compiler doesn't support arena_cast\n", __func__);
+		test__skip();
+		goto out;
+	}
+	ASSERT_FALSE(skel->bss->allocated, "page in faulted chunk");
+	if (!run_prog(skel, skel->progs.alloc_page, area + SZ_2M - page_size))
+		goto out;
+	ASSERT_FALSE(skel->bss->allocated, "last page in faulted chunk");
+
+	/* and the program sees what user space writes anywhere in it */
+	*(volatile __u64 *)(area + SZ_2M - page_size) = MAGIC + 1;
+	if (!run_prog(skel, skel->progs.read_val, area))
+		goto out;
+	ASSERT_EQ(skel->bss->val, MAGIC, "value at chunk start");
+	if (!run_prog(skel, skel->progs.read_val, area + SZ_2M - page_size))
+		goto out;
+	ASSERT_EQ(skel->bss->val, MAGIC + 1, "value at chunk end");
+
+	/* once part of a chunk is in use, faults only get their own page */
+	if (!run_prog(skel, skel->progs.alloc_page, area + SZ_2M + page_size))
+		goto out;
+	ASSERT_TRUE(skel->bss->allocated, "page in untouched chunk");
+	ASSERT_EQ(*(volatile __u64 *)(area + SZ_2M), 0, "fault in used chunk");
+	if (!run_prog(skel, skel->progs.alloc_page, area + SZ_2M + 2 * page_size))
+		goto out;
+	ASSERT_TRUE(skel->bss->allocated, "page next to faulted one");
+
+	/* MADV_POPULATE_WRITE faults in what's left of the arena */
+	ASSERT_OK(madvise(area, arena_sz, MADV_POPULATE_WRITE), "populate");
+	if (!run_prog(skel, skel->progs.read_val, area + SZ_2M - page_size))
+		goto out;
+	ASSERT_EQ(skel->bss->val, MAGIC + 1, "value after populate");
+out:
+	arena_huge__destroy(skel);
+}
+
+static void test_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts);
+	int fd;
+
+	/* an arena is only ever accessed through mmap() */
+	opts.map_flags = BPF_F_ARENA_HUGE;
+	fd = bpf_map_create(BPF_MAP_TYPE_ARENA, NULL, 0, 0, 1024, &opts);
+	ASSERT_EQ(fd, -EINVAL, "arena without BPF_F_MMAPABLE");
+
+	opts.map_flags = BPF_F_ARENA_HUGE | BPF_F_MMAPABLE;
+	fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, NULL, 4, 8, 1024, &opts);
+	ASSERT_EQ(fd, -EINVAL, "array");
+}
+
+void test_arena_huge(void)
+{
+	if (test__start_subtest("chunks"))
+		test_chunks();
+	if (test__start_subtest("reject"))
+		test_reject();
+}
@@ -38,6 +38,19 @@ static void test_fail_cases(void)
 	if (!ASSERT_LT(fd, 0, "bpf_map_create bloom filter invalid flags"))
 		close(fd);
 
+	/* Invalid number of hash functions with blocked bloom filter */
+	opts.map_flags = BPF_F_BLOOM_BLOCKED;
+	opts.map_extra = 16;
+	fd = bpf_map_create(BPF_MAP_TYPE_BLOOM_FILTER, NULL, 0, sizeof(value), 100, &opts);
+	if (!ASSERT_LT(fd, 0, "bpf_map_create blocked bloom filter invalid map_extra"))
+		close(fd);
+	opts.map_extra = 0;
+
+	/* BPF_F_BLOOM_BLOCKED is for bloom filter maps only */
+	fd = bpf_map_create(BPF_MAP_TYPE_HASH, NULL, sizeof(value), sizeof(value), 100, &opts);
+	if (!ASSERT_EQ(fd, -EINVAL, "bpf_map_create hash BPF_F_BLOOM_BLOCKED"))
+		close(fd);
+
 	fd = bpf_map_create(BPF_MAP_TYPE_BLOOM_FILTER, NULL, 0, sizeof(value), 100, NULL);
 	if (!ASSERT_GE(fd, 0, "bpf_map_create bloom filter"))
 		return;
@@ -86,6 +99,64 @@ static void test_success_cases(void)
 	close(fd);
 }
 
+static void test_blocked(__u32 value_size, __u32 nr_hash_funcs, __u32 nr_entries)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts,
+		.map_flags = BPF_F_BLOOM_BLOCKED,
+		.map_extra = nr_hash_funcs,
+	);
+	__u32 i, j, false_pos = 0;
+	char value[64] = {};
+	int fd, err;
+
+	fd = bpf_map_create(BPF_MAP_TYPE_BLOOM_FILTER, NULL, 0, value_size, nr_entries,
+			    &opts);
+	if (!ASSERT_GE(fd, 0, "bpf_map_create blocked bloom filter"))
+		return;
+
+	/* Even values go in */
+	for (i = 0; i < nr_entries; i++) {
+		for (j = 0; j < value_size; j += sizeof(i))
+			memcpy(value + j, &i, sizeof(i));
+		*(__u32 *)value = 2 * i;
+		err = bpf_map_update_elem(fd, NULL, value, BPF_ANY);
+		if (!ASSERT_OK(err, "bpf_map_update_elem blocked bloom filter"))
+			goto done;
+	}
+
+	/* No false negatives, and with the default sizing not many false
+	 * positives either
+	 */
+	for (i = 0; i < nr_entries; i++) {
+		for (j = 0; j < value_size; j += sizeof(i))
+			memcpy(value + j, &i, sizeof(i));
+		*(__u32 *)value = 2 * i;
+		err = bpf_map_lookup_elem(fd, NULL, value);
+		if (!ASSERT_OK(err, "bpf_map_lookup_elem blocked bloom filter"))
+			goto done;
+
+		*(__u32 *)value = 2 * i + 1;
+		err = bpf_map_lookup_elem(fd, NULL, value);
+		if (!err)
+			false_pos++;
+		else if (!ASSERT_EQ(err, -ENOENT, "bpf_map_lookup_elem blocked bloom filter"))
+			goto done;
+	}
+	ASSERT_LT(false_pos, nr_entries / 10 + 1, "blocked bloom filter false positives");
+
+done:
+	close(fd);
+}
+
+static void test_blocked_cases(void)
+{
+	/* A single block */
+	test_blocked(sizeof(__u32), 5, 1);
+	test_blocked(sizeof(__u32), 5, 10000);
+	test_blocked(11, 15, 10000);
+	test_blocked(64, 5, 10000);
+}
+
 static void check_bloom(struct bloom_filter_map *skel)
 {
 	struct bpf_link *link;
@@ -146,7 +217,7 @@ static void test_inner_map(struct bloom_filter_map *skel, const __u32 *rand_vals
 }
 
 static int setup_progs(struct bloom_filter_map **out_skel, __u32 **out_rand_vals,
-		       __u32 *out_nr_rand_vals)
+		       __u32 *out_nr_rand_vals, __u32 bloom_flags)
 {
 	struct bloom_filter_map *skel;
 	int random_data_fd, bloom_fd;
@@ -155,10 +226,18 @@ static int setup_progs(struct bloom_filter_map **out_skel, __u32 **out_rand_vals
 	int err, i;
 
 	/* Set up a bloom filter map skeleton */
-	skel = bloom_filter_map__open_and_load();
-	if (!ASSERT_OK_PTR(skel, "bloom_filter_map__open_and_load"))
+	skel = bloom_filter_map__open();
+	if (!ASSERT_OK_PTR(skel, "bloom_filter_map__open"))
 		return -EINVAL;
 
+	err = bpf_map__set_map_flags(skel->maps.map_bloom, bloom_flags);
+	if (!ASSERT_OK(err, "bpf_map__set_map_flags"))
+		goto error;
+
+	err = bloom_filter_map__load(skel);
+	if (!ASSERT_OK(err, "bloom_filter_map__load"))
+		goto error;
+
 	/* Set up rand_vals */
 	map_size = bpf_map__max_entries(skel->maps.map_random_data);
 	rand_vals = malloc(sizeof(*rand_vals) * map_size);
@@ -205,8 +284,9 @@ void test_bloom_filter_map(void)
 
 	test_fail_cases();
 	test_success_cases();
+	test_blocked_cases();
 
-	err = setup_progs(&skel, &rand_vals, &nr_rand_vals);
+	err = setup_progs(&skel, &rand_vals, &nr_rand_vals, 0);
 	if (err)
 		return;
 
@@ -216,4 +296,14 @@ void test_bloom_filter_map(void)
 	check_bloom(skel);
 
 	bloom_filter_map__destroy(skel);
+
+	/* Programs peek into a blocked bloom filter the same way */
+	err = setup_progs(&skel, &rand_vals, &nr_rand_vals, BPF_F_BLOOM_BLOCKED);
+	if (err)
+		return;
+	free(rand_vals);
+
+	check_bloom(skel);
+
+	bloom_filter_map__destroy(skel);
 }
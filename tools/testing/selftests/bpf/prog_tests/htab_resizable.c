@@ -0,0 +1,153 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+#include "htab_resizable.skel.h"
+
+#define MAX_ENTRIES 4096
+
+/* count keys with get_next_key, failing on one seen twice */
+static int count_keys(int fd, __u32 nr_keys)
+{
+	__u32 key, next_key, *prev = NULL;
+	char *seen;
+	int n = 0;
+
+	seen = calloc(nr_keys, 1);
+	if (!ASSERT_OK_PTR(seen, "calloc"))
+		return -1;
+
+	while (!bpf_map_get_next_key(fd, prev, &next_key)) {
+		if (!ASSERT_LT(next_key, nr_keys, "key range") ||
+		    !ASSERT_FALSE(seen[next_key], "key seen once")) {
+			n = -1;
+			break;
+		}
+		seen[next_key] = 1;
+		n++;
+		key = next_key;
+		prev = &key;
+	}
+	free(seen);
+	return n;
+}
+
+static void test_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts);
+	int fd;
+
+	/* preallocated elements can't move to a resized table */
+	opts.map_flags = BPF_F_RESIZABLE;
+	fd = bpf_map_create(BPF_MAP_TYPE_HASH, NULL, 4, 8, MAX_ENTRIES, &opts);
+	ASSERT_EQ(fd, -EINVAL, "hash prealloc");
+
+	opts.map_flags = BPF_F_RESIZABLE;
+	fd = bpf_map_create(BPF_MAP_TYPE_LRU_HASH, NULL, 4, 8, MAX_ENTRIES, &opts);
+	ASSERT_EQ(fd, -EINVAL, "lru hash");
+
+	opts.map_flags = BPF_F_RESIZABLE | BPF_F_NO_PREALLOC;
+	fd = bpf_map_create(BPF_MAP_TYPE_ARRAY, NULL, 4, 8, MAX_ENTRIES, &opts);
+	ASSERT_EQ(fd, -EINVAL, "array");
+}
+
+static void test_grow(enum bpf_map_type map_type)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts,
+		.map_flags = BPF_F_NO_PREALLOC | BPF_F_RESIZABLE,
+	);
+	int fd, err, nr_cpus = 1, cpu;
+	__u64 *vals = NULL;
+	__u32 key;
+
+	if (map_type == BPF_MAP_TYPE_PERCPU_HASH)
+		nr_cpus = libbpf_num_possible_cpus();
+	if (!ASSERT_GT(nr_cpus, 0, "nr_cpus"))
+		return;
+	vals = calloc(nr_cpus, sizeof(*vals));
+	if (!ASSERT_OK_PTR(vals, "calloc"))
+		return;
+
+	fd = bpf_map_create(map_type, NULL, 4, 8, MAX_ENTRIES, &opts);
+	if (!ASSERT_GE(fd, 0, "bpf_map_create"))
+		goto out;
+
+	/* grows through several resizes on the way */
+	for (key = 0; key < MAX_ENTRIES; key++) {
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			vals[cpu] = key + cpu;
+		err = bpf_map_update_elem(fd, &key, vals, BPF_NOEXIST);
+		if (!ASSERT_OK(err, "update"))
+			goto close;
+	}
+
+	/* max_entries still bounds the number of elements */
+	err = bpf_map_update_elem(fd, &key, vals, BPF_NOEXIST);
+	ASSERT_EQ(err, -E2BIG, "update full");
+
+	for (key = 0; key < MAX_ENTRIES; key++) {
+		err = bpf_map_lookup_elem(fd, &key, vals);
+		if (!ASSERT_OK(err, "lookup"))
+			goto close;
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			if (!ASSERT_EQ(vals[cpu], key + cpu, "value"))
+				goto close;
+	}
+	ASSERT_EQ(count_keys(fd, MAX_ENTRIES), MAX_ENTRIES, "count after grow");
+
+	/* shrink back */
+	for (key = 0; key < MAX_ENTRIES; key += 2) {
+		err = bpf_map_delete_elem(fd, &key);
+		if (!ASSERT_OK(err, "delete"))
+			goto close;
+	}
+	for (key = 0; key < MAX_ENTRIES; key++) {
+		err = bpf_map_lookup_elem(fd, &key, vals);
+		if (key & 1)
+			ASSERT_OK(err, "lookup odd");
+		else
+			ASSERT_EQ(err, -ENOENT, "lookup even");
+	}
+	ASSERT_EQ(count_keys(fd, MAX_ENTRIES), MAX_ENTRIES / 2,
+		  "count after shrink");
+close:
+	close(fd);
+out:
+	free(vals);
+}
+
+static void test_for_each(void)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, topts);
+	struct htab_resizable *skel;
+	int err;
+
+	skel = htab_resizable__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "htab_resizable__open_and_load"))
+		return;
+
+	err = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.fill), &topts);
+	if (!ASSERT_OK(err, "fill") || !ASSERT_OK(topts.retval, "fill retval"))
+		goto out;
+
+	err = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.walk), &topts);
+	if (!ASSERT_OK(err, "walk"))
+		goto out;
+	ASSERT_EQ(skel->bss->nr_seen, MAX_ENTRIES, "nr_seen");
+	ASSERT_EQ(skel->bss->sum, (__u64)MAX_ENTRIES * (MAX_ENTRIES - 1) / 2,
+		  "sum");
+	ASSERT_EQ(count_keys(bpf_map__fd(skel->maps.htab), MAX_ENTRIES),
+		  MAX_ENTRIES, "count_keys");
+out:
+	htab_resizable__destroy(skel);
+}
+
+void test_htab_resizable(void)
+{
+	if (test__start_subtest("reject"))
+		test_reject();
+	if (test__start_subtest("grow_hash"))
+		test_grow(BPF_MAP_TYPE_HASH);
+	if (test__start_subtest("grow_percpu_hash"))
+		test_grow(BPF_MAP_TYPE_PERCPU_HASH);
+	if (test__start_subtest("for_each"))
+		test_for_each();
+}
@@ -0,0 +1,84 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+
+#define MAX_ENTRIES 256
+
+static void test_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts);
+	int fd;
+
+	opts.map_flags = BPF_F_CLOCK_LRU;
+	fd = bpf_map_create(BPF_MAP_TYPE_HASH, NULL, 4, 8, MAX_ENTRIES, &opts);
+	ASSERT_EQ(fd, -EINVAL, "hash");
+
+	/* the clock LRU is already sharded per CPU */
+	opts.map_flags = BPF_F_CLOCK_LRU | BPF_F_NO_COMMON_LRU;
+	fd = bpf_map_create(BPF_MAP_TYPE_LRU_HASH, NULL, 4, 8, MAX_ENTRIES, &opts);
+	ASSERT_EQ(fd, -EINVAL, "no_common_lru");
+}
+
+static void test_evict(enum bpf_map_type map_type)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts,
+		.map_flags = BPF_F_CLOCK_LRU,
+	);
+	__u32 key, next_key, *prev = NULL;
+	int fd, err, nr_cpus = 1, cpu, n;
+	__u64 *vals;
+
+	if (map_type == BPF_MAP_TYPE_LRU_PERCPU_HASH)
+		nr_cpus = libbpf_num_possible_cpus();
+	if (!ASSERT_GT(nr_cpus, 0, "nr_cpus"))
+		return;
+	vals = calloc(nr_cpus, sizeof(*vals));
+	if (!ASSERT_OK_PTR(vals, "calloc"))
+		return;
+
+	fd = bpf_map_create(map_type, NULL, 4, 8, MAX_ENTRIES, &opts);
+	if (!ASSERT_GE(fd, 0, "bpf_map_create"))
+		goto out;
+
+	/* updates keep succeeding well past max_entries by evicting */
+	for (key = 0; key < 4 * MAX_ENTRIES; key++) {
+		for (cpu = 0; cpu < nr_cpus; cpu++)
+			vals[cpu] = key;
+		err = bpf_map_update_elem(fd, &key, vals, BPF_NOEXIST);
+		if (!ASSERT_OK(err, "update"))
+			goto close;
+
+		/* the element just added is never the one evicted */
+		err = bpf_map_lookup_elem(fd, &key, vals);
+		if (!ASSERT_OK(err, "lookup new"))
+			goto close;
+		if (!ASSERT_EQ(vals[0], key, "value"))
+			goto close;
+	}
+
+	n = 0;
+	while (!bpf_map_get_next_key(fd, prev, &next_key)) {
+		err = bpf_map_lookup_elem(fd, &next_key, vals);
+		if (!ASSERT_OK(err, "lookup") ||
+		    !ASSERT_EQ(vals[0], next_key, "value"))
+			break;
+		n++;
+		key = next_key;
+		prev = &key;
+	}
+	ASSERT_GT(n, 0, "nr elems");
+	ASSERT_LE(n, MAX_ENTRIES, "nr elems");
+close:
+	close(fd);
+out:
+	free(vals);
+}
+
+void test_lru_clock(void)
+{
+	if (test__start_subtest("reject"))
+		test_reject();
+	if (test__start_subtest("evict_lru_hash"))
+		test_evict(BPF_MAP_TYPE_LRU_HASH);
+	if (test__start_subtest("evict_lru_percpu_hash"))
+		test_evict(BPF_MAP_TYPE_LRU_PERCPU_HASH);
+}
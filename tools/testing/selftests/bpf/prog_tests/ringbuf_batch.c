@@ -0,0 +1,214 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+#include <time.h>
+#include "test_ringbuf_batch.skel.h"
+
+#define RINGBUF_SZ	4096
+#define WAKEUP_BYTES	1024
+#define WAKEUP_USECS	1000000ULL
+
+enum {
+	USE_RINGBUF,
+	USE_RINGBUF_WAKEUP,
+	USE_USER_RINGBUF,
+};
+
+struct rec {
+	__u64 seq;
+	__u64 val;
+};
+
+static int nr_recs;
+
+static int process_rec(void *ctx, void *data, size_t len)
+{
+	struct rec *r = data;
+
+	if (!ASSERT_EQ(len, sizeof(*r), "rec len") ||
+	    !ASSERT_EQ(r->seq, nr_recs, "rec seq") ||
+	    !ASSERT_EQ(r->val, ~r->seq, "rec val"))
+		return -EINVAL;
+	nr_recs++;
+	return 0;
+}
+
+static int run_batch(struct test_ringbuf_batch *skel, int use_map,
+		     __u32 data_sz, __u32 rec_size, __u64 flags)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, topts);
+	struct rec *recs = (struct rec *)skel->bss->data;
+	int err;
+	__u32 i;
+
+	for (i = 0; i < data_sz / sizeof(*recs); i++) {
+		recs[i].seq = i;
+		recs[i].val = ~(__u64)i;
+	}
+	skel->bss->use_map = use_map;
+	skel->bss->data_sz = data_sz;
+	skel->bss->rec_size = rec_size;
+	skel->bss->flags = flags;
+
+	err = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.output_batch),
+				     &topts);
+	if (!ASSERT_OK(err, "output_batch") ||
+	    !ASSERT_OK(topts.retval, "output_batch retval"))
+		return -EINVAL;
+	return skel->bss->ret;
+}
+
+static int output_recs(struct test_ringbuf_batch *skel, int use_map,
+		       __u32 nr, __u64 flags)
+{
+	return run_batch(skel, use_map, nr * sizeof(struct rec),
+			 sizeof(struct rec), flags);
+}
+
+static void test_output(void)
+{
+	struct test_ringbuf_batch *skel;
+	struct ring_buffer *rb = NULL;
+	int ret;
+
+	skel = test_ringbuf_batch__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "test_ringbuf_batch__open_and_load"))
+		return;
+
+	rb = ring_buffer__new(bpf_map__fd(skel->maps.ringbuf), process_rec,
+			      NULL, NULL);
+	if (!ASSERT_OK_PTR(rb, "ring_buffer__new"))
+		goto out;
+
+	ret = output_recs(skel, USE_RINGBUF, 32, 0);
+	ASSERT_EQ(ret, 32, "output_batch ret");
+
+	nr_recs = 0;
+	ret = ring_buffer__consume(rb);
+	ASSERT_EQ(ret, 32, "consume");
+	ASSERT_EQ(nr_recs, 32, "nr_recs");
+
+	/* with their headers, 256 records don't fit: none get in */
+	ret = output_recs(skel, USE_RINGBUF, 256, 0);
+	ASSERT_EQ(ret, -EAGAIN, "too big");
+	ASSERT_EQ(ring_buffer__consume(rb), 0, "consume too big");
+
+	/* and the ring is still usable afterwards */
+	ret = output_recs(skel, USE_RINGBUF, 1, BPF_RB_FORCE_WAKEUP);
+	ASSERT_EQ(ret, 1, "single");
+	nr_recs = 0;
+	ASSERT_EQ(ring_buffer__consume(rb), 1, "consume single");
+out:
+	ring_buffer__free(rb);
+	test_ringbuf_batch__destroy(skel);
+}
+
+static void test_output_reject(void)
+{
+	struct test_ringbuf_batch *skel;
+	int ret;
+
+	skel = test_ringbuf_batch__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "test_ringbuf_batch__open_and_load"))
+		return;
+
+	ret = run_batch(skel, USE_RINGBUF, sizeof(struct rec), 0, 0);
+	ASSERT_EQ(ret, -EINVAL, "zero rec_size");
+
+	ret = run_batch(skel, USE_RINGBUF, 0, sizeof(struct rec), 0);
+	ASSERT_EQ(ret, -EINVAL, "no records");
+
+	ret = run_batch(skel, USE_RINGBUF, 3 * sizeof(struct rec) / 2,
+			sizeof(struct rec), 0);
+	ASSERT_EQ(ret, -EINVAL, "partial record");
+
+	ret = output_recs(skel, USE_RINGBUF, 1, 4);
+	ASSERT_EQ(ret, -EINVAL, "bad flags");
+
+	ret = output_recs(skel, USE_USER_RINGBUF, 1, 0);
+	ASSERT_EQ(ret, -EINVAL, "user ringbuf");
+
+	test_ringbuf_batch__destroy(skel);
+}
+
+static void test_wakeup_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts);
+	int fd;
+
+	opts.map_extra = (WAKEUP_USECS << 32) | 0;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	ASSERT_EQ(fd, -EINVAL, "no bytes");
+
+	opts.map_extra = (0ULL << 32) | WAKEUP_BYTES;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	ASSERT_EQ(fd, -EINVAL, "no usecs");
+
+	opts.map_extra = (WAKEUP_USECS << 32) | RINGBUF_SZ;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	ASSERT_EQ(fd, -EINVAL, "bytes not below size");
+
+	opts.map_extra = ((WAKEUP_USECS + 1) << 32) | WAKEUP_BYTES;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	ASSERT_EQ(fd, -EINVAL, "usecs above 1s");
+
+	opts.map_extra = (WAKEUP_USECS << 32) | WAKEUP_BYTES;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	if (ASSERT_GE(fd, 0, "valid"))
+		close(fd);
+}
+
+static __u64 now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000ULL + ts.tv_nsec / 1000000;
+}
+
+static void test_wakeup(void)
+{
+	struct test_ringbuf_batch *skel;
+	struct ring_buffer *rb = NULL;
+	__u64 start;
+	int ret;
+
+	skel = test_ringbuf_batch__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "test_ringbuf_batch__open_and_load"))
+		return;
+
+	rb = ring_buffer__new(bpf_map__fd(skel->maps.ringbuf_wakeup),
+			      process_rec, NULL, NULL);
+	if (!ASSERT_OK_PTR(rb, "ring_buffer__new"))
+		goto out;
+
+	/* below the byte threshold: woken up by the timer, not before */
+	nr_recs = 0;
+	start = now_ms();
+	ret = output_recs(skel, USE_RINGBUF_WAKEUP, 1, 0);
+	ASSERT_EQ(ret, 1, "output small");
+	ret = ring_buffer__poll(rb, 5000);
+	ASSERT_EQ(ret, 1, "poll small");
+	ASSERT_GE(now_ms() - start, WAKEUP_USECS / 2000, "timer delay");
+
+	/* above it: woken up right away, well before the timer */
+	nr_recs = 0;
+	ret = output_recs(skel, USE_RINGBUF_WAKEUP, 64, 0);
+	ASSERT_EQ(ret, 64, "output large");
+	ret = ring_buffer__poll(rb, WAKEUP_USECS / 2000);
+	ASSERT_EQ(ret, 64, "poll large");
+out:
+	ring_buffer__free(rb);
+	test_ringbuf_batch__destroy(skel);
+}
+
+void test_ringbuf_batch(void)
+{
+	if (test__start_subtest("output"))
+		test_output();
+	if (test__start_subtest("output_reject"))
+		test_output_reject();
+	if (test__start_subtest("wakeup_reject"))
+		test_wakeup_reject();
+	if (test__start_subtest("wakeup"))
+		test_wakeup();
+}
@@ -0,0 +1,141 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <test_progs.h>
+#include "bpf/libbpf_internal.h"
+#include "test_ringbuf_percpu.skel.h"
+
+#define RINGBUF_SZ 4096
+
+static int nr_samples;
+static int last_cpu;
+
+static int process_sample(void *ctx, void *data, size_t len)
+{
+	if (!ASSERT_EQ(len, sizeof(__u32), "sample len"))
+		return -EINVAL;
+	last_cpu = *(__u32 *)data;
+	nr_samples++;
+	return 0;
+}
+
+static void test_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts);
+	int fd;
+
+	opts.map_flags = BPF_F_PERCPU_RING;
+	fd = bpf_map_create(BPF_MAP_TYPE_USER_RINGBUF, NULL, 0, 0, RINGBUF_SZ,
+			    &opts);
+	ASSERT_EQ(fd, -EINVAL, "user ringbuf");
+
+	/* per-CPU rings are placed on their CPU's node */
+	opts.map_flags = BPF_F_PERCPU_RING | BPF_F_NUMA_NODE;
+	opts.numa_node = 0;
+	fd = bpf_map_create(BPF_MAP_TYPE_RINGBUF, NULL, 0, 0, RINGBUF_SZ, &opts);
+	ASSERT_EQ(fd, -EINVAL, "numa node");
+}
+
+static void test_rings(void)
+{
+	LIBBPF_OPTS(bpf_test_run_opts, topts,
+		.flags = BPF_F_TEST_RUN_ON_CPU,
+	);
+	int err, i, idx, prog_fd, nr_possible, nr_online, nr_runs = 0;
+	bool *possible = NULL, *online = NULL;
+	struct test_ringbuf_percpu *skel;
+	struct ring_buffer *rb = NULL;
+	struct ring *r;
+
+	err = parse_cpu_mask_file("/sys/devices/system/cpu/possible",
+				  &possible, &nr_possible);
+	if (!ASSERT_OK(err, "parse possible"))
+		return;
+	err = parse_cpu_mask_file("/sys/devices/system/cpu/online",
+				  &online, &nr_online);
+	if (!ASSERT_OK(err, "parse online"))
+		goto out_free;
+
+	skel = test_ringbuf_percpu__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "test_ringbuf_percpu__open_and_load"))
+		goto out_free;
+
+	/* ring 0 is the plain ring, then one per possible CPU */
+	rb = ring_buffer__new(bpf_map__fd(skel->maps.ringbuf), process_sample,
+			      NULL, NULL);
+	if (!ASSERT_OK_PTR(rb, "ring_buffer__new"))
+		goto out;
+	err = ring_buffer__add(rb, bpf_map__fd(skel->maps.percpu_ringbuf),
+			       process_sample, NULL);
+	if (!ASSERT_OK(err, "ring_buffer__add"))
+		goto out;
+
+	for (i = 0, idx = 1; i < nr_possible; i++) {
+		if (!possible[i])
+			continue;
+		r = ring_buffer__ring(rb, idx++);
+		if (!ASSERT_OK_PTR(r, "ring_buffer__ring"))
+			goto out;
+		ASSERT_EQ(ring__size(r), RINGBUF_SZ, "ring__size");
+		ASSERT_EQ(ring__map_fd(r),
+			  bpf_map__fd(skel->maps.percpu_ringbuf), "ring__map_fd");
+	}
+	ASSERT_NULL(ring_buffer__ring(rb, idx), "ring past the last");
+
+	/* a sample produced on a CPU lands in that CPU's ring only */
+	prog_fd = bpf_program__fd(skel->progs.produce);
+	for (i = 0, idx = 1; i < nr_possible && i < nr_online; i++) {
+		if (!possible[i])
+			continue;
+		idx++;
+		if (!online[i])
+			continue;
+
+		topts.cpu = i;
+		err = bpf_prog_test_run_opts(prog_fd, &topts);
+		if (!ASSERT_OK(err, "test_run"))
+			goto out;
+		ASSERT_OK(skel->bss->percpu_ret, "percpu output");
+		ASSERT_OK(skel->bss->ret, "output");
+		nr_runs++;
+
+		nr_samples = 0;
+		r = ring_buffer__ring(rb, idx - 1);
+		ASSERT_EQ(ring__consume(r), 1, "ring__consume");
+		ASSERT_EQ(nr_samples, 1, "nr_samples");
+		ASSERT_EQ(last_cpu, i, "sample cpu");
+	}
+
+	/* the plain ring got one sample from each run, all at once */
+	nr_samples = 0;
+	err = ring_buffer__consume(rb);
+	ASSERT_EQ(err, nr_runs, "ring_buffer__consume");
+	ASSERT_EQ(nr_samples, nr_runs, "nr_samples");
+
+	/* polling the map fd reports data in any of the per-CPU rings */
+	for (i = nr_online - 1; i >= 0; i--)
+		if (online[i] && i < nr_possible && possible[i])
+			break;
+	if (!ASSERT_GE(i, 0, "online cpu"))
+		goto out;
+	topts.cpu = i;
+	err = bpf_prog_test_run_opts(prog_fd, &topts);
+	if (!ASSERT_OK(err, "test_run"))
+		goto out;
+	nr_samples = 0;
+	err = ring_buffer__poll(rb, 1000);
+	ASSERT_EQ(err, 2, "ring_buffer__poll");
+	ASSERT_EQ(nr_samples, 2, "nr_samples");
+out:
+	ring_buffer__free(rb);
+	test_ringbuf_percpu__destroy(skel);
+out_free:
+	free(possible);
+	free(online);
+}
+
+void test_ringbuf_percpu(void)
+{
+	if (test__start_subtest("reject"))
+		test_reject();
+	if (test__start_subtest("rings"))
+		test_rings();
+}
@@ -111,6 +111,85 @@ static void test_xdp_with_cpumap_frags_helpers(void)
 	test_xdp_with_cpumap_frags_helpers__destroy(skel);
 }
 
+#define NUM_FRAMES	1000
+
+static void test_xdp_cpumap_batch_size(void)
+{
+	struct test_xdp_with_cpumap_helpers *skel;
+	struct bpf_cpumap_val val = {
+		.qsize = 192,
+	};
+	char data[ETH_HLEN + 50] = {};
+	LIBBPF_OPTS(bpf_test_run_opts, opts,
+		.data_in = data,
+		.data_size_in = sizeof(data),
+		.flags = BPF_F_TEST_XDP_LIVE_FRAMES,
+		.repeat = NUM_FRAMES,
+	);
+	int err, map_fd, i;
+	__u32 idx = 0;
+
+	/* value_size covers qsize, the program fd, and then batch_size */
+	map_fd = bpf_map_create(BPF_MAP_TYPE_CPUMAP, NULL, sizeof(__u32),
+				sizeof(val) + sizeof(__u32), 4, NULL);
+	ASSERT_EQ(map_fd, -EINVAL, "value_size past batch_size");
+
+	skel = test_xdp_with_cpumap_helpers__open_and_load();
+	if (!ASSERT_OK_PTR(skel, "test_xdp_with_cpumap_helpers__open_and_load"))
+		return;
+	map_fd = bpf_map__fd(skel->maps.cpu_map);
+
+	/* 0 picks the default */
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	ASSERT_OK(err, "batch_size 0");
+	err = bpf_map_lookup_elem(map_fd, &idx, &val);
+	ASSERT_OK(err, "Read cpumap entry");
+	ASSERT_GT(val.batch_size, 0, "default batch_size");
+
+	val.batch_size = 64;
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	ASSERT_OK(err, "batch_size 64");
+
+	val.batch_size = 65;
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	ASSERT_EQ(err, -EINVAL, "batch_size 65");
+
+	err = bpf_map_lookup_elem(map_fd, &idx, &val);
+	ASSERT_OK(err, "Read cpumap entry");
+	ASSERT_EQ(val.batch_size, 64, "batch_size kept");
+
+	/* xdp_redir_prog sends everything to CPU 1 */
+	if (sysconf(_SC_NPROCESSORS_ONLN) < 2) {
+		test__skip();
+		goto out_close;
+	}
+
+	/* an odd batch size, so the last round is a partial one */
+	idx = 1;
+	val.qsize = 192;
+	val.batch_size = 3;
+	val.bpf_prog.fd = bpf_program__fd(skel->progs.xdp_count_cm);
+	err = bpf_map_update_elem(map_fd, &idx, &val, 0);
+	if (!ASSERT_OK(err, "Add counting program to cpumap entry"))
+		goto out_close;
+
+	err = bpf_prog_test_run_opts(bpf_program__fd(skel->progs.xdp_redir_prog),
+				     &opts);
+	if (!ASSERT_OK(err, "XDP live frames run"))
+		goto out_close;
+
+	/* the cpumap kthread runs the program asynchronously */
+	for (i = 0; i < 100; i++) {
+		if (READ_ONCE(skel->bss->cm_frames) == NUM_FRAMES)
+			break;
+		usleep(10000);
+	}
+	ASSERT_EQ(skel->bss->cm_frames, NUM_FRAMES, "cpumap frames");
+
+out_close:
+	test_xdp_with_cpumap_helpers__destroy(skel);
+}
+
 void serial_test_xdp_cpumap_attach(void)
 {
 	if (test__start_subtest("CPUMAP with programs in entries"))
@@ -118,4 +197,7 @@ void serial_test_xdp_cpumap_attach(void)
 
 	if (test__start_subtest("CPUMAP with frags programs in entries"))
 		test_xdp_with_cpumap_frags_helpers();
+
+	if (test__start_subtest("CPUMAP batch_size"))
+		test_xdp_cpumap_batch_size();
 }
@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0
+#define BPF_NO_KFUNC_PROTOTYPES
+#include <vmlinux.h>
+#include <bpf/bpf_helpers.h>
+#include "bpf_experimental.h"
+#include "bpf_arena_common.h"
+
+/* room for two 2M chunks, the kernel picks a 2M aligned address */
+struct {
+	__uint(type, BPF_MAP_TYPE_ARENA);
+	__uint(map_flags, BPF_F_MMAPABLE | BPF_F_ARENA_HUGE);
+	__uint(max_entries, 2 * (1 << 21) / __PAGE_SIZE);
+} arena SEC(".maps");
+
+/* user address of the page to work on */
+__u64 addr;
+__u64 val;
+bool allocated;
+bool skip = false;
+
+SEC("syscall")
+int alloc_page(void *ctx)
+{
+#ifdef __BPF_FEATURE_ADDR_SPACE_CAST
+	void __arena *page;
+
+	page = bpf_arena_alloc_pages(&arena, (void __arena *)addr, 1,
+				     NUMA_NO_NODE, 0);
+	allocated = page != NULL;
+#else
+	skip = true;
+#endif
+	return 0;
+}
+
+SEC("syscall")
+int read_val(void *ctx)
+{
+#ifdef __BPF_FEATURE_ADDR_SPACE_CAST
+	val = *(volatile __u64 __arena *)addr;
+#else
+	skip = true;
+#endif
+	return 0;
+}
+
+char _license[] SEC("license") = "GPL";
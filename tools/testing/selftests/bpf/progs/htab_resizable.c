@@ -0,0 +1,47 @@
+// SPDX-License-Identifier: GPL-2.0
+#include "vmlinux.h"
+#include <bpf/bpf_helpers.h>
+
+char _license[] SEC("license") = "GPL";
+
+#define MAX_ENTRIES 4096
+
+struct {
+	__uint(type, BPF_MAP_TYPE_HASH);
+	__uint(map_flags, BPF_F_NO_PREALLOC | BPF_F_RESIZABLE);
+	__uint(max_entries, MAX_ENTRIES);
+	__type(key, __u32);
+	__type(value, __u64);
+} htab SEC(".maps");
+
+__u64 sum = 0;
+long nr_seen = 0;
+
+static __u64 count_elem(struct bpf_map *map, __u32 *key, __u64 *val,
+			void *unused)
+{
+	sum += *val;
+	return 0;
+}
+
+SEC("syscall")
+int walk(void *ctx)
+{
+	sum = 0;
+	nr_seen = bpf_for_each_map_elem(&htab, count_elem, NULL, 0);
+	return 0;
+}
+
+SEC("syscall")
+int fill(void *ctx)
+{
+	__u64 val;
+	__u32 key;
+
+	for (key = 0; key < MAX_ENTRIES; key++) {
+		val = key;
+		if (bpf_map_update_elem(&htab, &key, &val, BPF_NOEXIST))
+			return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,61 @@
+// SPDX-License-Identifier: GPL-2.0
+#define BPF_NO_KFUNC_PROTOTYPES
+#include <vmlinux.h>
+#include <bpf/bpf_helpers.h>
+#include "bpf_experimental.h"
+
+char _license[] SEC("license") = "GPL";
+
+/* wake up after 1KB or 1s, whichever comes first */
+#define WAKEUP_BYTES	1024
+#define WAKEUP_USECS	1000000ULL
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 4096);
+} ringbuf SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 4096);
+	__ulong(map_extra, (WAKEUP_USECS << 32) | WAKEUP_BYTES);
+} ringbuf_wakeup SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_USER_RINGBUF);
+	__uint(max_entries, 4096);
+} user_ringbuf SEC(".maps");
+
+enum {
+	USE_RINGBUF,
+	USE_RINGBUF_WAKEUP,
+	USE_USER_RINGBUF,
+};
+
+int use_map = USE_RINGBUF;
+__u32 data_sz = 0;
+__u32 rec_size = 0;
+__u64 flags = 0;
+int ret = 0;
+
+__u64 data[512];
+
+SEC("syscall")
+int output_batch(void *ctx)
+{
+	__u32 sz = data_sz;
+	void *map;
+
+	if (sz > sizeof(data))
+		return 1;
+
+	if (use_map == USE_RINGBUF_WAKEUP)
+		map = &ringbuf_wakeup;
+	else if (use_map == USE_USER_RINGBUF)
+		map = &user_ringbuf;
+	else
+		map = &ringbuf;
+
+	ret = bpf_ringbuf_output_batch(map, data, sz, rec_size, flags);
+	return 0;
+}
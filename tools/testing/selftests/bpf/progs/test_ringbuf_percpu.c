@@ -0,0 +1,29 @@
+// SPDX-License-Identifier: GPL-2.0
+#include <vmlinux.h>
+#include <bpf/bpf_helpers.h>
+
+char _license[] SEC("license") = "GPL";
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(map_flags, BPF_F_PERCPU_RING);
+	__uint(max_entries, 4096);
+} percpu_ringbuf SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 4096);
+} ringbuf SEC(".maps");
+
+long percpu_ret = 0;
+long ret = 0;
+
+SEC("raw_tp")
+int produce(void *ctx)
+{
+	__u32 cpu = bpf_get_smp_processor_id();
+
+	percpu_ret = bpf_ringbuf_output(&percpu_ringbuf, &cpu, sizeof(cpu), 0);
+	ret = bpf_ringbuf_output(&ringbuf, &cpu, sizeof(cpu), 0);
+	return 0;
+}
@@ -33,6 +33,15 @@ int xdp_dummy_cm(struct xdp_md *ctx)
 	return XDP_PASS;
 }
 
+__u32 cm_frames = 0;
+
+SEC("xdp/cpumap")
+int xdp_count_cm(struct xdp_md *ctx)
+{
+	__sync_fetch_and_add(&cm_frames, 1);
+	return XDP_DROP;
+}
+
 SEC("xdp.frags/cpumap")
 int xdp_dummy_cm_frags(struct xdp_md *ctx)
 {
@@ -205,7 +205,7 @@ static void test_lpm_order(void)
 	tlpm_clear(l2);
 }
 
-static void test_lpm_map(int keysize)
+static void test_lpm_map(enum bpf_map_type map_type, int keysize)
 {
 	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
 	volatile size_t n_matches, n_matches_after_delete;
@@ -234,7 +234,7 @@ static void test_lpm_map(int keysize)
 	key = alloca(sizeof(*key) + keysize);
 	memset(key, 0, sizeof(*key) + keysize);
 
-	map = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, NULL,
+	map = bpf_map_create(map_type, NULL,
 			     sizeof(*key) + keysize,
 			     keysize + 1,
 			     4096,
@@ -328,7 +328,7 @@ static void test_lpm_map(int keysize)
 
 /* Test the implementation with some 'real world' examples */
 
-static void test_lpm_ipaddr(void)
+static void test_lpm_ipaddr(enum bpf_map_type map_type)
 {
 	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
 	struct bpf_lpm_trie_key_u8 *key_ipv4;
@@ -344,12 +344,12 @@ static void test_lpm_ipaddr(void)
 	key_ipv4 = alloca(key_size_ipv4);
 	key_ipv6 = alloca(key_size_ipv6);
 
-	map_fd_ipv4 = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, NULL,
+	map_fd_ipv4 = bpf_map_create(map_type, NULL,
 				     key_size_ipv4, sizeof(value),
 				     100, &opts);
 	assert(map_fd_ipv4 >= 0);
 
-	map_fd_ipv6 = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, NULL,
+	map_fd_ipv6 = bpf_map_create(map_type, NULL,
 				     key_size_ipv6, sizeof(value),
 				     100, &opts);
 	assert(map_fd_ipv6 >= 0);
@@ -420,7 +420,7 @@ static void test_lpm_ipaddr(void)
 	close(map_fd_ipv6);
 }
 
-static void test_lpm_delete(void)
+static void test_lpm_delete(enum bpf_map_type map_type)
 {
 	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
 	struct bpf_lpm_trie_key_u8 *key;
@@ -431,7 +431,7 @@ static void test_lpm_delete(void)
 	key_size = sizeof(*key) + sizeof(__u32);
 	key = alloca(key_size);
 
-	map_fd = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, NULL,
+	map_fd = bpf_map_create(map_type, NULL,
 				key_size, sizeof(value),
 				100, &opts);
 	assert(map_fd >= 0);
@@ -741,7 +741,7 @@ static void setup_lpm_mt_test_info(struct lpm_mt_test_info *info, int map_fd)
 	inet_pton(AF_INET, "192.168.1.0", &info->key[3].data);
 }
 
-static void test_lpm_multi_thread(void)
+static void test_lpm_multi_thread(enum bpf_map_type map_type)
 {
 	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
 	struct lpm_mt_test_info info[4];
@@ -753,7 +753,7 @@ static void test_lpm_multi_thread(void)
 	/* create a trie */
 	value_size = sizeof(__u32);
 	key_size = sizeof(struct bpf_lpm_trie_key_hdr) + value_size;
-	map_fd = bpf_map_create(BPF_MAP_TYPE_LPM_TRIE, NULL, key_size, value_size, 100, &opts);
+	map_fd = bpf_map_create(map_type, NULL, key_size, value_size, 100, &opts);
 
 	/* create 4 threads to test update, delete, lookup and get_next_key */
 	setup_lpm_mt_test_info(&info[0], map_fd);
@@ -770,6 +770,149 @@ static void test_lpm_multi_thread(void)
 	close(map_fd);
 }
 
+static void test_lpm_multibit_get_next_key(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
+	static const struct {
+		const char *addr;
+		__u32 prefixlen;
+	} prefixes[] = {
+		{ "0.0.0.0", 0 },
+		{ "10.0.0.0", 8 },
+		{ "10.1.0.0", 16 },
+		{ "10.1.2.0", 24 },
+		{ "10.1.2.3", 32 },
+		{ "10.128.0.0", 9 },
+		{ "172.16.0.0", 12 },
+		{ "192.168.0.0", 16 },
+		{ "192.168.0.0", 23 },
+		{ "192.168.1.0", 24 },
+		{ "192.168.1.128", 25 },
+	};
+	const size_t n = ARRAY_SIZE(prefixes);
+	struct bpf_lpm_trie_key_u8 *key_p, *next_key_p;
+	bool seen[ARRAY_SIZE(prefixes)];
+	size_t key_size, i, cnt;
+	__u32 value, addr;
+	int map_fd;
+
+	key_size = sizeof(*key_p) + sizeof(__u32);
+	key_p = alloca(key_size);
+	next_key_p = alloca(key_size);
+
+	map_fd = bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, key_size,
+				sizeof(value), 100, &opts);
+	assert(map_fd >= 0);
+
+	assert(bpf_map_get_next_key(map_fd, NULL, key_p) == -ENOENT);
+
+	for (i = 0; i < n; i++) {
+		value = i;
+		key_p->prefixlen = prefixes[i].prefixlen;
+		inet_pton(AF_INET, prefixes[i].addr, key_p->data);
+		assert(bpf_map_update_elem(map_fd, key_p, &value, 0) == 0);
+	}
+
+	/* every prefix comes back exactly once, in whatever order */
+	memset(seen, 0, sizeof(seen));
+	for (cnt = 0; ; cnt++) {
+		if (bpf_map_get_next_key(map_fd, cnt ? key_p : NULL,
+					 next_key_p) == -ENOENT)
+			break;
+		assert(bpf_map_lookup_elem(map_fd, next_key_p, &value) == 0);
+		assert(value < n && !seen[value]);
+		seen[value] = true;
+		inet_pton(AF_INET, prefixes[value].addr, &addr);
+		assert(next_key_p->prefixlen == prefixes[value].prefixlen);
+		assert(!memcmp(next_key_p->data, &addr, sizeof(addr)));
+		memcpy(key_p, next_key_p, key_size);
+	}
+	assert(cnt == n);
+
+	/* a key that isn't in the map starts over from the first one */
+	assert(bpf_map_get_next_key(map_fd, NULL, key_p) == 0);
+	next_key_p->prefixlen = 30;
+	inet_pton(AF_INET, "10.1.2.0", next_key_p->data);
+	assert(bpf_map_get_next_key(map_fd, next_key_p, next_key_p) == 0);
+	assert(!memcmp(key_p, next_key_p, key_size));
+
+	/* and deleted prefixes are skipped */
+	for (i = 0; i < n; i += 2) {
+		key_p->prefixlen = prefixes[i].prefixlen;
+		inet_pton(AF_INET, prefixes[i].addr, key_p->data);
+		assert(bpf_map_delete_elem(map_fd, key_p) == 0);
+	}
+	memset(seen, 0, sizeof(seen));
+	for (cnt = 0; ; cnt++) {
+		if (bpf_map_get_next_key(map_fd, cnt ? key_p : NULL,
+					 next_key_p) == -ENOENT)
+			break;
+		assert(bpf_map_lookup_elem(map_fd, next_key_p, &value) == 0);
+		assert(value < n && value % 2 && !seen[value]);
+		seen[value] = true;
+		memcpy(key_p, next_key_p, key_size);
+	}
+	assert(cnt == n / 2);
+
+	close(map_fd);
+}
+
+static void test_lpm_multibit_reject(void)
+{
+	LIBBPF_OPTS(bpf_map_create_opts, opts, .map_flags = BPF_F_NO_PREALLOC);
+	struct bpf_lpm_trie_key_u8 *key_p;
+	size_t key_size;
+	__u32 value = 0;
+	int map_fd;
+
+	key_size = sizeof(*key_p) + sizeof(__u32);
+	key_p = alloca(key_size);
+
+	/* elements are always allocated on update */
+	opts.map_flags = 0;
+	assert(bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, key_size,
+			      sizeof(value), 100, &opts) == -EINVAL);
+	opts.map_flags = BPF_F_NO_PREALLOC;
+
+	/* 1 to 16 bytes of key data */
+	assert(bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, sizeof(*key_p),
+			      sizeof(value), 100, &opts) == -EINVAL);
+	assert(bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL,
+			      sizeof(*key_p) + 17, sizeof(value), 100,
+			      &opts) == -EINVAL);
+	assert(bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, key_size,
+			      0, 100, &opts) == -EINVAL);
+	assert(bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, key_size,
+			      sizeof(value), 0, &opts) == -EINVAL);
+
+	map_fd = bpf_map_create(BPF_MAP_TYPE_LPM_MULTIBIT, NULL, key_size,
+				sizeof(value), 2, &opts);
+	assert(map_fd >= 0);
+
+	key_p->prefixlen = 33;
+	inet_pton(AF_INET, "10.0.0.0", key_p->data);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, 0) == -EINVAL);
+	assert(bpf_map_delete_elem(map_fd, key_p) == -EINVAL);
+
+	key_p->prefixlen = 8;
+	assert(bpf_map_update_elem(map_fd, key_p, &value, BPF_EXIST) == -ENOENT);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, BPF_NOEXIST) == 0);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, BPF_NOEXIST) == -EEXIST);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, BPF_EXIST) == 0);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, BPF_F_LOCK) == -EINVAL);
+
+	/* replacing an element doesn't count against max_entries */
+	key_p->prefixlen = 0;
+	assert(bpf_map_update_elem(map_fd, key_p, &value, 0) == 0);
+	assert(bpf_map_update_elem(map_fd, key_p, &value, 0) == 0);
+	key_p->prefixlen = 16;
+	assert(bpf_map_update_elem(map_fd, key_p, &value, 0) == -ENOSPC);
+
+	assert(bpf_map_delete_elem(map_fd, key_p) == -ENOENT);
+
+	close(map_fd);
+}
+
 int main(void)
 {
 	int i;
@@ -785,12 +928,22 @@ int main(void)
 
 	/* Test with 8, 16, 24, 32, ... 128 bit prefix length */
 	for (i = 1; i <= 16; ++i)
-		test_lpm_map(i);
+		test_lpm_map(BPF_MAP_TYPE_LPM_TRIE, i);
 
-	test_lpm_ipaddr();
-	test_lpm_delete();
+	test_lpm_ipaddr(BPF_MAP_TYPE_LPM_TRIE);
+	test_lpm_delete(BPF_MAP_TYPE_LPM_TRIE);
 	test_lpm_get_next_key();
-	test_lpm_multi_thread();
+	test_lpm_multi_thread(BPF_MAP_TYPE_LPM_TRIE);
+
+	/* The multibit map must match the same prefixes as the trie */
+	for (i = 1; i <= 16; ++i)
+		test_lpm_map(BPF_MAP_TYPE_LPM_MULTIBIT, i);
+
+	test_lpm_ipaddr(BPF_MAP_TYPE_LPM_MULTIBIT);
+	test_lpm_delete(BPF_MAP_TYPE_LPM_MULTIBIT);
+	test_lpm_multibit_get_next_key();
+	test_lpm_multi_thread(BPF_MAP_TYPE_LPM_MULTIBIT);
+	test_lpm_multibit_reject();
 
 	printf("test_lpm: OK\n");
 	return 0;
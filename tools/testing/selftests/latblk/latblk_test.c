@@ -0,0 +1,163 @@
+// SPDX-License-Identifier: GPL-2.0-only
+/*
+ * Tests for the latblk latency simulating block device: attribute limits,
+ * geometry locking while powered, and the latency of a powered device.
+ * Needs configfs mounted at /sys/kernel/config.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../kselftest_harness.h"
+
+#define LATBLK_CONFIGFS	"/sys/kernel/config/latblk"
+
+static int write_attr(const char *dir, const char *attr, const char *val)
+{
+	char path[PATH_MAX];
+	int fd, ret = 0;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_WRONLY);
+	if (fd < 0)
+		return -errno;
+	if (write(fd, val, strlen(val)) < 0)
+		ret = -errno;
+	close(fd);
+	return ret;
+}
+
+static int read_attr(const char *dir, const char *attr, char *buf, size_t len)
+{
+	char path[PATH_MAX];
+	ssize_t n;
+	int fd;
+
+	snprintf(path, sizeof(path), "%s/%s", dir, attr);
+	fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return -errno;
+	n = read(fd, buf, len - 1);
+	close(fd);
+	if (n < 0)
+		return -errno;
+	buf[n] = '\0';
+	return 0;
+}
+
+static long long now_us(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+FIXTURE(latblk) {
+	char dir[PATH_MAX];
+	bool powered;
+};
+
+FIXTURE_SETUP(latblk)
+{
+	self->dir[0] = '\0';
+	self->powered = false;
+	if (access(LATBLK_CONFIGFS, F_OK))
+		SKIP(return, "latblk is not available in configfs");
+
+	snprintf(self->dir, sizeof(self->dir), "%s/selftest%d",
+		 LATBLK_CONFIGFS, getpid());
+	ASSERT_EQ(0, mkdir(self->dir, 0755));
+}
+
+FIXTURE_TEARDOWN(latblk)
+{
+	if (self->powered)
+		write_attr(self->dir, "power", "0");
+	if (self->dir[0])
+		rmdir(self->dir);
+}
+
+TEST_F(latblk, attribute_limits)
+{
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "nr_queues", "0"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "queue_depth", "0"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "queue_depth", "10241"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "size_mb", "0"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "size_mb",
+				      "18446744073709551615"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "read_lat_us", "10000001"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "tail_lat_us", "10000001"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "tail_ppm", "1000001"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "qd_lat_ns", "1000000001"));
+	EXPECT_EQ(-EINVAL, write_attr(self->dir, "read_dist", "gaussian"));
+
+	EXPECT_EQ(0, write_attr(self->dir, "nr_queues", "1"));
+	EXPECT_EQ(0, write_attr(self->dir, "queue_depth", "10240"));
+	EXPECT_EQ(0, write_attr(self->dir, "size_mb", "16"));
+	EXPECT_EQ(0, write_attr(self->dir, "read_lat_us", "10000000"));
+	EXPECT_EQ(0, write_attr(self->dir, "read_dist", "exponential"));
+}
+
+TEST_F(latblk, geometry_fixed_while_powered)
+{
+	ASSERT_EQ(0, write_attr(self->dir, "size_mb", "16"));
+	ASSERT_EQ(0, write_attr(self->dir, "power", "1"));
+	self->powered = true;
+
+	EXPECT_EQ(-EBUSY, write_attr(self->dir, "size_mb", "32"));
+	EXPECT_EQ(-EBUSY, write_attr(self->dir, "nr_queues", "1"));
+	EXPECT_EQ(-EBUSY, write_attr(self->dir, "queue_depth", "64"));
+	/* the latency model may change at any time */
+	EXPECT_EQ(0, write_attr(self->dir, "read_lat_us", "50"));
+	EXPECT_EQ(0, write_attr(self->dir, "qd_lat_ns", "100"));
+}
+
+TEST_F(latblk, fixed_read_latency)
+{
+	const int nr_reads = 5, lat_us = 20000;
+	char buf[32], path[64];
+	long long start, elapsed;
+	void *data;
+	int fd, i;
+
+	ASSERT_EQ(0, write_attr(self->dir, "size_mb", "16"));
+	ASSERT_EQ(0, write_attr(self->dir, "read_dist", "fixed"));
+	snprintf(buf, sizeof(buf), "%d", lat_us);
+	ASSERT_EQ(0, write_attr(self->dir, "read_lat_us", buf));
+	ASSERT_EQ(0, write_attr(self->dir, "power", "1"));
+	self->powered = true;
+
+	ASSERT_EQ(0, read_attr(self->dir, "index", buf, sizeof(buf)));
+	snprintf(path, sizeof(path), "/dev/latblk%d", atoi(buf));
+	fd = open(path, O_RDONLY | O_DIRECT);
+	if (fd < 0)
+		SKIP(return, "%s: %s", path, strerror(errno));
+	ASSERT_EQ(0, posix_memalign(&data, 4096, 4096));
+
+	start = now_us();
+	for (i = 0; i < nr_reads; i++) {
+		memset(data, 0xa5, 4096);
+		ASSERT_EQ(4096, pread(fd, data, 4096, (off_t)i * 4096));
+		/* reads return zeroes */
+		EXPECT_EQ(0, ((unsigned char *)data)[0]);
+		EXPECT_EQ(0, ((unsigned char *)data)[4095]);
+	}
+	elapsed = now_us() - start;
+
+	/* synchronous reads can't complete before their fixed latency */
+	EXPECT_GE(elapsed, (long long)nr_reads * lat_us);
+
+	free(data);
+	close(fd);
+}
+
+TEST_HARNESS_MAIN